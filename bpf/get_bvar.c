@@ -39,7 +39,12 @@ noinline uint64_t dt_get_bvar(const dt_dctx_t *dctx, uint32_t id)
 
 	switch (id) {
 	case DIF_VAR_CURTHREAD:
-		return bpf_get_current_task();
+		if (!(mst->bvcached & DT_BV_TASK)) {
+			mst->task = bpf_get_current_task();
+			mst->bvcached |= DT_BV_TASK;
+		}
+
+		return mst->task;
 	case DIF_VAR_TIMESTAMP:
 		if (mst->tstamp == 0)
 			mst->tstamp = bpf_ktime_get_ns();
@@ -123,16 +128,17 @@ noinline uint64_t dt_get_bvar(const dt_dctx_t *dctx, uint32_t id)
 
 		return (uint64_t)(dctx->strtab + off);
 	}
-	case DIF_VAR_PID: {
-		uint64_t	val = bpf_get_current_pid_tgid();
+	case DIF_VAR_PID:
+	case DIF_VAR_TID:
+		if (!(mst->bvcached & DT_BV_PIDTGID)) {
+			mst->pid_tgid = bpf_get_current_pid_tgid();
+			mst->bvcached |= DT_BV_PIDTGID;
+		}
 
-		return val >> 32;
-	}
-	case DIF_VAR_TID: {
-		uint64_t	val = bpf_get_current_pid_tgid();
+		if (id == DIF_VAR_PID)
+			return mst->pid_tgid >> 32;
 
-		return val & 0x00000000ffffffffUL;
-	}
+		return mst->pid_tgid & 0x00000000ffffffffUL;
 	case DIF_VAR_EXECNAME: {
 		uint64_t	ptr;
 		uint32_t	key;
@@ -148,7 +154,12 @@ noinline uint64_t dt_get_bvar(const dt_dctx_t *dctx, uint32_t id)
 			return error(dctx, DTRACEFLT_ILLOP, 0);
 
 		/* &(current->comm) */
-		ptr = bpf_get_current_task();
+		if (!(mst->bvcached & DT_BV_TASK)) {
+			mst->task = bpf_get_current_task();
+			mst->bvcached |= DT_BV_TASK;
+		}
+
+		ptr = mst->task;
 		if (ptr == 0)
 			return error(dctx, DTRACEFLT_BADADDR, ptr);
 
@@ -178,7 +189,12 @@ noinline uint64_t dt_get_bvar(const dt_dctx_t *dctx, uint32_t id)
 			return -1;
 
 		/* Chase pointers val = current->real_parent->tgid. */
-		ptr = bpf_get_current_task();
+		if (!(mst->bvcached & DT_BV_TASK)) {
+			mst->task = bpf_get_current_task();
+			mst->bvcached |= DT_BV_TASK;
+		}
+
+		ptr = mst->task;
 		if (ptr == 0)
 			return error(dctx, DTRACEFLT_BADADDR, ptr);
 		if (bpf_probe_read((void *)&ptr, 8,
@@ -190,26 +206,34 @@ noinline uint64_t dt_get_bvar(const dt_dctx_t *dctx, uint32_t id)
 
 		return (uint64_t)val;
 	}
-	case DIF_VAR_UID: {
-		uint64_t	val = bpf_get_current_uid_gid();
+	case DIF_VAR_UID:
+	case DIF_VAR_GID:
+		if (!(mst->bvcached & DT_BV_UIDGID)) {
+			mst->uid_gid = bpf_get_current_uid_gid();
+			mst->bvcached |= DT_BV_UIDGID;
+		}
 
-		return val & 0x00000000ffffffffUL;
-	}
-	case DIF_VAR_GID: {
-		uint64_t	val = bpf_get_current_uid_gid();
+		if (id == DIF_VAR_UID)
+			return mst->uid_gid & 0x00000000ffffffffUL;
 
-		return val >> 32;
-	}
+		return mst->uid_gid >> 32;
 	case DIF_VAR_ERRNO:
 		return mst->syscall_errno;
 	case DIF_VAR_CURCPU: {
 		uint32_t	key = 0;
-		void		*val = bpf_map_lookup_elem(&cpuinfo, &key);
+		void		*val;
 
+		if (mst->bvcached & DT_BV_CPUINFO)
+			return mst->cpuinfo;
+
+		val = bpf_map_lookup_elem(&cpuinfo, &key);
 		if (val == NULL)
 			return (uint64_t)NULL;	/* FIXME */
 
-		return (uint64_t)val;
+		mst->cpuinfo = (uint64_t)val;
+		mst->bvcached |= DT_BV_CPUINFO;
+
+		return mst->cpuinfo;
 	}
 	default:
 		/* Not implemented yet. */
@@ -18,10 +18,17 @@
 #endif
 
 extern struct bpf_map_def specs;
+extern struct bpf_map_def specbufs;
 extern uint64_t NSPEC;
+extern uint64_t NCPUS;
+extern uint64_t SPECSZ;
 
 /*
  * Assign a speculation ID.
+ *
+ * Every speculation is assigned a unique generation number, so that data left
+ * behind in the speculation buffers by an earlier speculation with the same ID
+ * can be recognized as stale.
  */
 noinline uint32_t dt_speculation(void)
 {
@@ -29,6 +36,7 @@ noinline uint32_t dt_speculation(void)
 	dt_bpf_specs_t zero;
 
 	__builtin_memset(&zero, 0, sizeof (dt_bpf_specs_t));
+	zero.gen = bpf_ktime_get_ns();
 
 #if 1 /* Loops are broken in BPF right now */
 #define SEARCH(n)							\
@@ -75,11 +83,8 @@ noinline uint32_t dt_speculation(void)
  * Begin a speculation given an already-assigned ID.
  *
  * We consider a speculation ID usable only if it exists in the speculation map
- * (indicating that speculation() has returned it) with a a zero read value
+ * (indicating that speculation() has returned it) with a zero draining value
  * (indicating that neither commit() nor discard() have been called for it).
- * We bump the written value by one to indicate that another speculative buffer
- * is (or will soon be, once this clause terminates and its epilogue runs)
- * available for draining.
  */
 noinline int32_t
 dt_speculation_speculate(uint32_t id)
@@ -96,18 +101,75 @@ dt_speculation_speculate(uint32_t id)
 	if (spec->draining)
 		return -1;
 
-	spec->written++;
-	/* Use atomics once GCC/binutils can emit them in forms that older
-	 * kernels support:
-	 * __atomic_add_fetch(&spec->written, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * Append the content of the output buffer of a speculated clause to the
+ * speculation buffer for the given ID on the current CPU.
+ *
+ * The buffer holds a sequence of records, each of which is a 64-bit size
+ * followed by the buffer content (starting at the EPID), padded to a multiple
+ * of 8 bytes.  Records that do not fit in the remaining space are dropped, and
+ * counted as speculative drops.
+ *
+ * The size must be a constant at every call site: the verifier relies on that
+ * (and on the map value being large enough to hold a maximum size record past
+ * the end of the SPECSZ bytes of speculation buffer space) to validate the
+ * copy.
+ */
+noinline int32_t
+dt_speculation_append(uint32_t id, const char *buf, uint64_t size)
+{
+	dt_bpf_specs_t		*spec;
+	dt_bpf_specbuf_t	*sb;
+	uint32_t		key;
+	uint64_t		off, need;
+
+	if ((spec = bpf_map_lookup_elem(&specs, &id)) == NULL)
+		return -1;
+
+	/*
+	 * Spec already being drained: do not continue to emit new
+	 * data into it.
+	 */
+	if (spec->draining)
+		return -1;
+
+	key = (id - 1) * (uint32_t)(uint64_t)&NCPUS +
+	      bpf_get_smp_processor_id();
+	if ((sb = bpf_map_lookup_elem(&specbufs, &key)) == NULL)
+		return -1;
+
+	/*
+	 * Reset the buffer if it holds data for an earlier speculation that
+	 * had the same ID.
 	 */
+	if (sb->gen != spec->gen) {
+		sb->gen = spec->gen;
+		sb->size = 0;
+	}
+
+	off = sb->size;
+	need = sizeof(uint64_t) + ((size + 7) & ~7ULL);
+	if (off > (uint64_t)&SPECSZ || need > (uint64_t)&SPECSZ - off) {
+		spec->drops++;
+		return -1;
+	}
+
+	*(uint64_t *)&sb->data[off] = size;
+	if (bpf_probe_read(&sb->data[off + sizeof(uint64_t)], size, buf) != 0)
+		return -1;
+	sb->size = off + need;
+
 	return 0;
 }
 
 /*
  * Mark a committed or discarded speculation as drainable by userspace.
  *
- * Once drained, the speculation ID is freed and may be reused.
+ * Once drained (i.e. once userspace has copied out the speculation buffers of
+ * a committed speculation), the speculation ID is freed and may be reused.
  */
 
 noinline int32_t
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ */
+
+/*
+ * Word-at-a-time (SWAR: SIMD Within A Register) helpers for the BPF string
+ * functions that are implemented in assembler.  These operate on 8 bytes at
+ * a time, and are expressed as assembler macros so that they are expanded
+ * inline in the loops that use them.
+ *
+ * All macros take a register 'k' that must hold the constant
+ * 0x7f7f7f7f7f7f7f7f, which is loaded once before entering a loop.
+ */
+
+/*
+ * zbytes dst, src, k
+ *
+ * Set the high bit of every byte in dst for which the corresponding byte in
+ * src is 0, and clear all other bits:
+ *
+ *	dst = ~(((src & k) + k) | src | k)
+ *
+ * Unlike the common "haszero" approximation, this expression is exact:
+ * (src & k) + k cannot carry out of any byte, so there are no false
+ * positives in bytes that follow a 0 byte.
+ */
+	.macro	zbytes dst, src, k
+	mov	\dst, \src
+	and	\dst, \k
+	add	\dst, \k
+	or	\dst, \src
+	or	\dst, \k
+	xor	\dst, -1
+	.endm
+
+/*
+ * nzbytes dst, src, k
+ *
+ * Set the high bit of every byte in dst for which the corresponding byte in
+ * src is not 0, and clear all other bits:
+ *
+ *	dst = (((src & k) + k) | src) & ~k
+ */
+	.macro	nzbytes dst, src, k
+	mov	\dst, \src
+	and	\dst, \k
+	add	\dst, \k
+	or	\dst, \src
+	or	\dst, \k
+	xor	\dst, \k
+	.endm
+
+/*
+ * tailmask dst, len, tmp
+ *
+ * Given a (little-endian) word of which only the first len bytes are valid,
+ * clear all bits in dst that belong to bytes beyond the first len bytes.
+ * Nothing is done if len >= 8.  Both len and tmp are clobbered.
+ */
+	.macro	tailmask dst, len, tmp
+	jge	\len, 8, 6
+	mov	\tmp, 8
+	sub	\tmp, \len
+	lsh	\tmp, 3
+	mov	\len, -1
+	rsh	\len, \tmp
+	and	\dst, \len
+	.endm
+
+/*
+ * firstbyte idx, mask, tmp
+ *
+ * Given a mask (as produced by zbytes or nzbytes on a little-endian word)
+ * that is known to be non-zero, add the index of the first (lowest) byte
+ * that has its high bit set to idx.  The mask is clobbered.
+ */
+	.macro	firstbyte idx, mask, tmp
+	mov	\tmp, \mask
+	lsh	\tmp, 32
+	jne	\tmp, 0, 2
+	add	\idx, 4
+	rsh	\mask, 32
+	mov	\tmp, \mask
+	lsh	\tmp, 48
+	jne	\tmp, 0, 2
+	add	\idx, 2
+	rsh	\mask, 16
+	mov	\tmp, \mask
+	lsh	\tmp, 56
+	jne	\tmp, 0, 1
+	add	\idx, 1
+	.endm
+
+/*
+ * lastbyte idx, mask, tmp
+ *
+ * Given a mask (as produced by zbytes or nzbytes on a little-endian word)
+ * that is known to be non-zero, add the index of the last (highest) byte
+ * that has its high bit set to idx.  The mask is clobbered.
+ */
+	.macro	lastbyte idx, mask, tmp
+	mov	\tmp, \mask
+	rsh	\tmp, 32
+	jeq	\tmp, 0, 2
+	add	\idx, 4
+	mov	\mask, \tmp
+	mov	\tmp, \mask
+	rsh	\tmp, 16
+	jeq	\tmp, 0, 2
+	add	\idx, 2
+	mov	\mask, \tmp
+	mov	\tmp, \mask
+	rsh	\tmp, 8
+	jeq	\tmp, 0, 1
+	add	\idx, 1
+	.endm
@@ -0,0 +1 @@
+/* #undef HAVE_ELF_GETSHDRSTRNDX */
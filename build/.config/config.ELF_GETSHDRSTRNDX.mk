@@ -0,0 +1 @@
+# HAVE_ELF_GETSHDRSTRNDX undefined
@@ -0,0 +1 @@
+/* #undef HAVE_LIBCTF */
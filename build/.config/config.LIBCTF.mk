@@ -0,0 +1 @@
+# HAVE_LIBCTF undefined
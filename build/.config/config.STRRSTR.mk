@@ -0,0 +1 @@
+# HAVE_STRRSTR undefined
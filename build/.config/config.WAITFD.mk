@@ -0,0 +1 @@
+# HAVE_WAITFD undefined
@@ -0,0 +1,5 @@
+/* This file is automatically generated. */
+/* #undef HAVE_ELF_GETSHDRSTRNDX */
+/* #undef HAVE_LIBCTF */
+/* #undef HAVE_STRRSTR */
+/* #undef HAVE_WAITFD */
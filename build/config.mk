@@ -0,0 +1,5 @@
+# This file is automatically generated.
+# HAVE_ELF_GETSHDRSTRNDX undefined
+# HAVE_LIBCTF undefined
+# HAVE_STRRSTR undefined
+# HAVE_WAITFD undefined
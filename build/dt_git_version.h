@@ -0,0 +1,13 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2015, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef DT_GIT_VERSION_H
+#define DT_GIT_VERSION_H
+
+#define DT_GIT_VERSION "a7481e8bd2a47183155effcad9d3fc9760ab943e"
+
+#endif /* DT_GIT_VERSION_H */
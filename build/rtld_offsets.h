@@ -0,0 +1,123 @@
+/* Offsets and sizes for various structures in the dynamic linker.
+
+   This is a generated file. */
+
+#ifndef _RTLD_OFFSETS_H_
+#define _RTLD_OFFSETS_H_
+
+#define UINT_32_SIZE	4
+#ifndef DL_NNS
+#define DL_NNS	16
+#endif
+#define R_VERSION_32_OFFSET	0
+#define R_VERSION_32_SIZE	0
+#define R_MAP_32_OFFSET	0
+#define R_MAP_32_SIZE	0
+#define R_BRK_32_OFFSET	0
+#define R_BRK_32_SIZE	0
+#define R_STATE_32_OFFSET	0
+#define R_STATE_32_SIZE	0
+#define R_LDBASE_32_OFFSET	0
+#define R_LDBASE_32_SIZE	0
+#define L_ADDR_32_OFFSET	0
+#define L_ADDR_32_SIZE	0
+#define L_NAME_32_OFFSET	0
+#define L_NAME_32_SIZE	0
+#define L_LD_32_OFFSET	0
+#define L_LD_32_SIZE	0
+#define L_NEXT_32_OFFSET	0
+#define L_NEXT_32_SIZE	0
+#define L_PREV_32_OFFSET	0
+#define L_PREV_32_SIZE	0
+#define L_SEARCHLIST_32_OFFSET	0
+#define L_SEARCHLIST_32_SIZE	0
+#define G_DEBUG_32_OFFSET	0
+#define G_DEBUG_32_SIZE	0
+#define G_DEBUG_SUBSEQUENT_32_OFFSET	0
+#define G_DEBUG_SUBSEQUENT_32_SIZE	0
+#define G_NLOADED_32_OFFSET	0
+#define G_NLOADED_32_SIZE	0
+#define G_NLOADED_SUBSEQUENT_32_OFFSET	0
+#define G_NLOADED_SUBSEQUENT_32_SIZE	0
+#define G_NS_LOADED_32_OFFSET	0
+#define G_NS_LOADED_32_SIZE	0
+#define G_NS_LOADED_SUBSEQUENT_32_OFFSET	0
+#define G_NS_LOADED_SUBSEQUENT_32_SIZE	0
+#define G_DL_NNS_32_OFFSET	0
+#define G_DL_NNS_32_SIZE	0
+#define G_DL_LOAD_LOCK_32_OFFSET	0
+#define G_DL_LOAD_LOCK_32_SIZE	0
+
+#define UINT_64_SIZE	4
+#ifndef DL_NNS
+#define DL_NNS	16
+#endif
+#define R_VERSION_64_OFFSET	0
+#define R_VERSION_64_SIZE	4
+#define R_MAP_64_OFFSET	8
+#define R_MAP_64_SIZE	8
+#define R_BRK_64_OFFSET	16
+#define R_BRK_64_SIZE	8
+#define R_STATE_64_OFFSET	24
+#define R_STATE_64_SIZE	4
+#define R_LDBASE_64_OFFSET	32
+#define R_LDBASE_64_SIZE	8
+#define L_ADDR_64_OFFSET	0
+#define L_ADDR_64_SIZE	8
+#define L_NAME_64_OFFSET	8
+#define L_NAME_64_SIZE	8
+#define L_LD_64_OFFSET	16
+#define L_LD_64_SIZE	8
+#define L_NEXT_64_OFFSET	24
+#define L_NEXT_64_SIZE	8
+#define L_PREV_64_OFFSET	32
+#define L_PREV_64_SIZE	8
+#define L_SEARCHLIST_64_OFFSET	728
+#define L_SEARCHLIST_64_SIZE	8
+#define G_DEBUG_64_OFFSET	104
+#define G_DEBUG_64_SIZE	40
+#define G_DEBUG_SUBSEQUENT_64_OFFSET	248
+#define G_DEBUG_SUBSEQUENT_64_SIZE	40
+#define G_NLOADED_64_OFFSET	8
+#define G_NLOADED_64_SIZE	4
+#define G_NLOADED_SUBSEQUENT_64_OFFSET	152
+#define G_NLOADED_SUBSEQUENT_64_SIZE	4
+#define G_NS_LOADED_64_OFFSET	0
+#define G_NS_LOADED_64_SIZE	8
+#define G_NS_LOADED_SUBSEQUENT_64_OFFSET	144
+#define G_NS_LOADED_SUBSEQUENT_64_SIZE	8
+#define G_DL_NNS_64_OFFSET	2304
+#define G_DL_NNS_64_SIZE	8
+#define G_DL_LOAD_LOCK_64_OFFSET	2316
+#define G_DL_LOAD_LOCK_64_SIZE	4
+
+#if R_LDBASE_32_OFFSET > R_LDBASE_64_OFFSET
+#define R_LAST_OFFSET R_LDBASE_32_OFFSET
+#else
+#define R_LAST_OFFSET R_LDBASE_64_OFFSET
+#endif
+
+#if L_SEARCHLIST_32_OFFSET > L_SEARCHLIST_64_OFFSET
+#define L_LAST_OFFSET L_SEARCHLIST_32_OFFSET
+#else
+#define L_LAST_OFFSET L_SEARCHLIST_64_OFFSET
+#endif
+
+/*
+ * Index field sizes by native offset.  (Only possible for those structures
+ * with a public definition outside glibc_internal_link.h.  Other structure
+ * offset computations must be done the ugly way.)
+ *
+ * This won't cope with unions, but will do for now, and frees us from
+ * having to litter the code with ugly R_ and L_ constants.
+ */
+
+typedef struct rtld_offsets {
+	size_t offset[2];
+	size_t size[2];
+} rtld_offsets_t;
+
+extern rtld_offsets_t r_debug_offsets[R_LAST_OFFSET+1];
+extern rtld_offsets_t link_map_offsets[L_LAST_OFFSET+1];
+
+#endif
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2020, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -408,6 +408,31 @@ link_prog(dtrace_cmd_t *dcp)
 		dfatal("failed to link %s %s", dcp->dc_desc, dcp->dc_name);
 }
 
+/*
+ * Report the run-time statistics of a probe, and warn if the average cost per
+ * firing exceeds the budget (if one was given).
+ */
+static int
+probe_stat(dtrace_hdl_t *dtp, const dtrace_probestat_t *psp, void *arg)
+{
+	const dtrace_probedesc_t	*pdp = psp->dtps_desc;
+	dtrace_optval_t			budget = *(dtrace_optval_t *)arg;
+	uint64_t			avg = 0;
+
+	if (psp->dtps_count != 0)
+		avg = psp->dtps_time / psp->dtps_count;
+
+	fprintf(stderr, "%5d %12lu %10lu %s:%s:%s:%s\n", pdp->id,
+		psp->dtps_count, avg, pdp->prv, pdp->mod, pdp->fun, pdp->prb);
+
+	if (budget != DTRACEOPT_UNSET && avg > budget)
+		error("warning: %s:%s:%s:%s costs %lu ns per firing, "
+		      "exceeding the budget of %ld ns\n", pdp->prv, pdp->mod,
+		      pdp->fun, pdp->prb, avg, budget);
+
+	return 0;
+}
+
 /*ARGSUSED*/
 static int
 list_probe(dtrace_hdl_t *dtp, const dtrace_probedesc_t *pdp, void *arg)
@@ -1556,6 +1581,18 @@ main(int argc, char *argv[])
 			dfatal("failed to print aggregations");
 	}
 
+	dtrace_getopt(g_dtp, "probestats", &opt);
+	if (opt != DTRACEOPT_UNSET) {
+		dtrace_optval_t	budget;
+
+		dtrace_getopt(g_dtp, "probebudget", &budget);
+
+		fprintf(stderr, "%5s %12s %10s %s\n", "ID", "FIRINGS",
+			"AVG(ns)", "PROBE");
+		if (dtrace_probestat_iter(g_dtp, probe_stat, &budget) != 0)
+			dfatal("failed to report probe statistics");
+	}
+
 release_procs:
 	for (i = 0; i < g_psc; i++)
 		dtrace_proc_release(g_dtp, g_psv[i]);
@@ -2,7 +2,7 @@
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  *
- * Copyright (c) 2009, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2009, 2022, Oracle and/or its affiliates. All rights reserved.
  */
 
 /*
@@ -21,5 +21,9 @@ struct dtrace_difo;
  * DIFO flags.
  */
 #define DIFOFLG_DESTRUCTIVE		1	/* Uses destructive ops */
+#define DIFOFLG_STRTAB			2	/* Uses the string table */
+#define DIFOFLG_AGGS			4	/* Uses aggregation data */
+#define DIFOFLG_GVARS			8	/* Uses global variables */
+#define DIFOFLG_LVARS			16	/* Uses local variables */
 
 #endif /* _DTRACE_DIFO_DEFINES_H */
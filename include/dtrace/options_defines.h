@@ -2,7 +2,7 @@
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  *
- * Copyright (c) 2009, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2009, 2022, Oracle and/or its affiliates. All rights reserved.
  */
 
 /*
@@ -60,7 +60,13 @@
 #define	DTRACEOPT_BPFLOGSIZE	30	/* BPF verifier log, max # bytes */
 #define	DTRACEOPT_MAXFRAMES	31	/* maximum number of stack frames */
 #define	DTRACEOPT_BPFLOG	32	/* always output BPF verifier log */
-#define	DTRACEOPT_MAX		33	/* number of options */
+#define	DTRACEOPT_AGGDELTA	33	/* print only changes in aggregations */
+#define	DTRACEOPT_PROBESTATS	34	/* collect per-probe BPF run stats */
+#define	DTRACEOPT_PROBEBUDGET	35	/* per-probe cost budget (ns/firing) */
+#define	DTRACEOPT_STATSRATE	36	/* consumer statistics dump rate */
+#define	DTRACEOPT_SYSCALLBATCH	37	/* batched syscall probe attach */
+#define	DTRACEOPT_FBTFENTRY	38	/* FBT probes on BPF trampolines */
+#define	DTRACEOPT_MAX		39	/* number of options */
 
 #define	DTRACEOPT_UNSET		(dtrace_optval_t)-2	/* unset option */
 
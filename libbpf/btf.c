@@ -26,6 +26,14 @@
 
 #define IS_VAR(k) ((k) == BTF_KIND_VAR)
 
+/* Kinds added by newer kernels.  Only their sizes are needed to parse the
+ * type section of kernel BTF; they are otherwise treated as unknown.
+ */
+#define BTF_KIND_FLOAT_NEW	16
+#define BTF_KIND_DECL_TAG_NEW	17
+#define BTF_KIND_TYPE_TAG_NEW	18
+#define BTF_KIND_ENUM64_NEW	19
+
 static struct btf_type btf_void;
 
 struct btf {
@@ -218,6 +226,13 @@ static int btf_type_size(struct btf_type *t)
 		return base_size + sizeof(struct btf_var);
 	case BTF_KIND_DATASEC:
 		return base_size + vlen * sizeof(struct btf_var_secinfo);
+	case BTF_KIND_FLOAT_NEW:
+	case BTF_KIND_TYPE_TAG_NEW:
+		return base_size;
+	case BTF_KIND_DECL_TAG_NEW:
+		return base_size + sizeof(__s32);
+	case BTF_KIND_ENUM64_NEW:
+		return base_size + vlen * 3 * sizeof(__u32);
 	default:
 		pr_debug("Unsupported BTF_KIND:%u\n", BTF_INFO_KIND(t->info));
 		return -EINVAL;
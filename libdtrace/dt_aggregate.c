@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2008, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2008, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -21,18 +21,39 @@
 #define	DTRACE_AHASHSIZE	32779		/* big 'ol prime */
 
 /*
- * Because qsort(3C) does not allow an argument to be passed to a comparison
- * function, the variables that affect comparison must regrettably be global;
- * they are protected by a global static lock, dt_qsort_lock.
+ * The state that affects comparison is passed to the comparison functions by
+ * means of qsort_r(3), so that multiple handles (or threads) can sort
+ * aggregation data concurrently.  Comparison functions always sort in
+ * ascending order; a reverse sort is implemented by dt_aggregate_sortcmp()
+ * negating the result.
  */
-static pthread_mutex_t dt_qsort_lock = PTHREAD_MUTEX_INITIALIZER;
+struct dt_aggsort;
+typedef int dt_aggcmp_f(const void *, const void *, const struct dt_aggsort *);
 
-static int dt_revsort;
-static int dt_keysort;
-static int dt_keypos;
+typedef struct dt_aggsort {
+	dt_aggcmp_f	*ds_cmp;		/* comparison function */
+	int		ds_revsort;		/* reverse sort order */
+	int		ds_keysort;		/* sort on keys first */
+	int		ds_keypos;		/* first key to sort on */
+	int		ds_keyed;		/* elements are sort entries */
+} dt_aggsort_t;
 
-#define	DT_LESSTHAN	(dt_revsort == 0 ? -1 : 1)
-#define	DT_GREATERTHAN	(dt_revsort == 0 ? 1 : -1)
+/*
+ * Sort element with precomputed sort keys, so that the common comparisons do
+ * not have to chase pointers through the aggregation data and description.
+ * The hash entry pointer must be the first member so that an element can also
+ * be passed to comparison functions that expect a (dt_ahashent_t **).
+ */
+typedef struct dt_aggsortent {
+	dt_ahashent_t		*dse_ent;	/* hash entry */
+	dtrace_aggdesc_t	*dse_desc;	/* aggregation description */
+	dtrace_aggid_t		dse_varid;	/* aggregation variable ID */
+	int			dse_scalar;	/* dse_val is valid */
+	int64_t			dse_val;	/* scalar aggregation value */
+} dt_aggsortent_t;
+
+#define	DT_LESSTHAN	(-1)
+#define	DT_GREATERTHAN	1
 
 static int
 dt_aggregate_countcmp(int64_t *lhs, int64_t *rhs)
@@ -80,9 +101,8 @@ dt_aggregate_stddevcmp(int64_t *lhs, int64_t *rhs)
 }
 
 static long double
-dt_aggregate_lquantizedsum(int64_t *lquanta)
+dt_aggregate_lquantizedsum(int64_t *lquanta, uint64_t arg)
 {
-	int64_t arg = *lquanta++;
 	int32_t base = DTRACE_LQUANTIZE_BASE(arg);
 	uint16_t step = DTRACE_LQUANTIZE_STEP(arg);
 	uint16_t levels = DTRACE_LQUANTIZE_LEVELS(arg), i;
@@ -96,9 +116,8 @@ dt_aggregate_lquantizedsum(int64_t *lquanta)
 }
 
 static int64_t
-dt_aggregate_lquantizedzero(int64_t *lquanta)
+dt_aggregate_lquantizedzero(int64_t *lquanta, uint64_t arg)
 {
-	int64_t arg = *lquanta++;
 	int32_t base = DTRACE_LQUANTIZE_BASE(arg);
 	uint16_t step = DTRACE_LQUANTIZE_STEP(arg);
 	uint16_t levels = DTRACE_LQUANTIZE_LEVELS(arg), i;
@@ -120,10 +139,10 @@ dt_aggregate_lquantizedzero(int64_t *lquanta)
 }
 
 static int
-dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs, uint64_t arg)
 {
-	long double lsum = dt_aggregate_lquantizedsum(lhs);
-	long double rsum = dt_aggregate_lquantizedsum(rhs);
+	long double lsum = dt_aggregate_lquantizedsum(lhs, arg);
+	long double rsum = dt_aggregate_lquantizedsum(rhs, arg);
 	int64_t lzero, rzero;
 
 	if (lsum < rsum)
@@ -138,8 +157,8 @@ dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs)
 	 * the range of the linear quantization), then this will be judged a
 	 * tie and will be resolved based on the key comparison.
 	 */
-	lzero = dt_aggregate_lquantizedzero(lhs);
-	rzero = dt_aggregate_lquantizedzero(rhs);
+	lzero = dt_aggregate_lquantizedzero(lhs, arg);
+	rzero = dt_aggregate_lquantizedzero(rhs, arg);
 
 	if (lzero < rzero)
 		return DT_LESSTHAN;
@@ -152,9 +171,8 @@ dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs)
 
 /* called by dt_aggregate_llquantizedcmp() */
 static long double
-dt_aggregate_llquantizedsum(int64_t *llquanta)
+dt_aggregate_llquantizedsum(int64_t *llquanta, uint64_t arg)
 {
-	int64_t arg = *llquanta++;
 	int factor = DTRACE_LLQUANTIZE_FACTOR(arg);
 	int lmag = DTRACE_LLQUANTIZE_LMAG(arg);
 	int hmag = DTRACE_LLQUANTIZE_HMAG(arg);
@@ -191,9 +209,8 @@ dt_aggregate_llquantizedsum(int64_t *llquanta)
 
 /* called by dt_aggregate_llquantizedcmp() */
 static int64_t
-dt_aggregate_llquantizedzero(int64_t *llquanta)
+dt_aggregate_llquantizedzero(int64_t *llquanta, uint64_t arg)
 {
-	int64_t arg = *llquanta++;
 	uint16_t factor = DTRACE_LLQUANTIZE_FACTOR(arg);
 	uint16_t lmag = DTRACE_LLQUANTIZE_LMAG(arg);
 	uint16_t hmag = DTRACE_LLQUANTIZE_HMAG(arg);
@@ -213,10 +230,10 @@ dt_aggregate_llquantizedzero(int64_t *llquanta)
  * Other behavior is also reasonable.
  */
 static int
-dt_aggregate_llquantizedcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_llquantizedcmp(int64_t *lhs, int64_t *rhs, uint64_t arg)
 {
-	long double lsum = dt_aggregate_llquantizedsum(lhs);
-	long double rsum = dt_aggregate_llquantizedsum(rhs);
+	long double lsum = dt_aggregate_llquantizedsum(lhs, arg);
+	long double rsum = dt_aggregate_llquantizedsum(rhs, arg);
 	int64_t lzero, rzero;
 
 	if (lsum < rsum)
@@ -231,8 +248,8 @@ dt_aggregate_llquantizedcmp(int64_t *lhs, int64_t *rhs)
 	 * the range of the linear quantization), then this will be judged a
 	 * tie and will be resolved based on the key comparison.
 	 */
-	lzero = dt_aggregate_llquantizedzero(lhs);
-	rzero = dt_aggregate_llquantizedzero(rhs);
+	lzero = dt_aggregate_llquantizedzero(lhs, arg);
+	rzero = dt_aggregate_llquantizedzero(rhs, arg);
 
 	if (lzero < rzero)
 		return DT_LESSTHAN;
@@ -415,12 +432,13 @@ typedef struct dt_snapstate {
 	char		*buf;
 	dt_aggregate_t	*agp;
 	agg_cpu_f	fun;
+	int		last;
 } dt_snapstate_t;
 
 static void
 dt_agg_one_copy(dt_ident_t *aid, int64_t *dst, int64_t *src, uint_t realsz)
 {
-	src++;  /* skip latch sequence number */
+	src++;  /* skip data flag */
 	memcpy(dst, src, realsz);
 }
 
@@ -432,7 +450,7 @@ dt_agg_one_agg(dt_ident_t *aid, int64_t *dst, int64_t *src, uint_t realsz)
 	if (*src == 0)
 		return;
 
-	src++;  /* skip latch sequence number */
+	src++;  /* skip data flag */
 	switch (((dt_ident_t *)aid->di_iarg)->di_id) {
 	case DT_AGG_MAX:
 		if (*src > *dst)
@@ -451,6 +469,21 @@ dt_agg_one_agg(dt_ident_t *aid, int64_t *dst, int64_t *src, uint_t realsz)
 	}
 }
 
+/*
+ * Mark an aggregation entry as changed in the current snapshot if its data
+ * differs from the data last reported by dtrace_aggregate_walk_delta().
+ * Entries that have never been reported that way are always marked, which
+ * avoids the comparison when delta walks are not used.
+ */
+static void
+dt_aggregate_dirty(dt_aggregate_t *agp, dt_ahashent_t *h)
+{
+	if (h->dtahe_base == NULL ||
+	    memcmp(h->dtahe_base, h->dtahe_data.dtada_data,
+		   h->dtahe_size) != 0)
+		h->dtahe_gen = agp->dtat_gen;
+}
+
 static int
 dt_aggregate_snap_one(dt_idhash_t *dhp, dt_ident_t *aid, dt_snapstate_t *st)
 {
@@ -468,11 +501,11 @@ dt_aggregate_snap_one(dt_idhash_t *dhp, dt_ident_t *aid, dt_snapstate_t *st)
 	if (rval != 0)
 		return rval;
 
-	/* point to the latch sequence number */
+	/* point to the data flag */
 	src = (int64_t *)(st->buf + aid->di_offset);
 
-	/* real size excludes latch sequence number and second data copy, if any */
-	realsz = (aid->di_size - sizeof(uint64_t)) / DT_AGG_NUM_COPIES;
+	/* real size excludes the data flag */
+	realsz = aid->di_size - sizeof(uint64_t);
 
 	/* See if we already have an entry for this aggregation. */
 	for (h = agh->dtah_hash[ndx]; h != NULL; h = h->dtahe_next) {
@@ -489,10 +522,14 @@ dt_aggregate_snap_one(dt_idhash_t *dhp, dt_ident_t *aid, dt_snapstate_t *st)
 			st->fun(aid, (int64_t *)agd->dtada_percpu[st->cpu],
 			    src, realsz);
 
+		/* Once all CPUs have been merged, check for changes. */
+		if (st->last)
+			dt_aggregate_dirty(st->agp, h);
+
 		return 0;
 	}
 
-	/* not found, so skip it if latch sequence number is 0 */
+	/* not found, so skip it if the data flag is 0 */
 	if (*src == 0)
 		return 0;
 
@@ -517,6 +554,7 @@ dt_aggregate_snap_one(dt_idhash_t *dhp, dt_ident_t *aid, dt_snapstate_t *st)
 
 	h->dtahe_hval = hval;
 	h->dtahe_size = realsz;
+	h->dtahe_gen = st->agp->dtat_gen;
 
 	if (st->agp->dtat_flags & DTRACE_A_PERCPU) {
 		char	**percpu = dt_calloc(st->dtp,
@@ -563,7 +601,8 @@ dt_aggregate_snap_one(dt_idhash_t *dhp, dt_ident_t *aid, dt_snapstate_t *st)
 }
 
 static int
-dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu, agg_cpu_f fun)
+dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu, agg_cpu_f fun,
+		      int last)
 {
 	dt_aggregate_t	*agp = &dtp->dt_aggregate;
 	char		*buf = agp->dtat_cpu_buf[cpu];
@@ -574,6 +613,7 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu, agg_cpu_f fun)
 	st.buf = buf;
 	st.agp = agp;
 	st.fun = fun;
+	st.last = last;
 
 	return dt_idhash_iter(dtp->dt_aggs,
 			      (dt_idhash_f *)dt_aggregate_snap_one, &st);
@@ -582,8 +622,8 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu, agg_cpu_f fun)
 /*
  * Retrieve all aggregation data for the enabled CPUs and aggregate it.
  */
-int
-dtrace_aggregate_snap(dtrace_hdl_t *dtp)
+static int
+dt_aggregate_snap_impl(dtrace_hdl_t *dtp)
 {
 	dt_aggregate_t	*agp = &dtp->dt_aggregate;
 	uint32_t	key = 0;
@@ -600,9 +640,12 @@ dtrace_aggregate_snap(dtrace_hdl_t *dtp)
 	if (rval != 0)
 		return dt_set_errno(dtp, -rval);
 
+	agp->dtat_gen++;
+
 	for (i = 0; i < dtp->dt_conf.num_online_cpus; i++) {
 		rval = dt_aggregate_snap_cpu(dtp, dtp->dt_conf.cpus[i].cpu_id,
-		    i == 0 ? dt_agg_one_copy : dt_agg_one_agg);
+		    i == 0 ? dt_agg_one_copy : dt_agg_one_agg,
+		    i == dtp->dt_conf.num_online_cpus - 1);
 		if (rval != 0)
 			return rval;
 	}
@@ -610,6 +653,18 @@ dtrace_aggregate_snap(dtrace_hdl_t *dtp)
 	return 0;
 }
 
+int
+dtrace_aggregate_snap(dtrace_hdl_t *dtp)
+{
+	hrtime_t	start = dt_phase_start();
+	int		rval;
+
+	rval = dt_aggregate_snap_impl(dtp);
+	dt_phase_end(dtp, DTRACE_PHASE_AGGSNAP, start);
+
+	return rval;
+}
+
 static int
 dt_aggregate_hashcmp(const void *lhs, const void *rhs)
 {
@@ -628,14 +683,20 @@ dt_aggregate_hashcmp(const void *lhs, const void *rhs)
 }
 
 static int
-dt_aggregate_varcmp(const void *lhs, const void *rhs)
+dt_aggregate_varcmp(const void *lhs, const void *rhs,
+		    const dt_aggsort_t *ds)
 {
 	dt_ahashent_t	*lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t	*rh = *((dt_ahashent_t **)rhs);
 	dtrace_aggid_t	lid, rid;
 
-	lid = dt_aggregate_aggid(lh);
-	rid = dt_aggregate_aggid(rh);
+	if (ds->ds_keyed) {
+		lid = ((const dt_aggsortent_t *)lhs)->dse_varid;
+		rid = ((const dt_aggsortent_t *)rhs)->dse_varid;
+	} else {
+		lid = dt_aggregate_aggid(lh);
+		rid = dt_aggregate_aggid(rh);
+	}
 
 	if (lid < rid)
 		return DT_LESSTHAN;
@@ -647,7 +708,8 @@ dt_aggregate_varcmp(const void *lhs, const void *rhs)
 }
 
 static int
-dt_aggregate_keycmp(const void *lhs, const void *rhs)
+dt_aggregate_keycmp(const void *lhs, const void *rhs,
+		    const dt_aggsort_t *ds)
 {
 	dt_ahashent_t *lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t *rh = *((dt_ahashent_t **)rhs);
@@ -663,7 +725,7 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 	nrecs = lagg->dtagd_nrecs - 1;
 	assert(nrecs == ragg->dtagd_nrecs - 1);
 
-	keypos = dt_keypos + 1 >= nrecs ? 0 : dt_keypos;
+	keypos = ds->ds_keypos + 1 >= nrecs ? 0 : ds->ds_keypos;
 
 	for (i = 1; i < nrecs; i++) {
 		uint64_t lval, rval;
@@ -758,7 +820,8 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 }
 
 static int
-dt_aggregate_valcmp(const void *lhs, const void *rhs)
+dt_aggregate_valcmp(const void *lhs, const void *rhs,
+		    const dt_aggsort_t *ds)
 {
 	dt_ahashent_t *lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t *rh = *((dt_ahashent_t **)rhs);
@@ -770,6 +833,25 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 	int64_t *laddr, *raddr;
 	int rval, i;
 
+	/*
+	 * If both elements belong to the same aggregation and the value is a
+	 * scalar, we can compare the precomputed values directly.
+	 */
+	if (ds->ds_keyed) {
+		const dt_aggsortent_t *lse = lhs;
+		const dt_aggsortent_t *rse = rhs;
+
+		if (lse->dse_desc == rse->dse_desc && lse->dse_scalar) {
+			if (lse->dse_val < rse->dse_val)
+				return DT_LESSTHAN;
+
+			if (lse->dse_val > rse->dse_val)
+				return DT_GREATERTHAN;
+
+			return 0;
+		}
+	}
+
 	if ((rval = dt_aggregate_hashcmp(lhs, rhs)) != 0)
 		return rval;
 
@@ -803,30 +885,32 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 	raddr = (int64_t *)(uintptr_t)(rdata + rrec->dtrd_offset);
 
 	switch (lrec->dtrd_action) {
-	case DTRACEAGG_AVG:
+	case DT_AGG_AVG:
 		rval = dt_aggregate_averagecmp(laddr, raddr);
 		break;
 
-	case DTRACEAGG_STDDEV:
+	case DT_AGG_STDDEV:
 		rval = dt_aggregate_stddevcmp(laddr, raddr);
 		break;
 
-	case DTRACEAGG_QUANTIZE:
+	case DT_AGG_QUANTIZE:
 		rval = dt_aggregate_quantizedcmp(laddr, raddr);
 		break;
 
-	case DTRACEAGG_LQUANTIZE:
-		rval = dt_aggregate_lquantizedcmp(laddr, raddr);
+	case DT_AGG_LQUANTIZE:
+		rval = dt_aggregate_lquantizedcmp(laddr, raddr,
+						  lagg->dtagd_sig);
 		break;
 
-	case DTRACEAGG_LLQUANTIZE:
-		rval = dt_aggregate_llquantizedcmp(laddr, raddr);
+	case DT_AGG_LLQUANTIZE:
+		rval = dt_aggregate_llquantizedcmp(laddr, raddr,
+						   lagg->dtagd_sig);
 		break;
 
-	case DTRACEAGG_COUNT:
-	case DTRACEAGG_SUM:
-	case DTRACEAGG_MIN:
-	case DTRACEAGG_MAX:
+	case DT_AGG_COUNT:
+	case DT_AGG_SUM:
+	case DT_AGG_MIN:
+	case DT_AGG_MAX:
 		rval = dt_aggregate_countcmp(laddr, raddr);
 		break;
 
@@ -838,11 +922,12 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 }
 
 static int
-dt_aggregate_valkeycmp(const void *lhs, const void *rhs)
+dt_aggregate_valkeycmp(const void *lhs, const void *rhs,
+		       const dt_aggsort_t *ds)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_valcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_valcmp(lhs, rhs, ds)) != 0)
 		return rval;
 
 	/*
@@ -850,85 +935,94 @@ dt_aggregate_valkeycmp(const void *lhs, const void *rhs)
 	 * equal.  We already know that the key layout is the same for the two
 	 * elements; we must now compare the keys themselves as a tie-breaker.
 	 */
-	return dt_aggregate_keycmp(lhs, rhs);
+	return dt_aggregate_keycmp(lhs, rhs, ds);
 }
 
 static int
-dt_aggregate_keyvarcmp(const void *lhs, const void *rhs)
+dt_aggregate_keyvarcmp(const void *lhs, const void *rhs,
+		       const dt_aggsort_t *ds)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_keycmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_keycmp(lhs, rhs, ds)) != 0)
 		return rval;
 
-	return dt_aggregate_varcmp(lhs, rhs);
+	return dt_aggregate_varcmp(lhs, rhs, ds);
 }
 
 static int
-dt_aggregate_varkeycmp(const void *lhs, const void *rhs)
+dt_aggregate_varkeycmp(const void *lhs, const void *rhs,
+		       const dt_aggsort_t *ds)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_varcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_varcmp(lhs, rhs, ds)) != 0)
 		return rval;
 
-	return dt_aggregate_keycmp(lhs, rhs);
+	return dt_aggregate_keycmp(lhs, rhs, ds);
 }
 
 static int
-dt_aggregate_valvarcmp(const void *lhs, const void *rhs)
+dt_aggregate_valvarcmp(const void *lhs, const void *rhs,
+		       const dt_aggsort_t *ds)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_valkeycmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_valkeycmp(lhs, rhs, ds)) != 0)
 		return rval;
 
-	return dt_aggregate_varcmp(lhs, rhs);
+	return dt_aggregate_varcmp(lhs, rhs, ds);
 }
 
 static int
-dt_aggregate_varvalcmp(const void *lhs, const void *rhs)
+dt_aggregate_varvalcmp(const void *lhs, const void *rhs,
+		       const dt_aggsort_t *ds)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_varcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_varcmp(lhs, rhs, ds)) != 0)
 		return rval;
 
-	return dt_aggregate_valkeycmp(lhs, rhs);
+	return dt_aggregate_valkeycmp(lhs, rhs, ds);
 }
 
 static int
-dt_aggregate_keyvarrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_keyvarrevcmp(const void *lhs, const void *rhs,
+			  const dt_aggsort_t *ds)
 {
-	return dt_aggregate_keyvarcmp(rhs, lhs);
+	return dt_aggregate_keyvarcmp(rhs, lhs, ds);
 }
 
 static int
-dt_aggregate_varkeyrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_varkeyrevcmp(const void *lhs, const void *rhs,
+			  const dt_aggsort_t *ds)
 {
-	return dt_aggregate_varkeycmp(rhs, lhs);
+	return dt_aggregate_varkeycmp(rhs, lhs, ds);
 }
 
 static int
-dt_aggregate_valvarrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_valvarrevcmp(const void *lhs, const void *rhs,
+			  const dt_aggsort_t *ds)
 {
-	return dt_aggregate_valvarcmp(rhs, lhs);
+	return dt_aggregate_valvarcmp(rhs, lhs, ds);
 }
 
 static int
-dt_aggregate_varvalrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_varvalrevcmp(const void *lhs, const void *rhs,
+			  const dt_aggsort_t *ds)
 {
-	return dt_aggregate_varvalcmp(rhs, lhs);
+	return dt_aggregate_varvalcmp(rhs, lhs, ds);
 }
 
 static int
-dt_aggregate_bundlecmp(const void *lhs, const void *rhs)
+dt_aggregate_bundlecmp(const void *lhs, const void *rhs,
+		       const dt_aggsort_t *ds)
 {
 	dt_ahashent_t **lh = *((dt_ahashent_t ***)lhs);
 	dt_ahashent_t **rh = *((dt_ahashent_t ***)rhs);
 	int i, rval;
 
-	if (dt_keysort) {
+	if (ds->ds_keysort) {
 		/*
 		 * If we're sorting on keys, we need to scan until we find the
 		 * last entry -- that's the representative key.  (The order of
@@ -942,7 +1036,7 @@ dt_aggregate_bundlecmp(const void *lhs, const void *rhs)
 		assert(i != 0);
 		assert(rh[i + 1] == NULL);
 
-		if ((rval = dt_aggregate_keycmp(&lh[i], &rh[i])) != 0)
+		if ((rval = dt_aggregate_keycmp(&lh[i], &rh[i], ds)) != 0)
 			return rval;
 	}
 
@@ -956,27 +1050,109 @@ dt_aggregate_bundlecmp(const void *lhs, const void *rhs)
 			 * key comparison from the representative key as the
 			 * tie-breaker.
 			 */
-			if (dt_keysort)
+			if (ds->ds_keysort)
 				return 0;
 
 			assert(i != 0);
 			assert(rh[i + 1] == NULL);
-			return dt_aggregate_keycmp(&lh[i], &rh[i]);
+			return dt_aggregate_keycmp(&lh[i], &rh[i], ds);
 		} else {
-			if ((rval = dt_aggregate_valcmp(&lh[i], &rh[i])) != 0)
+			rval = dt_aggregate_valcmp(&lh[i], &rh[i], ds);
+			if (rval != 0)
 				return rval;
 		}
 	}
 }
 
+/*
+ * Comparison function for qsort_r(3).
+ */
+static int
+dt_aggregate_sortcmp(const void *lhs, const void *rhs, void *arg)
+{
+	const dt_aggsort_t	*ds = arg;
+	int			rval;
+
+	rval = ds->ds_cmp(lhs, rhs, ds);
+
+	return ds->ds_revsort ? -rval : rval;
+}
+
+/*
+ * Initialize the sorting state from the "aggsortrev", "aggsortkey" and
+ * "aggsortkeypos" options.  If no comparison function is given, the default
+ * one for the "aggsortkey" option is used.
+ */
+static void
+dt_aggregate_sortopts(dtrace_hdl_t *dtp, dt_aggsort_t *ds, dt_aggcmp_f *cmp)
+{
+	dtrace_optval_t keyposopt = dtp->dt_options[DTRACEOPT_AGGSORTKEYPOS];
+
+	ds->ds_revsort = (dtp->dt_options[DTRACEOPT_AGGSORTREV] !=
+			  DTRACEOPT_UNSET);
+	ds->ds_keysort = (dtp->dt_options[DTRACEOPT_AGGSORTKEY] !=
+			  DTRACEOPT_UNSET);
+
+	if (keyposopt != DTRACEOPT_UNSET && keyposopt <= INT_MAX)
+		ds->ds_keypos = (int)keyposopt;
+	else
+		ds->ds_keypos = 0;
+
+	if (cmp == NULL)
+		cmp = ds->ds_keysort ? dt_aggregate_varkeycmp
+				     : dt_aggregate_varvalcmp;
+
+	ds->ds_cmp = cmp;
+	ds->ds_keyed = 0;
+}
+
+/*
+ * Fill in a sort element for a hash entry, precomputing the sort keys.
+ */
+static void
+dt_aggregate_sortent(dt_aggsortent_t *ent, dt_ahashent_t *h)
+{
+	dtrace_aggdesc_t	*agg = h->dtahe_data.dtada_desc;
+	dtrace_recdesc_t	*rec;
+	int64_t			*addr;
+
+	ent->dse_ent = h;
+	ent->dse_desc = agg;
+	ent->dse_varid = dt_aggregate_aggid(h);
+	ent->dse_scalar = 0;
+
+	if (agg->dtagd_nrecs <= 0)
+		return;
+
+	rec = &agg->dtagd_recs[agg->dtagd_nrecs - 1];
+	addr = (int64_t *)(uintptr_t)(h->dtahe_data.dtada_data +
+				      rec->dtrd_offset);
+
+	switch (rec->dtrd_action) {
+	case DT_AGG_AVG:
+		ent->dse_val = addr[0] ? (addr[1] / addr[0]) : 0;
+		break;
+	case DT_AGG_COUNT:
+	case DT_AGG_SUM:
+	case DT_AGG_MIN:
+	case DT_AGG_MAX:
+		ent->dse_val = addr[0];
+		break;
+	default:
+		return;
+	}
+
+	ent->dse_scalar = 1;
+}
+
 /*
  * Callback for initializing the min() and max() aggregation functions.
  * The minimum 64 bit value is set for max() and the maximum 64 bit value is
  * set for min(), so that any other value fed to the functions will register
  * properly.
  *
- * The latch sequence number of the first aggregation is used as a flag to
- * indicate whether an initial value was stored for any aggregation.
+ * The data flag of the first aggregation is used as a flag to indicate
+ * whether an initial value was stored for any aggregation.
  */
 static int
 init_minmax(dt_idhash_t *dhp, dt_ident_t *aid, char *buf)
@@ -998,12 +1174,9 @@ init_minmax(dt_idhash_t *dhp, dt_ident_t *aid, char *buf)
 	/* Indicate that we are setting initial values. */
 	*(int64_t *)buf = 1;
 
-	/* skip ptr[0], it is the latch sequence number */
+	/* skip ptr[0], it is the data flag */
 	ptr = (int64_t *)(buf + aid->di_offset);
 	ptr[1] = value;
-#if DT_AGG_NUM_COPIES == 2
-	ptr[2] = value;
-#endif
 
 	return 0;
 }
@@ -1171,6 +1344,7 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 		}
 
 		dt_free(dtp, aggdata->dtada_data);
+		dt_free(dtp, h->dtahe_base);
 		dt_free(dtp, h);
 
 		return 0;
@@ -1183,37 +1357,6 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 	return 0;
 }
 
-void
-dt_aggregate_qsort(dtrace_hdl_t *dtp, void *base, size_t nel, size_t width,
-    int (*compar)(const void *, const void *))
-{
-	int rev = dt_revsort, key = dt_keysort, keypos = dt_keypos;
-	dtrace_optval_t keyposopt = dtp->dt_options[DTRACEOPT_AGGSORTKEYPOS];
-
-	dt_revsort = (dtp->dt_options[DTRACEOPT_AGGSORTREV] != DTRACEOPT_UNSET);
-	dt_keysort = (dtp->dt_options[DTRACEOPT_AGGSORTKEY] != DTRACEOPT_UNSET);
-
-	if (keyposopt != DTRACEOPT_UNSET && keyposopt <= INT_MAX) {
-		dt_keypos = (int)keyposopt;
-	} else {
-		dt_keypos = 0;
-	}
-
-	if (compar == NULL) {
-		if (!dt_keysort) {
-			compar = dt_aggregate_varvalcmp;
-		} else {
-			compar = dt_aggregate_varkeycmp;
-		}
-	}
-
-	qsort(base, nel, width, compar);
-
-	dt_revsort = rev;
-	dt_keysort = key;
-	dt_keypos = keypos;
-}
-
 int
 dtrace_aggregate_walk(dtrace_hdl_t *dtp, dtrace_aggregate_f *func, void *arg)
 {
@@ -1237,11 +1380,13 @@ dtrace_aggregate_walk(dtrace_hdl_t *dtp, dtrace_aggregate_f *func, void *arg)
 
 static int
 dt_aggregate_walk_sorted(dtrace_hdl_t *dtp, dtrace_aggregate_f *func,
-			 void *arg, int (*sfunc)(const void *, const void *))
+			 void *arg, dt_aggcmp_f *sfunc)
 {
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
-	dt_ahashent_t *h, **sorted;
+	dt_ahashent_t *h;
 	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_aggsortent_t *sorted;
+	dt_aggsort_t ds;
 	size_t i, nentries = 0;
 
 	dtrace_aggregate_snap(dtp);
@@ -1255,31 +1400,31 @@ dt_aggregate_walk_sorted(dtrace_hdl_t *dtp, dtrace_aggregate_f *func,
 	if (nentries == 0)
 		return 0;
 
-	sorted = dt_calloc(dtp, nentries, sizeof(dt_ahashent_t *));
+	sorted = dt_calloc(dtp, nentries, sizeof(dt_aggsortent_t));
 	if (sorted == NULL)
 		return -1;
 
 	for (h = hash->dtah_all, i = 0; h != NULL; h = h->dtahe_nextall)
-		sorted[i++] = h;
+		dt_aggregate_sortent(&sorted[i++], h);
 
-	pthread_mutex_lock(&dt_qsort_lock);
-
-	if (sfunc == NULL) {
-		dt_aggregate_qsort(dtp, sorted, nentries,
-		    sizeof(dt_ahashent_t *), NULL);
-	} else {
+	if (sfunc == NULL)
+		dt_aggregate_sortopts(dtp, &ds, NULL);
+	else {
 		/*
 		 * If we've been explicitly passed a sorting function,
 		 * we'll use that -- ignoring the values of the "aggsortrev",
 		 * "aggsortkey" and "aggsortkeypos" options.
 		 */
-		qsort(sorted, nentries, sizeof(dt_ahashent_t *), sfunc);
+		memset(&ds, 0, sizeof(ds));
+		ds.ds_cmp = sfunc;
 	}
 
-	pthread_mutex_unlock(&dt_qsort_lock);
+	ds.ds_keyed = 1;
+	qsort_r(sorted, nentries, sizeof(dt_aggsortent_t), dt_aggregate_sortcmp,
+		&ds);
 
 	for (i = 0; i < nentries; i++) {
-		h = sorted[i];
+		h = sorted[i].dse_ent;
 
 		if (dt_aggwalk_rval(dtp, h, func(&h->dtahe_data, arg)) == -1) {
 			dt_free(dtp, sorted);
@@ -1362,6 +1507,123 @@ dtrace_aggregate_walk_valvarrevsorted(dtrace_hdl_t *dtp,
 					dt_aggregate_valvarrevcmp);
 }
 
+/*
+ * Compute the change in the data of an aggregation entry since it was last
+ * reported by dtrace_aggregate_walk_delta().  The data of min() and max() is
+ * reported as-is.  All other aggregations are merged by adding data words, so
+ * their change is the difference of the respective words.
+ */
+static void
+dt_aggregate_delta(dt_ahashent_t *h, int64_t *dst)
+{
+	dtrace_aggdesc_t	*agg = h->dtahe_data.dtada_desc;
+	int64_t			*cur = (int64_t *)h->dtahe_data.dtada_data;
+	int64_t			*base = (int64_t *)h->dtahe_base;
+	uint_t			i, cnt = h->dtahe_size / sizeof(int64_t);
+
+	if (base == NULL || agg->dtagd_nrecs == 0 ||
+	    agg->dtagd_recs[0].dtrd_action == DT_AGG_MIN ||
+	    agg->dtagd_recs[0].dtrd_action == DT_AGG_MAX) {
+		memcpy(dst, cur, h->dtahe_size);
+		return;
+	}
+
+	for (i = 0; i < cnt; i++)
+		dst[i] = cur[i] - base[i];
+}
+
+/*
+ * Walk the entries of aggregation variable 'varid' (or of all aggregation
+ * variables if varid is DTRACE_AGGVARIDNONE) that changed since they were last
+ * reported by this function.  The entries are walked in the order given by
+ * the sorting options, and the data passed to func is the change in value.
+ */
+int
+dtrace_aggregate_walk_delta(dtrace_hdl_t *dtp, dtrace_aggid_t varid,
+			    dtrace_aggregate_f *func, void *arg)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_ahashent_t *h;
+	dt_aggsortent_t *sorted;
+	dt_aggsort_t ds;
+	int64_t *delta = NULL;
+	size_t i, nentries = 0, dsize = 0;
+	int rval = -1;
+
+	dtrace_aggregate_snap(dtp);
+
+	for (h = hash->dtah_all; h != NULL; h = h->dtahe_nextall) {
+		if (h->dtahe_gen != agp->dtat_gen)
+			continue;
+		if (varid != DTRACE_AGGVARIDNONE &&
+		    dt_aggregate_aggid(h) != varid)
+			continue;
+
+		if (h->dtahe_size > dsize)
+			dsize = h->dtahe_size;
+		nentries++;
+	}
+
+	if (nentries == 0)
+		return 0;
+
+	sorted = dt_calloc(dtp, nentries, sizeof(dt_aggsortent_t));
+	if (sorted == NULL)
+		return -1;
+
+	delta = dt_alloc(dtp, dsize);
+	if (delta == NULL)
+		goto out;
+
+	for (h = hash->dtah_all, i = 0; h != NULL; h = h->dtahe_nextall) {
+		if (h->dtahe_gen != agp->dtat_gen)
+			continue;
+		if (varid != DTRACE_AGGVARIDNONE &&
+		    dt_aggregate_aggid(h) != varid)
+			continue;
+
+		dt_aggregate_sortent(&sorted[i++], h);
+	}
+
+	dt_aggregate_sortopts(dtp, &ds, NULL);
+	ds.ds_keyed = 1;
+	qsort_r(sorted, nentries, sizeof(dt_aggsortent_t), dt_aggregate_sortcmp,
+		&ds);
+
+	for (i = 0; i < nentries; i++) {
+		dtrace_aggdata_t	data;
+
+		h = sorted[i].dse_ent;
+		dt_aggregate_delta(h, delta);
+
+		/*
+		 * Record the current data as the base for the next delta walk
+		 * before calling func, because func may remove the entry.
+		 */
+		if (h->dtahe_base == NULL) {
+			h->dtahe_base = dt_alloc(dtp, h->dtahe_size);
+			if (h->dtahe_base == NULL)
+				goto out;
+		}
+		memcpy(h->dtahe_base, h->dtahe_data.dtada_data, h->dtahe_size);
+		h->dtahe_gen = 0;
+
+		data = h->dtahe_data;
+		data.dtada_data = (caddr_t)delta;
+		data.dtada_percpu = NULL;
+
+		if (dt_aggwalk_rval(dtp, h, func(&data, arg)) == -1)
+			goto out;
+	}
+
+	rval = 0;
+out:
+	dt_free(dtp, delta);
+	dt_free(dtp, sorted);
+	return rval;
+}
+
 int
 dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggid_t *aggvars,
 			     int naggvars, dtrace_aggregate_walk_joined_f *func,
@@ -1374,6 +1636,7 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggid_t *aggvars,
 	dt_ahash_t *hash = &agp->dtat_hash;
 	size_t nentries = 0, nbundles = 0, start, zsize = 0, bundlesize;
 	dtrace_aggid_t max = 0, aggvar;
+	dt_aggsort_t ds = { 0, };
 	int rval = -1, *map, *remap = NULL;
 	int i, j;
 	dtrace_optval_t sortpos = dtp->dt_options[DTRACEOPT_AGGSORTPOS];
@@ -1608,14 +1871,12 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggid_t *aggvars,
 
 	/*
 	 * We've loaded our array; now we need to sort by value to allow us
-	 * to create bundles of like value.  We're going to acquire the
-	 * dt_qsort_lock here, and hold it across all of our subsequent
-	 * comparison and sorting.
+	 * to create bundles of like value.  This sort (and the comparisons
+	 * used to find the bundle boundaries) ignores the sorting options.
 	 */
-	pthread_mutex_lock(&dt_qsort_lock);
-
-	qsort(sorted, nentries, sizeof(dt_ahashent_t *),
-	    dt_aggregate_keyvarcmp);
+	ds.ds_cmp = dt_aggregate_keyvarcmp;
+	qsort_r(sorted, nentries, sizeof(dt_ahashent_t *),
+		dt_aggregate_sortcmp, &ds);
 
 	/*
 	 * Now we need to go through and create bundles.  Because the number
@@ -1630,7 +1891,7 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggid_t *aggvars,
 
 	for (i = 1, start = 0; i <= nentries; i++) {
 		if (i < nentries &&
-		    dt_aggregate_keycmp(&sorted[i], &sorted[i - 1]) == 0)
+		    dt_aggregate_keycmp(&sorted[i], &sorted[i - 1], &ds) == 0)
 			continue;
 
 		/*
@@ -1640,10 +1901,8 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggid_t *aggvars,
 		assert(i - start <= naggvars);
 		bundlesize = (naggvars + 2) * sizeof(dt_ahashent_t *);
 
-		if ((nbundle = dt_zalloc(dtp, bundlesize)) == NULL) {
-			pthread_mutex_unlock(&dt_qsort_lock);
+		if ((nbundle = dt_zalloc(dtp, bundlesize)) == NULL)
 			goto out;
-		}
 
 		for (j = start; j < i; j++) {
 			dtrace_aggid_t	id = dt_aggregate_aggid(sorted[j]);
@@ -1687,10 +1946,9 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggid_t *aggvars,
 	/*
 	 * Now we need to re-sort based on the first value.
 	 */
-	dt_aggregate_qsort(dtp, bundle, nbundles, sizeof(dt_ahashent_t **),
-	    dt_aggregate_bundlecmp);
-
-	pthread_mutex_unlock(&dt_qsort_lock);
+	dt_aggregate_sortopts(dtp, &ds, dt_aggregate_bundlecmp);
+	qsort_r(bundle, nbundles, sizeof(dt_ahashent_t **),
+		dt_aggregate_sortcmp, &ds);
 
 	/*
 	 * We're done!  Now we just need to go back over the sorted bundles,
@@ -1819,6 +2077,7 @@ dt_aggregate_destroy(dtrace_hdl_t *dtp)
 			}
 
 			dt_free(dtp, aggdata->dtada_data);
+			dt_free(dtp, h->dtahe_base);
 			dt_free(dtp, h);
 		}
 
@@ -0,0 +1,130 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Arena allocator
+ *
+ * An arena hands out memory from large chunks by advancing an offset, and
+ * releases it all at once.  It is used for objects that do not outlive a
+ * single compilation (see dt_pcb.c), so that they do not have to be allocated
+ * and freed one by one.  Objects allocated from an arena cannot be freed
+ * individually.
+ *
+ * Chunks start out small and double in size (up to a limit) as more are
+ * needed.  Requests that are large compared to the chunk size are given their
+ * own chunk, which is placed behind the current one so that the remaining
+ * space in the current chunk is not wasted.
+ */
+
+#include <stdlib.h>
+
+#include <dt_arena.h>
+
+#define DT_ARENA_ALIGN		sizeof(uint64_t)
+#define DT_ARENA_MINCHUNK	4096
+#define DT_ARENA_MAXCHUNK	(256 * 1024)
+
+void
+dt_arena_create(dt_arena_t *dap)
+{
+	dap->da_chunk = NULL;
+	dap->da_off = 0;
+}
+
+void
+dt_arena_destroy(dt_arena_t *dap)
+{
+	dt_arena_chunk_t *dcp, *ncp;
+
+	for (dcp = dap->da_chunk; dcp != NULL; dcp = ncp) {
+		ncp = dcp->dac_next;
+		free(dcp);
+	}
+
+	dt_arena_create(dap);
+}
+
+/*
+ * Release all memory allocated from the arena, but hang on to the current
+ * (and therefore largest) chunk for reuse.
+ */
+void
+dt_arena_reset(dt_arena_t *dap)
+{
+	dt_arena_chunk_t *dcp = dap->da_chunk;
+
+	if (dcp == NULL)
+		return;
+
+	dap->da_chunk = dcp->dac_next;
+	dt_arena_destroy(dap);
+
+	dcp->dac_next = NULL;
+	dap->da_chunk = dcp;
+}
+
+static dt_arena_chunk_t *
+dt_arena_chunk(size_t size)
+{
+	dt_arena_chunk_t *dcp;
+
+	if ((dcp = malloc(sizeof(dt_arena_chunk_t) + size)) == NULL)
+		return NULL;
+
+	dcp->dac_next = NULL;
+	dcp->dac_size = size;
+
+	return dcp;
+}
+
+/*
+ * Allocate 'size' bytes from the arena.  The memory is not cleared.  Returns
+ * NULL if a new chunk was needed but could not be allocated.
+ */
+void *
+dt_arena_alloc(dt_arena_t *dap, size_t size)
+{
+	dt_arena_chunk_t *dcp = dap->da_chunk;
+	size_t csize;
+	void *p;
+
+	size = (size + DT_ARENA_ALIGN - 1) & ~(DT_ARENA_ALIGN - 1);
+
+	if (dcp != NULL && size <= dcp->dac_size - dap->da_off) {
+		p = (char *)dcp->dac_data + dap->da_off;
+		dap->da_off += size;
+
+		return p;
+	}
+
+	if (dcp != NULL && size > DT_ARENA_MAXCHUNK / 4) {
+		dt_arena_chunk_t *bcp = dt_arena_chunk(size);
+
+		if (bcp == NULL)
+			return NULL;
+
+		bcp->dac_next = dcp->dac_next;
+		dcp->dac_next = bcp;
+
+		return bcp->dac_data;
+	}
+
+	csize = dcp == NULL ? DT_ARENA_MINCHUNK : dcp->dac_size * 2;
+	if (csize > DT_ARENA_MAXCHUNK)
+		csize = DT_ARENA_MAXCHUNK;
+	if (csize < size)
+		csize = size;
+
+	if ((dcp = dt_arena_chunk(csize)) == NULL)
+		return NULL;
+
+	dcp->dac_next = dap->da_chunk;
+	dap->da_chunk = dcp;
+	dap->da_off = size;
+
+	return dcp->dac_data;
+}
@@ -0,0 +1,38 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef	_DT_ARENA_H
+#define	_DT_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct dt_arena_chunk {
+	struct dt_arena_chunk *dac_next; /* next (older) chunk */
+	size_t dac_size;		/* size of dac_data */
+	uint64_t dac_data[];		/* storage */
+} dt_arena_chunk_t;
+
+typedef struct dt_arena {
+	dt_arena_chunk_t *da_chunk;	/* current chunk (head of list) */
+	size_t da_off;			/* offset of free space in da_chunk */
+} dt_arena_t;
+
+extern void dt_arena_create(dt_arena_t *);
+extern void dt_arena_destroy(dt_arena_t *);
+extern void dt_arena_reset(dt_arena_t *);
+extern void *dt_arena_alloc(dt_arena_t *, size_t);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_ARENA_H */
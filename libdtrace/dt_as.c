@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -13,6 +13,7 @@
 #include <dt_impl.h>
 #include <dt_parser.h>
 #include <dt_as.h>
+#include <dt_dis.h>
 #include <bpf_asm.h>
 #include <port.h>
 
@@ -21,17 +22,30 @@ dt_irlist_create(dt_irlist_t *dlp)
 {
 	memset(dlp, 0, sizeof(dt_irlist_t));
 	dlp->dl_label = 1;
+	dt_arena_create(&dlp->dl_arena);
 }
 
+/*
+ * The nodes in an IR list are allocated from the arena of the list (see
+ * dt_cg_node_alloc()), so they are all released at once.
+ */
 void
 dt_irlist_destroy(dt_irlist_t *dlp)
 {
-	dt_irnode_t *dip, *nip;
+	dt_arena_destroy(&dlp->dl_arena);
+}
 
-	for (dip = dlp->dl_list; dip != NULL; dip = nip) {
-		nip = dip->di_next;
-		free(dip);
-	}
+/*
+ * Empty the list, keeping (some of) its storage around for new nodes.
+ */
+void
+dt_irlist_reset(dt_irlist_t *dlp)
+{
+	dt_arena_t arena = dlp->dl_arena;
+
+	dt_arena_reset(&arena);
+	dt_irlist_create(dlp);
+	dlp->dl_arena = arena;
 }
 
 void
@@ -194,6 +208,53 @@ dt_as_undef(const dt_ident_t *idp, uint_t offset)
 		"(offset 0x%x)\n", kind, dts->object, mark, dts->name, offset);
 }
 
+/*
+ * Disassemble the instruction list as it was emitted by the code generator,
+ * i.e. prior to optimization.
+ */
+static void
+dt_as_dis_unopt(dt_pcb_t *pcb)
+{
+	dtrace_hdl_t	*dtp = pcb->pcb_hdl;
+	dt_irlist_t	*dlp = &pcb->pcb_ir;
+	dtrace_difo_t	dif;
+	uint_t		*labels;
+	dt_irnode_t	*dip;
+	uint_t		i;
+
+	memset(&dif, 0, sizeof(dif));
+	dif.dtdo_buf = dt_calloc(dtp, dlp->dl_len, sizeof(struct bpf_insn));
+	labels = dt_calloc(dtp, dlp->dl_label, sizeof(uint_t));
+	if (dif.dtdo_buf == NULL || labels == NULL)
+		goto out;
+
+	for (i = 0, dip = dlp->dl_list; dip != NULL; dip = dip->di_next) {
+		if (dip->di_label != DT_LBL_NONE)
+			labels[dip->di_label] = i;
+
+		if (dip->di_label == DT_LBL_NONE || !BPF_IS_NOP(dip->di_instr))
+			dif.dtdo_buf[i++] = dip->di_instr;
+	}
+	dif.dtdo_len = i;
+
+	for (i = 0; i < dif.dtdo_len; i++) {
+		struct bpf_insn	*instr = &dif.dtdo_buf[i];
+		uint_t		op = BPF_OP(instr->code);
+
+		if (BPF_CLASS(instr->code) != BPF_JMP || BPF_IS_NOP(*instr) ||
+		    op == BPF_CALL || op == BPF_EXIT)
+			continue;
+
+		instr->off = labels[instr->off] - i - 1;
+	}
+
+	dt_dis_difo(&dif, stderr, NULL, pcb->pcb_pdesc, "unoptimized code");
+
+out:
+	dt_free(dtp, labels);
+	dt_free(dtp, dif.dtdo_buf);
+}
+
 dtrace_difo_t *
 dt_as(dt_pcb_t *pcb)
 {
@@ -245,6 +306,13 @@ dt_as(dt_pcb_t *pcb)
 		    dtp->dt_linkmode);
 	}
 
+	if ((pcb->pcb_cflags & DTRACE_C_DIFV) &&
+	    (dtp->dt_disasm & DT_DISASM_OPT_UNOPT))
+		dt_as_dis_unopt(pcb);
+
+	if (!dtp->dt_nopeephole)
+		dt_irlist_optimize(dlp);
+
 	assert(pcb->pcb_difo == NULL);
 	pcb->pcb_difo = dt_zalloc(dtp, sizeof(dtrace_difo_t));
 
@@ -370,6 +438,9 @@ fail:
 	    pcb->pcb_stmt->dtsd_clauseflags & DT_CLSFLAG_DESTRUCT)
 		dp->dtdo_flags |= DIFOFLG_DESTRUCTIVE;
 
+	/* Note which parts of the DTrace context the code depends on. */
+	dp->dtdo_flags |= pcb->pcb_difoflags;
+
 	pcb->pcb_asvidx = 0;
 
 	/*
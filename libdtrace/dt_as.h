@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2019, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <sys/dtrace_types.h>
 #include <linux/bpf.h>
+#include <dt_arena.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -30,16 +31,20 @@ typedef struct dt_irlist {
 	dt_irnode_t *dl_last;		/* pointer to last node in list */
 	uint_t dl_len;			/* number of valid instructions */
 	uint_t dl_label;		/* next label number to assign */
+	dt_arena_t dl_arena;		/* storage for nodes in list */
 } dt_irlist_t;
 
 extern void dt_irlist_create(dt_irlist_t *);
 extern void dt_irlist_destroy(dt_irlist_t *);
+extern void dt_irlist_reset(dt_irlist_t *);
 extern void dt_irlist_append(dt_irlist_t *, dt_irnode_t *);
 extern uint_t dt_irlist_label(dt_irlist_t *);
+extern void dt_irlist_optimize(dt_irlist_t *);
 
 #define emitle(dlp, lbl, instr, idp) \
 		({ \
-			dt_irnode_t *dip = dt_cg_node_alloc((lbl), (instr)); \
+			dt_irnode_t *dip = dt_cg_node_alloc((dlp), (lbl), \
+							    (instr)); \
 			dt_irlist_append((dlp), dip); \
 			if (idp != NULL) \
 				dip->di_extern = (idp); \
@@ -103,6 +103,47 @@ int dt_bpf_map_update(int fd, const void *key, const void *val)
 	return bpf(BPF_MAP_UPDATE_ELEM, &attr);
 }
 
+/*
+ * Enable the collection of run-time statistics for BPF programs.  The kernel
+ * keeps collecting them for as long as the returned fd remains open.
+ */
+static int
+dt_bpf_enable_stats(void)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.enable_stats.type = BPF_STATS_RUN_TIME;
+
+	return bpf(BPF_ENABLE_STATS, &attr);
+}
+
+/*
+ * Retrieve the number of runs and the total run time (in ns) for the BPF
+ * program referenced by the given fd.
+ */
+int dt_bpf_prog_stats(int fd, uint64_t *cnt, uint64_t *time)
+{
+	union bpf_attr		attr;
+	struct bpf_prog_info	info;
+	int			rc;
+
+	memset(&info, 0, sizeof(info));
+	memset(&attr, 0, sizeof(attr));
+	attr.info.bpf_fd = fd;
+	attr.info.info_len = sizeof(info);
+	attr.info.info = (uint64_t)(unsigned long)&info;
+
+	rc = bpf(BPF_OBJ_GET_INFO_BY_FD, &attr);
+	if (rc != 0)
+		return rc;
+
+	*cnt = info.run_cnt;
+	*time = info.run_time_ns;
+
+	return 0;
+}
+
 static int
 create_gmap(dtrace_hdl_t *dtp, const char *name, enum bpf_map_type type,
 	    int ksz, int vsz, int size)
@@ -187,12 +228,19 @@ populate_probes_map(dtrace_hdl_t *dtp, int fd)
  *		dt_state.h.
  * - aggs:	Aggregation data buffer map, associated with each CPU.  The
  *		map is implemented as a global per-CPU map with a singleton
- *		element (key 0).  Every aggregation is stored with two copies
- *		of its data to provide a lockless latch-based mechanism for
- *		atomic reading and writing.
+ *		element (key 0).  Every aggregation is stored as a data flag
+ *		(non-zero once the aggregation has been updated) followed by
+ *		its data.
  * - specs:     Map associating speculation IDs with a dt_bpf_specs_t struct
- *		giving the number of buffers speculated into for this
- *		speculation, and the number drained by userspace.
+ *		giving the generation of the speculation, the number of records
+ *		dropped from it, and whether it is being drained by userspace.
+ * - specbufs:	Speculation buffer map.  This is a global map indexed by
+ *		speculation ID and CPU id, associating a speculation buffer
+ *		with each speculation on each CPU.  Speculative records are
+ *		held in these buffers until the speculation is committed, at
+ *		which point userspace copies them out.  As in legacy DTrace,
+ *		the specsize option gives the size of each of these buffers.
+ *		The map is only created if a clause speculates data.
  * - buffers:	Perf event output buffer map, associating a perf event output
  *		buffer with each CPU.  The map is indexed by CPU id.
  * - cpuinfo:	CPU information map, associating a cpuinfo_t structure with
@@ -228,7 +276,8 @@ populate_probes_map(dtrace_hdl_t *dtp, int fd)
 int
 dt_bpf_gmap_create(dtrace_hdl_t *dtp)
 {
-	int		stabsz, gvarsz, lvarsz, aggsz, memsz;
+	int		stabsz, gvarsz, lvarsz, aggsz, memsz, specsz;
+	int		ncpus = dtp->dt_conf.max_cpuid + 1;
 	int		dvarc = 0;
 	int		ci_mapfd, st_mapfd, pr_mapfd;
 	uint64_t	key = 0;
@@ -278,6 +327,27 @@ dt_bpf_gmap_create(dtrace_hdl_t *dtp)
 		dtp->dt_options[DTRACEOPT_NSPEC]) == -1)
 		return -1;		/* dt_errno is set for us */
 
+	/*
+	 * The size of the map value is the sum of:
+	 *	- size of the speculation buffer header
+	 *	- size of the speculation buffer (specsize, capped at
+	 *	  DT_MAX_SPECBUFSZ), rounded down to a multiple of 8
+	 *	- size of the largest record that can be appended to the buffer
+	 *	  (a 64-bit size followed by the maximum trace buffer record
+	 *	  size, rounded up to the nearest multiple of 8), so that the
+	 *	  BPF verifier can validate the append at any offset within the
+	 *	  speculation buffer
+	 */
+	dtp->dt_specbufsz = MIN(dtp->dt_options[DTRACEOPT_SPECSIZE],
+				DT_MAX_SPECBUFSZ) & ~7;
+	specsz = sizeof(dt_bpf_specbuf_t) + dtp->dt_specbufsz +
+		 sizeof(uint64_t) + roundup(dtp->dt_maxreclen, 8);
+	if (dtp->dt_usespecbufs &&
+	    create_gmap(dtp, "specbufs", BPF_MAP_TYPE_ARRAY,
+			sizeof(uint32_t), specsz,
+			dtp->dt_options[DTRACEOPT_NSPEC] * ncpus) == -1)
+		return -1;		/* dt_errno is set for us */
+
 	if (create_gmap(dtp, "buffers", BPF_MAP_TYPE_PERF_EVENT_ARRAY,
 			sizeof(uint32_t), sizeof(uint32_t),
 			dtp->dt_conf.num_online_cpus) == -1)
@@ -410,17 +480,19 @@ dt_bpf_reloc_prog(dtrace_hdl_t *dtp, const dtrace_difo_t *dp)
 		uint32_t	val = 0;
 
 		/*
-		 * If the relocation is for a BPF map, fill in its fd.
+		 * If the relocation is for a BPF map, fill in its fd.  For a
+		 * direct map value reference, the second instruction slot
+		 * holds the offset into the value, which we leave alone.
 		 */
 		if (idp->di_kind == DT_IDENT_PTR) {
-			if (rp->dofr_type == R_BPF_64_64)
-				text[ioff].src_reg = BPF_PSEUDO_MAP_FD;
-
 			val = idp->di_id;
 
 			if (rp->dofr_type == R_BPF_64_64) {
+				if (text[ioff].src_reg != BPF_PSEUDO_MAP_VALUE) {
+					text[ioff].src_reg = BPF_PSEUDO_MAP_FD;
+					text[ioff + 1].imm = 0;
+				}
 				text[ioff].imm = val;
-				text[ioff + 1].imm = 0;
 			} else if (rp->dofr_type == R_BPF_64_32)
 				text[ioff].imm = val;
 		}
@@ -436,7 +508,7 @@ static int
 dt_bpf_load_prog(dtrace_hdl_t *dtp, const dt_probe_t *prp,
 		 const dtrace_difo_t *dp, uint_t cflags)
 {
-	struct bpf_load_program_attr	attr;
+	union bpf_attr			attr;
 	size_t				logsz;
 	char				*log;
 	int				rc, origerrno = 0;
@@ -451,18 +523,24 @@ dt_bpf_load_prog(dtrace_hdl_t *dtp, const dt_probe_t *prp,
 	if (dp->dtdo_brelen)
 		dt_bpf_reloc_prog(dtp, dp);
 
-	memset(&attr, 0, sizeof(struct bpf_load_program_attr));
+	memset(&attr, 0, sizeof(attr));
 
 	DT_DISASM_PROG_FINAL(dtp, cflags, dp, stderr, NULL, prp->desc);
 
 	attr.prog_type = prp->prov->impl->prog_type;
-	attr.name = NULL;
-	attr.insns = dp->dtdo_buf;
-	attr.insns_cnt = dp->dtdo_len;
-	attr.license = BPF_CG_LICENSE;
+	attr.insns = (uint64_t)(uintptr_t)dp->dtdo_buf;
+	attr.insn_cnt = dp->dtdo_len;
+	attr.license = (uint64_t)(uintptr_t)BPF_CG_LICENSE;
+
+	/*
+	 * Providers may need to load some probe programs with a different
+	 * program type or attach target.
+	 */
+	if (prp->prov->impl->prog_attr)
+		prp->prov->impl->prog_attr(dtp, prp, &attr);
 
 	if (dtp->dt_options[DTRACEOPT_BPFLOG] == DTRACEOPT_UNSET) {
-		rc = bpf_load_program_xattr(&attr, NULL, 0);
+		rc = bpf(BPF_PROG_LOAD, &attr);
 		if (rc >= 0)
 			return rc;
 
@@ -473,10 +551,12 @@ dt_bpf_load_prog(dtrace_hdl_t *dtp, const dt_probe_t *prp,
 		logsz = dtp->dt_options[DTRACEOPT_BPFLOGSIZE];
 	else
 		logsz = BPF_LOG_BUF_SIZE;
-	attr.log_level = 4 | 2 | 1;
 	log = dt_zalloc(dtp, logsz);
 	assert(log != NULL);
-	rc = bpf_load_program_xattr(&attr, log, logsz);
+	attr.log_level = 4 | 2 | 1;
+	attr.log_buf = (uint64_t)(uintptr_t)log;
+	attr.log_size = logsz;
+	rc = bpf(BPF_PROG_LOAD, &attr);
 	if (rc < 0) {
 		dt_bpf_error(dtp,
 			     "BPF program load for '%s:%s:%s:%s' failed: %s\n",
@@ -578,6 +658,19 @@ dt_bpf_load_progs(dtrace_hdl_t *dtp, uint_t cflags)
 	 */
 	dtrace_getopt(dtp, "destructive", &dest_ok);
 
+	/*
+	 * If probe statistics were requested, have the kernel collect run-time
+	 * statistics for our programs.
+	 */
+	if (dtp->dt_options[DTRACEOPT_PROBESTATS] != DTRACEOPT_UNSET &&
+	    dtp->dt_bpfstats_fd == -1) {
+		dtp->dt_bpfstats_fd = dt_bpf_enable_stats();
+		if (dtp->dt_bpfstats_fd < 0)
+			return dt_bpf_error(dtp, "failed to enable BPF program "
+					    "statistics: %s\n",
+					    strerror(errno));
+	}
+
 	/*
 	 * Now construct all the other programs.
 	 */
@@ -600,6 +693,7 @@ dt_bpf_load_progs(dtrace_hdl_t *dtp, uint_t cflags)
 		if (fd < 0)
 			return fd;
 
+		prp->pr_progfd = fd;
 		dt_difo_free(dtp, dp);
 
 		if (!prp->prov->impl->attach)
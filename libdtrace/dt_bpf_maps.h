@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2019, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2019, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -24,11 +24,19 @@ struct dt_bpf_probe {
 
 typedef struct dt_bpf_specs	dt_bpf_specs_t;
 struct dt_bpf_specs {
-	uint64_t	written;	/* number of spec buffers written */
+	uint64_t	gen;		/* generation of this speculation */
+	uint64_t	drops;		/* number of records dropped */
 	uint32_t	draining;	/* 1 if userspace has been asked to
 					 * drain this buffer */
 };
 
+typedef struct dt_bpf_specbuf	dt_bpf_specbuf_t;
+struct dt_bpf_specbuf {
+	uint64_t	gen;		/* generation of the speculation */
+	uint64_t	size;		/* size of the data in the buffer */
+	char		data[];		/* speculative records */
+};
+
 #ifdef  __cplusplus
 }
 #endif
@@ -0,0 +1,860 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Kernel type information from BTF.
+ *
+ * If there is no CTF archive for the running kernel, the types for vmlinux and
+ * for loaded kernel modules are taken from the BTF the kernel exposes in
+ * /sys/kernel/btf.  The BTF for a module is converted into a CTF container
+ * the first time the module's types are needed.  The vmlinux container takes
+ * the place of the shared CTF, and module containers are its children (module
+ * BTF is split BTF on top of the vmlinux BTF).
+ *
+ * If the btfcache option is set, converted containers are saved in the given
+ * directory and reused by later runs.  A cache file is named after a hash of
+ * the BTF it was converted from (and of the vmlinux BTF, for modules), so
+ * stale entries are never used.  It holds a header, the CTF id for each BTF
+ * type id, and the CTF data.  The id map is needed to convert module BTF that
+ * refers to vmlinux types.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/btf.h>
+
+#include <dt_impl.h>
+#include <dt_btf.h>
+#include <dt_module.h>
+
+#define BTF_DIR			"/sys/kernel/btf/"
+
+/* Kinds that older <linux/btf.h> headers do not know about. */
+#define DT_BTF_KIND_FLOAT	16
+#define DT_BTF_KIND_DECL_TAG	17
+#define DT_BTF_KIND_TYPE_TAG	18
+#define DT_BTF_KIND_ENUM64	19
+
+#define DT_BTF_KIND(t)		(((t)->info >> 24) & 0x1f)
+#define DT_BTF_VLEN(t)		((t)->info & 0xffff)
+#define DT_BTF_KFLAG(t)		((t)->info >> 31)
+
+#define DT_BTF_CACHE_MAGIC	0x44544246	/* "DTBF" */
+#define DT_BTF_CACHE_VERSION	1
+
+struct dt_btf {
+	char			*db_data;	/* raw BTF */
+	const char		*db_strs;	/* string section */
+	uint32_t		db_strsz;	/* size of string section */
+	uint32_t		db_str0;	/* offset of first string */
+	const struct btf_type	**db_types;	/* types, by id - db_id0 */
+	uint32_t		db_ntypes;	/* number of types */
+	uint32_t		db_id0;		/* id of first type */
+	uint64_t		db_hash;	/* hash of BTF (and base BTF) */
+	dt_btf_t		*db_base;	/* base BTF (or NULL) */
+	ctf_id_t		*db_ctfids;	/* CTF ids, by id - db_id0 */
+	char			*db_ctfbuf;	/* CTF data (read from cache) */
+};
+
+typedef struct dt_btf_cache_hdr {
+	uint32_t	dbc_magic;	/* DT_BTF_CACHE_MAGIC */
+	uint32_t	dbc_version;	/* DT_BTF_CACHE_VERSION */
+	uint64_t	dbc_hash;	/* hash of the BTF */
+	uint32_t	dbc_ntypes;	/* number of CTF ids that follow */
+	uint32_t	dbc_pad;
+	uint64_t	dbc_ctfsz;	/* size of the CTF data */
+} dt_btf_cache_hdr_t;
+
+/*
+ * Conversion state.  Structs and unions are created empty, and their members
+ * are added later: this breaks reference cycles, and keeps the recursion in
+ * dt_btf_add_type() shallow.
+ */
+typedef struct dt_btf_conv {
+	dtrace_hdl_t	*dbc_dtp;	/* DTrace handle */
+	dt_btf_t	*dbc_btf;	/* BTF being converted */
+	ctf_file_t	*dbc_ctfp;	/* CTF container being built */
+	ctf_id_t	dbc_void;	/* CTF id of void */
+	uint32_t	*dbc_pending;	/* structs and unions to fill in */
+	uint32_t	dbc_npending;	/* number of pending types */
+} dt_btf_conv_t;
+
+static uint64_t
+dt_btf_hash(const char *data, size_t size, uint64_t hval)
+{
+	size_t	i;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		hval ^= (unsigned char)data[i];
+		hval *= 0x100000001b3ULL;
+	}
+
+	return hval;
+}
+
+static int
+dt_btf_type_size(const struct btf_type *t)
+{
+	int	vlen = DT_BTF_VLEN(t);
+
+	switch (DT_BTF_KIND(t)) {
+	case BTF_KIND_FWD:
+	case BTF_KIND_CONST:
+	case BTF_KIND_VOLATILE:
+	case BTF_KIND_RESTRICT:
+	case BTF_KIND_PTR:
+	case BTF_KIND_TYPEDEF:
+	case BTF_KIND_FUNC:
+	case DT_BTF_KIND_FLOAT:
+	case DT_BTF_KIND_TYPE_TAG:
+		return sizeof(struct btf_type);
+	case BTF_KIND_INT:
+	case DT_BTF_KIND_DECL_TAG:
+		return sizeof(struct btf_type) + sizeof(uint32_t);
+	case BTF_KIND_ENUM:
+		return sizeof(struct btf_type) + vlen * sizeof(struct btf_enum);
+	case DT_BTF_KIND_ENUM64:
+		return sizeof(struct btf_type) + vlen * 3 * sizeof(uint32_t);
+	case BTF_KIND_ARRAY:
+		return sizeof(struct btf_type) + sizeof(struct btf_array);
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+		return sizeof(struct btf_type) +
+		       vlen * sizeof(struct btf_member);
+	case BTF_KIND_FUNC_PROTO:
+		return sizeof(struct btf_type) +
+		       vlen * sizeof(struct btf_param);
+	case BTF_KIND_VAR:
+		return sizeof(struct btf_type) + sizeof(struct btf_var);
+	case BTF_KIND_DATASEC:
+		return sizeof(struct btf_type) +
+		       vlen * sizeof(struct btf_var_secinfo);
+	default:
+		return -1;
+	}
+}
+
+static const struct btf_type *
+dt_btf_type(const dt_btf_t *btf, uint32_t id)
+{
+	if (id < btf->db_id0)
+		return btf->db_base ? dt_btf_type(btf->db_base, id) : NULL;
+	if (id - btf->db_id0 >= btf->db_ntypes)
+		return NULL;
+
+	return btf->db_types[id - btf->db_id0];
+}
+
+/*
+ * Return the name at the given offset, or NULL for anonymous types.
+ */
+static const char *
+dt_btf_name(const dt_btf_t *btf, uint32_t off)
+{
+	const char	*name;
+
+	if (off < btf->db_str0)
+		return btf->db_base ? dt_btf_name(btf->db_base, off) : NULL;
+	if (off - btf->db_str0 >= btf->db_strsz)
+		return NULL;
+
+	name = btf->db_strs + off - btf->db_str0;
+
+	return *name != '\0' ? name : NULL;
+}
+
+static void
+dt_btf_free(dtrace_hdl_t *dtp, dt_btf_t *btf)
+{
+	if (btf == NULL)
+		return;
+
+	dt_free(dtp, btf->db_data);
+	dt_free(dtp, btf->db_types);
+	dt_free(dtp, btf->db_ctfids);
+	dt_free(dtp, btf->db_ctfbuf);
+	dt_free(dtp, btf);
+}
+
+void
+dt_btf_destroy(dtrace_hdl_t *dtp, dt_btf_t *btf)
+{
+	dt_btf_free(dtp, btf);
+}
+
+/*
+ * Read a whole file into memory.
+ */
+static char *
+dt_btf_read_file(dtrace_hdl_t *dtp, int fd, size_t *sizep)
+{
+	struct stat	st;
+	char		*buf;
+	size_t		len;
+	ssize_t		n;
+
+	if (fstat(fd, &st) == -1 || st.st_size <= 0)
+		return NULL;
+
+	buf = dt_alloc(dtp, st.st_size);
+	if (buf == NULL)
+		return NULL;
+
+	for (len = 0; len < st.st_size; len += n) {
+		n = read(fd, buf + len, st.st_size - len);
+		if (n <= 0)
+			break;
+	}
+
+	if (len < st.st_size) {
+		dt_free(dtp, buf);
+		return NULL;
+	}
+
+	*sizep = len;
+	return buf;
+}
+
+/*
+ * Read and index the BTF for the given kernel module.  Module BTF is split
+ * BTF: its type ids and string offsets follow those of the base (vmlinux) BTF.
+ */
+static dt_btf_t *
+dt_btf_load(dtrace_hdl_t *dtp, const char *name, dt_btf_t *base)
+{
+	char			path[PATH_MAX];
+	dt_btf_t		*btf;
+	const struct btf_header	*hdr;
+	const char		*p, *end;
+	size_t			size;
+	uint32_t		i;
+	int			fd;
+
+	snprintf(path, sizeof(path), BTF_DIR "%s", name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	btf = dt_zalloc(dtp, sizeof(dt_btf_t));
+	if (btf == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	btf->db_data = dt_btf_read_file(dtp, fd, &size);
+	close(fd);
+	if (btf->db_data == NULL)
+		goto fail;
+
+	hdr = (const struct btf_header *)btf->db_data;
+	if (size < sizeof(struct btf_header) || hdr->magic != BTF_MAGIC ||
+	    hdr->version != BTF_VERSION || hdr->hdr_len > size ||
+	    hdr->type_off % sizeof(uint32_t) != 0 ||
+	    (uint64_t)hdr->type_off + hdr->type_len > size - hdr->hdr_len ||
+	    (uint64_t)hdr->str_off + hdr->str_len > size - hdr->hdr_len)
+		goto fail;
+
+	btf->db_base = base;
+	btf->db_strs = btf->db_data + hdr->hdr_len + hdr->str_off;
+	btf->db_strsz = hdr->str_len;
+	if (btf->db_strsz > 0 && btf->db_strs[btf->db_strsz - 1] != '\0')
+		goto fail;
+
+	if (base != NULL) {
+		btf->db_id0 = base->db_id0 + base->db_ntypes;
+		btf->db_str0 = base->db_str0 + base->db_strsz;
+		btf->db_hash = dt_btf_hash(btf->db_data, size, base->db_hash);
+	} else {
+		btf->db_id0 = 1;
+		btf->db_hash = dt_btf_hash(btf->db_data, size,
+					   0xcbf29ce484222325ULL);
+	}
+
+	/*
+	 * Count the types, and then record where each one is.
+	 */
+	p = btf->db_data + hdr->hdr_len + hdr->type_off;
+	end = p + hdr->type_len;
+	while (p < end) {
+		const struct btf_type	*t = (const struct btf_type *)p;
+		int			tsz;
+
+		if (end - p < sizeof(struct btf_type) ||
+		    (tsz = dt_btf_type_size(t)) < 0 || end - p < tsz) {
+			dt_dprintf("invalid BTF type %u in %s\n",
+				   btf->db_id0 + btf->db_ntypes, path);
+			goto fail;
+		}
+
+		p += tsz;
+		btf->db_ntypes++;
+	}
+
+	btf->db_types = dt_calloc(dtp, btf->db_ntypes,
+				  sizeof(struct btf_type *));
+	if (btf->db_types == NULL)
+		goto fail;
+
+	p = btf->db_data + hdr->hdr_len + hdr->type_off;
+	for (i = 0; i < btf->db_ntypes; i++) {
+		btf->db_types[i] = (const struct btf_type *)p;
+		p += dt_btf_type_size(btf->db_types[i]);
+	}
+
+	return btf;
+
+fail:
+	dt_btf_free(dtp, btf);
+	return NULL;
+}
+
+static ctf_id_t dt_btf_add_type(dt_btf_conv_t *dbc, uint32_t id);
+
+static ctf_id_t *
+dt_btf_ctfid(dt_btf_t *btf, uint32_t id)
+{
+	if (id < btf->db_id0)
+		return btf->db_base ? dt_btf_ctfid(btf->db_base, id) : NULL;
+	if (id - btf->db_id0 >= btf->db_ntypes)
+		return NULL;
+
+	return &btf->db_ctfids[id - btf->db_id0];
+}
+
+/*
+ * Add the members of a struct or union, whose (empty) CTF type was created
+ * earlier.
+ */
+static void
+dt_btf_add_members(dt_btf_conv_t *dbc, uint32_t id)
+{
+	dt_btf_t		*btf = dbc->dbc_btf;
+	const struct btf_type	*t = dt_btf_type(btf, id);
+	const struct btf_member	*m = (const struct btf_member *)(t + 1);
+	ctf_id_t		sou = *dt_btf_ctfid(btf, id);
+	int			i;
+
+	for (i = 0; i < DT_BTF_VLEN(t); i++, m++) {
+		const char	*name = dt_btf_name(btf, m->name_off);
+		ctf_id_t	type = dt_btf_add_type(dbc, m->type);
+		ulong_t		off = m->offset;
+		uint_t		bits = 0;
+
+		if (type == CTF_ERR)
+			continue;
+
+		/*
+		 * If the kind flag is set, the offset also encodes the size of
+		 * bit-field members.
+		 */
+		if (DT_BTF_KFLAG(t)) {
+			bits = BTF_MEMBER_BITFIELD_SIZE(off);
+			off = BTF_MEMBER_BIT_OFFSET(off);
+		}
+
+		/*
+		 * Bit-fields of integral type get an encoding of their own.
+		 * Others (e.g. enums) are added with the size of their type.
+		 */
+		if (bits != 0) {
+			ctf_file_t	*ctfp = dbc->dbc_ctfp;
+			ctf_id_t	base = ctf_type_resolve(ctfp, type);
+			ctf_encoding_t	enc;
+
+			if (ctf_type_kind(ctfp, base) == CTF_K_INTEGER &&
+			    ctf_type_encoding(ctfp, base, &enc) == 0) {
+				enc.cte_offset = 0;
+				enc.cte_bits = bits;
+				ctf_add_member_encoded(ctfp, sou, name, base,
+						       off, enc);
+				continue;
+			}
+		}
+
+		ctf_add_member_offset(dbc->dbc_ctfp, sou, name, type, off);
+	}
+}
+
+static ctf_id_t
+dt_btf_add_enum(dt_btf_conv_t *dbc, const struct btf_type *t,
+		const char *name)
+{
+	dt_btf_t	*btf = dbc->dbc_btf;
+	const uint32_t	*v = (const uint32_t *)(t + 1);
+	int		i, wide = DT_BTF_KIND(t) == DT_BTF_KIND_ENUM64;
+	ctf_id_t	type;
+
+	type = ctf_add_enum(dbc->dbc_ctfp, CTF_ADD_ROOT, name);
+	if (type == CTF_ERR)
+		return CTF_ERR;
+
+	/*
+	 * Enumerators are (name, value) pairs, or (name, low 32 bits, high 32
+	 * bits) triples for 64-bit enums.  CTF enumerators are ints, so values
+	 * that do not fit are left out.
+	 */
+	for (i = 0; i < DT_BTF_VLEN(t); i++) {
+		const char	*ename = dt_btf_name(btf, v[0]);
+		int64_t		val = (int32_t)v[1];
+
+		if (wide)
+			val = (int64_t)((uint64_t)v[2] << 32 | v[1]);
+
+		v += wide ? 3 : 2;
+		if (ename == NULL || val != (int)val)
+			continue;
+
+		ctf_add_enumerator(dbc->dbc_ctfp, type, ename, val);
+	}
+
+	return type;
+}
+
+static ctf_id_t
+dt_btf_add_function(dt_btf_conv_t *dbc, const struct btf_type *t)
+{
+	dtrace_hdl_t		*dtp = dbc->dbc_dtp;
+	const struct btf_param	*p = (const struct btf_param *)(t + 1);
+	ctf_funcinfo_t		fi;
+	ctf_id_t		*argv = NULL;
+	ctf_id_t		type = CTF_ERR;
+	int			i;
+
+	fi.ctc_return = dt_btf_add_type(dbc, t->type);
+	fi.ctc_argc = DT_BTF_VLEN(t);
+	fi.ctc_flags = 0;
+	if (fi.ctc_return == CTF_ERR)
+		return CTF_ERR;
+
+	if (fi.ctc_argc > 0 && p[fi.ctc_argc - 1].type == 0) {
+		fi.ctc_argc--;
+		fi.ctc_flags |= CTF_FUNC_VARARG;
+	}
+
+	if (fi.ctc_argc > 0) {
+		argv = dt_calloc(dtp, fi.ctc_argc, sizeof(ctf_id_t));
+		if (argv == NULL)
+			return CTF_ERR;
+	}
+
+	for (i = 0; i < fi.ctc_argc; i++) {
+		argv[i] = dt_btf_add_type(dbc, p[i].type);
+		if (argv[i] == CTF_ERR)
+			goto out;
+	}
+
+	type = ctf_add_function(dbc->dbc_ctfp, CTF_ADD_ROOT, &fi, argv);
+
+out:
+	dt_free(dtp, argv);
+	return type;
+}
+
+/*
+ * Return the CTF type for a BTF type, adding it to the container if needed.
+ * Returns CTF_ERR for types that cannot be represented in CTF, and for BTF
+ * entries that are not types (such as variables).
+ */
+static ctf_id_t
+dt_btf_add_type(dt_btf_conv_t *dbc, uint32_t id)
+{
+	dt_btf_t		*btf = dbc->dbc_btf;
+	ctf_file_t		*ctfp = dbc->dbc_ctfp;
+	const struct btf_type	*t;
+	const char		*name;
+	ctf_id_t		*idp, ref, type = CTF_ERR;
+	ctf_encoding_t		enc;
+	ctf_arinfo_t		ar;
+	uint32_t		val;
+
+	if (id == 0)
+		return dbc->dbc_void;
+
+	idp = dt_btf_ctfid(btf, id);
+	t = dt_btf_type(btf, id);
+	if (idp == NULL || t == NULL)
+		return CTF_ERR;
+	if (*idp != 0)
+		return *idp;
+
+	/*
+	 * Mark the type as failed while it is being converted.  Only structs
+	 * and unions can be part of a cycle, and those are recorded before
+	 * any other type is converted.
+	 */
+	*idp = CTF_ERR;
+	name = dt_btf_name(btf, t->name_off);
+
+	switch (DT_BTF_KIND(t)) {
+	case BTF_KIND_INT:
+		val = *(const uint32_t *)(t + 1);
+		enc.cte_format = 0;
+		if (BTF_INT_ENCODING(val) & BTF_INT_SIGNED)
+			enc.cte_format |= CTF_INT_SIGNED;
+		if (BTF_INT_ENCODING(val) & BTF_INT_CHAR)
+			enc.cte_format |= CTF_INT_CHAR;
+		if (BTF_INT_ENCODING(val) & BTF_INT_BOOL)
+			enc.cte_format |= CTF_INT_BOOL;
+		enc.cte_offset = BTF_INT_OFFSET(val);
+		enc.cte_bits = BTF_INT_BITS(val);
+		type = ctf_add_integer(ctfp, CTF_ADD_ROOT, name, &enc);
+		break;
+	case DT_BTF_KIND_FLOAT:
+		enc.cte_format = t->size == 4 ? CTF_FP_SINGLE :
+				 t->size == 8 ? CTF_FP_DOUBLE : CTF_FP_LDOUBLE;
+		enc.cte_offset = 0;
+		enc.cte_bits = t->size * NBBY;
+		type = ctf_add_float(ctfp, CTF_ADD_ROOT, name, &enc);
+		break;
+	case BTF_KIND_PTR:
+		if ((ref = dt_btf_add_type(dbc, t->type)) != CTF_ERR)
+			type = ctf_add_pointer(ctfp, CTF_ADD_ROOT, ref);
+		break;
+	case BTF_KIND_TYPEDEF:
+		if ((ref = dt_btf_add_type(dbc, t->type)) != CTF_ERR)
+			type = ctf_add_typedef(ctfp, CTF_ADD_ROOT, name, ref);
+		break;
+	case BTF_KIND_CONST:
+		if ((ref = dt_btf_add_type(dbc, t->type)) != CTF_ERR)
+			type = ctf_add_const(ctfp, CTF_ADD_ROOT, ref);
+		break;
+	case BTF_KIND_VOLATILE:
+		if ((ref = dt_btf_add_type(dbc, t->type)) != CTF_ERR)
+			type = ctf_add_volatile(ctfp, CTF_ADD_ROOT, ref);
+		break;
+	case BTF_KIND_RESTRICT:
+		if ((ref = dt_btf_add_type(dbc, t->type)) != CTF_ERR)
+			type = ctf_add_restrict(ctfp, CTF_ADD_ROOT, ref);
+		break;
+	case DT_BTF_KIND_TYPE_TAG:
+		type = dt_btf_add_type(dbc, t->type);
+		break;
+	case BTF_KIND_ARRAY: {
+		const struct btf_array	*a = (const struct btf_array *)(t + 1);
+
+		ar.ctr_contents = dt_btf_add_type(dbc, a->type);
+		ar.ctr_index = dt_btf_add_type(dbc, a->index_type);
+		ar.ctr_nelems = a->nelems;
+		if (ar.ctr_contents != CTF_ERR && ar.ctr_index != CTF_ERR)
+			type = ctf_add_array(ctfp, CTF_ADD_ROOT, &ar);
+		break;
+	}
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+		if (DT_BTF_KIND(t) == BTF_KIND_STRUCT)
+			type = ctf_add_struct_sized(ctfp, CTF_ADD_ROOT, name,
+						    t->size);
+		else
+			type = ctf_add_union_sized(ctfp, CTF_ADD_ROOT, name,
+						   t->size);
+		if (type != CTF_ERR)
+			dbc->dbc_pending[dbc->dbc_npending++] = id;
+		break;
+	case BTF_KIND_ENUM:
+	case DT_BTF_KIND_ENUM64:
+		type = dt_btf_add_enum(dbc, t, name);
+		break;
+	case BTF_KIND_FWD:
+		type = ctf_add_forward(ctfp, CTF_ADD_ROOT, name,
+				       DT_BTF_KFLAG(t) ? CTF_K_UNION
+						       : CTF_K_STRUCT);
+		break;
+	case BTF_KIND_FUNC_PROTO:
+		type = dt_btf_add_function(dbc, t);
+		break;
+	case BTF_KIND_VAR:
+		if (name != NULL &&
+		    (ref = dt_btf_add_type(dbc, t->type)) != CTF_ERR)
+			ctf_add_variable(ctfp, name, ref);
+		break;
+	default:
+		break;
+	}
+
+	*idp = type;
+	return type;
+}
+
+/*
+ * Convert BTF into a new CTF container.  For module BTF, the container is a
+ * child of the container for the base BTF.
+ */
+static ctf_file_t *
+dt_btf_to_ctf(dtrace_hdl_t *dtp, dt_btf_t *btf, ctf_file_t *parent)
+{
+	dt_btf_conv_t	dbc;
+	ctf_encoding_t	enc = { CTF_INT_SIGNED, 0, 0 };
+	uint32_t	i;
+
+	memset(&dbc, 0, sizeof(dbc));
+	dbc.dbc_dtp = dtp;
+	dbc.dbc_btf = btf;
+	dbc.dbc_ctfp = ctf_create(&dtp->dt_ctferr);
+	if (dbc.dbc_ctfp == NULL)
+		return NULL;
+
+	ctf_setmodel(dbc.dbc_ctfp, dtp->dt_conf.dtc_ctfmodel);
+
+	btf->db_ctfids = dt_calloc(dtp, btf->db_ntypes, sizeof(ctf_id_t));
+	dbc.dbc_pending = dt_calloc(dtp, btf->db_ntypes, sizeof(uint32_t));
+	if (btf->db_ctfids == NULL || dbc.dbc_pending == NULL)
+		goto fail;
+
+	if (parent != NULL) {
+		if (ctf_parent_name_set(dbc.dbc_ctfp, "shared_ctf") < 0 ||
+		    ctf_import(dbc.dbc_ctfp, parent) < 0)
+			goto fail;
+
+		dbc.dbc_void = ctf_lookup_by_name(parent, "void");
+	} else
+		dbc.dbc_void = ctf_add_integer(dbc.dbc_ctfp, CTF_ADD_ROOT,
+					       "void", &enc);
+	if (dbc.dbc_void == CTF_ERR)
+		goto fail;
+
+	for (i = 0; i < btf->db_ntypes; i++) {
+		dt_btf_add_type(&dbc, btf->db_id0 + i);
+
+		while (dbc.dbc_npending > 0)
+			dt_btf_add_members(&dbc,
+					   dbc.dbc_pending[--dbc.dbc_npending]);
+	}
+
+	if (ctf_update(dbc.dbc_ctfp) == CTF_ERR)
+		goto fail;
+
+	dt_free(dtp, dbc.dbc_pending);
+	return dbc.dbc_ctfp;
+
+fail:
+	dt_dprintf("BTF conversion failed: %s\n",
+		   ctf_errmsg(ctf_errno(dbc.dbc_ctfp)));
+	dt_free(dtp, dbc.dbc_pending);
+	dt_free(dtp, btf->db_ctfids);
+	btf->db_ctfids = NULL;
+	ctf_close(dbc.dbc_ctfp);
+
+	return NULL;
+}
+
+static void
+dt_btf_cache_path(dtrace_hdl_t *dtp, const char *name, const dt_btf_t *btf,
+		  char *path, size_t len)
+{
+	snprintf(path, len, "%s/btf-%s-%016llx.ctf", dtp->dt_btfcache, name,
+		 (unsigned long long)btf->db_hash);
+}
+
+/*
+ * Open the cached CTF container for the given BTF, if there is one.
+ */
+static ctf_file_t *
+dt_btf_cache_read(dtrace_hdl_t *dtp, const char *name, dt_btf_t *btf)
+{
+	char			path[PATH_MAX];
+	dt_btf_cache_hdr_t	*hdr;
+	ctf_sect_t		ctdata;
+	ctf_file_t		*ctfp;
+	char			*buf;
+	size_t			size, idsz;
+	int			fd;
+
+	dt_btf_cache_path(dtp, name, btf, path, sizeof(path));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	buf = dt_btf_read_file(dtp, fd, &size);
+	close(fd);
+	if (buf == NULL)
+		return NULL;
+
+	hdr = (dt_btf_cache_hdr_t *)buf;
+	idsz = (size_t)btf->db_ntypes * sizeof(ctf_id_t);
+	if (size < sizeof(dt_btf_cache_hdr_t) ||
+	    hdr->dbc_magic != DT_BTF_CACHE_MAGIC ||
+	    hdr->dbc_version != DT_BTF_CACHE_VERSION ||
+	    hdr->dbc_hash != btf->db_hash ||
+	    hdr->dbc_ntypes != btf->db_ntypes ||
+	    size != sizeof(dt_btf_cache_hdr_t) + idsz + hdr->dbc_ctfsz)
+		goto fail;
+
+	btf->db_ctfids = dt_alloc(dtp, idsz);
+	if (btf->db_ctfids == NULL)
+		goto fail;
+
+	memcpy(btf->db_ctfids, hdr + 1, idsz);
+
+	/*
+	 * The CTF data is used in place, so the buffer is kept around for as
+	 * long as the BTF.
+	 */
+	memset(&ctdata, 0, sizeof(ctdata));
+	ctdata.cts_name = ".ctf";
+#ifndef HAVE_LIBCTF
+	ctdata.cts_type = SHT_PROGBITS;
+#endif
+	ctdata.cts_data = (char *)(hdr + 1) + idsz;
+	ctdata.cts_size = hdr->dbc_ctfsz;
+
+	ctfp = ctf_bufopen(&ctdata, NULL, NULL, &dtp->dt_ctferr);
+	if (ctfp == NULL)
+		goto fail;
+
+	btf->db_ctfbuf = buf;
+	dt_dprintf("using cached CTF %s\n", path);
+
+	return ctfp;
+
+fail:
+	dt_dprintf("ignoring cached CTF %s\n", path);
+	dt_free(dtp, btf->db_ctfids);
+	btf->db_ctfids = NULL;
+	dt_free(dtp, buf);
+
+	return NULL;
+}
+
+/*
+ * Save a converted CTF container in the cache.  Failures are not fatal: the
+ * cache is merely an optimization.
+ */
+static void
+dt_btf_cache_write(dtrace_hdl_t *dtp, const char *name, const dt_btf_t *btf,
+		   ctf_file_t *ctfp)
+{
+	char			path[PATH_MAX], tmp[PATH_MAX + 16];
+	dt_btf_cache_hdr_t	hdr;
+	size_t			idsz = btf->db_ntypes * sizeof(ctf_id_t);
+	off_t			end;
+	int			fd;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.dbc_magic = DT_BTF_CACHE_MAGIC;
+	hdr.dbc_version = DT_BTF_CACHE_VERSION;
+	hdr.dbc_hash = btf->db_hash;
+	hdr.dbc_ntypes = btf->db_ntypes;
+
+	/*
+	 * Write to a temporary file, and rename it into place so that
+	 * concurrent consumers never see a partial cache file.  The size of
+	 * the CTF data is only known once it has been written, so the header
+	 * is written last.
+	 */
+	dt_btf_cache_path(dtp, name, btf, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		goto fail;
+
+	if (pwrite(fd, btf->db_ctfids, idsz, sizeof(hdr)) != idsz ||
+	    lseek(fd, sizeof(hdr) + idsz, SEEK_SET) == -1 ||
+	    ctf_write(ctfp, fd) == CTF_ERR ||
+	    (end = lseek(fd, 0, SEEK_END)) == -1)
+		goto fail;
+
+	hdr.dbc_ctfsz = end - sizeof(hdr) - idsz;
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto fail;
+
+	if (close(fd) == 0 && rename(tmp, path) == 0)
+		return;
+
+	fd = -1;
+
+fail:
+	dt_dprintf("failed to write cached CTF %s\n", path);
+	if (fd != -1)
+		close(fd);
+	unlink(tmp);
+}
+
+/*
+ * Get a CTF container for BTF, from the cache or by converting it.
+ */
+static ctf_file_t *
+dt_btf_ctf(dtrace_hdl_t *dtp, const char *name, dt_btf_t *btf,
+	   ctf_file_t *parent)
+{
+	ctf_file_t	*ctfp = NULL;
+
+	if (dtp->dt_btfcache != NULL)
+		ctfp = dt_btf_cache_read(dtp, name, btf);
+
+	if (ctfp == NULL) {
+		dt_dprintf("converting BTF for %s\n", name);
+
+		ctfp = dt_btf_to_ctf(dtp, btf, parent);
+		if (ctfp == NULL)
+			return NULL;
+
+		if (dtp->dt_btfcache != NULL)
+			dt_btf_cache_write(dtp, name, btf, ctfp);
+	} else if (parent != NULL && ctf_import(ctfp, parent) < 0) {
+		ctf_close(ctfp);
+		return NULL;
+	}
+
+	ctf_setmodel(ctfp, dtp->dt_conf.dtc_ctfmodel);
+
+	return ctfp;
+}
+
+/*
+ * Get the CTF container for a kernel module from its BTF.  The vmlinux
+ * container is the shared CTF, and is created the first time any module's
+ * types are needed.
+ */
+ctf_file_t *
+dt_btf_module_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
+{
+	dt_btf_t	*btf;
+	ctf_file_t	*ctfp;
+
+	if (dtp->dt_btf == NULL) {
+		btf = dt_btf_load(dtp, "vmlinux", NULL);
+		if (btf == NULL)
+			return NULL;
+
+		ctfp = dt_btf_ctf(dtp, "vmlinux", btf, NULL);
+		if (ctfp == NULL) {
+			dt_btf_free(dtp, btf);
+			return NULL;
+		}
+
+		dtp->dt_btf = btf;
+		dtp->dt_shared_ctf = ctfp;
+	}
+
+	if (strcmp(dmp->dm_name, "vmlinux") == 0)
+		return dtp->dt_shared_ctf;
+
+	btf = dt_btf_load(dtp, dmp->dm_name, dtp->dt_btf);
+	if (btf == NULL)
+		return NULL;
+
+	ctfp = dt_btf_ctf(dtp, dmp->dm_name, btf, dtp->dt_shared_ctf);
+
+	/*
+	 * Only the vmlinux BTF is needed after conversion (as the base for
+	 * module BTF).  A container read from the cache keeps using its buffer.
+	 */
+	if (ctfp != NULL && btf->db_ctfbuf != NULL) {
+		dmp->dm_ctdata_data = btf->db_ctfbuf;
+		btf->db_ctfbuf = NULL;
+	}
+	dt_btf_free(dtp, btf);
+
+	return ctfp;
+}
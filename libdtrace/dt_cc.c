@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2008, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2008, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -1487,6 +1487,7 @@ dt_compile_one_clause(dtrace_hdl_t *dtp, dt_node_t *cnp, dt_node_t *pnp)
 	dtrace_ecbdesc_t	*edp;
 	dtrace_datadesc_t	*ddp;
 	dtrace_stmtdesc_t	*sdp;
+	dtrace_difo_t		*dp;
 
 	yylineno = pnp->dn_line;
 	dt_setcontext(dtp, pnp->dn_desc);
@@ -1518,7 +1519,9 @@ dt_compile_one_clause(dtrace_hdl_t *dtp, dt_node_t *cnp, dt_node_t *pnp)
 	 * Compile the clause (predicate and action).
 	 */
 	dt_cg(yypcb, cnp);
-	sdp->dtsd_clause = dt_clause_create(dtp, dt_as(yypcb));
+	dp = dt_as(yypcb);
+	sdp->dtsd_clause = dt_clause_create(dtp, dp);
+	dt_cg_pfilter(dtp, sdp->dtsd_clause, cnp->dn_pred);
 
 	assert(yypcb->pcb_stmt == sdp);
 	if (dtrace_stmt_add(yypcb->pcb_hdl, yypcb->pcb_prog, sdp) != 0)
@@ -1725,7 +1728,7 @@ dt_reduce(dtrace_hdl_t *dtp, dt_version_t v)
  * read/write loop, but a splice is more efficient.)
  */
 static FILE *
-dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
+dt_preproc_cpp(dtrace_hdl_t *dtp, FILE *ifp)
 {
 	int argc = dtp->dt_cpp_argc;
 	char **argv = alloca(sizeof(char *) * (argc + 5));
@@ -1906,6 +1909,29 @@ err:
 	return NULL;
 }
 
+/*
+ * Preprocess the specified input file, and return a FILE handle for the
+ * output.  In embedded mode, the input is preprocessed in-process unless it
+ * uses features that require cpp(1) (see dt_pp.c).
+ */
+static FILE *
+dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
+{
+	FILE *ofp, *cfp;
+
+	if (dtp->dt_cppmode != DT_CPP_EMBEDDED)
+		return dt_preproc_cpp(dtp, ifp);
+
+	ofp = dt_pp_embedded(dtp, ifp, &cfp);
+	if (ofp != NULL || cfp == NULL)
+		return ofp;
+
+	ofp = dt_preproc_cpp(dtp, cfp);
+	fclose(cfp);
+
+	return ofp;
+}
+
 void *
 dt_compile(dtrace_hdl_t *dtp, int context, dtrace_probespec_t pspec, void *arg,
     uint_t cflags, int argc, char *const argv[], FILE *fp, const char *s)
@@ -2358,6 +2384,9 @@ dt_link_construct(dtrace_hdl_t *dtp, const dt_probe_t *prp, dtrace_difo_t *dp,
 			case DT_CONST_NCPUS:
 				nrp->dofr_data = dtp->dt_conf.max_cpuid + 1;
 				continue;
+			case DT_CONST_SPECSZ:
+				nrp->dofr_data = dtp->dt_specbufsz;
+				continue;
 			case DT_CONST_STKSIZ:
 				nrp->dofr_data = sizeof(uint64_t)
 				    * dtp->dt_options[DTRACEOPT_MAXFRAMES];
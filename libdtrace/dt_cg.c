@@ -26,6 +26,313 @@
 
 static void dt_cg_node(dt_node_t *, dt_irlist_t *, dt_regset_t *);
 
+static uint32_t
+dt_cg_pfilter_hval(const dt_pfilter_t *pfp)
+{
+	return str2hval(pfp->pf_clause->di_name, 0);
+}
+
+static int
+dt_cg_pfilter_cmp(const dt_pfilter_t *p, const dt_pfilter_t *q)
+{
+	return strcmp(p->pf_clause->di_name, q->pf_clause->di_name);
+}
+
+DEFINE_HE_STD_LINK_FUNCS(dt_cg_pfilter, dt_pfilter_t, pf_he)
+
+static void *
+dt_cg_pfilter_del_free(dt_pfilter_t *head, dt_pfilter_t *pfp)
+{
+	head = dt_cg_pfilter_del(head, pfp);
+	free(pfp);
+
+	return head;
+}
+
+static dt_htab_ops_t dt_cg_pfilter_htab_ops = {
+	.hval = (htab_hval_fn)dt_cg_pfilter_hval,
+	.cmp = (htab_cmp_fn)dt_cg_pfilter_cmp,
+	.add = (htab_add_fn)dt_cg_pfilter_add,
+	.del = (htab_del_fn)dt_cg_pfilter_del_free,
+	.next = (htab_next_fn)dt_cg_pfilter_next
+};
+
+/*
+ * Determine whether a clause predicate starts with an equality test of a
+ * built-in variable (pid, tid, uid, gid, or execname) against a constant.  If
+ * so, record a prefilter that describes the test for the clause.  Only the
+ * first term that the predicate evaluates is considered: if it is false, the
+ * predicate is false and no other term would have been evaluated, so skipping
+ * the clause is safe even if other terms have side effects.
+ *
+ * A clause without a prefilter simply cannot be skipped early, so failing to
+ * record one is not an error.
+ */
+void
+dt_cg_pfilter(dtrace_hdl_t *dtp, const dt_ident_t *clause,
+	      const dt_node_t *pred)
+{
+	const dt_node_t	*var, *val;
+	dt_ident_t	*idp;
+	dt_pfilter_t	*pfp;
+
+	if (pred == NULL)
+		return;
+
+	while (pred->dn_kind == DT_NODE_OP2 && pred->dn_op == DT_TOK_LAND)
+		pred = pred->dn_left;
+
+	if (pred->dn_kind != DT_NODE_OP2 || pred->dn_op != DT_TOK_EQU)
+		return;
+
+	if (pred->dn_left->dn_kind == DT_NODE_VAR) {
+		var = pred->dn_left;
+		val = pred->dn_right;
+	} else {
+		var = pred->dn_right;
+		val = pred->dn_left;
+	}
+
+	if (var->dn_kind != DT_NODE_VAR)
+		return;
+
+	idp = dt_ident_resolve(var->dn_ident);
+	if (idp->di_kind != DT_IDENT_SCALAR ||
+	    (idp->di_flags & (DT_IDFLG_LOCAL | DT_IDFLG_TLS)))
+		return;
+
+	switch (idp->di_id) {
+	case DIF_VAR_PID:
+	case DIF_VAR_TID:
+	case DIF_VAR_UID:
+	case DIF_VAR_GID:
+		if (val->dn_kind != DT_NODE_INT || val->dn_value > INT32_MAX)
+			return;
+		break;
+	case DIF_VAR_EXECNAME:
+		if (val->dn_kind != DT_NODE_STRING ||
+		    strlen(val->dn_string) >= sizeof(pfp->pf_str))
+			return;
+		break;
+	default:
+		return;
+	}
+
+	if (dtp->dt_pfilters == NULL) {
+		dtp->dt_pfilters = dt_htab_create(dtp, &dt_cg_pfilter_htab_ops);
+		if (dtp->dt_pfilters == NULL)
+			return;
+	}
+
+	pfp = dt_zalloc(dtp, sizeof(dt_pfilter_t));
+	if (pfp == NULL)
+		return;
+
+	pfp->pf_clause = clause;
+	pfp->pf_var = idp->di_id;
+	if (idp->di_id == DIF_VAR_EXECNAME)
+		strcpy(pfp->pf_str, val->dn_string);
+	else
+		pfp->pf_val = val->dn_value;
+
+	if (dt_htab_insert(dtp->dt_pfilters, pfp) < 0)
+		dt_free(dtp, pfp);
+}
+
+/*
+ * Return the prefilter for a clause, or NULL if it does not have one.
+ */
+static const dt_pfilter_t *
+dt_cg_pfilter_lookup(dtrace_hdl_t *dtp, const dt_ident_t *clause)
+{
+	dt_pfilter_t	tmpl;
+
+	if (dtp->dt_pfilters == NULL)
+		return NULL;
+
+	tmpl.pf_clause = clause;
+
+	return dt_htab_lookup(dtp->dt_pfilters, &tmpl);
+}
+
+static int
+dt_cg_has_pfilter(dtrace_hdl_t *dtp, dt_ident_t *idp, void *arg)
+{
+	(*(int *)arg)++;
+
+	return dt_cg_pfilter_lookup(dtp, idp) == NULL;
+}
+
+typedef struct {
+	dt_irlist_t	*dlp;
+	uint_t		lbl_pass;
+	uint_t		var;
+} dt_pfilter_arg_t;
+
+static int
+dt_cg_tramp_pfilter(dtrace_hdl_t *dtp, dt_ident_t *idp, dt_pfilter_arg_t *arg)
+{
+	dt_irlist_t		*dlp = arg->dlp;
+	const dt_pfilter_t	*pfp = dt_cg_pfilter_lookup(dtp, idp);
+	uint_t			lbl_next = dt_irlist_label(dlp);
+
+	/*
+	 * The value of the built-in variable is still available in %r0 (or
+	 * on the stack, for execname) if the previous test used it also.
+	 */
+	switch (pfp->pf_var) {
+	case DIF_VAR_PID:
+		if (arg->var != pfp->pf_var) {
+			emit(dlp,  BPF_CALL_HELPER(BPF_FUNC_get_current_pid_tgid));
+			emit(dlp,  BPF_ALU64_IMM(BPF_RSH, BPF_REG_0, 32));
+		}
+		emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, BPF_REG_0, pfp->pf_val, arg->lbl_pass));
+		break;
+	case DIF_VAR_TID:
+		if (arg->var != pfp->pf_var) {
+			emit(dlp,  BPF_CALL_HELPER(BPF_FUNC_get_current_pid_tgid));
+			emit(dlp,  BPF_ALU64_IMM(BPF_LSH, BPF_REG_0, 32));
+			emit(dlp,  BPF_ALU64_IMM(BPF_RSH, BPF_REG_0, 32));
+		}
+		emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, BPF_REG_0, pfp->pf_val, arg->lbl_pass));
+		break;
+	case DIF_VAR_UID:
+		if (arg->var != pfp->pf_var) {
+			emit(dlp,  BPF_CALL_HELPER(BPF_FUNC_get_current_uid_gid));
+			emit(dlp,  BPF_ALU64_IMM(BPF_LSH, BPF_REG_0, 32));
+			emit(dlp,  BPF_ALU64_IMM(BPF_RSH, BPF_REG_0, 32));
+		}
+		emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, BPF_REG_0, pfp->pf_val, arg->lbl_pass));
+		break;
+	case DIF_VAR_GID:
+		if (arg->var != pfp->pf_var) {
+			emit(dlp,  BPF_CALL_HELPER(BPF_FUNC_get_current_uid_gid));
+			emit(dlp,  BPF_ALU64_IMM(BPF_RSH, BPF_REG_0, 32));
+		}
+		emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, BPF_REG_0, pfp->pf_val, arg->lbl_pass));
+		break;
+	case DIF_VAR_EXECNAME: {
+		uint64_t	val[2];
+
+		/*
+		 * The task comm is NUL-padded, so it can be compared against
+		 * the (NUL-padded) constant 8 bytes at a time.
+		 */
+		if (arg->var != pfp->pf_var) {
+			emit(dlp,  BPF_MOV_REG(BPF_REG_1, BPF_REG_FP));
+			emit(dlp,  BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, DT_STK_SPILL(1)));
+			emit(dlp,  BPF_MOV_IMM(BPF_REG_2, sizeof(pfp->pf_str)));
+			emit(dlp,  BPF_CALL_HELPER(BPF_FUNC_get_current_comm));
+		}
+
+		memcpy(val, pfp->pf_str, sizeof(val));
+		emit(dlp,  BPF_LOAD(BPF_DW, BPF_REG_0, BPF_REG_FP, DT_STK_SPILL(1)));
+		dt_cg_xsetx(dlp, NULL, DT_LBL_NONE, BPF_REG_1, val[0]);
+		emit(dlp,  BPF_BRANCH_REG(BPF_JNE, BPF_REG_0, BPF_REG_1, lbl_next));
+		emit(dlp,  BPF_LOAD(BPF_DW, BPF_REG_0, BPF_REG_FP, DT_STK_SPILL(0)));
+		dt_cg_xsetx(dlp, NULL, DT_LBL_NONE, BPF_REG_1, val[1]);
+		emit(dlp,  BPF_BRANCH_REG(BPF_JEQ, BPF_REG_0, BPF_REG_1, arg->lbl_pass));
+		break;
+	}
+	default:
+		assert(0);
+	}
+
+	emitl(dlp, lbl_next,
+		   BPF_NOP());
+
+	arg->var = pfp->pf_var;
+
+	return 0;
+}
+
+/*
+ * If every clause for the probe has a prefilter (see dt_cg_pfilter()), none
+ * of the clauses can fire unless at least one prefilter test is true.  Emit
+ * those tests so that the trampoline can exit before it performs any of the
+ * map lookups needed to set up the DTrace context.  The clause predicates are
+ * still evaluated as usual.
+ *
+ * This clobbers %r0 through %r5.
+ */
+static void
+dt_cg_tramp_prefilter(dt_pcb_t *pcb)
+{
+	dtrace_hdl_t		*dtp = pcb->pcb_hdl;
+	dt_irlist_t		*dlp = &pcb->pcb_ir;
+	const dt_probe_t	*prp = pcb->pcb_probe;
+	dt_pfilter_arg_t	arg = { dlp, dt_irlist_label(dlp), 0 };
+	int			cnt = 0;
+
+	if (prp == NULL ||
+	    dt_probe_clause_iter(dtp, prp, dt_cg_has_pfilter, &cnt) != 0 ||
+	    cnt == 0)
+		return;
+
+	dt_probe_clause_iter(dtp, prp, (dt_clause_f *)dt_cg_tramp_pfilter,
+			     &arg);
+	emit(dlp,  BPF_JUMP(pcb->pcb_exitlbl));
+	emitl(dlp, arg.lbl_pass,
+		   BPF_NOP());
+}
+
+static int
+dt_cg_add_difoflags(dtrace_hdl_t *dtp, dt_ident_t *idp, uint_t *flags)
+{
+	const dtrace_difo_t	*dp = idp->di_data;
+
+	*flags |= dp->dtdo_flags;
+
+	return 0;
+}
+
+/*
+ * Determine which parts of the DTrace context are used by the clauses that
+ * the trampoline for the current probe calls.  The ERROR probe clauses are
+ * always included because any clause may trigger them.
+ *
+ * Some trampolines call clauses for other probes than their own (e.g. pid
+ * probes are implemented on top of an underlying probe that has no clauses).
+ * If the probe has no clauses, we assume that everything may be used.
+ */
+static uint_t
+dt_cg_tramp_difoflags(dt_pcb_t *pcb)
+{
+	dtrace_hdl_t	*dtp = pcb->pcb_hdl;
+	dt_probe_t	*prp = pcb->pcb_probe;
+	uint_t		flags = 0;
+
+	if (prp == NULL || dt_list_next(&prp->clauses) == NULL)
+		return DIFOFLG_STRTAB | DIFOFLG_AGGS | DIFOFLG_GVARS |
+		       DIFOFLG_LVARS;
+
+	dt_probe_clause_iter(dtp, prp, (dt_clause_f *)dt_cg_add_difoflags,
+			     &flags);
+	if (dtp->dt_error != NULL && dtp->dt_error != prp)
+		dt_probe_clause_iter(dtp, dtp->dt_error,
+				     (dt_clause_f *)dt_cg_add_difoflags,
+				     &flags);
+
+	return flags;
+}
+
+/*
+ * Invalidate the built-in variable values that are cached in the machine state
+ * (pointed to by 'mreg').  This happens at the start of every probe firing, so
+ * that the cached values are shared by all clauses for the probe.  Anything
+ * that can make cached values stale during a probe firing must invalidate the
+ * cache as well.
+ *
+ *	dctx.mst->tstamp = 0;	// stdw [%mreg + DMST_TSTAMP], 0
+ *	dctx.mst->bvcached = 0;	// stw [%mreg + DMST_BVCACHED], 0
+ */
+static void
+dt_cg_bvar_invalidate(dt_irlist_t *dlp, int mreg)
+{
+	emit(dlp,  BPF_STORE_IMM(BPF_DW, mreg, DMST_TSTAMP, 0));
+	emit(dlp,  BPF_STORE_IMM(BPF_W, mreg, DMST_BVCACHED, 0));
+}
+
 /*
  * Generate the generic prologue of the trampoline BPF program.
  *
@@ -52,6 +359,7 @@ dt_cg_tramp_prologue_act(dt_pcb_t *pcb, dt_activity_t act)
 	dt_ident_t	*state = dt_dlib_get_map(dtp, "state");
 	dt_ident_t	*prid = dt_dlib_get_var(pcb->pcb_hdl, "PRID");
 	uint_t		lbl_exit = pcb->pcb_exitlbl;
+	uint_t		flags;
 
 	assert(mem != NULL);
 	assert(state != NULL);
@@ -74,6 +382,13 @@ dt_cg_tramp_prologue_act(dt_pcb_t *pcb, dt_activity_t act)
 	emit(dlp,  BPF_MOV_REG(BPF_REG_8, BPF_REG_1));
 	emit(dlp,  BPF_STORE(BPF_DW, BPF_REG_FP, DCTX_FP(DCTX_CTX), BPF_REG_8));
 
+	/*
+	 * Events that cannot cause any clause to fire are discarded before
+	 * we set up the DTrace context (see dt_cg_tramp_prefilter()).
+	 */
+	if (act == DT_ACTIVITY_ACTIVE)
+		dt_cg_tramp_prefilter(pcb);
+
 	/*
 	 *	key = DT_STATE_ACTIVITY;// stw [%fp + DCTX_FP(DCTX_ACT)],
 	 *				//		DT_STATE_ACTIVITY
@@ -119,6 +434,8 @@ dt_cg_tramp_prologue_act(dt_pcb_t *pcb, dt_activity_t act)
 	 *	dctx.mst->prid = PRID;	// stw [%r7 + DMST_PRID], PRID
 	 *	dctx.mst->syscall_errno = 0;
 	 *				// stw [%r7 + DMST_ERRNO], 0
+	 *	dctx.mst->tstamp = 0;	// stdw [%r7 + DMST_TSTAMP], 0
+	 *	dctx.mst->bvcached = 0;	// stw [%r7 + DMST_BVCACHED], 0
 	 */
 	emit(dlp,  BPF_STORE_IMM(BPF_W, BPF_REG_FP, DCTX_FP(DCTX_MST), 0));
 	dt_cg_xsetx(dlp, mem, DT_LBL_NONE, BPF_REG_1, mem->di_id);
@@ -130,6 +447,7 @@ dt_cg_tramp_prologue_act(dt_pcb_t *pcb, dt_activity_t act)
 	emit(dlp,  BPF_STORE(BPF_DW, BPF_REG_FP, DCTX_FP(DCTX_MST), BPF_REG_7));
 	emite(dlp, BPF_STORE_IMM(BPF_W, BPF_REG_7, DMST_PRID, -1), prid);
 	emit(dlp,  BPF_STORE_IMM(BPF_W, BPF_REG_7, DMST_ERRNO, 0));
+	dt_cg_bvar_invalidate(dlp, BPF_REG_7);
 
 	/*
 	 *	buf = rc + roundup(sizeof(dt_mstate_t), 8);
@@ -194,14 +512,35 @@ dt_cg_tramp_prologue_act(dt_pcb_t *pcb, dt_activity_t act)
 		emit(dlp, BPF_STORE(BPF_DW, BPF_REG_FP, DCTX_FP(offset), BPF_REG_0)); \
 	} while(0)
 
-	DT_CG_STORE_MAP_PTR("strtab", DCTX_STRTAB);
-	if (dt_idhash_datasize(dtp->dt_aggs) > 0)
+	/*
+	 * Store pointer to the value of single-element BPF array map "name"
+	 * in the DTrace context field "fld" at "offset".  The pointer is
+	 * loaded directly (BPF_PSEUDO_MAP_VALUE), so there is no need for a
+	 * helper call and the pointer is known not to be NULL.
+	 *
+	 *	dctx.fld = &name[0];	// lddw %r0, &name[0]
+	 *				// stdw [%fp + DCTX_FP(offset)], %r0
+	 */
+#define DT_CG_STORE_MAP_VALUE(name, offset) \
+	do { \
+		dt_ident_t *idp = dt_dlib_get_map(dtp, name); \
+		\
+		assert(idp != NULL); \
+		dt_cg_map_value(dlp, idp, BPF_REG_0, 0); \
+		emit(dlp, BPF_STORE(BPF_DW, BPF_REG_FP, DCTX_FP(offset), BPF_REG_0)); \
+	} while(0)
+
+	flags = dt_cg_tramp_difoflags(pcb);
+	if (flags & DIFOFLG_STRTAB)
+		DT_CG_STORE_MAP_VALUE("strtab", DCTX_STRTAB);
+	if ((flags & DIFOFLG_AGGS) && dt_idhash_datasize(dtp->dt_aggs) > 0)
 		DT_CG_STORE_MAP_PTR("aggs", DCTX_AGG);
-	if (dt_idhash_datasize(dtp->dt_globals) > 0)
-		DT_CG_STORE_MAP_PTR("gvars", DCTX_GVARS);
-	if (dtp->dt_maxlvaralloc > 0)
+	if ((flags & DIFOFLG_GVARS) && dt_idhash_datasize(dtp->dt_globals) > 0)
+		DT_CG_STORE_MAP_VALUE("gvars", DCTX_GVARS);
+	if ((flags & DIFOFLG_LVARS) && dtp->dt_maxlvaralloc > 0)
 		DT_CG_STORE_MAP_PTR("lvars", DCTX_LVARS);
 #undef DT_CG_STORE_MAP_PTR
+#undef DT_CG_STORE_MAP_VALUE
 }
 
 void
@@ -532,7 +871,6 @@ dt_cg_prologue(dt_pcb_t *pcb, dt_node_t *pred)
 	/*
 	 *	dctx->mst->fault = 0;	// lddw %r0, [%r0 + DCTX_MST]
 	 *				// stdw [%r0 + DMST_FAULT], 0
-	 *	dctx->mst->tstamp = 0;	// stdw [%r0 + DMST_TSTAMP], 0
 	 *	dctx->mst->epid = EPID;	// stw [%r0 + DMST_EPID], EPID
 	 *	dctx->mst->clid = CLID;	// stw [%r0 + DMST_CLID], CLID
 	 *	*((uint32_t *)&buf[0]) = EPID;
@@ -540,7 +878,6 @@ dt_cg_prologue(dt_pcb_t *pcb, dt_node_t *pred)
 	 */
 	emit(dlp,  BPF_LOAD(BPF_DW, BPF_REG_0, BPF_REG_0, DCTX_MST));
 	emit(dlp,  BPF_STORE_IMM(BPF_DW, BPF_REG_0, DMST_FAULT, 0));
-	emit(dlp,  BPF_STORE_IMM(BPF_DW, BPF_REG_0, DMST_TSTAMP, 0));
 	emite(dlp, BPF_STORE_IMM(BPF_W, BPF_REG_0, DMST_EPID, -1), epid);
 	emite(dlp, BPF_STORE_IMM(BPF_W, BPF_REG_0, DMST_CLID, -1), clid);
 	emite(dlp, BPF_STORE_IMM(BPF_W, BPF_REG_9, 0, -1), epid);
@@ -579,7 +916,8 @@ dt_cg_prologue(dt_pcb_t *pcb, dt_node_t *pred)
 /*
  * Generate the function epilogue:
  *	4. Submit the buffer to the perf event output buffer for the current
- *	   cpu, if this is a data recording action..
+ *	   cpu (or to the speculation buffer for the current cpu, if
+ *	   speculating), if this is a data recording action..
  *	5. Return 0
  * }
  */
@@ -587,6 +925,7 @@ static void
 dt_cg_epilogue(dt_pcb_t *pcb)
 {
 	dt_irlist_t	*dlp = &pcb->pcb_ir;
+	int		cflags = pcb->pcb_stmt->dtsd_clauseflags;
 
 	TRACE_REGSET("Epilogue: Begin");
 
@@ -595,9 +934,31 @@ dt_cg_epilogue(dt_pcb_t *pcb)
 	 *   - data-recording action, or
 	 *   - default action (no clause specified)
 	 *   - committing or discarding a speculation
+	 *
+	 * Speculated data is appended to the speculation buffer instead, and
+	 * is kept there until the speculation is committed (or discarded).  If
+	 * the speculate() action failed, we never get here.
 	 */
-	if (pcb->pcb_stmt->dtsd_clauseflags & DT_CLSFLAG_DATAREC ||
-	    pcb->pcb_stmt->dtsd_clauseflags & DT_CLSFLAG_COMMIT_DISCARD) {
+	if ((cflags & DT_CLSFLAG_SPECULATE) && (cflags & DT_CLSFLAG_DATAREC)) {
+		dt_ident_t *idp = dt_dlib_get_func(pcb->pcb_hdl,
+						   "dt_speculation_append");
+
+		assert(idp != NULL);
+		pcb->pcb_hdl->dt_usespecbufs = 1;
+
+		/*
+		 *	dt_speculation_append(*((uint32_t *)&buf[4]), buf,
+		 *			      bufoff);
+		 *				// ldw %r1, [%r9 + 4]
+		 *				// mov %r2, %r9
+		 *				// mov %r3, pcb->pcb_bufoff
+		 *				// call dt_speculation_append
+		 */
+		emit(dlp,  BPF_LOAD(BPF_W, BPF_REG_1, BPF_REG_9, 4));
+		emit(dlp,  BPF_MOV_REG(BPF_REG_2, BPF_REG_9));
+		emit(dlp,  BPF_MOV_IMM(BPF_REG_3, pcb->pcb_bufoff));
+		emite(dlp, BPF_CALL_FUNC(idp->di_id), idp);
+	} else if (cflags & (DT_CLSFLAG_DATAREC | DT_CLSFLAG_COMMIT_DISCARD)) {
 		dt_ident_t *buffers = dt_dlib_get_map(pcb->pcb_hdl, "buffers");
 
 		assert(buffers != NULL);
@@ -1113,7 +1474,10 @@ dt_cg_act_chill(dt_pcb_t *pcb, dt_node_t *dnp, dtrace_actkind_t kind)
 {
 	dt_cg_node(dnp->dn_args, &pcb->pcb_ir, pcb->pcb_regs);
 	dnerror(dnp, D_UNKNOWN, "chill() is not implemented (yet)\n");
-	/* FIXME: Needs implementation */
+	/*
+	 * FIXME: Needs implementation.  Time passes during chill(), so it
+	 * must invalidate the cached timestamp (dt_cg_bvar_invalidate()).
+	 */
 }
 
 static void
@@ -1880,9 +2244,9 @@ static const dt_cg_actdesc_t _dt_cg_actions[DT_ACT_MAX] = {
 };
 
 dt_irnode_t *
-dt_cg_node_alloc(uint_t label, struct bpf_insn instr)
+dt_cg_node_alloc(dt_irlist_t *dlp, uint_t label, struct bpf_insn instr)
 {
-	dt_irnode_t *dip = malloc(sizeof(dt_irnode_t));
+	dt_irnode_t *dip = dt_arena_alloc(&dlp->dl_arena, sizeof(dt_irnode_t));
 
 	if (dip == NULL)
 		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
@@ -1938,6 +2302,24 @@ dt_cg_setx(dt_irlist_t *dlp, int reg, uint64_t x)
 	dt_cg_xsetx(dlp, NULL, DT_LBL_NONE, reg, x);
 }
 
+/*
+ * Load the address of the value of the single-element BPF array map 'idp'
+ * (plus 'off') into 'reg'.  This is a BPF_PSEUDO_MAP_VALUE load: the map fd
+ * is filled in by dt_bpf_reloc_prog() while the offset is kept in the
+ * immediate of the second instruction slot.
+ */
+void
+dt_cg_map_value(dt_irlist_t *dlp, dt_ident_t *idp, int reg, uint32_t off)
+{
+	struct bpf_insn instr[2] = {
+		BPF_LDDW(reg, ((uint64_t)off << 32) | idp->di_id)
+	};
+
+	instr[0].src_reg = BPF_PSEUDO_MAP_VALUE;
+	emite(dlp, instr[0], idp);
+	emit(dlp,  instr[1]);
+}
+
 /*
  * Lookup the correct load opcode to use for the specified node and CTF type.
  * We determine the size and convert it to a 3-bit index.  Our lookup table
@@ -2028,10 +2410,13 @@ dt_cg_load_var(dt_node_t *dst, dt_irlist_t *dlp, dt_regset_t *drp)
 
 		/* get pointer to BPF map */
 		emit(dlp, BPF_LOAD(BPF_DW, dst->dn_reg, BPF_REG_FP, DT_STK_DCTX));
-		if (idp->di_flags & DT_IDFLG_LOCAL)
+		if (idp->di_flags & DT_IDFLG_LOCAL) {
 			emit(dlp, BPF_LOAD(BPF_DW, dst->dn_reg, dst->dn_reg, DCTX_LVARS));
-		else
+			yypcb->pcb_difoflags |= DIFOFLG_LVARS;
+		} else {
 			emit(dlp, BPF_LOAD(BPF_DW, dst->dn_reg, dst->dn_reg, DCTX_GVARS));
+			yypcb->pcb_difoflags |= DIFOFLG_GVARS;
+		}
 
 		/* load the variable value or address */
 		if (dst->dn_flags & DT_NF_REF)
@@ -2093,6 +2478,15 @@ dt_cg_load_var(dt_node_t *dst, dt_irlist_t *dlp, dt_regset_t *drp)
 	}
 
 	/* built-in variables */
+	switch (idp->di_id) {
+	case DIF_VAR_PROBEPROV:
+	case DIF_VAR_PROBEMOD:
+	case DIF_VAR_PROBEFUNC:
+	case DIF_VAR_PROBENAME:
+		/* The probe description strings live in the string table. */
+		yypcb->pcb_difoflags |= DIFOFLG_STRTAB;
+	}
+
 	if (dt_regset_xalloc_args(drp) == -1)
 		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
 
@@ -2344,10 +2738,13 @@ dt_cg_store_var(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp,
 
 		/* get pointer to BPF map */
 		emit(dlp, BPF_LOAD(BPF_DW, reg, BPF_REG_FP, DT_STK_DCTX));
-		if (idp->di_flags & DT_IDFLG_LOCAL)
+		if (idp->di_flags & DT_IDFLG_LOCAL) {
 			emit(dlp, BPF_LOAD(BPF_DW, reg, reg, DCTX_LVARS));
-		else
+			yypcb->pcb_difoflags |= DIFOFLG_LVARS;
+		} else {
 			emit(dlp, BPF_LOAD(BPF_DW, reg, reg, DCTX_GVARS));
+			yypcb->pcb_difoflags |= DIFOFLG_GVARS;
+		}
 
 		/* store by value or by reference */
 		if (dnp->dn_flags & DT_NF_REF) {
@@ -2511,7 +2908,8 @@ dt_cg_arglist(dt_ident_t *idp, dt_node_t *args,
 
 #if 0
 		instr = DIF_INSTR_PUSHTS(op, t.dtdt_kind, reg, dnp->dn_reg);
-		dt_irlist_append(dlp, dt_cg_node_alloc(DT_LBL_NONE, instr));
+		dt_irlist_append(dlp,
+				 dt_cg_node_alloc(dlp, DT_LBL_NONE, instr));
 #else
 		emit(dlp, BPF_CALL_FUNC(op));
 #endif
@@ -2764,12 +3162,145 @@ dt_cg_compare_signed(dt_node_t *dnp)
 	return dn.dn_flags & DT_NF_SIGNED;
 }
 
+/*
+ * Generate code for an (in)equality comparison of a string against a string
+ * constant.  The constant is not placed in the string table.  Instead, only
+ * the non-constant string is copied into scratch memory, reading no more than
+ * two bytes beyond the length of the constant.  If the length of the copy is
+ * not the same as that of the constant, the strings differ.  Otherwise, the
+ * copy is compared against the constant (including its terminating NUL byte)
+ * using immediate values, 8 bytes at a time.
+ */
+static void
+dt_cg_compare_strconst(dt_node_t *dnp, dt_node_t *var, const char *str,
+		       dt_irlist_t *dlp, dt_regset_t *drp, uint_t op)
+{
+	uint_t		lbl_false = dt_irlist_label(dlp);
+	uint_t		lbl_post = dt_irlist_label(dlp);
+	size_t		len = strlen(str) + 1;
+	size_t		i, sz;
+	uint64_t	off;
+	int		reg, vreg, creg;
+
+	dt_cg_node(var, dlp, drp);
+	reg = var->dn_reg;
+
+	/* A NULL string never matches a string constant. */
+	emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, reg, 0, lbl_false));
+
+	off = dt_cg_tstring_xalloc(yypcb);
+
+	if (dt_regset_xalloc_args(drp) == -1)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
+	emit(dlp,  BPF_MOV_REG(BPF_REG_3, reg));
+	emit(dlp,  BPF_LOAD(BPF_DW, BPF_REG_1, BPF_REG_FP, DT_STK_DCTX));
+	emit(dlp,  BPF_LOAD(BPF_DW, BPF_REG_1, BPF_REG_1, DCTX_MEM));
+	emit(dlp,  BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, off));
+	emit(dlp,  BPF_MOV_IMM(BPF_REG_2, len + 1));
+	dt_regset_xalloc(drp, BPF_REG_0);
+	emit(dlp,  BPF_CALL_HELPER(BPF_FUNC_probe_read_str));
+	dt_regset_free_args(drp);
+	emit(dlp,  BPF_BRANCH_IMM(BPF_JNE, BPF_REG_0, len, lbl_false));
+	dt_regset_free(drp, BPF_REG_0);
+
+	if ((vreg = dt_regset_alloc(drp)) == -1 ||
+	    (creg = dt_regset_alloc(drp)) == -1)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
+
+	/* The string pointer is no longer needed; use it as base address. */
+	emit(dlp,  BPF_LOAD(BPF_DW, reg, BPF_REG_FP, DT_STK_DCTX));
+	emit(dlp,  BPF_LOAD(BPF_DW, reg, reg, DCTX_MEM));
+	emit(dlp,  BPF_ALU64_IMM(BPF_ADD, reg, off));
+
+	for (i = 0; i < len; i += sz) {
+		uint64_t	val;
+
+		/*
+		 * Compare 8 bytes at a time, and use the largest naturally
+		 * aligned load that fits the remainder.  The loaded value is
+		 * zero-extended, so we construct the constant the same way.
+		 */
+		if (len - i >= 8) {
+			uint64_t	v;
+
+			sz = 8;
+			memcpy(&v, str + i, sz);
+			val = v;
+		} else if (len - i >= 4) {
+			uint32_t	v;
+
+			sz = 4;
+			memcpy(&v, str + i, sz);
+			val = v;
+		} else if (len - i >= 2) {
+			uint16_t	v;
+
+			sz = 2;
+			memcpy(&v, str + i, sz);
+			val = v;
+		} else {
+			sz = 1;
+			val = (uint8_t)str[i];
+		}
+
+		emit(dlp,  BPF_LOAD(ldstw[sz], vreg, reg, i));
+		if (val <= INT32_MAX)
+			emit(dlp,  BPF_BRANCH_IMM(BPF_JNE, vreg, val, lbl_false));
+		else {
+			dt_cg_setx(dlp, creg, val);
+			emit(dlp,  BPF_BRANCH_REG(BPF_JNE, vreg, creg, lbl_false));
+		}
+	}
+
+	dt_regset_free(drp, creg);
+	dt_regset_free(drp, vreg);
+	dt_cg_tstring_xfree(yypcb, off);
+	dt_cg_tstring_free(yypcb, var);
+
+	dnp->dn_reg = reg;
+	emit(dlp,  BPF_MOV_IMM(dnp->dn_reg, op == BPF_JEQ ? 1 : 0));
+	emit(dlp,  BPF_JUMP(lbl_post));
+
+	emitl(dlp, lbl_false,
+		   BPF_MOV_IMM(dnp->dn_reg, op == BPF_JEQ ? 0 : 1));
+
+	emitl(dlp, lbl_post,
+		   BPF_NOP());
+}
+
 static void
 dt_cg_compare_op(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp, uint_t op)
 {
 	uint_t lbl_true = dt_irlist_label(dlp);
 	uint_t lbl_post = dt_irlist_label(dlp);
 
+	/*
+	 * Equality tests of a string against a string constant (e.g. a
+	 * predicate like /execname == "foo"/) are very common, and can be
+	 * done without a call to dt_strcmp().  Constants that do not fit in
+	 * a temporary string are handled by the general case below.
+	 */
+	if ((op == BPF_JEQ || op == BPF_JNE) &&
+	    dt_node_is_string(dnp->dn_left) &&
+	    dt_node_is_string(dnp->dn_right)) {
+		size_t	strsize = yypcb->pcb_hdl->dt_options[DTRACEOPT_STRSIZE];
+		dt_node_t *cnp = NULL, *vnp = NULL;
+
+		if (dnp->dn_right->dn_kind == DT_NODE_STRING) {
+			cnp = dnp->dn_right;
+			vnp = dnp->dn_left;
+		} else if (dnp->dn_left->dn_kind == DT_NODE_STRING) {
+			cnp = dnp->dn_left;
+			vnp = dnp->dn_right;
+		}
+
+		if (cnp != NULL && strlen(cnp->dn_string) < strsize) {
+			dt_cg_compare_strconst(dnp, vnp, cnp->dn_string, dlp,
+					       drp, op);
+			return;
+		}
+	}
+
 	dt_cg_node(dnp->dn_left, dlp, drp);
 	dt_cg_node(dnp->dn_right, dlp, drp);
 
@@ -3050,7 +3581,8 @@ dt_cg_asgn_op(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp)
 		    ctf_type_size(dxp->dx_dst_ctfp, dxp->dx_dst_base));
 
 		instr = DIF_INSTR_ALLOCS(r1, r1);
-		dt_irlist_append(dlp, dt_cg_node_alloc(DT_LBL_NONE, instr));
+		dt_irlist_append(dlp,
+				 dt_cg_node_alloc(dlp, DT_LBL_NONE, instr));
 
 		/*
 		 * When dt_cg_asgn_op() is called, we have already generated
@@ -3226,14 +3758,17 @@ dt_cg_assoc_op(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp)
 
 		dt_cg_setx(dlp, dnp->dn_reg, dt_node_type_size(dnp));
 		instr = DIF_INSTR_ALLOCS(dnp->dn_reg, dnp->dn_reg);
-		dt_irlist_append(dlp, dt_cg_node_alloc(DT_LBL_NONE, instr));
+		dt_irlist_append(dlp,
+				 dt_cg_node_alloc(dlp, DT_LBL_NONE, instr));
 
 		dnp->dn_ident->di_flags |= DT_IDFLG_DIFW;
 		instr = DIF_INSTR_STV(stvop, dnp->dn_ident->di_id, dnp->dn_reg);
-		dt_irlist_append(dlp, dt_cg_node_alloc(DT_LBL_NONE, instr));
+		dt_irlist_append(dlp,
+				 dt_cg_node_alloc(dlp, DT_LBL_NONE, instr));
 
 		instr = DIF_INSTR_LDV(op, dnp->dn_ident->di_id, dnp->dn_reg);
-		dt_irlist_append(dlp, dt_cg_node_alloc(DT_LBL_NONE, instr));
+		dt_irlist_append(dlp,
+				 dt_cg_node_alloc(dlp, DT_LBL_NONE, instr));
 
 		emitl(dlp, label,
 			   BPF_NOP());
@@ -3737,6 +4272,8 @@ dt_cg_subr_strlen(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp)
 	dt_cg_tstring_free(yypcb, str);
 	dt_regset_xalloc(drp, BPF_REG_0);
 	emite(dlp,BPF_CALL_FUNC(idp->di_id), idp);
+	/* dt_strlen() uses scratch space at the end of the string table. */
+	yypcb->pcb_difoflags |= DIFOFLG_STRTAB;
 
 	dt_regset_free_args(drp);
 	dnp->dn_reg = dt_regset_alloc(drp);
@@ -4455,7 +4992,8 @@ dt_cg_node(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp)
 				op = DIF_OP_XLARG;
 
 			instr = DIF_INSTR_XLATE(op, 0, dnp->dn_reg);
-			dt_irlist_append(dlp, dt_cg_node_alloc(DT_LBL_NONE, instr));
+			dt_irlist_append(dlp,
+					 dt_cg_node_alloc(dlp, DT_LBL_NONE, instr));
 
 			dlp->dl_last->di_extern = dnp->dn_xmember;
 #else
@@ -4584,6 +5122,7 @@ dt_cg_node(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp)
 		 */
 		emit(dlp, BPF_LOAD(BPF_DW, dnp->dn_reg, BPF_REG_FP, DT_STK_DCTX));
 		emit(dlp, BPF_LOAD(BPF_DW, dnp->dn_reg, dnp->dn_reg, DCTX_STRTAB));
+		yypcb->pcb_difoflags |= DIFOFLG_STRTAB;
 		emit(dlp, BPF_ALU64_IMM(BPF_ADD, dnp->dn_reg, stroff));
 		break;
 
@@ -4694,37 +5233,31 @@ dt_cg_node(dt_node_t *dnp, dt_irlist_t *dlp, dt_regset_t *drp)
  * Macro to set the storage data (offset and size) for the aggregation
  * identifier (if not set yet).
  *
- * We make room for a latch sequence number of sizeof(uint64_t).
- *
- * If DT_AGG_NUM_COPIES==2, we consume twice the required data size for
- * a dual-copy mechanism to provide lockless, write-wait-free operation.
+ * We make room for a data flag of sizeof(uint64_t) ahead of the data.
  */
 #define DT_CG_AGG_SET_STORAGE(aid, sz) \
 	do { \
 		if ((aid)->di_offset == -1) \
 			dt_ident_set_storage((aid), sizeof(uint64_t), \
-					     sizeof(uint64_t) + \
-					     DT_AGG_NUM_COPIES * (sz)); \
+					     sizeof(uint64_t) + (sz)); \
 	} while (0)
 
-#if DT_AGG_NUM_COPIES == 1
 /*
  * Return a register that holds a pointer to the aggregation data to be
  * updated.
  *
- * We update the latch seqcount (first value in the aggregation) to
- * signal that the aggregation has data.  The location of data for the
- * given aggregation is stored in the register returned from this function.
+ * We set the data flag (first value in the aggregation) to signal that the
+ * aggregation has data.  The aggregation buffer is per-CPU, so a plain store
+ * suffices.  The location of data for the given aggregation is stored in the
+ * register returned from this function.
  */
 static int
-dt_cg_agg_buf_prepare(dt_ident_t *aid, int size, dt_irlist_t *dlp,
-		      dt_regset_t *drp)
+dt_cg_agg_buf_prepare(dt_ident_t *aid, dt_irlist_t *dlp, dt_regset_t *drp)
 {
 	int		rptr;
 
 	TRACE_REGSET("            Prep: Begin");
 
-	dt_regset_xalloc(drp, BPF_REG_0);
 	rptr = dt_regset_alloc(drp);
 	assert(rptr != -1);
 
@@ -4734,99 +5267,32 @@ dt_cg_agg_buf_prepare(dt_ident_t *aid, int size, dt_irlist_t *dlp,
 	 */
 	emit(dlp, BPF_LOAD(BPF_DW, rptr, BPF_REG_FP, DT_STK_DCTX));
 	emit(dlp, BPF_LOAD(BPF_DW, rptr, rptr, DCTX_AGG));
+	yypcb->pcb_difoflags |= DIFOFLG_AGGS;
 
 	/*
-	 *	*((uint64_t *)(ptr + aid->di_offset))++;
-	 *				// mov %r0, 1
-	 *				// xadd [%rptr + aid->di_offset], %r0
+	 *	*((uint64_t *)(ptr + aid->di_offset)) = 1;
+	 *				// stdw [%rptr + aid->di_offset], 1
 	 *      ptr += aid->di_offset + sizeof(uint64_t);
 	 *				// add %rptr, aid->di_offset +
 	 *				//	      sizeof(uint64_t)
 	 */
-	emit(dlp, BPF_MOV_IMM(BPF_REG_0, 1));
-	emit(dlp, BPF_XADD_REG(BPF_DW, rptr, aid->di_offset, BPF_REG_0));
+	emit(dlp, BPF_STORE_IMM(BPF_DW, rptr, aid->di_offset, 1));
 	emit(dlp, BPF_ALU64_IMM(BPF_ADD, rptr, aid->di_offset + sizeof(uint64_t)));
 
-	dt_regset_free(drp, BPF_REG_0);
-
 	TRACE_REGSET("            Prep: End  ");
 
 	return rptr;
 }
-#else
-/*
- * Prepare the aggregation buffer for updating for a specific aggregation, and
- * return a register that holds a pointer to the aggregation data to be
- * updated.
- *
- * We update the latch seqcount (first value in the aggregation) to
- * signal that reads should be directed to the alternate copy of the data.  We
- * then determine the location of data for the given aggregation that can be
- * updated.  This value is stored in the register returned from this function.
- */
-static int
-dt_cg_agg_buf_prepare(dt_ident_t *aid, int size, dt_irlist_t *dlp,
-		      dt_regset_t *drp)
-{
-	int		ragd, roff;
-
-	TRACE_REGSET("            Prep: Begin");
-
-	dt_regset_xalloc(drp, BPF_REG_0);
-	ragd = dt_regset_alloc(drp);
-	roff = dt_regset_alloc(drp);
-	assert(ragd != -1 && roff != -1);
-
-	/*
-	 *	agd = dctx->agg;	// lddw %r0, [%fp + DT_STK_DCTX]
-	 *				// lddw %ragd, [%r0 + DCTX_AGG]
-	 *	agd += aid->di_offset	// %ragd += aid->di_offset
-	 */
-	emit(dlp, BPF_LOAD(BPF_DW, BPF_REG_0, BPF_REG_FP, DT_STK_DCTX));
-	emit(dlp, BPF_LOAD(BPF_DW, ragd, BPF_REG_0, DCTX_AGG));
-	emit(dlp, BPF_ALU64_IMM(BPF_ADD, ragd, aid->di_offset));
-
-	/*
-	 *	off = (*agd & 1) * size	// lddw %roff, [%ragd + 0]
-	 *	      + sizeof(uint64_t);	// and %roff, 1
-	 *				// mul %roff, size
-	 *				// add %roff, sizeof(uint64_t)
-	 *	(*agd)++;		// mov %r0, 1
-	 *				// xadd [%ragd + 0], %r0
-	 *	agd += off;		// add %ragd, %roff
-	 */
-	emit(dlp, BPF_LOAD(BPF_DW, roff, ragd, 0));
-	emit(dlp, BPF_ALU64_IMM(BPF_AND, roff, 1));
-	emit(dlp, BPF_ALU64_IMM(BPF_MUL, roff, size));
-	emit(dlp, BPF_ALU64_IMM(BPF_ADD, roff, sizeof(uint64_t)));
-	emit(dlp, BPF_MOV_IMM(BPF_REG_0, 1));
-	emit(dlp, BPF_XADD_REG(BPF_DW, ragd, 0, BPF_REG_0));
-	emit(dlp, BPF_ALU64_REG(BPF_ADD, ragd, roff));
-
-	dt_regset_free(drp, roff);
-	dt_regset_free(drp, BPF_REG_0);
-
-	TRACE_REGSET("            Prep: End  ");
-
-	return ragd;
-}
-#endif
 
 #define DT_CG_AGG_IMPL(aid, sz, dlp, drp, f, ...) \
 	do {								\
-		int	i, dreg;					\
+		int	dreg;						\
 									\
 		TRACE_REGSET("        Upd: Begin ");			\
 									\
-		for (i = 0; i < DT_AGG_NUM_COPIES; i++) {		\
-			if (i == 1)					\
-				TRACE_REGSET("        Upd: Switch");	\
-									\
-			dreg = dt_cg_agg_buf_prepare((aid), (sz), (dlp), (drp));\
-									\
-			(f)((dlp), (drp), dreg, ## __VA_ARGS__);	\
-			dt_regset_free((drp), dreg);			\
-		}							\
+		dreg = dt_cg_agg_buf_prepare((aid), (dlp), (drp));	\
+		(f)((dlp), (drp), dreg, ## __VA_ARGS__);		\
+		dt_regset_free((drp), dreg);				\
 									\
 		TRACE_REGSET("        Upd: End   ");			\
 	} while (0)
@@ -5015,63 +5481,89 @@ dt_cg_agg_quantize_impl(dt_irlist_t *dlp, dt_regset_t *drp, int dreg, int vreg,
  *
  * The bins are arranged in numerical order, starting with negative overflow,
  * ending with positive overflow, and with underflow exactly in the middle.
+ *
+ * All bin boundaries are known at compile time.  As long as there are not
+ * too many of them, we compute them here and emit a binary search over the
+ * absolute value, so the BPF code only needs about log2(#bins) compares and
+ * no multiply/divide at all.  Otherwise, we fall back to a loop over the
+ * logarithmic ranges.
+ */
+#define DT_LLQUANTIZE_TABLE_MAX	256
+
+/*
+ * Emit a binary search for the interval (lo..hi) that holds %tmp, where
+ * interval i >= 0 is [bnd[i], bnd[i + 1]) and interval -1 is [0, bnd[0]).
+ * The offset of the matching bin from the underflow bin is left in %mag.
+ * The first instruction emitted is labelled with lbl.
  */
 static void
-dt_cg_agg_llquantize_bin(dt_irlist_t *dlp, dt_regset_t *drp, int valreg,
-			 int32_t factor, int32_t lmag, int32_t hmag,
-			 int32_t steps)
+dt_cg_agg_llquantize_search(dt_irlist_t *dlp, int tmpreg, int magreg,
+			    int maxreg, const uint64_t *bnd, const int *off,
+			    int n, int lo, int hi, uint_t lbl, uint_t Ldone)
 {
+	uint_t	Lright;
+	int	mid;
+
+	if (lo == hi) {
+		emitl(dlp, lbl,
+			   BPF_MOV_IMM(magreg, lo < 0 ? 0 : off[lo]));
+		if (lo != n - 1)
+			emit(dlp,  BPF_JUMP(Ldone));
+		return;
+	}
+
 	/*
-	 * We say there are "steps" bins per logarithmic range,
-	 * but steps/factor of them actually overlap with lower ranges.
+	 *     if (%tmp >= bnd[mid]) goto Lright
+	 *     <search lo .. mid - 1>
+	 * Lright:
+	 *     <search mid .. hi>
 	 */
-	int steps_factor = steps / factor;
-
-	/* the underflow bin is in the middle */
-	int underflow_bin = 1 + (hmag - lmag + 1) * (steps - steps_factor);
-
-	/* initial bucket_max */
-	uint64_t bucket_max0 = powl(factor, lmag);
+	mid = (lo + hi + 1) / 2;
+	Lright = dt_irlist_label(dlp);
+	if (bnd[mid] <= INT32_MAX)
+		emitl(dlp, lbl,
+			   BPF_BRANCH_IMM(BPF_JGE, tmpreg, bnd[mid], Lright));
+	else {
+		dt_cg_xsetx(dlp, NULL, lbl, maxreg, bnd[mid]);
+		emit(dlp,  BPF_BRANCH_REG(BPF_JGE, tmpreg, maxreg, Lright));
+	}
 
-	/* registers */
-	int indreg, magreg, tmpreg, maxreg;
+	dt_cg_agg_llquantize_search(dlp, tmpreg, magreg, maxreg, bnd, off, n,
+				    lo, mid - 1, DT_LBL_NONE, Ldone);
+	dt_cg_agg_llquantize_search(dlp, tmpreg, magreg, maxreg, bnd, off, n,
+				    mid, hi, Lright, Ldone);
+}
 
-	/* labels */
-	uint_t		L1 = dt_irlist_label(dlp);
+/*
+ * Emit a loop over the logarithmic ranges to find the bin for %tmp, for
+ * when there are too many bins for a binary search.  The offset of the bin
+ * from the underflow bin is left in %mag.
+ */
+static void
+dt_cg_agg_llquantize_loop(dt_irlist_t *dlp, dt_regset_t *drp, int tmpreg,
+			  int magreg, int maxreg, int32_t factor, int32_t lmag,
+			  int32_t hmag, int32_t steps)
+{
+	int		steps_factor = steps / factor;
+	uint64_t	bucket_max0 = powl(factor, lmag);
+	int		indreg;
 	uint_t		L2 = dt_irlist_label(dlp);
 	uint_t		L3 = dt_irlist_label(dlp);
-	uint_t		L4 = dt_irlist_label(dlp);
 	uint_t		Lloop = dt_irlist_label(dlp);
 	uint_t		Lbin = dt_irlist_label(dlp);
 	uint_t		Lshift = dt_irlist_label(dlp);
 	uint_t		Lend = dt_irlist_label(dlp);
 
-	TRACE_REGSET("            Bin: Begin");
-
-	if ((indreg = dt_regset_alloc(drp)) == -1 ||
-	    (magreg = dt_regset_alloc(drp)) == -1 ||
-	    (tmpreg = dt_regset_alloc(drp)) == -1 ||
-	    (maxreg = dt_regset_alloc(drp)) == -1)
+	if ((indreg = dt_regset_alloc(drp)) == -1)
 		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
 
-	/*
-	 * %tmp = %val
-	 * if (%val >= 0) goto L1
-	 * %tmp *= -1
-	 */
-	emit(dlp,  BPF_MOV_REG(tmpreg, valreg));
-	emit(dlp,  BPF_BRANCH_IMM(BPF_JSGE, valreg, 0, L1));
-	emit(dlp,  BPF_ALU64_IMM(BPF_MUL, tmpreg, -1));
-
 	/*
 	 * check for "underflow" (smaller than the smallest bin)
-	 * L1:
-	 *     %mag = underflow_bin
+	 *     %mag = 0
 	 *     %max = bucket_max0
 	 *     if (%tmp < %max) goto Lend
 	 */
-	emitl(dlp, L1,
-		   BPF_MOV_IMM(magreg, underflow_bin));
+	emit(dlp,  BPF_MOV_IMM(magreg, 0));
 	dt_cg_xsetx(dlp, NULL, DT_LBL_NONE, maxreg, bucket_max0);
 	emit(dlp,  BPF_BRANCH_REG(BPF_JLT, tmpreg, maxreg, Lend));
 
@@ -5119,30 +5611,119 @@ dt_cg_agg_llquantize_bin(dt_irlist_t *dlp, dt_regset_t *drp, int valreg,
 	emit(dlp,  BPF_ALU64_IMM(BPF_SUB, indreg, steps_factor));
 
 	/*
-	 * shift to center around underflow_bin
+	 * offset from underflow_bin
 	 * Lshift:
 	 *     %mag = (%mag - lmag) * (steps - steps_factor) + %ind + 1
-	 *     if (%v < 0) %mag *= -1
-	 *     %mag += underflow_bin
+	 * Lend:
 	 */
 	emitl(dlp, Lshift,
 		   BPF_ALU64_IMM(BPF_SUB, magreg, lmag));
 	emit(dlp,  BPF_ALU64_IMM(BPF_MUL, magreg, steps - steps_factor));
 	emit(dlp,  BPF_ALU64_REG(BPF_ADD, magreg, indreg));
 	emit(dlp,  BPF_ALU64_IMM(BPF_ADD, magreg, 1));
-	emit(dlp,  BPF_BRANCH_IMM(BPF_JSGE, valreg, 0, L4));
-	emit(dlp,  BPF_ALU64_IMM(BPF_MUL, magreg, -1));
-	emitl(dlp, L4,
-		   BPF_ALU64_IMM(BPF_ADD, magreg, underflow_bin));
+	emitl(dlp, Lend,
+		   BPF_NOP());
 
+	dt_regset_free(drp, indreg);
+}
+
+static void
+dt_cg_agg_llquantize_bin(dt_irlist_t *dlp, dt_regset_t *drp, int valreg,
+			 int32_t factor, int32_t lmag, int32_t hmag,
+			 int32_t steps)
+{
 	/*
-	 * Lend:
+	 * We say there are "steps" bins per logarithmic range,
+	 * but steps/factor of them actually overlap with lower ranges.
+	 */
+	int steps_factor = steps / factor;
+
+	/* the underflow bin is in the middle */
+	int underflow_bin = 1 + (hmag - lmag + 1) * (steps - steps_factor);
+
+	/* registers */
+	int magreg, tmpreg, maxreg;
+
+	/* labels */
+	uint_t		L1 = dt_irlist_label(dlp);
+	uint_t		L4 = dt_irlist_label(dlp);
+	uint_t		Lsign = dt_irlist_label(dlp);
+
+	TRACE_REGSET("            Bin: Begin");
+
+	if ((magreg = dt_regset_alloc(drp)) == -1 ||
+	    (tmpreg = dt_regset_alloc(drp)) == -1 ||
+	    (maxreg = dt_regset_alloc(drp)) == -1)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
+
+	/*
+	 * %tmp = %val
+	 * if (%val >= 0) goto L1
+	 * %tmp *= -1
+	 * L1:
+	 */
+	emit(dlp,  BPF_MOV_REG(tmpreg, valreg));
+	emit(dlp,  BPF_BRANCH_IMM(BPF_JSGE, valreg, 0, L1));
+	emit(dlp,  BPF_ALU64_IMM(BPF_MUL, tmpreg, -1));
+	emitl(dlp, L1,
+		   BPF_NOP());
+
+	if (underflow_bin <= DT_LLQUANTIZE_TABLE_MAX) {
+		uint64_t	bnd[DT_LLQUANTIZE_TABLE_MAX];
+		int		off[DT_LLQUANTIZE_TABLE_MAX];
+		uint64_t	min, max;
+		int		mag, k, n = 0, o = 1;
+
+		/*
+		 * Compute the lowest value for each bin in the logarithmic
+		 * ranges, followed by the lowest value for positive overflow.
+		 * Bins that cannot hold any integer value share their lower
+		 * bound with the next bin, and are dropped.
+		 */
+		min = powl(factor, lmag);
+		for (mag = lmag; mag <= hmag; mag++, min = max) {
+			max = min * factor;
+			for (k = steps_factor; k < steps; k++, o++) {
+				uint64_t	b;
+
+				if (mag == 0)
+					b = ((uint64_t)k * max + steps - 1) /
+					    steps;
+				else
+					b = k * (max / steps);
+				if (b < min)
+					b = min;
+
+				if (n > 0 && bnd[n - 1] == b)
+					n--;
+				bnd[n] = b;
+				off[n++] = o;
+			}
+		}
+		bnd[n] = min;
+		off[n++] = o;
+
+		dt_cg_agg_llquantize_search(dlp, tmpreg, magreg, maxreg,
+					    bnd, off, n, -1, n - 1,
+					    DT_LBL_NONE, Lsign);
+	} else
+		dt_cg_agg_llquantize_loop(dlp, drp, tmpreg, magreg, maxreg,
+					  factor, lmag, hmag, steps);
+
+	/*
+	 * shift to center around underflow_bin
+	 * Lsign:
+	 *     if (%v < 0) %mag *= -1
+	 *     %mag += underflow_bin
 	 *     %val = %mag
 	 */
-	emitl(dlp, Lend,
-		   BPF_MOV_REG(valreg, magreg));
+	emitl(dlp, Lsign,
+		   BPF_BRANCH_IMM(BPF_JSGE, valreg, 0, L4));
+	emit(dlp,  BPF_ALU64_IMM(BPF_MUL, magreg, -1));
+	emitl(dlp, L4,
+		   BPF_ALU64_IMM(BPF_ADD, magreg, underflow_bin));
+	emit(dlp,  BPF_MOV_REG(valreg, magreg));
 
-	dt_regset_free(drp, indreg);
 	dt_regset_free(drp, magreg);
 	dt_regset_free(drp, tmpreg);
 	dt_regset_free(drp, maxreg);
@@ -5599,11 +6180,103 @@ dt_cg_agg_min(dt_pcb_t *pcb, dt_ident_t *aid, dt_node_t *dnp,
 	TRACE_REGSET("    AggMin: End  ");
 }
 
+/*
+ * Quantize the value held in valreg to a 0-based power-of-two bin number.
+ * The zero bucket is in the middle, with positive values v in bucket
+ * 63 + 1 + floor(log2(v)) and negative values mirrored below it.  INT64_MIN
+ * has no positive counterpart and ends up in bucket 0.
+ *
+ * This is emitted inline rather than calling a BPF function, since it is
+ * only a handful of instructions and typically sits in a hot path (e.g. for
+ * latency distributions).
+ */
+static void
+dt_cg_agg_quantize_bin(dt_irlist_t *dlp, dt_regset_t *drp, int valreg)
+{
+	int		offreg, tmpreg, nxtreg, shift;
+	uint_t		lbl;
+	uint_t		L1 = dt_irlist_label(dlp);
+	uint_t		L2 = dt_irlist_label(dlp);
+	uint_t		Lend = dt_irlist_label(dlp);
+
+	TRACE_REGSET("            Bin: Begin");
+
+	if ((offreg = dt_regset_alloc(drp)) == -1 ||
+	    (tmpreg = dt_regset_alloc(drp)) == -1 ||
+	    (nxtreg = dt_regset_alloc(drp)) == -1)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
+
+	/*
+	 *     %off = DTRACE_QUANTIZE_ZEROBUCKET
+	 *     if (%val == 0) goto Lend
+	 *     %tmp = %val
+	 *     if (%val >= 0) goto L1
+	 *     %tmp = -%tmp
+	 *     %off = 0
+	 *     if (%tmp < 0) goto Lend          only for INT64_MIN
+	 */
+	emit(dlp,  BPF_MOV_IMM(offreg, DTRACE_QUANTIZE_ZEROBUCKET));
+	emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, valreg, 0, Lend));
+	emit(dlp,  BPF_MOV_REG(tmpreg, valreg));
+	emit(dlp,  BPF_BRANCH_IMM(BPF_JSGE, valreg, 0, L1));
+	emit(dlp,  BPF_NEG_REG(tmpreg));
+	emit(dlp,  BPF_MOV_IMM(offreg, 0));
+	emit(dlp,  BPF_BRANCH_IMM(BPF_JSLT, tmpreg, 0, Lend));
+
+	/*
+	 * %off = 1 + floor(log2(%tmp)), by binary search on the bit position
+	 * L1:
+	 *     %off = 1
+	 *     for (shift = 32; shift > 0; shift /= 2) {
+	 *         %nxt = %tmp >> shift
+	 *         if (%nxt == 0) goto Lnext
+	 *         %off += shift
+	 *         %tmp = %nxt
+	 *     Lnext:
+	 *     }
+	 */
+	emitl(dlp, L1,
+		   BPF_MOV_IMM(offreg, 1));
+	for (lbl = DT_LBL_NONE, shift = 32; shift > 0; shift /= 2) {
+		uint_t	Lnext = dt_irlist_label(dlp);
+
+		emitl(dlp, lbl,
+			   BPF_MOV_REG(nxtreg, tmpreg));
+		emit(dlp,  BPF_ALU64_IMM(BPF_RSH, nxtreg, shift));
+		emit(dlp,  BPF_BRANCH_IMM(BPF_JEQ, nxtreg, 0, Lnext));
+		emit(dlp,  BPF_ALU64_IMM(BPF_ADD, offreg, shift));
+		emit(dlp,  BPF_MOV_REG(tmpreg, nxtreg));
+		lbl = Lnext;
+	}
+
+	/*
+	 * shift to center around the zero bucket
+	 *     if (%val >= 0) goto L2
+	 *     %off = -%off
+	 * L2:
+	 *     %off += DTRACE_QUANTIZE_ZEROBUCKET
+	 * Lend:
+	 *     %val = %off
+	 */
+	emitl(dlp, lbl,
+		   BPF_BRANCH_IMM(BPF_JSGE, valreg, 0, L2));
+	emit(dlp,  BPF_NEG_REG(offreg));
+	emitl(dlp, L2,
+		   BPF_ALU64_IMM(BPF_ADD, offreg, DTRACE_QUANTIZE_ZEROBUCKET));
+	emitl(dlp, Lend,
+		   BPF_MOV_REG(valreg, offreg));
+
+	dt_regset_free(drp, offreg);
+	dt_regset_free(drp, tmpreg);
+	dt_regset_free(drp, nxtreg);
+
+	TRACE_REGSET("            Bin: End  ");
+}
+
 static void
 dt_cg_agg_quantize(dt_pcb_t *pcb, dt_ident_t *aid, dt_node_t *dnp,
 		   dt_irlist_t *dlp, dt_regset_t *drp)
 {
-	dt_ident_t	*idp;
 	dt_node_t	*incr;
 	int		ireg, sz = DTRACE_QUANTIZE_NBUCKETS * sizeof(uint64_t);
 
@@ -5624,17 +6297,7 @@ dt_cg_agg_quantize(dt_pcb_t *pcb, dt_ident_t *aid, dt_node_t *dnp,
 
 	dt_cg_node(dnp->dn_aggfun->dn_args, dlp, drp);
 
-	/* quantize the value to a 0-based bin # using dt_agg_qbin() */
-	if (dt_regset_xalloc_args(drp) == -1)
-		longjmp(yypcb->pcb_jmpbuf, EDT_NOREG);
-	emit(dlp,  BPF_MOV_REG(BPF_REG_1, dnp->dn_aggfun->dn_args->dn_reg));
-	idp = dt_dlib_get_func(yypcb->pcb_hdl, "dt_agg_qbin");
-	assert(idp != NULL);
-	dt_regset_xalloc(drp, BPF_REG_0);
-	emite(dlp, BPF_CALL_FUNC(idp->di_id), idp);
-	dt_regset_free_args(drp);
-	emit(dlp,  BPF_MOV_REG(dnp->dn_aggfun->dn_args->dn_reg, BPF_REG_0));
-	dt_regset_free(drp, BPF_REG_0);
+	dt_cg_agg_quantize_bin(dlp, drp, dnp->dn_aggfun->dn_args->dn_reg);
 
 	if (incr == NULL) {
 		if ((ireg = dt_regset_alloc(drp)) == -1)
@@ -5895,11 +6558,11 @@ dt_cg(dt_pcb_t *pcb, dt_node_t *dnp)
 	dt_regset_reset(pcb->pcb_regs);
 	dt_cg_tstring_reset(pcb->pcb_hdl);
 
-	dt_irlist_destroy(&pcb->pcb_ir);
-	dt_irlist_create(&pcb->pcb_ir);
+	dt_irlist_reset(&pcb->pcb_ir);
 	pcb->pcb_exitlbl = dt_irlist_label(&pcb->pcb_ir);
 
 	pcb->pcb_bufoff = 0;
+	pcb->pcb_difoflags = 0;
 
 	if (dt_node_is_dynamic(dnp))
 		dnerror(dnp, D_CG_DYN, "expression cannot evaluate to result "
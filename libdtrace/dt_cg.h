@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2020, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2020, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -19,7 +19,10 @@ extern "C" {
 
 extern void dt_cg(dt_pcb_t *, dt_node_t *);
 extern void dt_cg_xsetx(dt_irlist_t *, dt_ident_t *, uint_t, int, uint64_t);
-extern dt_irnode_t *dt_cg_node_alloc(uint_t, struct bpf_insn);
+extern void dt_cg_map_value(dt_irlist_t *, dt_ident_t *, int, uint32_t);
+extern dt_irnode_t *dt_cg_node_alloc(dt_irlist_t *, uint_t, struct bpf_insn);
+extern void dt_cg_pfilter(dtrace_hdl_t *, const dt_ident_t *,
+			  const dt_node_t *);
 extern void dt_cg_tramp_prologue_act(dt_pcb_t *pcb, dt_activity_t act);
 extern void dt_cg_tramp_prologue(dt_pcb_t *pcb);
 extern void dt_cg_tramp_clear_regs(dt_pcb_t *pcb);
@@ -364,55 +364,6 @@ dt_stddev(uint64_t *data, uint64_t normal)
 	return dt_sqrt_128(diff);
 }
 
-static uint32_t
-dt_spec_buf_hval(const dt_spec_buf_t *head)
-{
-	uint32_t g = 0, hval = 0;
-	uint32_t *p = (uint32_t *) &head->dtsb_id;
-
-	while ((uintptr_t) p < (((uintptr_t) &head->dtsb_id) +
-				sizeof(head->dtsb_id))) {
-		hval = (hval << 4) + *p++;
-		g = hval & 0xf0000000;
-		if (g != 0) {
-			hval ^= (g >> 24);
-			hval ^= g;
-		}
-	}
-
-	return hval;
-}
-
-static int
-dt_spec_buf_cmp(const dt_spec_buf_t *p,
-		const dt_spec_buf_t *q)
-{
-	if (p->dtsb_id == q->dtsb_id)
-		return 0;
-	return 1;
-}
-
-DEFINE_HE_STD_LINK_FUNCS(dt_spec_buf, dt_spec_buf_t, dtsb_he);
-
-static void
-dt_spec_buf_destroy(dtrace_hdl_t *dtp, dt_spec_buf_t *dtsb);
-
-static void *
-dt_spec_buf_del_buf(dt_spec_buf_t *head, dt_spec_buf_t *ent)
-{
-	head = dt_spec_buf_del(head, ent);
-	dt_spec_buf_destroy(ent->dtsb_dtp, ent);
-	return head;
-}
-
-static dt_htab_ops_t dt_spec_buf_htab_ops = {
-	.hval = (htab_hval_fn)dt_spec_buf_hval,
-	.cmp = (htab_cmp_fn)dt_spec_buf_cmp,
-	.add = (htab_add_fn)dt_spec_buf_add,
-	.del = (htab_del_fn)dt_spec_buf_del_buf,
-	.next = (htab_next_fn)dt_spec_buf_next
-};
-
 static int
 dt_flowindent(dtrace_hdl_t *dtp, dtrace_probedata_t *data, dtrace_epid_t last,
 	      dtrace_epid_t next)
@@ -1056,8 +1007,8 @@ dt_print_tracemem(dtrace_hdl_t *dtp, FILE *fp, const dtrace_recdesc_t *rec,
 }
 #endif
 
-int
-dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
+static int
+dt_print_stack_impl(dtrace_hdl_t *dtp, FILE *fp, const char *format,
     caddr_t addr, int depth, int size)
 {
 	dtrace_syminfo_t dts;
@@ -1134,7 +1085,20 @@ dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 }
 
 int
-dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
+dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
+    caddr_t addr, int depth, int size)
+{
+	hrtime_t	start = dt_phase_start();
+	int		rval;
+
+	rval = dt_print_stack_impl(dtp, fp, format, addr, depth, size);
+	dt_phase_end(dtp, DTRACE_PHASE_SYMBOL, start);
+
+	return rval;
+}
+
+static int
+dt_print_ustack_impl(dtrace_hdl_t *dtp, FILE *fp, const char *format,
     caddr_t addr, uint64_t arg)
 {
 	/* LINTED - alignment */
@@ -1280,6 +1244,19 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	return err;
 }
 
+int
+dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
+    caddr_t addr, uint64_t arg)
+{
+	hrtime_t	start = dt_phase_start();
+	int		rval;
+
+	rval = dt_print_ustack_impl(dtp, fp, format, addr, arg);
+	dt_phase_end(dtp, DTRACE_PHASE_SYMBOL, start);
+
+	return rval;
+}
+
 static int
 dt_print_usym(dtrace_hdl_t *dtp, FILE *fp, caddr_t addr, dtrace_actkind_t act)
 {
@@ -1856,10 +1833,24 @@ dt_printa(dtrace_hdl_t *dtp, FILE *fp, void *fmtdata,
 	pd.dtpa_allunprint = 0;
 
 	if (naggvars == 1) {
+		int	rval;
+
 		pd.dtpa_id = aggvars[0];
 
-		if (dt_printf(dtp, fp, "\n") < 0 ||
-		    dtrace_aggregate_walk_sorted(dtp, dt_print_agg, &pd) < 0)
+		if (dt_printf(dtp, fp, "\n") < 0)
+			return -1;		/* errno is set for us */
+
+		/*
+		 * With the "aggdelta" option, only print the entries that
+		 * changed since this aggregation was last printed.
+		 */
+		if (dtp->dt_options[DTRACEOPT_AGGDELTA] != DTRACEOPT_UNSET)
+			rval = dtrace_aggregate_walk_delta(dtp, pd.dtpa_id,
+							   dt_print_agg, &pd);
+		else
+			rval = dtrace_aggregate_walk_sorted(dtp, dt_print_agg,
+							    &pd);
+		if (rval < 0)
 			return -1;		/* errno is set for us */
 	} else {
 		pd.dtpa_id = 0;
@@ -1984,144 +1975,38 @@ dt_print_trace(dtrace_hdl_t *dtp, FILE *fp, dtrace_recdesc_t *rec,
 }
 
 /*
- * The lifecycle of speculation buffers is as follows:
+ * The lifecycle of speculations is as follows:
  *
  *  - They are created upon speculation() as entries in the specs map mapping
- *    from the speculation ID to a dt_bpf_specs_t entry with read, written,
- *    and draining values all zero.
+ *    from the speculation ID to a dt_bpf_specs_t entry with a unique
+ *    generation number, and with drops and draining both zero.
  *
  *  - speculate() verifies the existence of the requested speculation entry in
- *    the specs map, and that draining has not been set in it, and atomically
- *    bumps the written value.
- *
- *  - Speculations drain from the perf ring buffer into possibly many
- *    dt_spec_buf_data instances, one dt_spec_buf_data per ring-buffer of data
- *    fetched from the kernel with a nonzero specid (one speculated clause);
- *    these are chained into dt_spec_bufs, one per speculation ID, and these are
- *    put into dtp->dt_spec_bufs instead of being consumed.
+ *    the specs map, and that draining has not been set in it.
  *
- *  - commit / discard set the specs map entry's drained value to 1, which
- *    indicates that it is drainable by userspace and prevents further
- *    speculate()s, and  record a single entry in the output buffer with the
- *    committed/discarded ID attached
+ *  - The output buffer of each speculated clause is appended to the
+ *    speculation buffer for the speculation on the current CPU (in the
+ *    specbufs map) rather than being written to the perf ring buffer.  A
+ *    buffer that holds data for an older speculation with the same ID (a
+ *    different generation) is reset first.  Records that do not fit in the
+ *    speculation buffer are dropped, and counted in the drops value.
  *
- *  - Non-speculated probe buffers (with a zero specid) are scanned by
- *    dt_consume_one_probe for commit / discard; the first found for a given
- *    live speculation triggers draining, chaining the spec buf into
- *    dtp->dt_spec_bufs_draining.  dt_spec_bufs_draining contains a counter of
- *    the number of data buffers drained ("read", mirroring "written" in the
- *    specs map).
+ *  - commit / discard set the specs map entry's draining value to 1, which
+ *    prevents further speculate()s and appends to the speculation buffers,
+ *    and record a single entry in the output buffer with the
+ *    committed/discarded ID attached.
  *
- *  - dt_spec_bufs_draining is traversed on every buffer consume and any
- *    speculations that are committing have their speculation buffers processed
- *    as if they had just been received (but keeping their original CPU number);
- *    both entries that are committing and those that are discarding are then
- *    removed, leaving the buffer head behind to be filled out by future
- *    ring-buffer fetches, and the number removed recorded by incrementing
- *    dtsb_draining_t.dtsd_read.  Buffers for which read >= written are removed
- *    from dt_spec_bufs_draining and from dt_spec_bufs and have their ID removed
- *    from the specs map, freeing them for recycling by future calls to
+ *  - Non-speculated probe buffers are scanned by dt_consume_one_probe for
+ *    commit / discard.  For a commit, the speculation buffers for all CPUs
+ *    are copied out of the kernel, and the records in the buffers that belong
+ *    to the current generation of the speculation are processed as if they
+ *    had just been received (but keeping their original CPU number).  For a
+ *    discard, the speculation buffers are not read at all.  In both cases,
+ *    the drops are accounted for as speculative drops, and the ID is removed
+ *    from the specs map, freeing it for recycling by future calls to
  *    speculation().
  */
 
-/*
- * Member of the dtsb_draining_list.
- */
-typedef struct dtsb_draining {
-	dt_list_t dtsd_list;
-	dt_spec_buf_t *dtsd_dtsb;
-	uint64_t dtsd_read;
-} dtsb_draining_t;
-
-static dt_spec_buf_t *
-dt_spec_buf_create(dtrace_hdl_t *dtp, int32_t spec)
-{
-	dt_spec_buf_t *dtsb;
-
-	dtsb = dt_zalloc(dtp, sizeof(struct dt_spec_buf));
-	if (!dtsb)
-		goto oom;
-	dtsb->dtsb_id = spec;
-
-	/* Needed for the htab destructor */
-	dtsb->dtsb_dtp = dtp;
-
-	if (dt_htab_insert(dtp->dt_spec_bufs, dtsb) < 0)
-		goto oom;
-	return dtsb;
-oom:
-	dt_free(dtp, dtsb);
-	dt_set_errno(dtp, EDT_NOMEM);
-	return NULL;
-}
-
-static dt_spec_buf_data_t *
-dt_spec_buf_add_data(dtrace_hdl_t *dtp, dt_spec_buf_t *dtsb,
-		     dtrace_epid_t epid, unsigned int cpu,
-		     dtrace_datadesc_t *datadesc, char *data,
-		     uint32_t size)
-{
-	dt_spec_buf_data_t *dsbd;
-
-	dsbd = dt_zalloc(dtp, sizeof(struct dt_spec_buf_data));
-	if (!dsbd)
-		goto oom;
-
-	dsbd->dsbd_cpu = cpu;
-	dsbd->dsbd_size = size;
-	dsbd->dsbd_data = dt_alloc(dtp, size);
-	if (!dsbd->dsbd_data)
-		goto oom;
-
-	dtsb->dtsb_size += size;
-	memcpy(dsbd->dsbd_data, data, size);
-
-	dt_list_append(&dtsb->dtsb_dsbd_list, dsbd);
-	return dsbd;
-
-oom:
-	dt_free(dtp, dsbd);
-	dt_set_errno(dtp, EDT_NOMEM);
-	return NULL;
-}
-
-/*
- * Remove a speculation buffer's data.  The buffer is left alone.
- */
-static void
-dt_spec_buf_data_destroy(dtrace_hdl_t *dtp, dt_spec_buf_t *dtsb)
-{
-	dt_spec_buf_data_t	*dsbd;
-
-	while ((dsbd = dt_list_next(&dtsb->dtsb_dsbd_list)) != NULL) {
-
-		dt_list_delete(&dtsb->dtsb_dsbd_list, dsbd);
-		dt_free(dtp, dsbd->dsbd_data);
-		dt_free(dtp, dsbd);
-	}
-
-	dtsb->dtsb_size = 0;
-}
-
-/*
- * Remove a speculation's buffers, the speculation itself, and the record of it
- * in the BPF specs map (which frees the ID for reuse).
- *
- * Note: if the speculation is being committed, it will also be interned on the
- * dtp->dt_spec_bufs_draining list.  Such entries must be removed first.
- */
-static void
-dt_spec_buf_destroy(dtrace_hdl_t *dtp, dt_spec_buf_t *dtsb)
-{
-	dt_ident_t *idp = dt_dlib_get_map(dtp, "specs");
-
-	dt_spec_buf_data_destroy(dtp, dtsb);
-
-	if (idp)
-		dt_bpf_map_delete(idp->di_id, &dtsb->dtsb_id);
-	dt_free(dtp, dtsb);
-}
-
 /*
  * Peeking flags (values for the peekflag parameter for functions that have
  * one).
@@ -2129,10 +2014,8 @@ dt_spec_buf_destroy(dtrace_hdl_t *dtp, dt_spec_buf_t *dtsb)
  * These let you process a single buffer more than once.  The first call
  * should pass CONSUME_PEEK_START: this suppresses deletion of consumed records.
  * Subsequent calls should pass CONSUME_PEEK; this does as CONSUME_PEEK_START
- * does, but also suppresses hiving off of speculative buffers (because they
- * have already been hived off under CONSUME_PEEK_START).  The final call should
- * pass CONSUME_PEEK_FINISH; this does a normal buffer consumption (with
- * deletion) except that speculative hiving-off is again suppressd.
+ * does.  The final call should pass CONSUME_PEEK_FINISH; this does a normal
+ * buffer consumption (with deletion).
  *
  * These are not bit-flags: pass only one.
  */
@@ -2148,32 +2031,89 @@ dt_consume_one_probe(dtrace_hdl_t *dtp, FILE *fp, char *data, uint32_t size,
 		     void *arg);
 
 /*
- * Commit one speculation.
+ * Commit or discard one speculation.
  */
 static dtrace_workstatus_t
-dt_commit_one_spec(dtrace_hdl_t *dtp, FILE *fp, dt_spec_buf_t *dtsb,
-		   dtrace_probedata_t *pdat, dtrace_consume_probe_f *efunc,
-		   dtrace_consume_rec_f *rfunc, int flow, int quiet,
-		   int peekflags, dtrace_epid_t *last, void *arg)
+dt_spec_drain(dtrace_hdl_t *dtp, FILE *fp, uint32_t id, int commit,
+	      dtrace_probedata_t *pdat, dtrace_consume_probe_f *efunc,
+	      dtrace_consume_rec_f *rfunc, int flow, int quiet,
+	      int peekflags, dtrace_epid_t *last, void *arg)
 {
-	dt_spec_buf_data_t 	*dsbd;
+	dt_ident_t		*idp = dt_dlib_get_map(dtp, "specs");
+	dt_ident_t		*bidp = dt_dlib_get_map(dtp, "specbufs");
+	int			ncpus = dtp->dt_conf.max_cpuid + 1;
+	dt_bpf_specs_t		spec;
+	dt_bpf_specbuf_t	*sb;
+	size_t			sbsz;
+	int			cpu;
+	int			consume;
+	dtrace_workstatus_t	ret = DTRACE_WORKSTATUS_OKAY;
+
+	/*
+	 * Out-of-range IDs and speculations that were already committed or
+	 * discarded have no entry in the specs map.
+	 */
+	if (dt_bpf_map_lookup(idp->di_id, &id, &spec) != 0)
+		return DTRACE_WORKSTATUS_OKAY;
 
-	for (dsbd = dt_list_next(&dtsb->dtsb_dsbd_list);
-	     dsbd != NULL; dsbd = dt_list_next(dsbd)) {
-		dtrace_workstatus_t ret;
-		dtrace_probedata_t specpdat;
+	assert(spec.draining);
+
+	/*
+	 * When peeking, a later pass sees this commit again, and each pass
+	 * filters out different records.  The buffers are therefore drained
+	 * on every pass, but the ID is only freed (and its drops counted) when
+	 * the record is actually consumed.
+	 */
+	consume = peekflags != CONSUME_PEEK_START && peekflags != CONSUME_PEEK;
+	if (consume)
+		dtp->dt_status[dtp->dt_statusgen].dtst_specdrops += spec.drops;
+
+	if (!commit || !dtp->dt_usespecbufs)
+		goto out;
+
+	/* See dt_bpf_gmap_create() for the size of the specbufs map values. */
+	sbsz = sizeof(dt_bpf_specbuf_t) + dtp->dt_specbufsz +
+	       sizeof(uint64_t) + roundup(dtp->dt_maxreclen, 8);
+	sb = dt_alloc(dtp, sbsz);
+	if (sb == NULL) {
+		ret = dt_set_errno(dtp, EDT_NOMEM);
+		goto out;
+	}
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		dtrace_probedata_t	specpdat;
+		uint32_t		key = (id - 1) * ncpus + cpu;
+		uint64_t		off;
+
+		if (dt_bpf_map_lookup(bidp->di_id, &key, sb) != 0 ||
+		    sb->gen != spec.gen)
+			continue;
 
 		memcpy(&specpdat, pdat, sizeof(dtrace_probedata_t));
-		specpdat.dtpda_cpu = dsbd->dsbd_cpu;
-		ret = dt_consume_one_probe(dtp, fp, dsbd->dsbd_data,
-					   dsbd->dsbd_size, &specpdat,
-					   efunc, rfunc, flow, quiet,
-					   peekflags, last, 1, arg);
-		if (ret != DTRACE_WORKSTATUS_OKAY)
-			return ret;
+		specpdat.dtpda_cpu = cpu;
+
+		for (off = 0; off < sb->size && off < dtp->dt_specbufsz; ) {
+			uint64_t	size = *(uint64_t *)&sb->data[off];
+
+			off += sizeof(uint64_t);
+			ret = dt_consume_one_probe(dtp, fp, &sb->data[off],
+						   size, &specpdat, efunc,
+						   rfunc, flow, quiet,
+						   peekflags, last, 1, arg);
+			if (ret != DTRACE_WORKSTATUS_OKAY)
+				goto free;
+
+			off += roundup(size, 8);
+		}
 	}
 
-	return DTRACE_WORKSTATUS_OKAY;
+free:
+	dt_free(dtp, sb);
+out:
+	if (consume)
+		dt_bpf_map_delete(idp->di_id, &id);
+
+	return ret;
 }
 
 static dtrace_workstatus_t
@@ -2184,8 +2124,6 @@ dt_consume_one_probe(dtrace_hdl_t *dtp, FILE *fp, char *data, uint32_t size,
 		     void *arg)
 {
 	dtrace_epid_t		epid;
-	dt_spec_buf_t		tmpl;
-	dt_spec_buf_t		*dtsb;
 	int			specid;
 	int			i;
 	int			rval;
@@ -2217,52 +2155,6 @@ dt_consume_one_probe(dtrace_hdl_t *dtp, FILE *fp, char *data, uint32_t size,
 			return DTRACE_WORKSTATUS_ERROR;
 	}
 
-	/*
-	 * If speculating (and not peeking), hive this buffer off into a
-	 * suitable spec buf, creating the spec buf head if need be.  No need to
-	 * do anything else with this buffer until a commit or discard is seen
-	 * for it (in some other, non-speculated buffer).
-	 */
-
-	if (!committing && specid != 0) {
-		size_t cursz = 0;
-
-		/*
-		 * If peeking, we dealt with this buffer earlier: don't
-		 * re-speculate it again.
-		 */
-		if (peekflags == CONSUME_PEEK ||
-		    peekflags == CONSUME_PEEK_FINISH)
-			return DTRACE_WORKSTATUS_OKAY;
-
-		tmpl.dtsb_id = specid;
-		dtsb = dt_htab_lookup(dtp->dt_spec_bufs, &tmpl);
-
-		/*
-		 * Discard when over the specsize.
-		 *
-		 * TODO: add a drop when OOM or > specsize -- and also on OOM in
-		 * any of the consuming functions.
-		 */
-
-		if (dtsb)
-			cursz = dtsb->dtsb_size;
-
-		if (cursz + size > dtp->dt_options[DTRACEOPT_SPECSIZE])
-			return DTRACE_WORKSTATUS_OKAY;
-
-		if (!dtsb) {
-			if ((dtsb = dt_spec_buf_create(dtp, specid)) == NULL)
-				return -1;
-		}
-
-		if (dt_spec_buf_add_data(dtp, dtsb, epid, pdat->dtpda_cpu,
-					 pdat->dtpda_ddesc, data, size) == NULL)
-			return -1;
-
-		return DTRACE_WORKSTATUS_OKAY;
-	}
-
 	/*
 	 * First, scan for commit/discard.  Track whether we have seen discards,
 	 * and whether we have seen anything else, to determine whether this
@@ -2372,42 +2264,19 @@ dt_consume_one_probe(dtrace_hdl_t *dtp, FILE *fp, char *data, uint32_t size,
 
 		if (act == DTRACEACT_COMMIT || act == DTRACEACT_DISCARD) {
 			/*
-			 * Committing or discarding.  If this is the first
-			 * commit/discard we've seen for this speculation,
-			 * arrange to drain it until enough CPUs have passed by
-			 * that all must have been drained.  Out-of-range IDs
-			 * are automatically ignored by the code below, since
-			 * they will have no dtsb entries.
+			 * Committing or discarding.  Out-of-range IDs and IDs
+			 * of speculations that were already drained are
+			 * ignored by dt_spec_drain().
 			 */
 
 			assert(specid == 0);
 
-			tmpl.dtsb_id = *(uint32_t *)recdata;
-			dtsb = dt_htab_lookup(dtp->dt_spec_bufs, &tmpl);
-
-			/*
-			 * Speculation exists and is not already being drained.
-			 */
-			if (dtsb && !dtsb->dtsb_spec.draining) {
-				dtsb_draining_t *dtsd;
-				dt_bpf_specs_t spec;
-				dt_ident_t *idp = dt_dlib_get_map(dtp, "specs");
-				int rval;
-
-				rval = dt_bpf_map_lookup(idp->di_id, &tmpl.dtsb_id, &spec);
-				if (rval != 0)
-					return dt_set_errno(dtp, -rval);
-
-				assert(spec.draining);
-				dtsd = dt_zalloc(dtp, sizeof(dtsb_draining_t));
-				if (!dtsd)
-					return dt_set_errno(dtp, EDT_NOMEM);
-				dtsd->dtsd_dtsb = dtsb;
-				dtsb->dtsb_committing = (act == DTRACEACT_COMMIT);
-				memcpy(&dtsb->dtsb_spec, &spec,
-				    sizeof(dt_bpf_specs_t));
-				dt_list_append(&dtp->dt_spec_bufs_draining, dtsd);
-			}
+			ret = dt_spec_drain(dtp, fp, *(uint32_t *)recdata,
+					    act == DTRACEACT_COMMIT, pdat,
+					    efunc, rfunc, flow, quiet,
+					    peekflags, last, arg);
+			if (ret != DTRACE_WORKSTATUS_OKAY)
+				return ret;
 			continue;
 		}
 
@@ -2504,43 +2373,6 @@ dt_consume_one_probe(dtrace_hdl_t *dtp, FILE *fp, char *data, uint32_t size,
 		*last = epid;
 	}
 
-	/*
-	 * If we're not committing a speculative buffer already, commit any spec
-	 * buffers that are marked as committing and draining and have any
-	 * content to drain.
-	 */
-	if (!committing) {
-		dtsb_draining_t *dtsd, *next;
-
-		for (dtsd = dt_list_next(&dtp->dt_spec_bufs_draining);
-		     dtsd != NULL; dtsd = next) {
-
-			dtsb = dtsd->dtsd_dtsb;
-			dtsd->dtsd_read += dt_list_length(&dtsb->dtsb_dsbd_list);
-
-			if (dtsb->dtsb_committing) {
-				if ((ret = dt_commit_one_spec(dtp, fp, dtsb,
-							      pdat, efunc, rfunc,
-							      flow, quiet, peekflags,
-							      last, arg)) !=
-				    DTRACE_WORKSTATUS_OKAY) {
-					dt_spec_buf_data_destroy(dtp, dtsb);
-					return ret;
-				}
-			}
-
-			next = dt_list_next(dtsd);
-
-			if (dtsd->dtsd_read < dtsb->dtsb_spec.written)
-				dt_spec_buf_data_destroy(dtp, dtsb);
-			else {
-				dt_list_delete(&dtp->dt_spec_bufs_draining, dtsd);
-				dt_htab_delete(dtp->dt_spec_bufs, dtsb);
-				dt_free(dtp, dtsd);
-			}
-		}
-	}
-
 	return DTRACE_WORKSTATUS_OKAY;
 }
 
@@ -2608,10 +2440,10 @@ dt_consume_one(dtrace_hdl_t *dtp, FILE *fp, char *buf,
 		return DTRACE_WORKSTATUS_ERROR;
 }
 
-int
-dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, dt_peb_t *peb,
-	       dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc,
-	       int peekflags, void *arg)
+static int
+dt_consume_cpu_impl(dtrace_hdl_t *dtp, FILE *fp, dt_peb_t *peb,
+		    dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc,
+		    int peekflags, void *arg)
 {
 	struct perf_event_mmap_page	*rb_page = (void *)peb->base;
 	struct perf_event_header	*hdr;
@@ -2633,8 +2465,8 @@ dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, dt_peb_t *peb,
 	 *
 	 * Initializing more fields here (or anywhere above
 	 * dt_consume_one_probe) may require the addition of new fields to
-	 * dt_spec_bufs, if you want the original value to be preserved across
-	 * speculate/commit.
+	 * the speculation buffer records, if you want the original value to be
+	 * preserved across speculate/commit.
 	 */
 	memset(&pdat, 0, sizeof(pdat));
 	pdat.dtpda_handle = dtp;
@@ -2687,6 +2519,9 @@ dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, dt_peb_t *peb,
 				event = dst;
 			}
 
+			dtp->dt_stats.dtst_records++;
+			dtp->dt_stats.dtst_bytes += len;
+
 			rval = dt_consume_one(dtp, fp, event, &pdat, efunc,
 					      rfunc, flow, quiet, peekflags,
 					      &last, arg);
@@ -2705,6 +2540,20 @@ dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, dt_peb_t *peb,
 	return DTRACE_WORKSTATUS_OKAY;
 }
 
+int
+dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, dt_peb_t *peb,
+	       dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc,
+	       int peekflags, void *arg)
+{
+	hrtime_t	start = dt_phase_start();
+	int		rval;
+
+	rval = dt_consume_cpu_impl(dtp, fp, peb, efunc, rfunc, peekflags, arg);
+	dt_phase_end(dtp, DTRACE_PHASE_CONSUME, start);
+
+	return rval;
+}
+
 typedef struct dt_begin {
 	dtrace_consume_probe_f *dtbgn_probefunc;
 	dtrace_consume_rec_f *dtbgn_recfunc;
@@ -2943,37 +2792,14 @@ dt_consume_proc_exits(dtrace_hdl_t *dtp)
 	pthread_mutex_unlock(&dph->dph_lock);
 }
 
-int
-dt_consume_init(dtrace_hdl_t *dtp)
-{
-	dtp->dt_spec_bufs = dt_htab_create(dtp, &dt_spec_buf_htab_ops);
-
-	if (!dtp->dt_spec_bufs)
-		return dt_set_errno(dtp, EDT_NOMEM);
-	return 0;
-}
-
-void
-dt_consume_fini(dtrace_hdl_t *dtp)
-{
-	dtsb_draining_t *dtsd;
-
-	while ((dtsd = dt_list_next(&dtp->dt_spec_bufs_draining)) != NULL) {
-		dt_list_delete(&dtp->dt_spec_bufs_draining, dtsd);
-		dt_free(dtp, dtsd);
-	}
-
-	dt_htab_destroy(dtp, dtp->dt_spec_bufs);
-}
-
 dtrace_workstatus_t
 dtrace_consume(dtrace_hdl_t *dtp, FILE *fp, dtrace_consume_probe_f *pf,
 	       dtrace_consume_rec_f *rf, void *arg)
 {
 	dtrace_optval_t		timeout = dtp->dt_options[DTRACEOPT_SWITCHRATE];
 	struct epoll_event	events[dtp->dt_conf.num_online_cpus];
-	int			drained = 0;
 	int			i, cnt;
+	hrtime_t		start;
 	dtrace_workstatus_t	rval;
 
 	/*
@@ -3000,8 +2826,10 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp, dtrace_consume_probe_f *pf,
 	 * We therefore need to convert the value.
 	 */
 	timeout /= NANOSEC / MILLISEC;
+	start = dt_phase_start();
 	cnt = epoll_wait(dtp->dt_poll_fd, events, dtp->dt_conf.num_online_cpus,
 			 timeout);
+	dt_phase_end(dtp, DTRACE_PHASE_WAIT, start);
 	if (cnt < 0) {
 		dt_set_errno(dtp, errno);
 		return DTRACE_WORKSTATUS_ERROR;
@@ -3038,7 +2866,6 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp, dtrace_consume_probe_f *pf,
 	 * by one.  If tracing has stopped, skip the CPU on which the END probe
 	 * executed because we want to process that one last.
 	 */
-drain:
 	for (i = 0; i < cnt; i++) {
 		dt_peb_t	*peb = events[i].data.ptr;
 
@@ -3052,20 +2879,6 @@ drain:
 			return rval;
 	}
 
-	/*
-	 * If a commit or discard has come in, loop twice, because if it was a
-	 * commit the commit probably wasn't the first in the CPU list, and it is
-	 * quite likely that an earlier CPU contains some of the speculative
-	 * content we want to commit.  Circle round and process it once more to
-	 * pick this up.  This means users don't find themselves with committed
-	 * speculative content routinely split between one consume loop and the
-	 * next.
-	 */
-	if (!drained && dt_list_next(&dtp->dt_spec_bufs_draining) != NULL) {
-		drained = 1;
-		goto drain;
-	}
-
 	/*
 	 * If tracing has not been stopped, we are done here.
 	 */
@@ -23,12 +23,27 @@ typedef struct dt_mstate {
 	uint32_t	clid;		/* Clause ID (unique per probe) */
 	uint32_t	tag;		/* Tag (for future use) */
 	int32_t		syscall_errno;	/* syscall errno */
+	uint32_t	bvcached;	/* cached built-in values (DT_BV_*) */
 	uint64_t	fault;		/* DTrace fault flags */
 	uint64_t	tstamp;		/* cached timestamp value */
+	uint64_t	pid_tgid;	/* cached pid and tid */
+	uint64_t	uid_gid;	/* cached uid and gid */
+	uint64_t	task;		/* cached current task */
+	uint64_t	cpuinfo;	/* cached cpuinfo pointer */
 	dt_pt_regs	regs;		/* CPU registers */
 	uint64_t	argv[10];	/* Probe arguments */
 } dt_mstate_t;
 
+/*
+ * Built-in variable values that are cached in the machine state.  The cache
+ * (and the cached timestamp) is valid for the duration of a probe firing, and
+ * is shared by all clauses for the probe.
+ */
+#define DT_BV_PIDTGID	0x1		/* pid_tgid is valid */
+#define DT_BV_UIDGID	0x2		/* uid_gid is valid */
+#define DT_BV_TASK	0x4		/* task is valid */
+#define DT_BV_CPUINFO	0x8		/* cpuinfo is valid */
+
 /*
  * The DTrace context.
  */
@@ -74,6 +89,7 @@ typedef struct dt_dctx {
 #define DMST_CLID	offsetof(dt_mstate_t, clid)
 #define DMST_TAG	offsetof(dt_mstate_t, tag)
 #define DMST_ERRNO	offsetof(dt_mstate_t, syscall_errno)
+#define DMST_BVCACHED	offsetof(dt_mstate_t, bvcached)
 #define DMST_FAULT	offsetof(dt_mstate_t, fault)
 #define DMST_TSTAMP	offsetof(dt_mstate_t, tstamp)
 #define DMST_REGS	offsetof(dt_mstate_t, regs)
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2020, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -51,10 +51,15 @@ dt_decl_check(dt_decl_t *ddp)
 	return ddp;
 }
 
+/*
+ * Declarations and scopes do not outlive the compilation pass that creates
+ * them, so they are allocated from the arena of the current PCB and are not
+ * freed individually.
+ */
 dt_decl_t *
 dt_decl_alloc(ushort_t kind, char *name)
 {
-	dt_decl_t *ddp = malloc(sizeof(dt_decl_t));
+	dt_decl_t *ddp = dt_arena_alloc(&yypcb->pcb_arena, sizeof(dt_decl_t));
 
 	if (ddp == NULL)
 		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
@@ -79,7 +84,6 @@ dt_decl_free(dt_decl_t *ddp)
 		ndp = ddp->dd_next;
 		free(ddp->dd_name);
 		dt_node_list_free(&ddp->dd_node);
-		free(ddp);
 	}
 }
 
@@ -1051,8 +1055,6 @@ dt_scope_destroy(dt_scope_t *dsp)
 		dt_decl_free(dsp->ds_decl);
 		free(dsp->ds_ident);
 		nsp = dsp->ds_next;
-		if (dsp != &yypcb->pcb_dstack)
-			free(dsp);
 	}
 }
 
@@ -1060,7 +1062,8 @@ void
 dt_scope_push(ctf_file_t *ctfp, ctf_id_t type)
 {
 	dt_scope_t *rsp = &yypcb->pcb_dstack;
-	dt_scope_t *dsp = malloc(sizeof(dt_scope_t));
+	dt_scope_t *dsp = dt_arena_alloc(&yypcb->pcb_arena,
+					 sizeof(dt_scope_t));
 
 	if (dsp == NULL)
 		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
@@ -1102,6 +1105,5 @@ dt_scope_pop(void)
 	rsp->ds_class = dsp->ds_class;
 	rsp->ds_enumval = dsp->ds_enumval;
 
-	free(dsp);
 	return rsp->ds_decl;
 }
@@ -81,61 +81,102 @@ dt_dis_varname_off(const dtrace_difo_t *dp, uint_t off, uint_t scope, uint_t add
 	return NULL;
 }
 
+/*
+ * Find the instruction prior to 'addr' that last assigned a value to the given
+ * register, looking through register to register moves.  This is a simple
+ * linear scan that does not take branches into account.
+ */
+static const struct bpf_insn *
+dt_dis_regdef(const dtrace_difo_t *dp, uint_t addr, int reg)
+{
+	while (addr-- > 0) {
+		const struct bpf_insn	*in = &dp->dtdo_buf[addr];
+
+		switch (BPF_CLASS(in->code)) {
+		case BPF_LD:
+			if (in->code == 0)
+				continue;	/* second half of lddw */
+			/* fallthrough */
+		case BPF_LDX:
+		case BPF_ALU:
+		case BPF_ALU64:
+			if (in->dst_reg != reg)
+				continue;
+			break;
+		case BPF_JMP:
+			if (BPF_IS_CALL(*in) && reg <= BPF_REG_5)
+				return NULL;
+			continue;
+		default:
+			continue;
+		}
+
+		if (in->code != (BPF_ALU64 | BPF_MOV | BPF_X))
+			return in;
+
+		reg = in->src_reg;
+	}
+
+	return NULL;
+}
+
 /*
  * Check if we are loading either the gvar or lvar BPF map.  If so,
  * we want to report the name of the variable it is looking up.
  * The sequence of instructions we are looking for is:
  *         insn   code  dst  src    offset        imm
- *          -2:    ld   dst  %fp  DT_STK_DCTX  00000000
- *          -1:    ld   dst  dst  DCTX_*VARS   00000000
- *           0:    ld   dst  dst  var_offset   00000000
- *           0:    st   dst  src  var_offset   00000000
- *           0:    add  dst    0     0         var_offset
+ *                 ld   r1   %fp  DT_STK_DCTX  00000000
+ *                 ld   r2   r1   DCTX_*VARS   00000000
+ *           0:    ld   dst  r2   var_offset   00000000
+ *           0:    st   r2   src  var_offset   00000000
+ *           0:    add  r2     0     0         var_offset
  * where instruction 0 is the current instruction, which may be one
  * of the three above cases.  The three cases represent:
  *   - load by value
  *   - store by value
  *   - access by reference
+ * The preceding loads need not be adjacent to the current instruction, and
+ * the registers involved may be copies of one another, since the optimizer
+ * may have removed redundant loads.
  */
 static void
 dt_dis_varname(const dtrace_difo_t *dp, const struct bpf_insn *in, uint_t addr,
 	       int n, FILE *fp)
 {
-	__u8		ldcode = BPF_LDX | BPF_MEM | BPF_DW;
-	__u8		addcode = BPF_ALU64 | BPF_ADD | BPF_K;
-	int		dst, scope, var_offset = -1;
-	const char	*vname;
-
-	/* make sure in[-2] and in[-1] exist */
-	if (addr < 2)
+	__u8			ldcode = BPF_LDX | BPF_MEM | BPF_DW;
+	__u8			addcode = BPF_ALU64 | BPF_ADD | BPF_K;
+	int			dst, scope, var_offset = -1;
+	const struct bpf_insn	*vars, *dctx;
+	const char		*vname;
+
+	/* get the register holding the address of the variable storage */
+	dst = BPF_CLASS(in->code) == BPF_LDX ? in->src_reg : in->dst_reg;
+
+	/* find the load of the variable storage address */
+	vars = dt_dis_regdef(dp, addr, dst);
+	if (vars == NULL || vars->code != ldcode || vars->imm != 0)
 		goto out;
 
-	/* get dst and scope */
-	dst = in[-1].dst_reg;
-
-	if (in[-1].off == DCTX_GVARS)
+	/* get the scope */
+	if (vars->off == DCTX_GVARS)
 		scope = DIFV_SCOPE_GLOBAL;
-	else if (in[-1].off == DCTX_LVARS)
+	else if (vars->off == DCTX_LVARS)
 		scope = DIFV_SCOPE_LOCAL;
 	else
 		goto out;
 
-	/* check preceding instructions */
-	if (in[-2].code != ldcode ||
-	    in[-2].dst_reg != dst ||
-	    in[-2].src_reg != BPF_REG_FP ||
-	    in[-2].off != DT_STK_DCTX ||
-	    in[-2].imm != 0 ||
-	    in[-1].code != ldcode ||
-	    in[-1].src_reg != dst ||
-	    in[-1].imm != 0)
+	/* find the load of the DTrace context */
+	dctx = dt_dis_regdef(dp, vars - dp->dtdo_buf, vars->src_reg);
+	if (dctx == NULL ||
+	    dctx->code != ldcode ||
+	    dctx->src_reg != BPF_REG_FP ||
+	    dctx->off != DT_STK_DCTX ||
+	    dctx->imm != 0)
 		goto out;
 
 	/* check the current instruction and read var_offset */
-	if (in->dst_reg != dst)
-		goto out;
 	if (BPF_CLASS(in->code) == BPF_LDX && BPF_MODE(in->code) == BPF_MEM &&
-	    in->src_reg == dst && in->imm == 0)
+	    in->imm == 0)
 		var_offset = in->off;
 	else if (BPF_CLASS(in->code) == BPF_STX &&
 		 BPF_MODE(in->code) == BPF_MEM &&
@@ -251,7 +292,16 @@ dt_dis_load_imm(const dtrace_difo_t *dp, const char *name, uint_t addr,
 		in[1].imm, in[0].imm);
 	dt_dis_prefix(addr + 1, &in[1], fp);
 
-	if (rname != NULL)
+	/*
+	 * A map value load (as opposed to a map fd load) yields the address
+	 * of the map value plus the offset in the second instruction slot.
+	 */
+	if (rname != NULL && in->src_reg == BPF_PSEUDO_MAP_VALUE && in[1].imm)
+		fprintf(fp, "%*s! &%s%+d\n", DT_DIS_INSTR_LEN, "", rname,
+			in[1].imm);
+	else if (rname != NULL && in->src_reg == BPF_PSEUDO_MAP_VALUE)
+		fprintf(fp, "%*s! &%s\n", DT_DIS_INSTR_LEN, "", rname);
+	else if (rname != NULL)
 		fprintf(fp, "%*s! %s\n", DT_DIS_INSTR_LEN, "", rname);
 	else
 		fprintf(fp, "\n");
@@ -456,6 +506,29 @@ dt_dis_typestr(const dtrace_diftype_t *t, char *buf, size_t len)
 	return buf;
 }
 
+static void
+dt_dis_flags(const dtrace_difo_t *dp, FILE *fp)
+{
+	static const struct {
+		uint_t		flag;
+		const char	*name;
+	} flagtab[] = {
+		{ DIFOFLG_DESTRUCTIVE,	"destructive" },
+		{ DIFOFLG_STRTAB,	"strtab" },
+		{ DIFOFLG_AGGS,		"aggs" },
+		{ DIFOFLG_GVARS,	"gvars" },
+		{ DIFOFLG_LVARS,	"lvars" },
+	};
+	uint_t	i;
+
+	fprintf(fp, "\n%-16s", "FLAGS");
+	for (i = 0; i < ARRAY_SIZE(flagtab); i++) {
+		if (dp->dtdo_flags & flagtab[i].flag)
+			fprintf(fp, " %s", flagtab[i].name);
+	}
+	fprintf(fp, "\n");
+}
+
 static void
 dt_dis_rtab(const char *rtag, const dtrace_difo_t *dp, FILE *fp,
     const dof_relodesc_t *rp, uint32_t len)
@@ -691,6 +764,9 @@ dt_dis_difo(const dtrace_difo_t *dp, FILE *fp, const dt_ident_t *idp,
 			i += skip;
 	}
 
+	if (dp->dtdo_flags != 0)
+		dt_dis_flags(dp, fp);
+
 	if (dp->dtdo_varlen != 0) {
 		fprintf(fp, "\n%-16s %-4s %-6s %-3s %-3s %-11s %-4s %s\n",
 			"NAME", "ID", "OFFSET", "KND", "SCP", "RANGE", "FLAG", "TYPE");
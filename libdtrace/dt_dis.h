@@ -20,6 +20,7 @@ extern "C" {
  *    - After constructing a probe program.
  *    - After linking in dependencies.
  *    - After all processing, prior to loading the program.
+ *    - After code generation, prior to optimization and assembly.
  * The values can be combined to select multiple listings.  The '-S' option
  * must also be supplied in order for disassembler output to be generated.
  */
@@ -27,6 +28,7 @@ extern "C" {
 #define DT_DISASM_OPT_PROG		2
 #define DT_DISASM_OPT_PROG_LINKED	4
 #define DT_DISASM_OPT_PROG_FINAL	8
+#define DT_DISASM_OPT_UNOPT		16
 
 #define DT_DISASM_OPT_DEFAULT		DT_DISASM_OPT_CLAUSE
 
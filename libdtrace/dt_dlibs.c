@@ -1,12 +1,16 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2008, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2008, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <port.h>
@@ -15,6 +19,7 @@
 #include <dt_grammar.h>
 #include <dt_impl.h>
 #include <dt_bpf.h>
+#include <dt_string.h>
 
 #define DT_DLIB_D	0
 #define DT_DLIB_BPF	1
@@ -39,6 +44,11 @@ struct dt_bpf_func {
 	dt_bpf_reloc_t	*last_reloc;
 };
 
+typedef struct dt_libsnap	dt_libsnap_t;
+
+static int dt_libsnap_addfunc(dtrace_hdl_t *dtp, dt_libsnap_t *lsp,
+			      const char *fname, dt_ident_t *idp);
+
 static dtrace_attribute_t	dt_bpf_attr = DT_ATTR_STABCMN;
 
 #define DT_BPF_SYMBOL(name, type) \
@@ -53,7 +63,6 @@ static const dt_ident_t		dt_bpf_symbols[] = {
 	DT_BPF_SYMBOL(dt_program, DT_IDENT_FUNC),
 	/* BPF library (external) functions */
 	DT_BPF_SYMBOL(dt_agg_lqbin, DT_IDENT_SYMBOL),
-	DT_BPF_SYMBOL(dt_agg_qbin, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_basename, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_dirname, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_error, DT_IDENT_SYMBOL),
@@ -70,6 +79,7 @@ static const dt_ident_t		dt_bpf_symbols[] = {
 	DT_BPF_SYMBOL(dt_substr, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_speculation, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_speculation_speculate, DT_IDENT_SYMBOL),
+	DT_BPF_SYMBOL(dt_speculation_append, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_speculation_set_drainable, DT_IDENT_SYMBOL),
 	DT_BPF_SYMBOL(dt_strnlen, DT_IDENT_SYMBOL),
 	/* BPF maps */
@@ -81,6 +91,7 @@ static const dt_ident_t		dt_bpf_symbols[] = {
 	DT_BPF_SYMBOL(lvars, DT_IDENT_PTR),
 	DT_BPF_SYMBOL(mem, DT_IDENT_PTR),
 	DT_BPF_SYMBOL(probes, DT_IDENT_PTR),
+	DT_BPF_SYMBOL(specbufs, DT_IDENT_PTR),
 	DT_BPF_SYMBOL(specs, DT_IDENT_PTR),
 	DT_BPF_SYMBOL(state, DT_IDENT_PTR),
 	DT_BPF_SYMBOL(strtab, DT_IDENT_PTR),
@@ -95,6 +106,7 @@ static const dt_ident_t		dt_bpf_symbols[] = {
 	DT_BPF_SYMBOL_ID(BOOTTM, DT_IDENT_SCALAR, DT_CONST_BOOTTM),
 	DT_BPF_SYMBOL_ID(NSPEC, DT_IDENT_SCALAR, DT_CONST_NSPEC),
 	DT_BPF_SYMBOL_ID(NCPUS, DT_IDENT_SCALAR, DT_CONST_NCPUS),
+	DT_BPF_SYMBOL_ID(SPECSZ, DT_IDENT_SCALAR, DT_CONST_SPECSZ),
 	/* End-of-list marker */
 	{ NULL, }
 };
@@ -332,10 +344,14 @@ relcmp(const void *a, const void *b)
  * For functions, we fix up the symbol size (to work around an issue with the
  * gcc BPF compiler not emitting symbol sizes), and then associate any listed
  * relocations with each function.
+ *
+ * Each function is also recorded in the library snapshot (if any), so that
+ * the next consumer does not need to parse the ELF object again.
  */
 static int
-get_symbols(dtrace_hdl_t *dtp, Elf *elf, int syms_idx, int strs_idx,
-	    int text_idx, int text_len, int relo_idx, int maps_idx)
+get_symbols(dtrace_hdl_t *dtp, dt_libsnap_t *lsp, const char *fn, Elf *elf,
+	    int syms_idx, int strs_idx, int text_idx, int text_len,
+	    int relo_idx, int maps_idx)
 {
 	int		idx, fid, fun0;
 	Elf_Scn		*scn;
@@ -681,6 +697,9 @@ setdata:
 		dt_ident_morph(idp, idp->di_kind, &dt_idops_difo, dtp);
 		dt_ident_set_data(idp, fp->difo);
 		fp->difo = NULL;
+
+		if (dt_libsnap_addfunc(dtp, lsp, fn, idp) != 0)
+			goto err;
 	}
 
 out:
@@ -713,7 +732,7 @@ err:
 }
 
 static int
-readBPFFile(dtrace_hdl_t *dtp, const char *fn)
+readBPFFile(dtrace_hdl_t *dtp, dt_libsnap_t *lsp, const char *fn)
 {
 	int		fd;
 	int		rc = -1;
@@ -808,8 +827,8 @@ readBPFFile(dtrace_hdl_t *dtp, const char *fn)
 			break;
 	}
 
-	rc = get_symbols(dtp, elf, syms_idx, strs_idx, text_idx, text_len,
-			 relo_idx, maps_idx);
+	rc = get_symbols(dtp, lsp, fn, elf, syms_idx, strs_idx, text_idx,
+			 text_len, relo_idx, maps_idx);
 	goto out;
 
 err_elf:
@@ -1028,6 +1047,632 @@ dt_lib_depend_free(dtrace_hdl_t *dtp)
 	}
 }
 
+/*
+ * Library snapshots.
+ *
+ * Determining the compilation order of the D library files requires a scan of
+ * the control directives in every file, and the BPF library functions have to
+ * be extracted from the ELF object(s) along with their relocations.  If the
+ * libcache option is set, the dependencies found by that scan and the parsed
+ * BPF functions are saved in a snapshot file (one for each library directory)
+ * in the given directory.  The snapshot is used instead of scanning a library
+ * file as long as the size and modification time of that file did not change,
+ * and it is rebuilt whenever a file is (re)scanned.  The snapshot is also
+ * discarded if the kernel or the DTrace build changed.
+ *
+ * A snapshot consists of a header, the file records, the BPF instructions, the
+ * BPF function records, the BPF relocation records, the dependency records
+ * (string table offsets of the library each file depends on) and the string
+ * table, and is used in place using mmap().
+ */
+#define DT_LIBSNAP_MAGIC	0x534c5444	/* "DTLS" */
+#define DT_LIBSNAP_VERSION	2
+
+typedef struct dt_libsnap_hdr {
+	uint32_t	magic;		/* DT_LIBSNAP_MAGIC */
+	uint32_t	version;	/* DT_LIBSNAP_VERSION */
+	uint32_t	kernver;	/* kernel version */
+	uint32_t	nfiles;		/* number of file records */
+	uint32_t	ninsns;		/* number of BPF instructions */
+	uint32_t	nfuncs;		/* number of BPF function records */
+	uint32_t	nrelocs;	/* number of BPF relocation records */
+	uint32_t	ndeps;		/* number of dependency records */
+	uint32_t	strsz;		/* size of the string table */
+	uint32_t	pad;
+	char		dtver[64];	/* DTrace build version */
+} dt_libsnap_hdr_t;
+
+typedef struct dt_libsnap_file {
+	uint32_t	name;		/* library path (strtab offset) */
+	uint32_t	dep;		/* index of first dependency record */
+	uint32_t	ndeps;		/* number of dependency records */
+	uint32_t	func;		/* index of first function record */
+	uint32_t	nfuncs;		/* number of function records */
+	uint32_t	pad;
+	int64_t		size;		/* file size */
+	int64_t		mtime;		/* modification time (ns) */
+} dt_libsnap_file_t;
+
+typedef struct dt_libsnap_func {
+	uint32_t	name;		/* function name (strtab offset) */
+	uint32_t	insn;		/* index of first instruction */
+	uint32_t	ninsns;		/* number of instructions */
+	uint32_t	reloc;		/* index of first relocation record */
+	uint32_t	nrelocs;	/* number of relocation records */
+} dt_libsnap_func_t;
+
+typedef struct dt_libsnap_reloc {
+	uint32_t	type;		/* relocation type */
+	uint32_t	offset;		/* offset in the function */
+	uint32_t	name;		/* symbol name (strtab offset) */
+} dt_libsnap_reloc_t;
+
+/*
+ * A BPF function that was loaded from the given library file, either from the
+ * ELF object or from the snapshot.
+ */
+typedef struct dt_libsnap_bpf {
+	dt_list_t		list;		/* next/prev pointers */
+	char			*file;		/* library path */
+	dt_ident_t		*ident;		/* function identifier */
+} dt_libsnap_bpf_t;
+
+struct dt_libsnap {
+	char			ls_path[PATH_MAX]; /* snapshot file ("" if none) */
+	char			ls_dir[PATH_MAX]; /* library directory */
+	void			*ls_base;	/* mapped snapshot (if any) */
+	size_t			ls_size;	/* size of mapped snapshot */
+	const dt_libsnap_file_t	*ls_files;	/* file records */
+	const struct bpf_insn	*ls_insns;	/* BPF instructions */
+	const dt_libsnap_func_t	*ls_funcs;	/* BPF function records */
+	const dt_libsnap_reloc_t *ls_relocs;	/* BPF relocation records */
+	const uint32_t		*ls_deps;	/* dependency records */
+	const char		*ls_strtab;	/* string table */
+	uint32_t		ls_nfiles;	/* number of file records */
+	uint32_t		ls_nused;	/* number of file records used */
+	int			ls_stale;	/* snapshot must be rebuilt */
+	dt_list_t		ls_bpf;		/* BPF functions loaded */
+};
+
+static int64_t
+dt_libsnap_mtime(const struct stat *st)
+{
+	return (int64_t)st->st_mtim.tv_sec * NANOSEC + st->st_mtim.tv_nsec;
+}
+
+/*
+ * Map the snapshot for the given library directory, if there is a valid one.
+ * Trailing slashes are stripped from the directory name so that the snapshot
+ * and the library paths do not depend on how the directory was specified.
+ */
+static void
+dt_libsnap_open(dtrace_hdl_t *dtp, const char *path, dt_libsnap_t *lsp)
+{
+	const dt_libsnap_hdr_t	*hdr;
+	struct stat		st;
+	size_t			off, len;
+	int			fd;
+
+	memset(lsp, 0, sizeof(dt_libsnap_t));
+	if (dtp->dt_libcache == NULL)
+		return;
+
+	len = strlcpy(lsp->ls_dir, path, sizeof(lsp->ls_dir));
+	while (len > 1 && lsp->ls_dir[len - 1] == '/')
+		lsp->ls_dir[--len] = '\0';
+
+	snprintf(lsp->ls_path, sizeof(lsp->ls_path), "%s/dlibs-%08x.snap",
+		 dtp->dt_libcache, str2hval(lsp->ls_dir, 0));
+
+	lsp->ls_stale = 1;
+	if ((fd = open(lsp->ls_path, O_RDONLY | O_CLOEXEC)) == -1)
+		return;
+
+	if (fstat(fd, &st) == -1 ||
+	    (size_t)st.st_size < sizeof(dt_libsnap_hdr_t)) {
+		close(fd);
+		return;
+	}
+
+	lsp->ls_base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (lsp->ls_base == MAP_FAILED) {
+		lsp->ls_base = NULL;
+		return;
+	}
+
+	lsp->ls_size = st.st_size;
+	hdr = lsp->ls_base;
+	off = sizeof(dt_libsnap_hdr_t) +
+	      (size_t)hdr->nfiles * sizeof(dt_libsnap_file_t) +
+	      (size_t)hdr->ninsns * sizeof(struct bpf_insn) +
+	      (size_t)hdr->nfuncs * sizeof(dt_libsnap_func_t) +
+	      (size_t)hdr->nrelocs * sizeof(dt_libsnap_reloc_t) +
+	      (size_t)hdr->ndeps * sizeof(uint32_t);
+
+	if (hdr->magic != DT_LIBSNAP_MAGIC ||
+	    hdr->version != DT_LIBSNAP_VERSION ||
+	    hdr->kernver != dtp->dt_kernver ||
+	    strncmp(hdr->dtver, _libdtrace_vcs_version,
+		    sizeof(hdr->dtver)) != 0 ||
+	    hdr->strsz == 0 || off + hdr->strsz != lsp->ls_size) {
+		dt_dprintf("discarding library snapshot %s\n", lsp->ls_path);
+		munmap(lsp->ls_base, lsp->ls_size);
+		lsp->ls_base = NULL;
+		return;
+	}
+
+	lsp->ls_files = (const dt_libsnap_file_t *)(hdr + 1);
+	lsp->ls_insns = (const struct bpf_insn *)(lsp->ls_files + hdr->nfiles);
+	lsp->ls_funcs = (const dt_libsnap_func_t *)(lsp->ls_insns +
+						    hdr->ninsns);
+	lsp->ls_relocs = (const dt_libsnap_reloc_t *)(lsp->ls_funcs +
+						      hdr->nfuncs);
+	lsp->ls_deps = (const uint32_t *)(lsp->ls_relocs + hdr->nrelocs);
+	lsp->ls_strtab = (const char *)lsp->ls_base + off;
+	lsp->ls_nfiles = hdr->nfiles;
+
+	if (lsp->ls_strtab[hdr->strsz - 1] != '\0') {
+		munmap(lsp->ls_base, lsp->ls_size);
+		lsp->ls_base = NULL;
+		return;
+	}
+
+	lsp->ls_stale = 0;
+}
+
+/*
+ * Return the snapshot record for the given library file, provided that the
+ * file did not change since the snapshot was written.
+ */
+static const dt_libsnap_file_t *
+dt_libsnap_file(const dt_libsnap_t *lsp, const char *fname)
+{
+	const dt_libsnap_hdr_t	*hdr = lsp->ls_base;
+	const dt_libsnap_file_t	*lfp;
+	struct stat		st;
+	uint32_t		i;
+
+	if (lsp->ls_base == NULL)
+		return NULL;
+
+	for (i = 0, lfp = lsp->ls_files; i < lsp->ls_nfiles; i++, lfp++) {
+		if (lfp->name < hdr->strsz &&
+		    strcmp(lsp->ls_strtab + lfp->name, fname) == 0)
+			break;
+	}
+
+	if (i == lsp->ls_nfiles || stat(fname, &st) == -1 ||
+	    st.st_size != lfp->size || dt_libsnap_mtime(&st) != lfp->mtime ||
+	    lfp->dep > hdr->ndeps || lfp->ndeps > hdr->ndeps - lfp->dep ||
+	    lfp->func > hdr->nfuncs || lfp->nfuncs > hdr->nfuncs - lfp->func)
+		return NULL;
+
+	return lfp;
+}
+
+/*
+ * Add the library dependencies for the given library file from the snapshot.
+ * Return 0 if that was done, 1 if the file needs to be scanned, and -1 if an
+ * error occured.
+ */
+static int
+dt_libsnap_lookup(dtrace_hdl_t *dtp, dt_libsnap_t *lsp, const char *fname)
+{
+	const dt_libsnap_hdr_t	*hdr = lsp->ls_base;
+	const dt_libsnap_file_t	*lfp;
+	dt_lib_depend_t		*dld;
+	uint32_t		j;
+
+	if ((lfp = dt_libsnap_file(lsp, fname)) == NULL)
+		return 1;
+
+	for (j = 0; j < lfp->ndeps; j++) {
+		if (lsp->ls_deps[lfp->dep + j] >= hdr->strsz)
+			return 1;
+	}
+
+	if (dt_lib_depend_add(dtp, &dtp->dt_lib_dep, fname) != 0)
+		return -1;
+
+	dld = dt_list_prev(&dtp->dt_lib_dep);
+	for (j = 0; j < lfp->ndeps; j++) {
+		const char	*dep = lsp->ls_strtab + lsp->ls_deps[lfp->dep + j];
+
+		if (dt_lib_depend_add(dtp, &dld->dtld_dependencies, dep) != 0)
+			return -1;
+	}
+
+	lsp->ls_nused++;
+	dt_dprintf("using cached dependencies for %s\n", fname);
+
+	return 0;
+}
+
+/*
+ * Record a BPF function that was loaded from the given library file, so that
+ * it can be saved in a new snapshot.
+ */
+static int
+dt_libsnap_addfunc(dtrace_hdl_t *dtp, dt_libsnap_t *lsp, const char *fname,
+		   dt_ident_t *idp)
+{
+	dt_libsnap_bpf_t	*lbp;
+
+	if (lsp == NULL || lsp->ls_path[0] == '\0')
+		return 0;
+
+	if ((lbp = dt_zalloc(dtp, sizeof(dt_libsnap_bpf_t))) == NULL)
+		return -1;
+
+	if ((lbp->file = strdup(fname)) == NULL) {
+		dt_free(dtp, lbp);
+		return dt_set_errno(dtp, EDT_NOMEM);
+	}
+
+	lbp->ident = idp;
+	dt_list_append(&lsp->ls_bpf, lbp);
+
+	return 0;
+}
+
+/*
+ * Construct the DIFO for a BPF function from the snapshot.
+ */
+static dtrace_difo_t *
+dt_libsnap_difo(dtrace_hdl_t *dtp, const dt_libsnap_t *lsp,
+		const dt_libsnap_func_t *lfn)
+{
+	const dt_libsnap_reloc_t	*lrp = lsp->ls_relocs + lfn->reloc;
+	dtrace_difo_t			*dp;
+	dof_relodesc_t			*brp;
+	dt_strtab_t			*stab;
+	uint32_t			i;
+
+	if ((dp = dt_zalloc(dtp, sizeof(dtrace_difo_t))) == NULL)
+		return NULL;
+
+	dp->dtdo_buf = dt_alloc(dtp, lfn->ninsns * sizeof(struct bpf_insn));
+	if (dp->dtdo_buf == NULL)
+		goto err;
+
+	memcpy(dp->dtdo_buf, lsp->ls_insns + lfn->insn,
+	       lfn->ninsns * sizeof(struct bpf_insn));
+	dp->dtdo_len = lfn->ninsns;
+
+	if (lfn->nrelocs == 0)
+		return dp;
+
+	dp->dtdo_breltab = dt_calloc(dtp, lfn->nrelocs, sizeof(dof_relodesc_t));
+	if (dp->dtdo_breltab == NULL)
+		goto err;
+
+	dp->dtdo_brelen = lfn->nrelocs;
+
+	if ((stab = dt_strtab_create(BUFSIZ)) == NULL) {
+		dt_set_errno(dtp, EDT_NOMEM);
+		goto err;
+	}
+
+	for (i = 0, brp = dp->dtdo_breltab; i < lfn->nrelocs;
+	     i++, brp++, lrp++) {
+		brp->dofr_type = lrp->type;
+		brp->dofr_offset = lrp->offset;
+		brp->dofr_name = dt_strtab_insert(stab,
+						  lsp->ls_strtab + lrp->name);
+		brp->dofr_data = 0;
+	}
+
+	dp->dtdo_strlen = dt_strtab_size(stab);
+	dp->dtdo_strtab = dt_alloc(dtp, dp->dtdo_strlen);
+	if (dp->dtdo_strtab == NULL) {
+		dt_strtab_destroy(stab);
+		goto err;
+	}
+
+	dt_strtab_write(stab, (dt_strtab_write_f *)dt_strtab_copystr,
+			dp->dtdo_strtab);
+	dt_strtab_destroy(stab);
+
+	return dp;
+
+err:
+	dt_difo_free(dtp, dp);
+	return NULL;
+}
+
+/*
+ * Load the BPF functions for the given library file from the snapshot.
+ * Return 0 if that was done, 1 if the file needs to be parsed, and -1 if an
+ * error occured.
+ */
+static int
+dt_libsnap_lookup_bpf(dtrace_hdl_t *dtp, dt_libsnap_t *lsp, const char *fname)
+{
+	const dt_libsnap_hdr_t	*hdr = lsp->ls_base;
+	const dt_libsnap_file_t	*lfp;
+	const dt_libsnap_func_t	*lfn;
+	uint32_t		i, j;
+
+	if ((lfp = dt_libsnap_file(lsp, fname)) == NULL || lfp->nfuncs == 0)
+		return 1;
+
+	/*
+	 * Validate all function records before any identifier is modified, so
+	 * that falling back to parsing the ELF object is always possible.
+	 */
+	for (i = 0, lfn = lsp->ls_funcs + lfp->func; i < lfp->nfuncs;
+	     i++, lfn++) {
+		if (lfn->name >= hdr->strsz || lfn->ninsns == 0 ||
+		    lfn->insn > hdr->ninsns ||
+		    lfn->ninsns > hdr->ninsns - lfn->insn ||
+		    lfn->reloc > hdr->nrelocs ||
+		    lfn->nrelocs > hdr->nrelocs - lfn->reloc)
+			return 1;
+
+		for (j = 0; j < lfn->nrelocs; j++) {
+			if (lsp->ls_relocs[lfn->reloc + j].name >= hdr->strsz)
+				return 1;
+		}
+	}
+
+	for (i = 0, lfn = lsp->ls_funcs + lfp->func; i < lfp->nfuncs;
+	     i++, lfn++) {
+		const char	*name = lsp->ls_strtab + lfn->name;
+		dt_ident_t	*idp;
+		dtrace_difo_t	*dp;
+
+		idp = dt_dlib_get_func(dtp, name);
+		if (idp == NULL) {
+			idp = dt_dlib_add_func(dtp, name);
+			if (idp == NULL) {
+				dt_dprintf("BPF snapshot: cannot add %s\n",
+					   name);
+				continue;
+			}
+		}
+
+		if ((dp = dt_libsnap_difo(dtp, lsp, lfn)) == NULL)
+			return -1;
+
+		dt_ident_morph(idp, idp->di_kind, &dt_idops_difo, dtp);
+		dt_ident_set_data(idp, dp);
+
+		if (dt_libsnap_addfunc(dtp, lsp, fname, idp) != 0)
+			return -1;
+	}
+
+	lsp->ls_nused++;
+	dt_dprintf("using cached BPF functions for %s\n", fname);
+
+	return 0;
+}
+
+/*
+ * Check whether the given library path (including a trailing slash) is the
+ * directory of the snapshot.
+ */
+static int
+dt_libsnap_indir(const dt_libsnap_t *lsp, const char *libpath)
+{
+	size_t	len = strlen(lsp->ls_dir);
+	size_t	plen = strlen(libpath);
+
+	while (plen > 1 && libpath[plen - 1] == '/')
+		plen--;
+
+	return plen == len && strncmp(libpath, lsp->ls_dir, len) == 0;
+}
+
+/*
+ * Write a new snapshot based on the library dependencies that were collected
+ * and the BPF functions that were loaded.  Failures are not fatal: the
+ * snapshot is merely an optimization.
+ */
+static void
+dt_libsnap_write(dtrace_hdl_t *dtp, dt_libsnap_t *lsp)
+{
+	dt_libsnap_hdr_t	*hdr;
+	dt_libsnap_file_t	*lfp;
+	struct bpf_insn		*insns, *insn;
+	dt_libsnap_func_t	*lfn;
+	dt_libsnap_reloc_t	*lrp;
+	uint32_t		*dep;
+	char			*str, *strtab, *buf;
+	dt_lib_depend_t		*dld, *dpld;
+	dt_libsnap_bpf_t	*lbp;
+	const char		*file;
+	uint32_t		nfiles = 0, ninsns = 0, nfuncs = 0;
+	uint32_t		nrelocs = 0, ndeps = 0, strsz = 0;
+	size_t			size;
+	char			tmp[PATH_MAX];
+	int			fd;
+
+	for (dld = dt_list_next(&dtp->dt_lib_dep); dld != NULL;
+	     dld = dt_list_next(dld)) {
+		if (!dt_libsnap_indir(lsp, dld->dtld_libpath))
+			continue;
+
+		nfiles++;
+		strsz += strlen(dld->dtld_library) + 1;
+
+		for (dpld = dt_list_next(&dld->dtld_dependencies);
+		     dpld != NULL; dpld = dt_list_next(dpld)) {
+			ndeps++;
+			strsz += strlen(dpld->dtld_library) + 1;
+		}
+	}
+
+	/*
+	 * The BPF functions for a library file are recorded consecutively, so
+	 * a change in file name marks the start of the next file.
+	 */
+	for (lbp = dt_list_next(&lsp->ls_bpf), file = NULL; lbp != NULL;
+	     lbp = dt_list_next(lbp)) {
+		const dtrace_difo_t	*dp = lbp->ident->di_data;
+		uint32_t		i;
+
+		if (file == NULL || strcmp(file, lbp->file) != 0) {
+			file = lbp->file;
+			nfiles++;
+			strsz += strlen(file) + 1;
+		}
+
+		nfuncs++;
+		ninsns += dp->dtdo_len;
+		nrelocs += dp->dtdo_brelen;
+		strsz += strlen(lbp->ident->di_name) + 1;
+		for (i = 0; i < dp->dtdo_brelen; i++)
+			strsz += strlen(dp->dtdo_strtab +
+					dp->dtdo_breltab[i].dofr_name) + 1;
+	}
+
+	if (strsz == 0)
+		return;
+
+	size = sizeof(dt_libsnap_hdr_t) + nfiles * sizeof(dt_libsnap_file_t) +
+	       ninsns * sizeof(struct bpf_insn) +
+	       nfuncs * sizeof(dt_libsnap_func_t) +
+	       nrelocs * sizeof(dt_libsnap_reloc_t) +
+	       ndeps * sizeof(uint32_t) + strsz;
+	if ((buf = dt_zalloc(dtp, size)) == NULL)
+		return;
+
+	hdr = (dt_libsnap_hdr_t *)buf;
+	hdr->magic = DT_LIBSNAP_MAGIC;
+	hdr->version = DT_LIBSNAP_VERSION;
+	hdr->kernver = dtp->dt_kernver;
+	hdr->nfiles = nfiles;
+	hdr->ninsns = ninsns;
+	hdr->nfuncs = nfuncs;
+	hdr->nrelocs = nrelocs;
+	hdr->ndeps = ndeps;
+	hdr->strsz = strsz;
+	strlcpy(hdr->dtver, _libdtrace_vcs_version, sizeof(hdr->dtver));
+
+	lfp = (dt_libsnap_file_t *)(hdr + 1);
+	insns = insn = (struct bpf_insn *)(lfp + nfiles);
+	lfn = (dt_libsnap_func_t *)(insns + ninsns);
+	lrp = (dt_libsnap_reloc_t *)(lfn + nfuncs);
+	dep = (uint32_t *)(lrp + nrelocs);
+	strtab = str = (char *)(dep + ndeps);
+	ndeps = nfuncs = 0;
+
+	for (dld = dt_list_next(&dtp->dt_lib_dep); dld != NULL;
+	     dld = dt_list_next(dld)) {
+		struct stat	st;
+
+		if (!dt_libsnap_indir(lsp, dld->dtld_libpath))
+			continue;
+
+		if (stat(dld->dtld_library, &st) == -1)
+			goto out;
+
+		lfp->name = str - strtab;
+		lfp->dep = ndeps;
+		lfp->size = st.st_size;
+		lfp->mtime = dt_libsnap_mtime(&st);
+		str = stpcpy(str, dld->dtld_library) + 1;
+
+		for (dpld = dt_list_next(&dld->dtld_dependencies);
+		     dpld != NULL; dpld = dt_list_next(dpld)) {
+			dep[ndeps++] = str - strtab;
+			str = stpcpy(str, dpld->dtld_library) + 1;
+			lfp->ndeps++;
+		}
+
+		lfp++;
+	}
+
+	for (lbp = dt_list_next(&lsp->ls_bpf), file = NULL; lbp != NULL;
+	     lbp = dt_list_next(lbp)) {
+		const dtrace_difo_t	*dp = lbp->ident->di_data;
+		uint32_t		i;
+
+		if (file == NULL || strcmp(file, lbp->file) != 0) {
+			struct stat	st;
+
+			if (file != NULL)
+				lfp++;
+
+			file = lbp->file;
+			if (stat(file, &st) == -1)
+				goto out;
+
+			lfp->name = str - strtab;
+			lfp->func = nfuncs;
+			lfp->size = st.st_size;
+			lfp->mtime = dt_libsnap_mtime(&st);
+			str = stpcpy(str, file) + 1;
+		}
+
+		lfn->name = str - strtab;
+		lfn->insn = insn - insns;
+		lfn->ninsns = dp->dtdo_len;
+		str = stpcpy(str, lbp->ident->di_name) + 1;
+		memcpy(insn, dp->dtdo_buf,
+		       dp->dtdo_len * sizeof(struct bpf_insn));
+		insn += dp->dtdo_len;
+
+		for (i = 0; i < dp->dtdo_brelen; i++, lrp++) {
+			const dof_relodesc_t	*brp = &dp->dtdo_breltab[i];
+
+			lrp->type = brp->dofr_type;
+			lrp->offset = brp->dofr_offset;
+			lrp->name = str - strtab;
+			str = stpcpy(str, dp->dtdo_strtab + brp->dofr_name) + 1;
+		}
+
+		lfn->nrelocs = dp->dtdo_brelen;
+		lfn++;
+		nfuncs++;
+		lfp->nfuncs++;
+	}
+
+	/*
+	 * Write the snapshot to a temporary file, and rename it into place so
+	 * that concurrent consumers never see a partial snapshot.
+	 */
+	snprintf(tmp, sizeof(tmp), "%s.%d", lsp->ls_path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		goto out;
+
+	if (write(fd, buf, size) != (ssize_t)size || close(fd) != 0 ||
+	    rename(tmp, lsp->ls_path) != 0) {
+		dt_dprintf("failed to write library snapshot %s: %s\n",
+			   lsp->ls_path, strerror(errno));
+		unlink(tmp);
+	}
+
+out:
+	dt_free(dtp, buf);
+}
+
+/*
+ * Release the snapshot, after writing a new one if requested and needed.
+ */
+static void
+dt_libsnap_close(dtrace_hdl_t *dtp, dt_libsnap_t *lsp, int save)
+{
+	dt_libsnap_bpf_t	*lbp;
+
+	if (save && lsp->ls_path[0] != '\0' &&
+	    (lsp->ls_stale || lsp->ls_nused != lsp->ls_nfiles))
+		dt_libsnap_write(dtp, lsp);
+
+	if (lsp->ls_base != NULL)
+		munmap(lsp->ls_base, lsp->ls_size);
+
+	while ((lbp = dt_list_next(&lsp->ls_bpf)) != NULL) {
+		dt_list_delete(&lsp->ls_bpf, lbp);
+		free(lbp->file);
+		dt_free(dtp, lbp);
+	}
+
+	memset(lsp, 0, sizeof(dt_libsnap_t));
+}
+
 /*
  * Open all of the .d library files found in the specified directory and
  * compile each one in topological order to cache its inlines and translators,
@@ -1044,18 +1689,21 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 	const char *p;
 	DIR *dirp;
 
-	int type;
+	int type, rc;
 	char fname[PATH_MAX];
 	dtrace_prog_t *pgp;
 	FILE *fp;
 	void *rv;
 	dt_lib_depend_t *dld;
+	dt_libsnap_t snap;
 
 	if ((dirp = opendir(path)) == NULL) {
 		dt_dprintf("skipping lib dir %s: %s\n", path, strerror(errno));
 		return 0;
 	}
 
+	dt_libsnap_open(dtp, path, &snap);
+
 	/* First, parse each file for library dependencies. */
 	while ((dp = readdir(dirp)) != NULL) {
 		if ((p = strrchr(dp->d_name, '.')) == NULL)
@@ -1073,17 +1721,35 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 		snprintf(fname, sizeof(fname), "%s/%s", path, dp->d_name);
 
 		if (type == DT_DLIB_BPF) {
-			if (readBPFFile(dtp, fname) != 0)
+			rc = dt_libsnap_lookup_bpf(dtp, &snap, fname);
+			if (rc < 0)
+				goto err_closedir;
+			if (rc == 0)
+				continue;
+
+			snap.ls_stale = 1;
+			if (readBPFFile(dtp, &snap, fname) != 0)
 				goto err_closedir;
 			continue;
 		}
 
+		/*
+		 * If the snapshot has current dependency information for this
+		 * library, there is no need to scan it.
+		 */
+		rc = dt_libsnap_lookup(dtp, &snap, fname);
+		if (rc < 0)
+			goto err_closedir;
+		if (rc == 0)
+			continue;
+
 		if ((fp = fopen(fname, "r")) == NULL) {
 			dt_dprintf("skipping library %s: %s\n",
 				   fname, strerror(errno));
 			continue;
 		}
 
+		snap.ls_stale = 1;
 		dtp->dt_filetag = fname;
 		if (dt_lib_depend_add(dtp, &dtp->dt_lib_dep, fname) != 0)
 			goto err_close;
@@ -1106,6 +1772,7 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 	}
 
 	closedir(dirp);
+	dt_libsnap_close(dtp, &snap, 1);
 
 	/*
 	 * Finish building the graph containing the library dependencies
@@ -1150,6 +1817,7 @@ err_close:
 	fclose(fp);
 err_closedir:
 	closedir(dirp);
+	dt_libsnap_close(dtp, &snap, 0);
 err:
 	dt_lib_depend_free(dtp);
 	return -1; /* preserve dt_errno */
@@ -633,29 +633,39 @@ dt_idhash_populate(dt_idhash_t *dhp)
 	}
 }
 
+/*
+ * Identifier hashes are open-addressing tables with linear probing, sized to a
+ * power of two.  Each slot caches the hash value of the identifier name so that
+ * probing rarely needs to look at the identifier itself.  The table is
+ * allocated on the first insert, and doubles in size whenever it would become
+ * more than 3/4 full.  Deletion shifts the following entries of the cluster
+ * back, so no tombstones are needed.
+ *
+ * If more than one identifier with the same name is inserted, the most recent
+ * one comes first in the probe sequence, so it is the one that is found.
+ */
+#define DT_IDHASH_MINSZ	16
+
 dt_idhash_t *
 dt_idhash_create(const char *name, const dt_ident_t *tmpl,
     uint_t min, uint_t max)
 {
 	dt_idhash_t *dhp;
-	size_t size;
 
 	assert(min <= max);
 
-	size = sizeof(dt_idhash_t) +
-	    sizeof(dt_ident_t *) * (_dtrace_strbuckets - 1);
-
-	if ((dhp = malloc(size)) == NULL)
+	if ((dhp = malloc(sizeof(dt_idhash_t))) == NULL)
 		return NULL;
 
-	memset(dhp, 0, size);
+	memset(dhp, 0, sizeof(dt_idhash_t));
 	dhp->dh_name = name;
 	dhp->dh_tmpl = tmpl;
 	dhp->dh_nextid = min;
 	dhp->dh_minid = min;
 	dhp->dh_maxid = max;
 	dhp->dh_nextoff = 0;
-	dhp->dh_hashsz = _dtrace_strbuckets;
+	dhp->dh_hashsz = 0;
+	dhp->dh_slots = NULL;
 
 	return dhp;
 }
@@ -672,31 +682,113 @@ dt_idhash_create(const char *name, const dt_ident_t *tmpl,
 void
 dt_idhash_destroy(dt_idhash_t *dhp)
 {
-	dt_ident_t *idp, *next;
+	dt_ident_t *idp;
 	ulong_t i;
 
 	if (!dhp)
 		return;
 
 	for (i = 0; i < dhp->dh_hashsz; i++) {
-		for (idp = dhp->dh_hash[i]; idp != NULL; idp = next) {
-			next = idp->di_next;
-			if (idp->di_ops)
-				idp->di_ops->di_dtor(idp);
-		}
+		if ((idp = dhp->dh_slots[i].ds_ident) != NULL && idp->di_ops)
+			idp->di_ops->di_dtor(idp);
 	}
 
 	for (i = 0; i < dhp->dh_hashsz; i++) {
-		for (idp = dhp->dh_hash[i]; idp != NULL; idp = next) {
-			next = idp->di_next;
+		if ((idp = dhp->dh_slots[i].ds_ident) != NULL) {
 			free(idp->di_name);
 			free(idp);
 		}
 	}
 
+	free(dhp->dh_slots);
 	free(dhp);
 }
 
+/*
+ * Double the size of the table (or allocate the initial one).  The entries are
+ * re-inserted starting from a free slot, so that every cluster is visited from
+ * front to back and identifiers with the same name remain in order.
+ */
+static int
+dt_idhash_grow(dt_idhash_t *dhp)
+{
+	ulong_t osz = dhp->dh_hashsz;
+	ulong_t sz = osz ? osz * 2 : DT_IDHASH_MINSZ;
+	dt_idslot_t *oslots = dhp->dh_slots;
+	dt_idslot_t *slots;
+	ulong_t i, j, k;
+
+	if ((slots = calloc(sz, sizeof(dt_idslot_t))) == NULL)
+		return -1;
+
+	for (j = 0; j < osz && oslots[j].ds_ident != NULL; j++)
+		continue;
+
+	for (i = 0; i < osz; i++) {
+		dt_idslot_t *dsp = &oslots[(i + j) % osz];
+
+		if (dsp->ds_ident == NULL)
+			continue;
+
+		for (k = dsp->ds_hval & (sz - 1); slots[k].ds_ident != NULL;
+		    k = (k + 1) & (sz - 1))
+			continue;
+
+		slots[k] = *dsp;
+	}
+
+	free(oslots);
+	dhp->dh_slots = slots;
+	dhp->dh_hashsz = sz;
+
+	return 0;
+}
+
+/*
+ * Make room for one more identifier.  If the table cannot be grown, we can
+ * still carry on (at a higher load) as long as a free slot remains.
+ */
+static int
+dt_idhash_reserve(dt_idhash_t *dhp)
+{
+	if ((dhp->dh_nelems + 1) * 4 <= dhp->dh_hashsz * 3)
+		return 0;
+
+	if (dt_idhash_grow(dhp) == 0 || dhp->dh_nelems + 1 < dhp->dh_hashsz)
+		return 0;
+
+	return -1;
+}
+
+/*
+ * Add an identifier to the table (which must have a free slot).  If we come
+ * across an identifier with the same name, the new one takes its slot and the
+ * older one moves on down the probe sequence.
+ */
+static void
+dt_idhash_link(dt_idhash_t *dhp, dt_ident_t *idp)
+{
+	ulong_t mask = dhp->dh_hashsz - 1;
+	uint32_t hval = str2hval(idp->di_name, 0);
+	dt_idslot_t *dsp;
+	ulong_t i;
+
+	for (i = hval & mask; (dsp = &dhp->dh_slots[i])->ds_ident != NULL;
+	    i = (i + 1) & mask) {
+		if (dsp->ds_hval == hval &&
+		    strcmp(dsp->ds_ident->di_name, idp->di_name) == 0) {
+			dt_ident_t *odp = dsp->ds_ident;
+
+			dsp->ds_ident = idp;
+			idp = odp;
+		}
+	}
+
+	dsp->ds_hval = hval;
+	dsp->ds_ident = idp;
+	dhp->dh_nelems++;
+}
+
 void
 dt_idhash_update(dt_idhash_t *dhp)
 {
@@ -705,16 +797,17 @@ dt_idhash_update(dt_idhash_t *dhp)
 	ulong_t i;
 
 	for (i = 0; i < dhp->dh_hashsz; i++) {
-		for (idp = dhp->dh_hash[i]; idp != NULL; idp = idp->di_next) {
-			/*
-			 * Right now we're hard coding which types need to be
-			 * reset, but ideally this would be done dynamically.
-			 */
-			if (idp->di_kind == DT_IDENT_ARRAY ||
-			    idp->di_kind == DT_IDENT_SCALAR ||
-			    idp->di_kind == DT_IDENT_AGG)
-				nextid = MAX(nextid, idp->di_id + 1);
-		}
+		if ((idp = dhp->dh_slots[i].ds_ident) == NULL)
+			continue;
+
+		/*
+		 * Right now we're hard coding which types need to be
+		 * reset, but ideally this would be done dynamically.
+		 */
+		if (idp->di_kind == DT_IDENT_ARRAY ||
+		    idp->di_kind == DT_IDENT_SCALAR ||
+		    idp->di_kind == DT_IDENT_AGG)
+			nextid = MAX(nextid, idp->di_id + 1);
 	}
 
 	dhp->dh_nextid = nextid;
@@ -723,15 +816,22 @@ dt_idhash_update(dt_idhash_t *dhp)
 dt_ident_t *
 dt_idhash_lookup(dt_idhash_t *dhp, const char *name)
 {
-	uint_t h = str2hval(name, 0) % dhp->dh_hashsz;
-	dt_ident_t *idp;
+	uint32_t hval = str2hval(name, 0);
+	ulong_t mask, i;
+	dt_idslot_t *dsp;
 
 	if (dhp->dh_tmpl != NULL)
 		dt_idhash_populate(dhp); /* fill hash w/ initial population */
 
-	for (idp = dhp->dh_hash[h]; idp != NULL; idp = idp->di_next) {
-		if (strcmp(idp->di_name, name) == 0)
-			return idp;
+	if (dhp->dh_hashsz == 0)
+		return NULL;
+
+	mask = dhp->dh_hashsz - 1;
+	for (i = hval & mask; (dsp = &dhp->dh_slots[i])->ds_ident != NULL;
+	    i = (i + 1) & mask) {
+		if (dsp->ds_hval == hval &&
+		    strcmp(dsp->ds_ident->di_name, name) == 0)
+			return dsp->ds_ident;
 	}
 
 	return NULL;
@@ -777,22 +877,20 @@ dt_idhash_insert(dt_idhash_t *dhp, const char *name, ushort_t kind,
     const dt_idops_t *ops, void *iarg, ulong_t gen)
 {
 	dt_ident_t *idp;
-	ulong_t h;
 
 	if (dhp->dh_tmpl != NULL)
 		dt_idhash_populate(dhp); /* fill hash w/ initial population */
 
+	if (dt_idhash_reserve(dhp) == -1)
+		return NULL;
+
 	idp = dt_ident_create(name, kind, flags, id, attr, vers, ops, iarg,
 			      gen);
 	if (idp == NULL)
 		return NULL;
 
-	h = str2hval(name, 0) % dhp->dh_hashsz;
-	idp->di_next = dhp->dh_hash[h];
 	idp->di_hash = dhp;
-
-	dhp->dh_hash[h] = idp;
-	dhp->dh_nelems++;
+	dt_idhash_link(dhp, idp);
 
 	if (dhp->dh_defer != NULL)
 		dhp->dh_defer(dhp, idp);
@@ -800,48 +898,61 @@ dt_idhash_insert(dt_idhash_t *dhp, const char *name, ushort_t kind,
 	return idp;
 }
 
-void
+/*
+ * Insert an existing identifier.  This is also used outside of the compiler
+ * (e.g. when probes are declared at open time), so a failure to make room for
+ * the identifier is reported to the caller rather than raised as an error.
+ */
+int
 dt_idhash_xinsert(dt_idhash_t *dhp, dt_ident_t *idp)
 {
-	ulong_t h;
-
 	if (dhp->dh_tmpl != NULL)
 		dt_idhash_populate(dhp); /* fill hash w/ initial population */
 
-	h = str2hval(idp->di_name, 0) % dhp->dh_hashsz;
-	idp->di_next = dhp->dh_hash[h];
+	if (dt_idhash_reserve(dhp) == -1)
+		return -1;
+
 	idp->di_hash = dhp;
 	idp->di_flags &= ~DT_IDFLG_ORPHAN;
-
-	dhp->dh_hash[h] = idp;
-	dhp->dh_nelems++;
+	dt_idhash_link(dhp, idp);
 
 	if (dhp->dh_defer != NULL)
 		dhp->dh_defer(dhp, idp);
+
+	return 0;
 }
 
 void
 dt_idhash_delete(dt_idhash_t *dhp, dt_ident_t *key)
 {
-	uint_t h = str2hval(key->di_name, 0) % dhp->dh_hashsz;
-	dt_ident_t **pp = &dhp->dh_hash[h];
-	dt_ident_t *idp;
+	uint32_t hval = str2hval(key->di_name, 0);
+	ulong_t mask = dhp->dh_hashsz - 1;
+	dt_idslot_t *dsp;
+	ulong_t i, j;
 
-	for (idp = dhp->dh_hash[h]; idp != NULL; idp = idp->di_next) {
-		if (idp == key)
-			break;
-		else
-			pp = &idp->di_next;
-	}
+	assert(dhp->dh_nelems != 0);
 
-	assert(idp == key);
-	*pp = idp->di_next;
+	for (i = hval & mask; dhp->dh_slots[i].ds_ident != key;
+	    i = (i + 1) & mask)
+		assert(dhp->dh_slots[i].ds_ident != NULL);
 
-	assert(dhp->dh_nelems != 0);
+	/*
+	 * Close the gap: move each following entry in the cluster into the
+	 * free slot, unless that slot comes before its home slot.
+	 */
+	for (j = (i + 1) & mask; (dsp = &dhp->dh_slots[j])->ds_ident != NULL;
+	    j = (j + 1) & mask) {
+		if (((j - dsp->ds_hval) & mask) >= ((j - i) & mask)) {
+			dhp->dh_slots[i] = *dsp;
+			i = j;
+		}
+	}
+
+	dhp->dh_slots[i].ds_ident = NULL;
 	dhp->dh_nelems--;
 
-	if (!(idp->di_flags & DT_IDFLG_ORPHAN))
-		dt_ident_destroy(idp);
+	if (!(key->di_flags & DT_IDFLG_ORPHAN))
+		dt_ident_destroy(key);
 }
 
 static int
@@ -871,7 +982,7 @@ dt_idhash_iter(dt_idhash_t *dhp, dt_idhash_f *func, void *data)
 	ids = alloca(sizeof(dt_ident_t *) * n);
 
 	for (i = 0, j = 0; i < dhp->dh_hashsz; i++) {
-		for (idp = dhp->dh_hash[i]; idp != NULL; idp = idp->di_next)
+		if ((idp = dhp->dh_slots[i].ds_ident) != NULL)
 			ids[j++] = idp;
 	}
 
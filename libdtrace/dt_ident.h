@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2020, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -60,7 +60,7 @@ typedef struct dt_ident {
 	ctf_id_t di_type;	/* CTF identifier for the variable data type */
 	int di_offset;		/* storage offset */
 	int di_size;		/* storage size */
-	struct dt_ident *di_next; /* pointer to next ident in hash chain */
+	struct dt_ident *di_next; /* pointer to next ident in list */
 	ulong_t di_gen;		/* generation number (pass that created me) */
 	int di_lineno;		/* line number that defined this identifier */
 	struct dt_idhash *di_hash; /* idhash this identifier belongs to */
@@ -97,6 +97,11 @@ typedef struct dt_ident {
 
 #define DT_IDENT_UNDEF	UINT_MAX /* id for (as yet) undefined identifiers */
 
+typedef struct dt_idslot {
+	uint32_t ds_hval;	/* cached hash value of the identifier name */
+	dt_ident_t *ds_ident;	/* identifier (NULL if the slot is free) */
+} dt_idslot_t;
+
 typedef struct dt_idhash {
 	dt_list_t dh_list;	/* list prev/next pointers for dt_idstack */
 	const char *dh_name;	/* name of this hash table */
@@ -107,8 +112,8 @@ typedef struct dt_idhash {
 	uint_t dh_maxid;	/* max id to be returned by idhash_nextid() */
 	uint_t dh_nextoff;	/* next offset to use for storage allocation */
 	ulong_t dh_nelems;	/* number of identifiers in hash table */
-	ulong_t dh_hashsz;	/* number of entries in dh_buckets array */
-	dt_ident_t *dh_hash[1];	/* array of hash table bucket pointers */
+	ulong_t dh_hashsz;	/* number of entries in dh_slots array */
+	dt_idslot_t *dh_slots;	/* open-addressing hash table slots */
 } dt_idhash_t;
 
 typedef struct dt_idstack {
@@ -140,7 +145,7 @@ extern dt_ident_t *dt_idhash_insert(dt_idhash_t *, const char *, ushort_t,
     ushort_t, uint_t, dtrace_attribute_t, uint_t,
     const dt_idops_t *, void *, ulong_t);
 
-extern void dt_idhash_xinsert(dt_idhash_t *, dt_ident_t *);
+extern int dt_idhash_xinsert(dt_idhash_t *, dt_ident_t *);
 extern void dt_idhash_delete(dt_idhash_t *, dt_ident_t *);
 
 typedef int dt_idhash_f(dt_idhash_t *, dt_ident_t *, void *);
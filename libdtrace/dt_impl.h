@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2010, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2010, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -170,6 +170,7 @@ typedef struct dt_kern_path {
 #define DT_DM_KERNEL		0x2	/* module is associated with a kernel object */
 #define DT_DM_CTF_ARCHIVED	0x4	/* module found in a CTF archive */
 #define DT_DM_KERN_UNLOADED	0x8	/* module not loaded into the kernel */
+#define DT_DM_CTF_BTF		0x10	/* module CTF converted from BTF */
 
 typedef struct dt_ahashent {
 	struct dt_ahashent *dtahe_prev;		/* prev on hash chain */
@@ -180,6 +181,8 @@ typedef struct dt_ahashent {
 	size_t dtahe_size;			/* size of data */
 	dtrace_aggdata_t dtahe_data;		/* data */
 	void (*dtahe_aggregate)(int64_t *, int64_t *, size_t); /* function */
+	uint64_t dtahe_gen;			/* snapshot gen. of last change */
+	caddr_t dtahe_base;			/* data last reported as delta */
 } dt_ahashent_t;
 
 typedef struct dt_ahash {
@@ -206,24 +209,26 @@ typedef struct dt_tstring {
 } dt_tstring_t;
 
 /*
- * To provide a lock-free aggregation write mechanism for the producer,
- * two copies of each aggregation can be used.  A latch sequence number
- * on each CPU can be incremented to indicate to the consumer which copy
- * should be read and whether a copy has changed during reading.
- *
- * Until BPF maps can be mmapped, however, we cannot take advantage of
- * this technique.  Using only a single-copy, of course, saves precious
- * BPF map space.
- *
- * Pick DT_AGG_NUM_COPIES to be either 1 or 2.
+ * Clause prefilter: an equality test of a built-in variable against a constant
+ * that is known to be the first term evaluated in the clause predicate.  The
+ * trampoline of a probe evaluates these before setting up the DTrace context,
+ * so that events for which no clause can fire are discarded cheaply.  The
+ * prefilters are kept in dtp->dt_pfilters, by clause identifier.
  */
-#define DT_AGG_NUM_COPIES 1
+typedef struct dt_pfilter {
+	const struct dt_ident *pf_clause;	/* clause identifier */
+	uint_t		pf_var;			/* DIF_VAR_* identifier */
+	uint64_t	pf_val;			/* integer constant */
+	char		pf_str[16];		/* string constant (execname) */
+	struct dt_hentry pf_he;			/* htab links */
+} dt_pfilter_t;
 
 typedef struct dt_aggregate {
 	char **dtat_cpu_buf;		/* per-CPU agg snapshot buffers */
 	char *dtat_buf;			/* aggregation snapshot buffer */
 	int dtat_flags;			/* aggregate flags */
 	dt_ahash_t dtat_hash;		/* aggregate hash table */
+	uint64_t dtat_gen;		/* snapshot generation */
 } dt_aggregate_t;
 
 typedef struct dt_dirpath {
@@ -242,24 +247,6 @@ typedef struct dt_lib_depend {
 	dt_list_t dtld_dependents;	/* linked-list of lib dependents */
 } dt_lib_depend_t;
 
-typedef struct dt_spec_buf_data {
-	dt_list_t dsbd_list;		/* linked-list forward/back pointers */
-	unsigned int dsbd_cpu;		/* cpu for data */
-	char *dsbd_data;		/* data for later processing */
-	uint32_t dsbd_size;		/* size of data */
-} dt_spec_buf_data_t;
-
-typedef struct dt_spec_buf {
-	dtrace_hdl_t *dtsb_dtp;		/* backpointer to the dtrace instance */
-	int32_t dtsb_id;		/* speculation ID */
-	size_t dtsb_size;		/* size of all buffers in this spec */
-	int dtsb_committing;		/* when draining, nonzero if commit */
-	dt_bpf_specs_t dtsb_spec;	/* bpf-side specs record for this spec
-					   (buffer read/write counts).  */
-	dt_list_t dtsb_dsbd_list;	/* list of dt_spec_bufs */
-	struct dt_hentry dtsb_he;	/* htab links */
-} dt_spec_buf_t;
-
 /*
  * This will be raised much higher in future: right now it is nailed low
  * because the search-for-free-speculation code is unrolled rather than being a
@@ -267,6 +254,13 @@ typedef struct dt_spec_buf {
  */
 #define DT_MAX_NSPECS 16		/* sanity upper bound on speculations */
 
+/*
+ * Upper bound on the size of the speculation buffer for a single speculation
+ * on a single CPU.  The kernel cannot allocate BPF map values that are much
+ * larger than this, and the buffers are allocated for every CPU.
+ */
+#define DT_MAX_SPECBUFSZ	(1024 * 1024)
+
 typedef uint32_t dt_version_t;		/* encoded version (see below) */
 
 struct dtrace_hdl {
@@ -292,6 +286,8 @@ struct dtrace_hdl {
 	dt_strtab_t *dt_ccstab;	/* global string table (during compilation) */
 	uint_t dt_strlen;	/* global string table (runtime) size */
 	uint_t dt_maxreclen;	/* largest record size across programs */
+	uint_t dt_specbufsz;	/* speculation buffer size (per CPU) */
+	int dt_usespecbufs;	/* programs append to speculation buffers */
 	uint_t dt_maxtlslen;	/* largest TLS variable across programs */
 	uint_t dt_maxlvaralloc;	/* largest lvar alloc across pcbs */
 	dt_tstring_t *dt_tstrings; /* temporary string slots */
@@ -301,6 +297,10 @@ struct dtrace_hdl {
 	ctf_archive_t *dt_ctfa; /* ctf archive for the entire kernel tree */
 	ctf_file_t *dt_shared_ctf; /* Handle to the shared CTF */
 	char *dt_ctfa_path;	/* path to vmlinux.ctfa */
+	struct dt_btf *dt_btf;	/* vmlinux BTF, if used instead of CTF */
+	char *dt_btfcache;	/* directory for CTF converted from BTF */
+	struct dt_typeidx *dt_typeidx; /* kernel type name index */
+	char *dt_typecache;	/* directory for the kernel type index */
 	dt_htab_t *dt_kernpaths; /* hash table of dt_kern_path_t's */
 	dt_module_t *dt_exec;	/* pointer to executable module */
 	dt_module_t *dt_cdefs;	/* pointer to C dynamic type module */
@@ -322,10 +322,12 @@ struct dtrace_hdl {
 	struct dt_probe **dt_probes; /* array of probes */
 	uint32_t dt_probes_sz;	/* size of array of probes */
 	uint32_t dt_probe_id;	/* next available probe id */
+	struct dt_probe_index *dt_probe_index; /* probe name indexes */
 
 	struct dt_probe *dt_error; /* ERROR probe */
 
 	dt_htab_t *dt_provs;	/* hash table of dt_provider_t's */
+	dt_htab_t *dt_pfilters;	/* hash table of clause prefilters */
 	const struct dt_provider *dt_prov_pid; /* PID provider */
 	dt_proc_hash_t *dt_procs; /* hash table of grabbed process handles */
 	dt_intdesc_t dt_ints[6]; /* cached integer type descriptions */
@@ -354,11 +356,13 @@ struct dtrace_hdl {
 	int dt_cpp_args;	/* size of dt_cpp_argv[] array */
 	char *dt_ld_path;	/* pathname of ld(1) to invoke if needed */
 	dt_list_t dt_lib_path;	/* linked-list forming library search path */
+	char *dt_libcache;	/* directory for library dependency snapshots */
 	char *dt_module_path;	/* pathname of kernel module root */
 	dt_version_t dt_kernver;/* kernel version, used in the libpath */
 	uid_t dt_useruid;	/* lowest non-system uid: set via -xuseruid */
 	char *dt_sysslice;	/* the systemd system slice: set via -xsysslice */
 	uint_t dt_lazyload;	/* boolean:  set via -xlazyload */
+	uint_t dt_nopeephole;	/* boolean:  set via -xnopeephole */
 	uint_t dt_droptags;	/* boolean:  set via -xdroptags */
 	uint_t dt_active;	/* boolean:  set once tracing is active */
 	uint_t dt_stopped;	/* boolean:  set once tracing is stopped */
@@ -372,6 +376,7 @@ struct dtrace_hdl {
 	uint_t dt_linktype;	/* dtrace link output file type (see below) */
 	uint_t dt_xlatemode;	/* dtrace translator linking mode (see below) */
 	uint_t dt_stdcmode;	/* dtrace stdc compatibility mode (see below) */
+	uint_t dt_cppmode;	/* dtrace preprocessor mode (see below) */
 	uint_t dt_treedump;	/* dtrace tree debug bitmap (see below) */
 	uint_t dt_disasm;	/* dtrace disassembler bitmap (see below) */
 	uint64_t dt_options[DTRACEOPT_MAX]; /* dtrace run-time options */
@@ -383,6 +388,7 @@ struct dtrace_hdl {
 	int dt_stdout_fd;	/* file descriptor for saved stdout */
 	int dt_poll_fd;		/* file descriptor for event polling */
 	int dt_proc_fd;		/* file descriptor for proc eventfd */
+	int dt_bpfstats_fd;	/* file descriptor enabling BPF prog stats */
 	int dt_stmap_fd;	/* file descriptor for the 'state' BPF map */
 	int dt_aggmap_fd;	/* file descriptor for the 'aggs' BPF map */
 	dtrace_handle_err_f *dt_errhdlr; /* error handler, if any */
@@ -398,8 +404,8 @@ struct dtrace_hdl {
 	hrtime_t dt_laststatus;	/* last status */
 	hrtime_t dt_lastswitch;	/* last switch of buffer data */
 	hrtime_t dt_lastagg;	/* last snapshot of aggregation data */
-	dt_list_t dt_spec_bufs_draining; /* List of spec bufs being drained */
-	dt_htab_t *dt_spec_bufs;/* spec ID -> list of dt_spec_bufs_head_t */
+	hrtime_t dt_laststats;	/* last dump of consumer statistics */
+	dtrace_stats_t dt_stats; /* consumer statistics */
 	char *dt_sprintf_buf;	/* buffer for dtrace_sprintf() */
 	int dt_sprintf_buflen;	/* length of dtrace_sprintf() buffer */
 	pthread_mutex_t dt_sprintf_lock; /* lock for dtrace_sprintf() buffer */
@@ -452,6 +458,13 @@ struct dtrace_hdl {
 #define	DT_STDC_XA	0	/* Strict ISO C. */
 #define	DT_STDC_XS	1	/* K&R C: __STDC__ not defined */
 
+/*
+ * Values for the dt_cppmode property, which is used by the compiler to decide
+ * how to preprocess input files.  Set using -xcppmode=<mode>.
+ */
+#define	DT_CPP_EXTERNAL	0	/* always run cpp(1) */
+#define	DT_CPP_EMBEDDED	1	/* use embedded cpp, cpp(1) if needed */
+
 /*
  * Values for the DTrace debug assertion property, which turns on assertions
  * which may be expensive while running the testsuite.
@@ -653,7 +666,8 @@ enum {
 	EDT_OBJIO,		/* cannot read object file or module name mapping */
 	EDT_READMAXSTACK,	/* cannot read kernel param perf_event_max_stack */
 	EDT_TRACEMEM,		/* missing or corrupt tracemem() record */
-	EDT_PCAP		/* missing or corrupt pcap() record */
+	EDT_PCAP,		/* missing or corrupt pcap() record */
+	EDT_NOSTATS		/* probe statistics are not enabled */
 };
 
 /*
@@ -696,6 +710,7 @@ extern int dt_str2kver(const char *, dt_version_t *);
  */
 extern char *dt_cpp_add_arg(dtrace_hdl_t *, const char *);
 extern char *dt_cpp_pop_arg(dtrace_hdl_t *);
+extern FILE *dt_pp_embedded(dtrace_hdl_t *, FILE *, FILE **);
 
 extern int dt_set_errno(dtrace_hdl_t *, int);
 extern void dt_set_errmsg(dtrace_hdl_t *, const char *, const char *,
@@ -760,12 +775,13 @@ extern int dt_reduce(dtrace_hdl_t *, dt_version_t);
 extern dtrace_difo_t *dt_as(dt_pcb_t *);
 extern dtrace_difo_t *dt_difo_copy(dtrace_hdl_t *dtp, const dtrace_difo_t *odp);
 
+extern hrtime_t dt_phase_start(void);
+extern void dt_phase_end(dtrace_hdl_t *, int, hrtime_t);
+
 extern int dt_aggregate_go(dtrace_hdl_t *);
 extern int dt_aggregate_init(dtrace_hdl_t *);
 extern void dt_aggregate_destroy(dtrace_hdl_t *);
 
-extern int dt_consume_init(dtrace_hdl_t *);
-extern void dt_consume_fini(dtrace_hdl_t *);
 
 extern dtrace_datadesc_t *dt_datadesc_hold(dtrace_datadesc_t *ddp);
 extern void dt_datadesc_release(dtrace_hdl_t *, dtrace_datadesc_t *);
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -277,13 +277,13 @@ dt_aggid_add(dtrace_hdl_t *dtp, const dt_ident_t *aid)
 	/*
 	 * Note the relationship between the aggregation storage
 	 * size (di_size) and the aggregation data size (dtagd_size):
-	 *     di_size = dtagd_size * (num copies) + (size of latch seq #)
+	 *     di_size = dtagd_size + (size of data flag)
 	 */
 	agg->dtagd_id = id;
 	agg->dtagd_name = aid->di_name;
 	agg->dtagd_sig = ((dt_idsig_t *)aid->di_data)->dis_auxinfo;
 	agg->dtagd_varid = aid->di_id;
-	agg->dtagd_size = (aid->di_size - sizeof(uint64_t)) / DT_AGG_NUM_COPIES;
+	agg->dtagd_size = aid->di_size - sizeof(uint64_t);
 	agg->dtagd_nrecs = agg->dtagd_size / sizeof(uint64_t);
 
 	recs = dt_calloc(dtp, agg->dtagd_nrecs, sizeof(dtrace_recdesc_t));
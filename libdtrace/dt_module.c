@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2009, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2009, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -23,10 +23,12 @@
 
 #include <zlib.h>
 
+#include <dt_btf.h>
 #include <dt_kernel_module.h>
 #include <dt_module.h>
 #include <dt_impl.h>
 #include <dt_string.h>
+#include <dt_typeidx.h>
 
 #define KSYM_NAME_MAX 128		    /* from kernel/scripts/kallsyms.c */
 #define GZCHUNKSIZE (1024*512)		    /* gzip uncompression chunk size */
@@ -401,7 +403,7 @@ dt_module_load(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	 * the CTF section.)
 	 */
 
-	if (!(dmp->dm_flags & DT_DM_CTF_ARCHIVED)) {
+	if (!(dmp->dm_flags & (DT_DM_CTF_ARCHIVED | DT_DM_CTF_BTF))) {
 		if ((dmp->dm_elf == NULL) && (dt_module_init_elf(dtp, dmp) != 0))
 			return -1; /* dt_errno is set for us */
 
@@ -542,7 +544,7 @@ dt_module_getctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	if (dmp->dm_ctfp != NULL)
 		return dmp->dm_ctfp;
 
-	assert(!(dmp->dm_flags & DT_DM_CTF_ARCHIVED));
+	assert(!(dmp->dm_flags & (DT_DM_CTF_ARCHIVED | DT_DM_CTF_BTF)));
 
 	if ((dmp->dm_ops == &dt_modops_64) || (dmp->dm_ops == NULL))
 		model = CTF_MODEL_LP64;
@@ -828,7 +830,8 @@ dt_kern_module_init(dtrace_hdl_t *dtp, dt_module_t *dmp)
 /*
  * Determine the location of a kernel module's CTF data.
  *
- * If the module is a CTF archive, also load it in.
+ * If the module is a CTF archive, also load it in.  If there is no CTF archive,
+ * use the module's BTF instead.
  */
 static void
 dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
@@ -915,7 +918,20 @@ dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 		}
 	}
 
-	if (dmp->dm_ctfp != NULL) {
+	/*
+	 * Without a CTF archive, fall back to the kernel's BTF for the module,
+	 * converted to CTF.
+	 */
+	if (dtp->dt_ctfa == NULL && dmp->dm_ctfp == NULL) {
+		dmp->dm_ctfp = dt_btf_module_ctf(dtp, dmp);
+
+		if (dmp->dm_ctfp != NULL) {
+			dt_dprintf("loaded CTF container for %s from BTF "
+			    "(%p)\n", dmp->dm_name, (void *)dmp->dm_ctfp);
+			dmp->dm_flags |= DT_DM_CTF_BTF;
+			ctf_setspecific(dmp->dm_ctfp, dmp);
+		}
+	} else if (dmp->dm_ctfp != NULL) {
 		const char *parent;
 
 		/*
@@ -1588,9 +1604,11 @@ dtrace_lookup_by_type(dtrace_hdl_t *dtp, const char *object, const char *name,
 	dtrace_typeinfo_t ti;
 	dt_module_t *dmp;
 	int found = 0;
-	ctf_id_t id;
+	ctf_id_t id, idxid = CTF_ERR;
 	uint_t n;
 	int justone;
+	int useidx = -1;
+	const char *idxmod = NULL;
 
 	uint_t mask = 0; /* mask of dt_module flags to match */
 	uint_t bits = 0; /* flag bits that must be present */
@@ -1624,6 +1642,26 @@ dtrace_lookup_by_type(dtrace_hdl_t *dtp, const char *object, const char *name,
 		if ((dmp->dm_flags & mask) != bits)
 			continue; /* failed to match required attributes */
 
+		/*
+		 * Kernel modules in the CTF archive whose CTF is not loaded yet
+		 * are skipped unless the kernel type index says that the type
+		 * is defined there.  The index only becomes available once the
+		 * archive is open, i.e. after the first kernel module is
+		 * loaded (normally vmlinux, which is searched early).
+		 */
+		if (!justone && (dmp->dm_flags & DT_DM_KERNEL) &&
+		    dmp->dm_ctfp == NULL) {
+			if (useidx == -1 &&
+			    dt_typeidx_lookup(dtp, name, &idxmod, &idxid) == 0)
+				useidx = 1;
+
+			if (useidx == 1 &&
+			    dt_typeidx_has_module(dtp, dmp->dm_name) &&
+			    (idxmod == NULL ||
+			     strcmp(idxmod, dmp->dm_name) != 0))
+				continue;
+		}
+
 		/*
 		 * If we can't load the CTF container, continue on to the next
 		 * module.  If our search was scoped to only one module then
@@ -1640,8 +1678,18 @@ dtrace_lookup_by_type(dtrace_hdl_t *dtp, const char *object, const char *name,
 		 * match is a forward declaration tag, save this choice in
 		 * 'tip' and keep going in the hope that we will locate the
 		 * underlying structure definition.  Otherwise just return.
+		 *
+		 * If the kernel type index led us here, it has the type id
+		 * already.
 		 */
-		if ((id = ctf_lookup_by_name(dmp->dm_ctfp, name)) != CTF_ERR) {
+		if (useidx == 1 && idxmod != NULL &&
+		    (dmp->dm_flags & DT_DM_CTF_ARCHIVED) &&
+		    strcmp(idxmod, dmp->dm_name) == 0)
+			id = idxid;
+		else
+			id = ctf_lookup_by_name(dmp->dm_ctfp, name);
+
+		if (id != CTF_ERR) {
 			tip->dtt_object = dmp->dm_name;
 			tip->dtt_ctfp = dmp->dm_ctfp;
 			tip->dtt_type = id;
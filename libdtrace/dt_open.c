@@ -28,6 +28,7 @@
 #include <libproc.h>
 
 #include <dt_impl.h>
+#include <dt_btf.h>
 #include <dt_pcap.h>
 #include <dt_program.h>
 #include <dt_module.h>
@@ -38,6 +39,7 @@
 #include <dt_probe.h>
 #include <dt_dis.h>
 #include <dt_peb.h>
+#include <dt_typeidx.h>
 
 const dt_version_t _dtrace_versions[] = {
 	DT_VERS_1_0,	/* D API 1.0.0 (PSARC 2001/466) Solaris 10 FCS */
@@ -729,12 +731,14 @@ dt_vopen(int version, int flags, int *errp,
 	dtp->dt_linktype = DT_LTYP_ELF;
 	dtp->dt_xlatemode = DT_XL_STATIC;
 	dtp->dt_stdcmode = DT_STDC_XA;
+	dtp->dt_cppmode = DT_CPP_EXTERNAL;
 	dtp->dt_disasm = DT_DISASM_OPT_DEFAULT;
 	dtp->dt_version = version;
 	dtp->dt_cdefs_fd = -1;
 	dtp->dt_ddefs_fd = -1;
 	dtp->dt_stdout_fd = -1;
 	dtp->dt_poll_fd = -1;
+	dtp->dt_bpfstats_fd = -1;
 	dt_proc_hash_create(dtp);
 	dtp->dt_proc_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 	dtp->dt_nextepid = 1;
@@ -1112,12 +1116,6 @@ dt_vopen(int version, int flags, int *errp,
 	 */
 	dt_dlib_init(dtp);
 
-	/*
-	 * Initialize consume handling, e.g. storage of uncommitted speculations.
-	 */
-	if (dt_consume_init(dtp) < 0)
-		return set_open_errno(dtp, errp, dtp->dt_errno);
-
 	/*
 	 * Initialize the collection of probes that is made available by the
 	 * known providers.
@@ -1203,8 +1201,6 @@ dtrace_close(dtrace_hdl_t *dtp)
 
 	dt_free(dtp, dtp->dt_xlatormap);
 
-	dt_consume_fini(dtp);
-
 	for (idp = dtp->dt_externs; idp != NULL; idp = ndp) {
 		ndp = idp->di_next;
 		dt_ident_destroy(idp);
@@ -1233,6 +1229,8 @@ dtrace_close(dtrace_hdl_t *dtp)
 		ctf_close(dtp->dt_shared_ctf);
 	if (dtp->dt_ctfa != NULL)
 		ctf_arc_close(dtp->dt_ctfa);
+	dt_btf_destroy(dtp, dtp->dt_btf);
+	dt_typeidx_destroy(dtp);
 
 	dt_pcap_destroy(dtp);
 
@@ -1246,6 +1244,8 @@ dtrace_close(dtrace_hdl_t *dtp)
 		close(dtp->dt_proc_fd);
 	if (dtp->dt_poll_fd != -1)
 		close(dtp->dt_poll_fd);
+	if (dtp->dt_bpfstats_fd != -1)
+		close(dtp->dt_bpfstats_fd);
 
 	dt_epid_destroy(dtp);
 	dt_aggid_destroy(dtp);
@@ -1257,6 +1257,7 @@ dtrace_close(dtrace_hdl_t *dtp)
 	dt_probe_fini(dtp);
 
 	dt_htab_destroy(dtp, dtp->dt_provs);
+	dt_htab_destroy(dtp, dtp->dt_pfilters);
 
 	for (i = 1; i < dtp->dt_cpp_argc; i++)
 		free(dtp->dt_cpp_argv[i]);
@@ -1270,6 +1271,9 @@ dtrace_close(dtrace_hdl_t *dtp)
 	free(dtp->dt_cpp_argv);
 	free(dtp->dt_cpp_path);
 	free(dtp->dt_ld_path);
+	free(dtp->dt_libcache);
+	free(dtp->dt_btfcache);
+	free(dtp->dt_typecache);
 	free(dtp->dt_sysslice);
 
 	free(dtp->dt_freopen_filename);
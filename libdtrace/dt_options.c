@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2007, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2007, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -165,6 +165,26 @@ dt_opt_cpp_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return 0;
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_cpp_mode(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	if (arg == NULL)
+		return dt_set_errno(dtp, EDT_BADOPTVAL);
+
+	if (dtp->dt_pcb != NULL)
+		return dt_set_errno(dtp, EDT_BADOPTCTX);
+
+	if (strcmp(arg, "external") == 0)
+		dtp->dt_cppmode = DT_CPP_EXTERNAL;
+	else if (strcmp(arg, "embedded") == 0)
+		dtp->dt_cppmode = DT_CPP_EMBEDDED;
+	else
+		return dt_set_errno(dtp, EDT_BADOPTVAL);
+
+	return 0;
+}
+
 static int
 dt_opt_cpp_opts(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 {
@@ -280,6 +300,15 @@ dt_opt_lazyload(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return 0;
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_nopeephole(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	dtp->dt_nopeephole = 1;
+
+	return 0;
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_ld_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -301,6 +330,26 @@ dt_opt_ld_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return 0;
 }
 
+static int
+dt_opt_btfcache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	char *dir;
+
+	if (arg == NULL)
+		return dt_set_errno(dtp, EDT_BADOPTVAL);
+
+	if (dtp->dt_pcb != NULL)
+		return dt_set_errno(dtp, EDT_BADOPTCTX);
+
+	if ((dir = strdup(arg)) == NULL)
+		return dt_set_errno(dtp, EDT_NOMEM);
+
+	free(dtp->dt_btfcache);
+	dtp->dt_btfcache = dir;
+
+	return 0;
+}
+
 static int
 dt_opt_ctfa_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 {
@@ -321,6 +370,46 @@ dt_opt_ctfa_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return 0;
 }
 
+static int
+dt_opt_libcache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	char *dir;
+
+	if (arg == NULL)
+		return dt_set_errno(dtp, EDT_BADOPTVAL);
+
+	if (dtp->dt_pcb != NULL)
+		return dt_set_errno(dtp, EDT_BADOPTCTX);
+
+	if ((dir = strdup(arg)) == NULL)
+		return dt_set_errno(dtp, EDT_NOMEM);
+
+	free(dtp->dt_libcache);
+	dtp->dt_libcache = dir;
+
+	return 0;
+}
+
+static int
+dt_opt_typecache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	char *dir;
+
+	if (arg == NULL)
+		return dt_set_errno(dtp, EDT_BADOPTVAL);
+
+	if (dtp->dt_pcb != NULL)
+		return dt_set_errno(dtp, EDT_BADOPTCTX);
+
+	if ((dir = strdup(arg)) == NULL)
+		return dt_set_errno(dtp, EDT_NOMEM);
+
+	free(dtp->dt_typecache);
+	dtp->dt_typecache = dir;
+
+	return 0;
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_libdir(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -1039,10 +1128,12 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "aggpercpu", dt_opt_agg, DTRACE_A_PERCPU },
 	{ "amin", dt_opt_amin },
 	{ "argref", dt_opt_cflags, DTRACE_C_ARGREF },
+	{ "btfcache", dt_opt_btfcache },
 	{ "core", dt_opt_core },
 	{ "cpp", dt_opt_cflags, DTRACE_C_CPP },
 	{ "cppargs", dt_opt_cpp_args },
 	{ "cpphdrs", dt_opt_cpp_hdrs },
+	{ "cppmode", dt_opt_cpp_mode },
 	{ "cpppath", dt_opt_cpp_path },
 	{ "ctypes", dt_opt_ctypes },
 	{ "ctfpath", dt_opt_ctfa_path },
@@ -1063,11 +1154,13 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "late", dt_opt_xlate },
 	{ "lazyload", dt_opt_lazyload },
 	{ "ldpath", dt_opt_ld_path },
+	{ "libcache", dt_opt_libcache },
 	{ "libdir", dt_opt_libdir },
 	{ "linkmode", dt_opt_linkmode },
 	{ "linktype", dt_opt_linktype },
 	{ "modpath", dt_opt_module_path },
 	{ "nolibs", dt_opt_cflags, DTRACE_C_NOLIBS },
+	{ "nopeephole", dt_opt_nopeephole },
 	{ "pgmax", dt_opt_pgmax },
 	{ "preallocate", dt_opt_preallocate },
 	{ "procfspath", dt_opt_procfs_path },
@@ -1078,6 +1171,7 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "sysslice", dt_opt_sysslice },
 	{ "tree", dt_opt_tree },
 	{ "tregs", dt_opt_tregs },
+	{ "typecache", dt_opt_typecache },
 	{ "udefs", dt_opt_invcflags, DTRACE_C_UNODEF },
 	{ "undef", dt_opt_cpp_opts, (uintptr_t)"-U" },
 	{ "unodefs", dt_opt_cflags, DTRACE_C_UNODEF },
@@ -1102,16 +1196,21 @@ static const dt_option_t _dtrace_rtoptions[] = {
 	{ "cpu", dt_opt_runtime, DTRACEOPT_CPU },
 	{ "destructive", dt_opt_runtime, DTRACEOPT_DESTRUCTIVE },
 	{ "dynvarsize", dt_opt_size, DTRACEOPT_DYNVARSIZE },
+	{ "fbtfentry", dt_opt_runtime, DTRACEOPT_FBTFENTRY },
 	{ "grabanon", dt_opt_runtime, DTRACEOPT_GRABANON },
 	{ "jstackframes", dt_opt_runtime, DTRACEOPT_JSTACKFRAMES },
 	{ "jstackstrsize", dt_opt_size, DTRACEOPT_JSTACKSTRSIZE },
 	{ "maxframes", dt_opt_runtime, DTRACEOPT_MAXFRAMES },
 	{ "nspec", dt_opt_runtime, DTRACEOPT_NSPEC },
 	{ "pcapsize", dt_opt_pcapsize, DTRACEOPT_PCAPSIZE },
+	{ "probebudget", dt_opt_runtime, DTRACEOPT_PROBEBUDGET },
+	{ "probestats", dt_opt_runtime, DTRACEOPT_PROBESTATS },
 	{ "specsize", dt_opt_size, DTRACEOPT_SPECSIZE },
 	{ "stackframes", dt_opt_runtime, DTRACEOPT_STACKFRAMES },
+	{ "statsrate", dt_opt_rate, DTRACEOPT_STATSRATE },
 	{ "statusrate", dt_opt_rate, DTRACEOPT_STATUSRATE },
 	{ "strsize", dt_opt_strsize, DTRACEOPT_STRSIZE },
+	{ "syscallbatch", dt_opt_runtime, DTRACEOPT_SYSCALLBATCH },
 	{ "ustackframes", dt_opt_runtime, DTRACEOPT_USTACKFRAMES },
 	{ "noresolve", dt_opt_runtime, DTRACEOPT_NORESOLVE },
 	{ NULL }
@@ -1121,6 +1220,7 @@ static const dt_option_t _dtrace_rtoptions[] = {
  * Dynamic run-time options.
  */
 static const dt_option_t _dtrace_drtoptions[] = {
+	{ "aggdelta", dt_opt_runtime, DTRACEOPT_AGGDELTA },
 	{ "aggrate", dt_opt_rate, DTRACEOPT_AGGRATE },
 	{ "aggsortkey", dt_opt_runtime, DTRACEOPT_AGGSORTKEY },
 	{ "aggsortkeypos", dt_opt_runtime, DTRACEOPT_AGGSORTKEYPOS },
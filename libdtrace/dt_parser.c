@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -2363,7 +2363,9 @@ dt_node_inline(dt_node_t *expr)
 	 * Finally, insert the inline identifier into dt_globals to make it
 	 * visible, and then cook 'dnp' to check its type against 'expr'.
 	 */
-	dt_idhash_xinsert(dtp->dt_globals, idp);
+	if (dt_idhash_xinsert(dtp->dt_globals, idp) == -1)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
+
 	return dt_node_cook(dnp, DT_IDFLG_REF);
 }
 
@@ -4375,7 +4377,8 @@ dt_node_provider_cmp(dt_provider_t *pvp, dt_node_t *pnp,
 			old->pr_ident->di_flags |= DT_IDFLG_ORPHAN;
 
 		dt_idhash_delete(pvp->pv_probes, old->pr_ident);
-		dt_probe_declare(pvp, new);
+		if (dt_probe_declare(pvp, new) == -1)
+			longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
 	}
 }
 
@@ -4447,8 +4450,8 @@ dt_cook_provider(dt_node_t *dnp, uint_t idflags)
 		} else if (prp != NULL) {
 			dnerror(pnp, D_PROV_PRDUP, "probe redeclared: %s:%s\n",
 			    dnp->dn_provname, probename);
-		} else
-			dt_probe_declare(pvp, pnp->dn_ident->di_data);
+		} else if (dt_probe_declare(pvp, pnp->dn_ident->di_data) == -1)
+			longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
 
 		dt_cook_probe(pnp, pvp);
 	}
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -55,6 +55,7 @@ dt_pcb_push(dtrace_hdl_t *dtp, dt_pcb_t *pcb)
 
 	memset(pcb, 0, sizeof(dt_pcb_t));
 
+	dt_arena_create(&pcb->pcb_arena);
 	dt_scope_create(&pcb->pcb_dstack);
 	dt_idstack_push(&pcb->pcb_globals, dtp->dt_globals);
 	dt_irlist_create(&pcb->pcb_ir);
@@ -105,6 +106,7 @@ dt_pcb_pop(dtrace_hdl_t *dtp, int err)
 		dt_scope_pop();
 
 	dt_scope_destroy(&pcb->pcb_dstack);
+	dt_arena_destroy(&pcb->pcb_arena);
 	dt_irlist_destroy(&pcb->pcb_ir);
 
 	dt_node_link_free(&pcb->pcb_list);
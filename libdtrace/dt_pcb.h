@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2020, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -20,6 +20,7 @@ extern "C" {
 #include <dt_regset.h>
 #include <dt_decl.h>
 #include <dt_as.h>
+#include <dt_arena.h>
 
 typedef struct dt_pcb {
 	dtrace_hdl_t *pcb_hdl;	/* pointer to library handle */
@@ -43,7 +44,9 @@ typedef struct dt_pcb {
 	dt_regset_t *pcb_regs;	/* register set for code generation */
 	uint32_t pcb_bufoff;	/* output buffer offset (for DFUNCs) */
 	dt_irlist_t pcb_ir;	/* list of unrelocated IR instructions */
+	dt_arena_t pcb_arena;	/* storage for declarations and scopes */
 	uint_t pcb_exitlbl;	/* label for exit of program */
+	uint_t pcb_difoflags;	/* DIFO flags noted during code generation */
 	uint_t pcb_asvidx;	/* assembler vartab index (see dt_as.c) */
 	ulong_t **pcb_asxrefs;	/* assembler imported xlators (see dt_as.c) */
 	uint_t pcb_asxreflen;	/* assembler xlator map length (see dt_as.c) */
@@ -0,0 +1,1401 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * BPF instruction list optimizer.
+ *
+ * The code generator emits straightforward code: values are reloaded from
+ * the stack or the DTrace context whenever they are needed, labels are nop
+ * instructions, and constant operands are often first moved into a register.
+ * Before an instruction list is assembled, dt_irlist_optimize() performs a
+ * few simple passes over it:
+ *
+ *   - redundant load elimination: within a basic block, a load from a memory
+ *     location whose value is known to be held in a register is replaced by
+ *     a register move (or removed altogether if the value is already in the
+ *     destination register).  Values stored by a 64-bit store are forwarded
+ *     to subsequent 64-bit loads of the same location.
+ *   - constant propagation: within a basic block, register operands that are
+ *     known to hold a constant are replaced by an immediate operand, ALU
+ *     operations on constants are folded, and conditional branches with a
+ *     known outcome are turned into unconditional jumps (or removed).
+ *   - dead store elimination: stores to stack slots that are never read, or
+ *     that are overwritten before they are read, are removed.
+ *   - jump folding: jumps to unconditional jumps are threaded, jumps to the
+ *     next instruction are removed, and unreachable code is removed.
+ *
+ * Before these passes, registers that the code generator spilled to the stack
+ * (because it ran out of registers, or because the register was needed as a
+ * function call argument) are reallocated based on register liveness: a spill
+ * is removed if the register still holds the value when it is filled, and the
+ * spilled value is otherwise kept in a callee-saved register (%r6 - %r9) that
+ * is not live across the spill.
+ *
+ * Instructions are never moved, and a labeled instruction always starts a new
+ * basic block.  Removed instructions are turned into nops, and a final pass
+ * drops all nops that do not carry a label.  Instructions that carry an
+ * external reference (relocation) are never rewritten.
+ *
+ * Memory accessed through the frame pointer (%r10) is assumed not to alias
+ * memory accessed through any other register, unless the stack location is
+ * exposed, i.e. its address may have been passed to a function (see
+ * dt_peep_fpmin()).
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <dt_impl.h>
+#include <dt_as.h>
+#include <bpf_asm.h>
+
+#define DT_PEEP_MAXPASS		8	/* maximum number of optimizer passes */
+#define DT_PEEP_MAXFACTS		32	/* maximum number of known values */
+#define DT_PEEP_MAXSTORES	32	/* maximum number of pending stores */
+#define DT_PEEP_MAXTHREAD	16	/* maximum number of threaded jumps */
+
+#define DT_PEEP_NREGS		(BPF_REG_10 + 1)
+#define DT_PEEP_ALLREGS		((1 << DT_PEEP_NREGS) - 1)
+#define DT_PEEP_ARGREGS		0x3e	/* %r1 - %r5 */
+#define DT_PEEP_CALLREGS	0x3f	/* %r0 - %r5 */
+#define DT_PEEP_FPALL		INT_MIN	/* all stack locations are exposed */
+
+#define BPF_IS_LDDW(x)		((x).code == (BPF_LD | BPF_IMM | BPF_DW))
+
+/*
+ * A register known to hold the value of a memory location.
+ */
+typedef struct dt_peep_mem {
+	int	pm_reg;			/* register holding the value */
+	int	pm_base;		/* base register of memory location */
+	int	pm_off;			/* offset from base register */
+	int	pm_size;		/* size of memory location */
+} dt_peep_mem_t;
+
+typedef struct dt_peep {
+	dt_irlist_t	*pp_dlp;	/* instruction list */
+	dt_irnode_t	**pp_nodes;	/* instruction list nodes */
+	uint_t		pp_nnodes;	/* number of nodes */
+	uint_t		*pp_labels;	/* label to node index */
+	int		pp_fpmin;	/* lowest exposed stack offset */
+	int		pp_changed;	/* instruction list was modified */
+
+	/* Basic block state. */
+	uint_t		pp_cmask;	/* registers with a constant value */
+	uint64_t	pp_cval[DT_PEEP_NREGS]; /* constant register values */
+	dt_peep_mem_t	pp_mem[DT_PEEP_MAXFACTS]; /* known memory values */
+	int		pp_nmem;
+	dt_irnode_t	*pp_st[DT_PEEP_MAXSTORES]; /* unread stack stores */
+	int		pp_nst;
+} dt_peep_t;
+
+static int
+dt_peep_size(uint8_t code)
+{
+	switch (BPF_SIZE(code)) {
+	case BPF_B:
+		return 1;
+	case BPF_H:
+		return 2;
+	case BPF_W:
+		return 4;
+	default:
+		return 8;
+	}
+}
+
+static int
+dt_peep_overlap(int off1, int size1, int off2, int size2)
+{
+	return off1 < off2 + size2 && off2 < off1 + size1;
+}
+
+static int
+dt_peep_fits(uint64_t val)
+{
+	return (int64_t)val == (int64_t)(int32_t)val;
+}
+
+/*
+ * Remove an instruction by turning it into a nop.  If the instruction has a
+ * label, the nop will be retained as a label declaration.
+ */
+static void
+dt_peep_remove(dt_peep_t *pp, dt_irnode_t *dip)
+{
+	if (BPF_IS_LDDW(dip->di_instr))
+		dip->di_next->di_instr = BPF_NOP();
+
+	dip->di_instr = BPF_NOP();
+	dip->di_extern = NULL;
+	pp->pp_changed = 1;
+}
+
+/*
+ * Return the index of the first instruction at or after node 'i' that is not
+ * a nop.
+ */
+static uint_t
+dt_peep_insn(const dt_peep_t *pp, uint_t i)
+{
+	while (i < pp->pp_nnodes && BPF_IS_NOP(pp->pp_nodes[i]->di_instr))
+		i++;
+
+	return i;
+}
+
+/*
+ * Return the index of the instruction that follows the instruction at node
+ * 'i'.
+ */
+static uint_t
+dt_peep_next(const dt_peep_t *pp, uint_t i)
+{
+	return dt_peep_insn(pp, i + (BPF_IS_LDDW(pp->pp_nodes[i]->di_instr) ?
+				    2 : 1));
+}
+
+/*
+ * Return the index of the instruction a jump to the given label will arrive
+ * at.
+ */
+static uint_t
+dt_peep_target(const dt_peep_t *pp, uint_t lbl)
+{
+	if (lbl >= pp->pp_dlp->dl_label)
+		return pp->pp_nnodes;
+
+	return dt_peep_insn(pp, pp->pp_labels[lbl]);
+}
+
+/*
+ * Return the set of registers read by an instruction.
+ */
+static uint_t
+dt_peep_uses(const struct bpf_insn *in)
+{
+	uint_t	dst = 1 << in->dst_reg;
+	uint_t	src = 1 << in->src_reg;
+	int	x = BPF_SRC(in->code) == BPF_X;
+
+	switch (BPF_CLASS(in->code)) {
+	case BPF_LD:
+		if (BPF_IS_LDDW(*in) || in->code == 0)
+			return 0;
+
+		return DT_PEEP_ALLREGS;
+	case BPF_LDX:
+		return src;
+	case BPF_ST:
+		return dst;
+	case BPF_STX:
+		return dst | src;
+	case BPF_ALU:
+	case BPF_ALU64:
+		switch (BPF_OP(in->code)) {
+		case BPF_MOV:
+			return x ? src : 0;
+		case BPF_NEG:
+		case BPF_END:
+			return dst;
+		default:
+			return x ? dst | src : dst;
+		}
+	case BPF_JMP:
+	case BPF_JMP32:
+		switch (BPF_OP(in->code)) {
+		case BPF_CALL:
+			return DT_PEEP_ARGREGS;
+		case BPF_EXIT:
+			return 1 << BPF_REG_0;
+		case BPF_JA:
+			return 0;
+		default:
+			return x ? dst | src : dst;
+		}
+	default:
+		return DT_PEEP_ALLREGS;
+	}
+}
+
+/*
+ * Return the set of registers written by an instruction.
+ */
+static uint_t
+dt_peep_defs(const struct bpf_insn *in)
+{
+	switch (BPF_CLASS(in->code)) {
+	case BPF_LD:
+		if (in->code == 0)
+			return 0;		/* second half of lddw */
+		if (!BPF_IS_LDDW(*in))
+			return DT_PEEP_CALLREGS;
+		/* fallthrough */
+	case BPF_LDX:
+	case BPF_ALU:
+	case BPF_ALU64:
+		return 1 << in->dst_reg;
+	case BPF_JMP:
+		if (BPF_OP(in->code) == BPF_CALL)
+			return DT_PEEP_CALLREGS;
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Check whether the frame pointer copy at node 'i' is only used to pass the
+ * address of a stack location to a function, as in:
+ *
+ *	mov	%rX, %fp
+ *	add	%rX, off
+ *	...			(no use of %rX)
+ *	call	func
+ *
+ * where %rX is an argument register.  If so, return the stack offset that is
+ * passed.  Otherwise, return DT_PEEP_FPALL.
+ */
+static int
+dt_peep_fparg(const dt_peep_t *pp, uint_t i)
+{
+	const struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+	uint_t			reg = 1 << in->dst_reg;
+	int			off;
+
+	if (in->code != (BPF_ALU64 | BPF_MOV | BPF_X) ||
+	    !(reg & DT_PEEP_ARGREGS) || i + 1 >= pp->pp_nnodes)
+		return DT_PEEP_FPALL;
+
+	in = &pp->pp_nodes[++i]->di_instr;
+	if (in->code != (BPF_ALU64 | BPF_ADD | BPF_K) ||
+	    (1 << in->dst_reg) != reg ||
+	    pp->pp_nodes[i]->di_label != DT_LBL_NONE ||
+	    pp->pp_nodes[i]->di_extern != NULL)
+		return DT_PEEP_FPALL;
+
+	off = in->imm;
+
+	while (++i < pp->pp_nnodes) {
+		const dt_irnode_t	*dip = pp->pp_nodes[i];
+
+		in = &dip->di_instr;
+		if (dip->di_label != DT_LBL_NONE)
+			break;
+		if (BPF_IS_NOP(*in))
+			continue;
+		if (BPF_IS_CALL(*in))
+			return off;
+		if (dt_peep_uses(in) & reg)
+			break;
+		if (dt_peep_defs(in) & reg)
+			return off;
+		if (BPF_CLASS(in->code) == BPF_JMP ||
+		    BPF_CLASS(in->code) == BPF_JMP32)
+			break;
+	}
+
+	return DT_PEEP_FPALL;
+}
+
+/*
+ * Determine the lowest stack offset that may be accessed other than through
+ * a load or store with the frame pointer as base register.  A function that
+ * is passed the address of a stack location may access the stack at or above
+ * that location.  Any other use of the frame pointer (other than as base
+ * register) exposes the entire stack.
+ */
+static int
+dt_peep_fpmin(const dt_peep_t *pp)
+{
+	int	fpmin = 0;
+	uint_t	i;
+
+	for (i = 0; i < pp->pp_nnodes; i++) {
+		const struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+		int			x = BPF_SRC(in->code) == BPF_X;
+
+		switch (BPF_CLASS(in->code)) {
+		case BPF_LD:
+			if (BPF_IS_LDDW(*in))
+				i++;
+			/* fallthrough */
+		case BPF_LDX:
+			if (in->dst_reg == BPF_REG_FP)
+				return DT_PEEP_FPALL;
+			break;
+		case BPF_STX:
+			if (in->src_reg == BPF_REG_FP)
+				return DT_PEEP_FPALL;
+			break;
+		case BPF_ALU:
+		case BPF_ALU64:
+			if (in->dst_reg == BPF_REG_FP)
+				return DT_PEEP_FPALL;
+			if (x && in->src_reg == BPF_REG_FP) {
+				int	off = dt_peep_fparg(pp, i);
+
+				if (off == DT_PEEP_FPALL)
+					return DT_PEEP_FPALL;
+				if (off < fpmin)
+					fpmin = off;
+			}
+			break;
+		case BPF_JMP:
+		case BPF_JMP32:
+			if (BPF_OP(in->code) == BPF_CALL ||
+			    BPF_OP(in->code) == BPF_EXIT ||
+			    BPF_OP(in->code) == BPF_JA)
+				break;
+			if (in->dst_reg == BPF_REG_FP ||
+			    (x && in->src_reg == BPF_REG_FP))
+				return DT_PEEP_FPALL;
+			break;
+		}
+	}
+
+	return fpmin;
+}
+
+/*
+ * Check whether the given stack location may be accessed other than through
+ * the frame pointer.
+ */
+static int
+dt_peep_exposed(const dt_peep_t *pp, int off, int size)
+{
+	return pp->pp_fpmin == DT_PEEP_FPALL || off + size > pp->pp_fpmin;
+}
+
+static void
+dt_peep_reset(dt_peep_t *pp)
+{
+	pp->pp_cmask = 0;
+	pp->pp_nmem = 0;
+	pp->pp_nst = 0;
+}
+
+static int
+dt_peep_isconst(const dt_peep_t *pp, int reg)
+{
+	return (pp->pp_cmask & (1 << reg)) != 0;
+}
+
+static void
+dt_peep_setconst(dt_peep_t *pp, int reg, uint64_t val)
+{
+	pp->pp_cmask |= 1 << reg;
+	pp->pp_cval[reg] = val;
+}
+
+/*
+ * Forget everything we know about a register (because it is being assigned
+ * a new value).
+ */
+static void
+dt_peep_kill_reg(dt_peep_t *pp, int reg)
+{
+	int	i;
+
+	pp->pp_cmask &= ~(1 << reg);
+
+	for (i = 0; i < pp->pp_nmem; ) {
+		dt_peep_mem_t	*mp = &pp->pp_mem[i];
+
+		if (mp->pm_reg == reg || mp->pm_base == reg)
+			*mp = pp->pp_mem[--pp->pp_nmem];
+		else
+			i++;
+	}
+}
+
+/*
+ * Forget the value of any memory location that may be modified by a store to
+ * [base + off] of the given size.  A negative base register indicates that
+ * any memory other than the stack may be modified (e.g. by a function call).
+ */
+static void
+dt_peep_kill_mem(dt_peep_t *pp, int base, int off, int size)
+{
+	int	i;
+
+	for (i = 0; i < pp->pp_nmem; ) {
+		dt_peep_mem_t	*mp = &pp->pp_mem[i];
+		int		kill;
+
+		if (base < 0)
+			kill = mp->pm_base != BPF_REG_FP ||
+			       dt_peep_exposed(pp, mp->pm_off, mp->pm_size);
+		else if (mp->pm_base == base)
+			kill = dt_peep_overlap(mp->pm_off, mp->pm_size,
+					       off, size);
+		else if (mp->pm_base == BPF_REG_FP)
+			kill = dt_peep_exposed(pp, mp->pm_off, mp->pm_size);
+		else if (base == BPF_REG_FP)
+			kill = dt_peep_exposed(pp, off, size);
+		else
+			kill = 1;
+
+		if (kill)
+			*mp = pp->pp_mem[--pp->pp_nmem];
+		else
+			i++;
+	}
+}
+
+static void
+dt_peep_add_mem(dt_peep_t *pp, int reg, int base, int off, int size)
+{
+	dt_peep_mem_t	*mp;
+
+	if (reg == base || pp->pp_nmem == DT_PEEP_MAXFACTS)
+		return;
+
+	mp = &pp->pp_mem[pp->pp_nmem++];
+	mp->pm_reg = reg;
+	mp->pm_base = base;
+	mp->pm_off = off;
+	mp->pm_size = size;
+}
+
+static int
+dt_peep_find_mem(const dt_peep_t *pp, int base, int off, int size)
+{
+	int	i;
+
+	for (i = 0; i < pp->pp_nmem; i++) {
+		const dt_peep_mem_t	*mp = &pp->pp_mem[i];
+
+		if (mp->pm_base == base && mp->pm_off == off &&
+		    mp->pm_size == size)
+			return mp->pm_reg;
+	}
+
+	return -1;
+}
+
+/*
+ * A stack location is being read: stores to it are no longer dead.
+ */
+static void
+dt_peep_read_stack(dt_peep_t *pp, int off, int size)
+{
+	int	i;
+
+	for (i = 0; i < pp->pp_nst; ) {
+		const struct bpf_insn	*in = &pp->pp_st[i]->di_instr;
+
+		if (dt_peep_overlap(in->off, dt_peep_size(in->code), off, size))
+			pp->pp_st[i] = pp->pp_st[--pp->pp_nst];
+		else
+			i++;
+	}
+}
+
+/*
+ * A stack location is being written: earlier stores to the same location that
+ * have not been read yet are dead.
+ */
+static void
+dt_peep_write_stack(dt_peep_t *pp, dt_irnode_t *dip)
+{
+	const struct bpf_insn	*in = &dip->di_instr;
+	int			off = in->off;
+	int			size = dt_peep_size(in->code);
+	int			i;
+
+	for (i = 0; i < pp->pp_nst; ) {
+		dt_irnode_t		*sip = pp->pp_st[i];
+		const struct bpf_insn	*sin = &sip->di_instr;
+
+		if (sin->off >= off &&
+		    sin->off + dt_peep_size(sin->code) <= off + size) {
+			dt_peep_remove(pp, sip);
+			pp->pp_st[i] = pp->pp_st[--pp->pp_nst];
+		} else
+			i++;
+	}
+
+	if (dip->di_extern == NULL && pp->pp_nst < DT_PEEP_MAXSTORES)
+		pp->pp_st[pp->pp_nst++] = dip;
+}
+
+static void
+dt_peep_load(dt_peep_t *pp, dt_irnode_t *dip)
+{
+	struct bpf_insn	*in = &dip->di_instr;
+	int		dst = in->dst_reg;
+	int		base = in->src_reg;
+	int		off = in->off;
+	int		size = dt_peep_size(in->code);
+	int		reg;
+
+	if (BPF_MODE(in->code) != BPF_MEM) {
+		dt_peep_reset(pp);
+		return;
+	}
+
+	if (base == BPF_REG_FP)
+		dt_peep_read_stack(pp, off, size);
+
+	/*
+	 * If the value is already held in a register, use it.  If that is the
+	 * destination register, the load can be removed altogether.
+	 */
+	reg = dt_peep_find_mem(pp, base, off, size);
+	if (reg == dst) {
+		dt_peep_remove(pp, dip);
+		return;
+	}
+
+	dt_peep_kill_reg(pp, dst);
+
+	if (reg >= 0) {
+		*in = BPF_MOV_REG(dst, reg);
+		pp->pp_changed = 1;
+
+		if (dt_peep_isconst(pp, reg))
+			dt_peep_setconst(pp, dst, pp->pp_cval[reg]);
+	}
+
+	dt_peep_add_mem(pp, dst, base, off, size);
+}
+
+static void
+dt_peep_store(dt_peep_t *pp, dt_irnode_t *dip)
+{
+	struct bpf_insn	*in = &dip->di_instr;
+	int		base = in->dst_reg;
+	int		size = dt_peep_size(in->code);
+
+	switch (BPF_MODE(in->code)) {
+	case BPF_XADD:
+		if (base == BPF_REG_FP)
+			dt_peep_read_stack(pp, in->off, size);
+
+		dt_peep_kill_mem(pp, base, in->off, size);
+		break;
+	case BPF_MEM:
+		dt_peep_kill_mem(pp, base, in->off, size);
+
+		if (base == BPF_REG_FP && !dt_peep_exposed(pp, in->off, size))
+			dt_peep_write_stack(pp, dip);
+
+		/* A 64-bit store leaves the stored value in the register. */
+		if (BPF_CLASS(in->code) == BPF_STX && size == 8)
+			dt_peep_add_mem(pp, in->src_reg, base, in->off, size);
+		break;
+	default:
+		dt_peep_reset(pp);
+	}
+}
+
+static void
+dt_peep_alu(dt_peep_t *pp, dt_irnode_t *dip)
+{
+	struct bpf_insn	*in = &dip->di_instr;
+	int		dst = in->dst_reg;
+	int		src = in->src_reg;
+	uint8_t		aop = BPF_OP(in->code);
+	uint64_t	val;
+	int64_t		imm;
+
+	/*
+	 * We do not track 32-bit operations (other than constant moves) or
+	 * instructions with an external reference.
+	 */
+	if (BPF_CLASS(in->code) == BPF_ALU || dip->di_extern != NULL) {
+		dt_peep_kill_reg(pp, dst);
+
+		if (dip->di_extern == NULL &&
+		    in->code == (BPF_ALU | BPF_MOV | BPF_K))
+			dt_peep_setconst(pp, dst, (uint32_t)in->imm);
+
+		return;
+	}
+
+	/*
+	 * If the source register holds a known constant, use it as immediate
+	 * operand instead.  Division by 0 and out-of-range shifts are left
+	 * alone because the BPF verifier does not accept them as immediate.
+	 */
+	if (BPF_SRC(in->code) == BPF_X && dt_peep_isconst(pp, src) &&
+	    dt_peep_fits(pp->pp_cval[src])) {
+		val = pp->pp_cval[src];
+
+		switch (aop) {
+		case BPF_DIV:
+		case BPF_MOD:
+			if (val == 0)
+				goto unknown;
+			break;
+		case BPF_LSH:
+		case BPF_RSH:
+		case BPF_ARSH:
+			if (val >= 64)
+				goto unknown;
+			break;
+		}
+
+		*in = BPF_ALU64_IMM(aop, dst, (int32_t)val);
+		pp->pp_changed = 1;
+	}
+
+	if (BPF_SRC(in->code) == BPF_X) {
+		if (aop == BPF_MOV) {
+			dt_peep_kill_reg(pp, dst);
+			if (dt_peep_isconst(pp, src))
+				dt_peep_setconst(pp, dst, pp->pp_cval[src]);
+
+			return;
+		}
+
+		goto unknown;
+	}
+
+	if (aop != BPF_MOV && !dt_peep_isconst(pp, dst))
+		goto unknown;
+
+	/* Fold the operation. */
+	val = pp->pp_cval[dst];
+	imm = in->imm;
+
+	switch (aop) {
+	case BPF_MOV:
+		val = imm;
+		break;
+	case BPF_ADD:
+		val += imm;
+		break;
+	case BPF_SUB:
+		val -= imm;
+		break;
+	case BPF_MUL:
+		val *= imm;
+		break;
+	case BPF_OR:
+		val |= imm;
+		break;
+	case BPF_AND:
+		val &= imm;
+		break;
+	case BPF_XOR:
+		val ^= imm;
+		break;
+	case BPF_LSH:
+		val <<= imm & 63;
+		break;
+	case BPF_RSH:
+		val >>= imm & 63;
+		break;
+	case BPF_ARSH:
+		val = (int64_t)val >> (imm & 63);
+		break;
+	case BPF_NEG:
+		val = -val;
+		break;
+	default:
+		goto unknown;
+	}
+
+	dt_peep_kill_reg(pp, dst);
+	dt_peep_setconst(pp, dst, val);
+
+	if (aop != BPF_MOV && dt_peep_fits(val)) {
+		*in = BPF_MOV_IMM(dst, (int32_t)val);
+		pp->pp_changed = 1;
+	}
+
+	return;
+
+unknown:
+	dt_peep_kill_reg(pp, dst);
+}
+
+/*
+ * Evaluate a conditional branch: return 1 if it is taken, 0 if it is not, and
+ * -1 if we do not know.
+ */
+static int
+dt_peep_taken(uint8_t jop, uint64_t a, int32_t imm)
+{
+	uint64_t	b = (int64_t)imm;
+
+	switch (jop) {
+	case BPF_JEQ:
+		return a == b;
+	case BPF_JNE:
+		return a != b;
+	case BPF_JGT:
+		return a > b;
+	case BPF_JGE:
+		return a >= b;
+	case BPF_JLT:
+		return a < b;
+	case BPF_JLE:
+		return a <= b;
+	case BPF_JSGT:
+		return (int64_t)a > (int64_t)b;
+	case BPF_JSGE:
+		return (int64_t)a >= (int64_t)b;
+	case BPF_JSLT:
+		return (int64_t)a < (int64_t)b;
+	case BPF_JSLE:
+		return (int64_t)a <= (int64_t)b;
+	case BPF_JSET:
+		return (a & b) != 0;
+	default:
+		return -1;
+	}
+}
+
+static void
+dt_peep_jump(dt_peep_t *pp, dt_irnode_t *dip)
+{
+	struct bpf_insn	*in = &dip->di_instr;
+	uint8_t		jop = BPF_OP(in->code);
+	int		i, taken;
+
+	switch (jop) {
+	case BPF_CALL:
+		for (i = BPF_REG_0; i <= BPF_REG_5; i++)
+			dt_peep_kill_reg(pp, i);
+
+		dt_peep_kill_mem(pp, -1, 0, 0);
+		return;
+	case BPF_EXIT:
+		/* The stack is gone, so stores that were not read are dead. */
+		for (i = 0; i < pp->pp_nst; i++)
+			dt_peep_remove(pp, pp->pp_st[i]);
+
+		dt_peep_reset(pp);
+		return;
+	case BPF_JA:
+		dt_peep_reset(pp);
+		return;
+	}
+
+	/* The branch target may read pending stores. */
+	pp->pp_nst = 0;
+
+	if (BPF_SRC(in->code) == BPF_X && dt_peep_isconst(pp, in->src_reg) &&
+	    dt_peep_fits(pp->pp_cval[in->src_reg])) {
+		*in = BPF_BRANCH_IMM(jop, in->dst_reg,
+				     (int32_t)pp->pp_cval[in->src_reg], in->off);
+		pp->pp_changed = 1;
+	}
+
+	if (BPF_SRC(in->code) != BPF_K || !dt_peep_isconst(pp, in->dst_reg))
+		return;
+
+	taken = dt_peep_taken(jop, pp->pp_cval[in->dst_reg], in->imm);
+	if (taken < 0)
+		return;
+
+	if (taken) {
+		*in = BPF_JUMP(in->off);
+		pp->pp_changed = 1;
+		dt_peep_reset(pp);
+	} else
+		dt_peep_remove(pp, dip);
+}
+
+/*
+ * Perform redundant load elimination, constant propagation, and dead store
+ * elimination within each basic block.
+ */
+static void
+dt_peep_blocks(dt_peep_t *pp)
+{
+	uint_t	i;
+
+	dt_peep_reset(pp);
+
+	for (i = 0; i < pp->pp_nnodes; i++) {
+		dt_irnode_t	*dip = pp->pp_nodes[i];
+		struct bpf_insn	*in = &dip->di_instr;
+
+		if (dip->di_label != DT_LBL_NONE)
+			dt_peep_reset(pp);
+
+		if (BPF_IS_NOP(*in))
+			continue;
+
+		switch (BPF_CLASS(in->code)) {
+		case BPF_LDX:
+			dt_peep_load(pp, dip);
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			dt_peep_store(pp, dip);
+			break;
+		case BPF_LD:
+			if (!BPF_IS_LDDW(*in)) {
+				dt_peep_reset(pp);
+				break;
+			}
+
+			dt_peep_kill_reg(pp, in->dst_reg);
+			if (dip->di_extern == NULL && in->src_reg == 0)
+				dt_peep_setconst(pp, in->dst_reg,
+					(uint32_t)in->imm |
+					((uint64_t)dip->di_next->di_instr.imm << 32));
+
+			i++;
+			break;
+		case BPF_ALU:
+		case BPF_ALU64:
+			dt_peep_alu(pp, dip);
+			break;
+		case BPF_JMP:
+			dt_peep_jump(pp, dip);
+			break;
+		default:
+			dt_peep_reset(pp);
+		}
+	}
+}
+
+/*
+ * Remove stores to (unexposed) stack locations that are never read.
+ */
+static void
+dt_peep_dead_stores(dt_peep_t *pp)
+{
+	const struct bpf_insn	**rd;
+	uint_t			i, j, nrd = 0;
+
+	rd = malloc(pp->pp_nnodes * sizeof(struct bpf_insn *));
+	if (rd == NULL)
+		return;
+
+	for (i = 0; i < pp->pp_nnodes; i++) {
+		const struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+
+		if (in->code == (BPF_LDX | BPF_MEM | BPF_SIZE(in->code)) &&
+		    in->src_reg == BPF_REG_FP)
+			rd[nrd++] = in;
+		else if (in->code ==
+				(BPF_STX | BPF_XADD | BPF_SIZE(in->code)) &&
+			 in->dst_reg == BPF_REG_FP)
+			rd[nrd++] = in;
+		else if (BPF_IS_LDDW(*in))
+			i++;
+	}
+
+	for (i = 0; i < pp->pp_nnodes; i++) {
+		dt_irnode_t		*dip = pp->pp_nodes[i];
+		const struct bpf_insn	*in = &dip->di_instr;
+		int			size = dt_peep_size(in->code);
+
+		if (BPF_IS_LDDW(*in)) {
+			i++;
+			continue;
+		}
+
+		if ((BPF_CLASS(in->code) != BPF_ST &&
+		     BPF_CLASS(in->code) != BPF_STX) ||
+		    BPF_MODE(in->code) != BPF_MEM ||
+		    in->dst_reg != BPF_REG_FP || dip->di_extern != NULL ||
+		    dt_peep_exposed(pp, in->off, size))
+			continue;
+
+		for (j = 0; j < nrd; j++) {
+			if (dt_peep_overlap(in->off, size, rd[j]->off,
+					   dt_peep_size(rd[j]->code)))
+				break;
+		}
+
+		if (j == nrd)
+			dt_peep_remove(pp, dip);
+	}
+
+	free(rd);
+}
+
+/*
+ * Thread jumps to unconditional jumps, turn jumps to an exit instruction into
+ * an exit instruction, and remove jumps to the next instruction.
+ */
+static void
+dt_peep_jumps(dt_peep_t *pp)
+{
+	uint_t	i, j, t;
+
+	for (i = 0; i < pp->pp_nnodes; i++) {
+		dt_irnode_t	*dip = pp->pp_nodes[i];
+		struct bpf_insn	*in = &dip->di_instr;
+		uint_t		lbl;
+
+		if (BPF_IS_LDDW(*in)) {
+			i++;
+			continue;
+		}
+
+		if (BPF_CLASS(in->code) != BPF_JMP || BPF_IS_NOP(*in) ||
+		    BPF_OP(in->code) == BPF_CALL ||
+		    BPF_OP(in->code) == BPF_EXIT)
+			continue;
+
+		lbl = in->off;
+		for (j = 0; j < DT_PEEP_MAXTHREAD; j++) {
+			const struct bpf_insn	*tin;
+
+			t = dt_peep_target(pp, lbl);
+			if (t >= pp->pp_nnodes)
+				break;
+
+			tin = &pp->pp_nodes[t]->di_instr;
+			if (tin->code != (BPF_JMP | BPF_JA) || tin->off == lbl)
+				break;
+
+			lbl = tin->off;
+		}
+
+		if (lbl != in->off) {
+			in->off = lbl;
+			pp->pp_changed = 1;
+		}
+
+		t = dt_peep_target(pp, lbl);
+		if (t == dt_peep_next(pp, i))
+			dt_peep_remove(pp, dip);
+		else if (BPF_OP(in->code) == BPF_JA && t < pp->pp_nnodes &&
+			 pp->pp_nodes[t]->di_instr.code == (BPF_JMP | BPF_EXIT)) {
+			*in = BPF_RETURN();
+			pp->pp_changed = 1;
+		}
+	}
+}
+
+/*
+ * Remove instructions that cannot be reached.  The BPF verifier rejects
+ * programs that contain unreachable instructions.
+ */
+static void
+dt_peep_unreachable(dt_peep_t *pp)
+{
+	uint_t	n = pp->pp_nnodes;
+	uint_t	*stack, sp = 0;
+	char	*seen;
+	uint_t	i;
+
+	/*
+	 * Every instruction is visited at most once, so the stack holds at most
+	 * one entry for each call and each conditional branch, plus one.
+	 */
+	seen = calloc(n + 1, 1);
+	stack = malloc((2 * n + 1) * sizeof(uint_t));
+	if (seen == NULL || stack == NULL)
+		goto out;
+
+	/*
+	 * Code starts at the first instruction, and at the label of any BPF
+	 * function that is called from within the instruction list.
+	 */
+	stack[sp++] = 0;
+	for (i = 0; i < n; i++) {
+		const dt_irnode_t	*dip = pp->pp_nodes[i];
+		const dt_ident_t	*idp = dip->di_extern;
+
+		if (BPF_IS_CALL(dip->di_instr) && idp != NULL &&
+		    dip->di_instr.src_reg == BPF_PSEUDO_CALL &&
+		    idp->di_kind == DT_IDENT_FUNC &&
+		    idp->di_id < pp->pp_dlp->dl_label)
+			stack[sp++] = pp->pp_labels[idp->di_id];
+	}
+
+	while (sp > 0) {
+		for (i = stack[--sp]; i < n && !seen[i]; ) {
+			const struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+			uint8_t			jop = BPF_OP(in->code);
+
+			seen[i] = 1;
+
+			if (BPF_IS_LDDW(*in)) {
+				seen[i + 1] = 1;
+				i += 2;
+				continue;
+			}
+
+			if (BPF_CLASS(in->code) != BPF_JMP || BPF_IS_NOP(*in) ||
+			    jop == BPF_CALL) {
+				i++;
+				continue;
+			}
+
+			if (jop == BPF_EXIT)
+				break;
+
+			if (in->off < pp->pp_dlp->dl_label) {
+				if (jop == BPF_JA) {
+					i = pp->pp_labels[in->off];
+					continue;
+				}
+
+				if (!seen[pp->pp_labels[in->off]])
+					stack[sp++] = pp->pp_labels[in->off];
+			}
+
+			i++;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!seen[i] && !BPF_IS_NOP(pp->pp_nodes[i]->di_instr))
+			dt_peep_remove(pp, pp->pp_nodes[i]);
+	}
+
+out:
+	free(seen);
+	free(stack);
+}
+
+/*
+ * Return the union of the given per-node sets for the successors of node 'i'.
+ * This is only valid for instruction lists without backward jumps, so that a
+ * single backward pass over the list computes the sets.
+ */
+static uint_t
+dt_peep_succ(const dt_peep_t *pp, uint_t i, const uint_t *set)
+{
+	const struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+	uint_t			next, tgt;
+
+	next = i + (BPF_IS_LDDW(*in) ? 2 : 1);
+	if (next > pp->pp_nnodes)
+		next = pp->pp_nnodes;
+
+	if (BPF_CLASS(in->code) != BPF_JMP || BPF_IS_NOP(*in) ||
+	    BPF_OP(in->code) == BPF_CALL)
+		return set[next];
+
+	if (BPF_OP(in->code) == BPF_EXIT)
+		return 0;
+
+	tgt = in->off < pp->pp_dlp->dl_label ? pp->pp_labels[in->off]
+					      : pp->pp_nnodes;
+	if (BPF_OP(in->code) == BPF_JA)
+		return set[tgt];
+
+	return set[next] | set[tgt];
+}
+
+static int
+dt_peep_is_lddw_hi(const dt_peep_t *pp, uint_t i)
+{
+	return i > 0 && BPF_IS_LDDW(pp->pp_nodes[i - 1]->di_instr);
+}
+
+/*
+ * Compute the set of registers that are live on entry to each node.
+ */
+static void
+dt_peep_liveness(const dt_peep_t *pp, uint_t *live)
+{
+	uint_t	i;
+
+	live[pp->pp_nnodes] = 0;
+	for (i = pp->pp_nnodes; i-- > 0; ) {
+		const struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+
+		if (dt_peep_is_lddw_hi(pp, i)) {
+			live[i] = 0;
+			continue;
+		}
+
+		live[i] = dt_peep_uses(in) |
+			  (dt_peep_succ(pp, i, live) & ~dt_peep_defs(in));
+	}
+}
+
+/*
+ * Determine whether the 8-byte stack slot at the given offset may be read
+ * after node 'i' (other than by the load at node 'f').
+ */
+static int
+dt_peep_slot_live(const dt_peep_t *pp, uint_t i, uint_t f, int off,
+		  uint_t *sl)
+{
+	uint_t	k;
+
+	sl[pp->pp_nnodes] = 0;
+	for (k = pp->pp_nnodes; k-- > i + 1; ) {
+		const struct bpf_insn	*in = &pp->pp_nodes[k]->di_instr;
+		int			size = dt_peep_size(in->code);
+
+		if (dt_peep_is_lddw_hi(pp, k)) {
+			sl[k] = 0;
+			continue;
+		}
+
+		sl[k] = dt_peep_succ(pp, k, sl);
+
+		switch (BPF_CLASS(in->code)) {
+		case BPF_LDX:
+			if (k != f && in->src_reg == BPF_REG_FP &&
+			    dt_peep_overlap(in->off, size, off, 8))
+				sl[k] = 1;
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			if (in->dst_reg != BPF_REG_FP ||
+			    !dt_peep_overlap(in->off, size, off, 8))
+				break;
+			if (BPF_MODE(in->code) != BPF_MEM)
+				sl[k] = 1;
+			else if (in->off <= off && in->off + size >= off + 8)
+				sl[k] = 0;
+			break;
+		}
+	}
+
+	return sl[i + 1];
+}
+
+/*
+ * Reallocate registers that were spilled to the stack.  For every 64-bit store
+ * of a register to an unexposed stack slot that is followed by a 64-bit load
+ * from that slot (the fill) with no other access to the slot in between:
+ *
+ *  - if the register is not modified between the store and the fill, the
+ *    store is removed and the fill becomes a register move (or is removed);
+ *  - otherwise, if there is a callee-saved register that is neither live
+ *    across the store nor used before the fill, the value is kept in that
+ *    register rather than on the stack.
+ *
+ * Both require that the value stored to the slot is not read other than by
+ * the fill, and that the fill can only be reached through the store.  To keep
+ * the analysis simple, this pass is not performed on instruction lists with
+ * backward jumps (which the code generator does not emit).
+ */
+static void
+dt_peep_spills(dt_peep_t *pp)
+{
+	uint_t	n = pp->pp_nnodes;
+	uint_t	*live = NULL, *sl = NULL, *lmin = NULL;
+	uint_t	i, k;
+
+	live = malloc((n + 1) * sizeof(uint_t));
+	sl = malloc((n + 1) * sizeof(uint_t));
+	lmin = malloc(pp->pp_dlp->dl_label * sizeof(uint_t));
+	if (live == NULL || sl == NULL || lmin == NULL)
+		goto out;
+
+	/*
+	 * Determine for every label the first jump that references it.  A
+	 * label that is the entry point of a function is considered to be
+	 * referenced from the start of the list.
+	 */
+	for (i = 0; i < pp->pp_dlp->dl_label; i++)
+		lmin[i] = n;
+
+	for (i = 0; i < n; i++) {
+		const dt_irnode_t	*dip = pp->pp_nodes[i];
+		const struct bpf_insn	*in = &dip->di_instr;
+		const dt_ident_t	*idp = dip->di_extern;
+
+		if (BPF_CLASS(in->code) == BPF_JMP32)
+			goto out;
+		if (BPF_CLASS(in->code) != BPF_JMP || BPF_IS_NOP(*in) ||
+		    BPF_OP(in->code) == BPF_EXIT)
+			continue;
+
+		if (BPF_OP(in->code) == BPF_CALL) {
+			if (idp != NULL && in->src_reg == BPF_PSEUDO_CALL &&
+			    idp->di_kind == DT_IDENT_FUNC &&
+			    idp->di_id < pp->pp_dlp->dl_label)
+				lmin[idp->di_id] = 0;
+
+			continue;
+		}
+
+		if (in->off >= pp->pp_dlp->dl_label ||
+		    pp->pp_labels[in->off] <= i)
+			goto out;		/* backward jump */
+
+		if (i < lmin[in->off])
+			lmin[in->off] = i;
+	}
+
+	dt_peep_liveness(pp, live);
+
+	for (i = 0; i < n; i++) {
+		struct bpf_insn	*in = &pp->pp_nodes[i]->di_instr;
+		struct bpf_insn	*fin = NULL;
+		uint_t		f, uses = 0, defs = 0;
+		int		reg, off = in->off;
+
+		if (BPF_IS_LDDW(*in)) {
+			i++;
+			continue;
+		}
+
+		if (in->code != (BPF_STX | BPF_MEM | BPF_DW) ||
+		    in->dst_reg != BPF_REG_FP ||
+		    pp->pp_nodes[i]->di_extern != NULL ||
+		    dt_peep_exposed(pp, off, 8))
+			continue;
+
+		reg = in->src_reg;
+
+		/*
+		 * Find the fill, and collect the registers that are used and
+		 * modified between the store and the fill.
+		 */
+		for (f = i + 1; f < n; f++) {
+			const dt_irnode_t	*dip = pp->pp_nodes[f];
+			const struct bpf_insn	*fi = &dip->di_instr;
+			int			base;
+
+			if (dip->di_label != DT_LBL_NONE &&
+			    lmin[dip->di_label] <= i)
+				break;		/* reachable from elsewhere */
+
+			base = BPF_CLASS(fi->code) == BPF_LDX ? fi->src_reg
+							       : fi->dst_reg;
+			if ((BPF_CLASS(fi->code) == BPF_LDX ||
+			     BPF_CLASS(fi->code) == BPF_ST ||
+			     BPF_CLASS(fi->code) == BPF_STX) &&
+			    base == BPF_REG_FP &&
+			    dt_peep_overlap(fi->off, dt_peep_size(fi->code),
+					    off, 8)) {
+				if (fi->code == (BPF_LDX | BPF_MEM | BPF_DW) &&
+				    fi->off == off)
+					fin = &pp->pp_nodes[f]->di_instr;
+
+				break;
+			}
+
+			uses |= dt_peep_uses(fi);
+			defs |= dt_peep_defs(fi);
+		}
+
+		if (fin == NULL || dt_peep_slot_live(pp, i, f, off, sl))
+			continue;
+
+		if (!(defs & (1 << reg))) {
+			/* The register still holds the value at the fill. */
+			dt_peep_remove(pp, pp->pp_nodes[i]);
+			if (fin->dst_reg == reg)
+				dt_peep_remove(pp, pp->pp_nodes[f]);
+			else {
+				*fin = BPF_MOV_REG(fin->dst_reg, reg);
+				pp->pp_changed = 1;
+			}
+		} else {
+			for (k = BPF_REG_6; k <= BPF_REG_9; k++) {
+				if (!((uses | defs | live[i + 1]) & (1 << k)))
+					break;
+			}
+
+			if (k > BPF_REG_9)
+				continue;
+
+			*in = BPF_MOV_REG(k, reg);
+			*fin = BPF_MOV_REG(fin->dst_reg, k);
+			pp->pp_changed = 1;
+		}
+
+		dt_peep_liveness(pp, live);
+	}
+
+out:
+	free(live);
+	free(sl);
+	free(lmin);
+}
+
+/*
+ * Remove nops that do not declare a label from the instruction list, and
+ * update the instruction count.  The nodes are allocated from the arena of
+ * the instruction list, so dropped nodes are simply unlinked.
+ */
+static void
+dt_peep_sweep(dt_peep_t *pp)
+{
+	dt_irlist_t	*dlp = pp->pp_dlp;
+	dt_irnode_t	*last = NULL;
+	uint_t		i;
+
+	dlp->dl_list = NULL;
+	dlp->dl_len = 0;
+
+	for (i = 0; i < pp->pp_nnodes; i++) {
+		dt_irnode_t	*dip = pp->pp_nodes[i];
+		int		nop = BPF_IS_NOP(dip->di_instr);
+
+		if (nop && dip->di_label == DT_LBL_NONE)
+			continue;
+
+		if (!nop)
+			dlp->dl_len++;
+
+		dip->di_next = NULL;
+		if (last != NULL)
+			last->di_next = dip;
+		else
+			dlp->dl_list = dip;
+
+		last = dip;
+	}
+
+	dlp->dl_last = last;
+}
+
+void
+dt_irlist_optimize(dt_irlist_t *dlp)
+{
+	dt_peep_t	pp;
+	dt_irnode_t	*dip;
+	uint_t		i, pass;
+
+	memset(&pp, 0, sizeof(pp));
+	pp.pp_dlp = dlp;
+
+	for (dip = dlp->dl_list; dip != NULL; dip = dip->di_next)
+		pp.pp_nnodes++;
+
+	if (pp.pp_nnodes == 0)
+		return;
+
+	pp.pp_nodes = malloc(pp.pp_nnodes * sizeof(dt_irnode_t *));
+	pp.pp_labels = malloc(dlp->dl_label * sizeof(uint_t));
+	if (pp.pp_nodes == NULL || pp.pp_labels == NULL)
+		goto out;
+
+	for (i = 0; i < dlp->dl_label; i++)
+		pp.pp_labels[i] = pp.pp_nnodes;
+
+	for (i = 0, dip = dlp->dl_list; dip != NULL; i++, dip = dip->di_next) {
+		pp.pp_nodes[i] = dip;
+		if (dip->di_label != DT_LBL_NONE)
+			pp.pp_labels[dip->di_label] = i;
+	}
+
+	pp.pp_fpmin = dt_peep_fpmin(&pp);
+
+	dt_peep_spills(&pp);
+
+	for (pass = 0; pass < DT_PEEP_MAXPASS; pass++) {
+		pp.pp_changed = 0;
+
+		dt_peep_blocks(&pp);
+		dt_peep_dead_stores(&pp);
+		dt_peep_jumps(&pp);
+		dt_peep_unreachable(&pp);
+
+		if (!pp.pp_changed)
+			break;
+	}
+
+	dt_peep_sweep(&pp);
+
+out:
+	free(pp.pp_nodes);
+	free(pp.pp_labels);
+}
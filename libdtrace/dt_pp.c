@@ -0,0 +1,1776 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Embedded C preprocessor.
+ *
+ * Preprocessing a D program with cpp(1) costs a fork and exec for every
+ * compilation.  The embedded preprocessor handles the subset of cpp that D
+ * programs use in-process: object-like and function-like macros (including
+ * variadic macros and the # and ## operators), #undef, #include, conditional
+ * compilation (#if, #ifdef, #ifndef, #elif, #else and #endif), and #pragma
+ * and #ident lines, which are passed through to the D compiler.
+ *
+ * Whenever the embedded preprocessor encounters something it does not support
+ * (other directives, preprocessing errors, include files it cannot find, cpp
+ * options other than -D, -U and -I, ...) it gives up, and the input is passed
+ * to cpp(1) instead.  That way, the result (or the diagnostic) is always the
+ * same as what cpp(1) would produce.
+ *
+ * The predefined macros are the ones that cpp(1) predefines, as recorded in
+ * dt_pp_predefs.h at build time.  #if expressions are evaluated using signed
+ * 64-bit arithmetic.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <dt_impl.h>
+#include <dt_htab.h>
+#include <dt_string.h>
+
+#define DT_PP_MAXCOND		64	/* maximum #if nesting per file */
+#define DT_PP_MAXDEPTH		64	/* maximum #include nesting */
+#define DT_PP_MAXEXPAND		100000	/* maximum expansions per line */
+#define DT_PP_PAINT		'\001'	/* marks identifiers never to expand */
+
+/* Token types. */
+#define DT_PP_T_EOF		0
+#define DT_PP_T_WS		1
+#define DT_PP_T_IDENT		2
+#define DT_PP_T_NUMBER		3
+#define DT_PP_T_STRING		4	/* string or character literal */
+#define DT_PP_T_PUNCT		5
+
+/* Conditional group states. */
+#define DT_PP_COND_ACTIVE	0	/* group is being processed */
+#define DT_PP_COND_PENDING	1	/* group is skipped, no branch taken */
+#define DT_PP_COND_DONE		2	/* group is skipped, branch was taken */
+#define DT_PP_COND_MASK		3
+#define DT_PP_COND_ELSE		4	/* #else was seen */
+
+/* Builtin macros. */
+#define DT_PP_B_NONE		0	/* regular macro */
+#define DT_PP_B_FILE		1	/* __FILE__ */
+#define DT_PP_B_LINE		2	/* __LINE__ */
+#define DT_PP_B_UNSUP		3	/* cpp builtin we do not support */
+
+typedef struct dt_ppmem {
+	dt_list_t	pm_list;
+	uint64_t	pm_data[];
+} dt_ppmem_t;
+
+typedef struct dt_ppbuf {
+	char		*pb_buf;
+	size_t		pb_len;
+	size_t		pb_size;
+} dt_ppbuf_t;
+
+typedef struct dt_ppmacro {
+	dt_hentry_t	pm_he;
+	char		*pm_name;
+	int		pm_builtin;	/* DT_PP_B_* */
+	int		pm_nparams;	/* -1 for object-like macros */
+	int		pm_variadic;	/* last parameter is __VA_ARGS__ */
+	char		**pm_params;
+	char		*pm_body;
+} dt_ppmacro_t;
+
+typedef struct dt_ppactive {
+	const dt_ppmacro_t *pa_macro;
+	size_t		pa_end;		/* end of the replacement text */
+} dt_ppactive_t;
+
+typedef struct dt_ppfile {
+	const char	*pf_name;	/* file name */
+	char		*pf_dir;	/* directory for "" includes (or NULL) */
+	const char	*pf_ptr;	/* current position */
+	const char	*pf_end;	/* end of the text */
+	int		pf_line;	/* line number at pf_ptr */
+	int		pf_lline;	/* line number of the current line */
+	int		pf_oline;	/* line number of the next output line */
+	int		pf_ncond;	/* number of open conditional groups */
+	int		pf_cond[DT_PP_MAXCOND];
+} dt_ppfile_t;
+
+typedef struct dt_pp {
+	dtrace_hdl_t	*pp_hdl;
+	jmp_buf		pp_jmp;		/* error return */
+	int		pp_err;		/* error (0 if we gave up) */
+	char		pp_why[256];	/* reason for giving up */
+	dt_list_t	pp_mem;		/* allocated memory */
+	dt_htab_t	*pp_macros;	/* macro definitions */
+	char		**pp_incdirs;	/* -I directories */
+	int		pp_nincdirs;
+	int		pp_depth;	/* #include depth */
+	dt_ppfile_t	*pp_file;	/* current file */
+	dt_ppbuf_t	pp_out;		/* preprocessed output */
+} dt_pp_t;
+
+static const char *const dt_pp_sysdirs[] = {
+	"/usr/local/include",
+	"/usr/include",
+	NULL
+};
+
+/*
+ * The macros that cpp(1) predefines for D programs, as determined at build time
+ * (see mkppdefs.sh).  The cpp(1) arguments (-D, -U) are applied on top of these.
+ */
+static const char *const dt_pp_predefs[] = {
+#include "dt_pp_predefs.h"
+	NULL
+};
+
+static const char *const dt_pp_unsupported[] = {
+	"__BASE_FILE__",
+	"__COUNTER__",
+	"__DATE__",
+	"__INCLUDE_LEVEL__",
+	"__TIME__",
+	"__TIMESTAMP__",
+	"__has_attribute",
+	"__has_builtin",
+	"__has_cpp_attribute",
+	"__has_include",
+	"__has_include_next",
+	"_Pragma",
+	NULL
+};
+
+static uint32_t
+dt_pp_macro_hval(const dt_ppmacro_t *pmp)
+{
+	return str2hval(pmp->pm_name, 0);
+}
+
+static int
+dt_pp_macro_cmp(const dt_ppmacro_t *p, const dt_ppmacro_t *q)
+{
+	return strcmp(p->pm_name, q->pm_name);
+}
+
+DEFINE_HE_STD_LINK_FUNCS(dt_pp_macro, dt_ppmacro_t, pm_he)
+DEFINE_HTAB_STD_OPS(dt_pp_macro)
+
+static void _dt_printflike_(2, 3) _dt_noreturn_
+dt_pp_giveup(dt_pp_t *pp, const char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsnprintf(pp->pp_why, sizeof(pp->pp_why), fmt, ap);
+	va_end(ap);
+
+	longjmp(pp->pp_jmp, 1);
+}
+
+static void _dt_noreturn_
+dt_pp_nomem(dt_pp_t *pp)
+{
+	pp->pp_err = EDT_NOMEM;
+	dt_pp_giveup(pp, "out of memory");
+}
+
+/*
+ * All memory is allocated through the preprocessor state so that it can all
+ * be released at once, also when we give up halfway through.
+ */
+static void *
+dt_pp_alloc(dt_pp_t *pp, size_t size)
+{
+	dt_ppmem_t	*pmp;
+
+	if ((pmp = malloc(sizeof(dt_ppmem_t) + size)) == NULL)
+		dt_pp_nomem(pp);
+
+	dt_list_append(&pp->pp_mem, pmp);
+
+	return pmp->pm_data;
+}
+
+static void *
+dt_pp_realloc(dt_pp_t *pp, void *ptr, size_t size)
+{
+	dt_ppmem_t	*pmp, *npmp;
+
+	if (ptr == NULL)
+		return dt_pp_alloc(pp, size);
+
+	pmp = (dt_ppmem_t *)((char *)ptr - offsetof(dt_ppmem_t, pm_data));
+	dt_list_delete(&pp->pp_mem, pmp);
+
+	if ((npmp = realloc(pmp, sizeof(dt_ppmem_t) + size)) == NULL) {
+		dt_list_append(&pp->pp_mem, pmp);
+		dt_pp_nomem(pp);
+	}
+
+	dt_list_append(&pp->pp_mem, npmp);
+
+	return npmp->pm_data;
+}
+
+static void
+dt_pp_free(dt_pp_t *pp, void *ptr)
+{
+	dt_ppmem_t	*pmp;
+
+	if (ptr == NULL)
+		return;
+
+	pmp = (dt_ppmem_t *)((char *)ptr - offsetof(dt_ppmem_t, pm_data));
+	dt_list_delete(&pp->pp_mem, pmp);
+	free(pmp);
+}
+
+static char *
+dt_pp_strndup(dt_pp_t *pp, const char *s, size_t n)
+{
+	char	*p = dt_pp_alloc(pp, n + 1);
+
+	memcpy(p, s, n);
+	p[n] = '\0';
+
+	return p;
+}
+
+static void
+dt_pp_put(dt_pp_t *pp, dt_ppbuf_t *pbp, const char *s, size_t n)
+{
+	if (pbp->pb_len + n + 1 > pbp->pb_size) {
+		size_t	size = pbp->pb_size ? pbp->pb_size : 128;
+
+		while (pbp->pb_len + n + 1 > size)
+			size *= 2;
+
+		pbp->pb_buf = dt_pp_realloc(pp, pbp->pb_buf, size);
+		pbp->pb_size = size;
+	}
+
+	memcpy(pbp->pb_buf + pbp->pb_len, s, n);
+	pbp->pb_len += n;
+	pbp->pb_buf[pbp->pb_len] = '\0';
+}
+
+static void
+dt_pp_putc(dt_pp_t *pp, dt_ppbuf_t *pbp, char c)
+{
+	dt_pp_put(pp, pbp, &c, 1);
+}
+
+static void
+dt_pp_puts(dt_pp_t *pp, dt_ppbuf_t *pbp, const char *s)
+{
+	dt_pp_put(pp, pbp, s, strlen(s));
+}
+
+static void
+dt_pp_release(dt_pp_t *pp, dt_ppbuf_t *pbp)
+{
+	dt_pp_free(pp, pbp->pb_buf);
+	memset(pbp, 0, sizeof(dt_ppbuf_t));
+}
+
+static const char *
+dt_pp_skipws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\f' || *p == '\v' ||
+	       *p == '\r')
+		p++;
+
+	return p;
+}
+
+static int
+dt_pp_isident(int c)
+{
+	return isalnum(c) || c == '_' || c == '$';
+}
+
+/*
+ * Determine the type of the token that starts at p, and store a pointer to
+ * the end of the token in *next.
+ */
+static int
+dt_pp_token(const char *p, const char *end, const char **next)
+{
+	const char	*q = p;
+	int		type;
+
+	if (q >= end) {
+		*next = q;
+		return DT_PP_T_EOF;
+	}
+
+	if (*q == ' ' || *q == '\t' || *q == '\f' || *q == '\v' ||
+	    *q == '\r') {
+		q = dt_pp_skipws(q);
+		if (q > end)
+			q = end;
+		type = DT_PP_T_WS;
+	} else if (isalpha(*q) || *q == '_' || *q == '$') {
+		while (q < end && dt_pp_isident(*q))
+			q++;
+		type = DT_PP_T_IDENT;
+	} else if (isdigit(*q) ||
+		   (*q == '.' && q + 1 < end && isdigit(q[1]))) {
+		for (q++; q < end; q++) {
+			if ((*q == '+' || *q == '-') && strchr("eEpP", q[-1]))
+				continue;
+			if (!dt_pp_isident(*q) && *q != '.')
+				break;
+		}
+		type = DT_PP_T_NUMBER;
+	} else if (*q == '"' || *q == '\'') {
+		char	c = *q++;
+
+		while (q < end && *q != c) {
+			if (*q == '\\' && q + 1 < end)
+				q++;
+			q++;
+		}
+		if (q < end)
+			q++;
+		type = DT_PP_T_STRING;
+	} else if (*q == '#' && q + 1 < end && q[1] == '#') {
+		q += 2;
+		type = DT_PP_T_PUNCT;
+	} else {
+		q++;
+		type = DT_PP_T_PUNCT;
+	}
+
+	*next = q;
+	return type;
+}
+
+static int
+dt_pp_ispunct(const char *p, const char *next, const char *s)
+{
+	size_t	n = strlen(s);
+
+	return (size_t)(next - p) == n && strncmp(p, s, n) == 0;
+}
+
+static dt_ppmacro_t *
+dt_pp_lookup(dt_pp_t *pp, const char *name, size_t n)
+{
+	dt_ppmacro_t	tmpl;
+	char		*s = alloca(n + 1);
+
+	memcpy(s, name, n);
+	s[n] = '\0';
+	tmpl.pm_name = s;
+
+	return dt_htab_lookup(pp->pp_macros, &tmpl);
+}
+
+static void
+dt_pp_undef(dt_pp_t *pp, const char *name, size_t n)
+{
+	dt_ppmacro_t	*pmp = dt_pp_lookup(pp, name, n);
+
+	if (pmp != NULL)
+		dt_htab_delete(pp->pp_macros, pmp);
+}
+
+static void
+dt_pp_insert(dt_pp_t *pp, dt_ppmacro_t *pmp)
+{
+	dt_pp_undef(pp, pmp->pm_name, strlen(pmp->pm_name));
+
+	if (dt_htab_insert(pp->pp_macros, pmp) != 0)
+		dt_pp_nomem(pp);
+}
+
+/*
+ * Process a macro definition (the text following #define).
+ */
+static void
+dt_pp_define(dt_pp_t *pp, const char *p)
+{
+	dt_ppmacro_t	*pmp;
+	const char	*q, *end = p + strlen(p);
+
+	if (dt_pp_token(p, end, &q) != DT_PP_T_IDENT)
+		dt_pp_giveup(pp, "invalid macro name");
+
+	pmp = dt_pp_alloc(pp, sizeof(dt_ppmacro_t));
+	memset(pmp, 0, sizeof(dt_ppmacro_t));
+	pmp->pm_name = dt_pp_strndup(pp, p, q - p);
+	pmp->pm_nparams = -1;
+
+	if (strcmp(pmp->pm_name, "defined") == 0)
+		dt_pp_giveup(pp, "cannot define 'defined'");
+
+	p = q;
+	if (*p == '(') {
+		int	n = 0;
+
+		pmp->pm_params = dt_pp_alloc(pp, sizeof(char *) *
+						 ((end - p) / 2 + 1));
+		for (p = dt_pp_skipws(p + 1); *p != ')';
+		     p = dt_pp_skipws(p + 1)) {
+			if (strncmp(p, "...", 3) == 0) {
+				pmp->pm_params[n++] = "__VA_ARGS__";
+				pmp->pm_variadic = 1;
+				p = dt_pp_skipws(p + 3);
+			} else if (dt_pp_token(p, end, &q) == DT_PP_T_IDENT) {
+				int	i;
+
+				pmp->pm_params[n] = dt_pp_strndup(pp, p, q - p);
+				for (i = 0; i < n; i++) {
+					if (strcmp(pmp->pm_params[i],
+						   pmp->pm_params[n]) == 0)
+						dt_pp_giveup(pp, "duplicate "
+							     "parameter");
+				}
+				n++;
+				p = dt_pp_skipws(q);
+			} else
+				dt_pp_giveup(pp, "invalid macro parameter");
+
+			if (*p == ')')
+				break;
+			if (*p != ',' || pmp->pm_variadic)
+				dt_pp_giveup(pp, "invalid macro parameters");
+		}
+
+		pmp->pm_nparams = n;
+		p++;
+	} else if (*p != '\0' && *p != ' ' && *p != '\t')
+		dt_pp_giveup(pp, "missing whitespace after macro name");
+
+	p = dt_pp_skipws(p);
+	while (end > p && isspace(end[-1]))
+		end--;
+
+	pmp->pm_body = dt_pp_strndup(pp, p, end - p);
+	if (strstr(pmp->pm_body, "__VA_OPT__") != NULL)
+		dt_pp_giveup(pp, "__VA_OPT__ is not supported");
+
+	dt_pp_insert(pp, pmp);
+}
+
+static int dt_pp_expand(dt_pp_t *, const char *, size_t, dt_ppbuf_t *,
+			const dt_ppactive_t *, int, int);
+
+/*
+ * Collect the arguments of a function-like macro invocation, starting at the
+ * opening parenthesis at p.  The arguments are stored (with leading and
+ * trailing whitespace removed) in args.  Return a pointer past the closing
+ * parenthesis, or NULL if the invocation is not complete.
+ */
+static const char *
+dt_pp_args(dt_pp_t *pp, const dt_ppmacro_t *pmp, const char *p,
+	   const char *end, char **args)
+{
+	const char	*q, *start;
+	int		depth = 0, n = 0, type;
+
+	for (start = ++p; (type = dt_pp_token(p, end, &q)) != DT_PP_T_EOF;
+	     p = q) {
+		const char	*s, *e;
+
+		if (type != DT_PP_T_PUNCT)
+			continue;
+
+		if (*p == '(') {
+			depth++;
+			continue;
+		}
+
+		if (*p == ')' && depth > 0) {
+			depth--;
+			continue;
+		}
+
+		if (*p != ')' && (*p != ',' || depth > 0))
+			continue;
+
+		/* A comma in the variable arguments does not end them. */
+		if (*p == ',' && pmp->pm_variadic && n == pmp->pm_nparams - 1)
+			continue;
+
+		s = dt_pp_skipws(start);
+		for (e = p; e > s && isspace(e[-1]); e--)
+			;
+
+		if (n == pmp->pm_nparams) {
+			if (n > 0 || e > s)
+				dt_pp_giveup(pp, "too many arguments for %s",
+					     pmp->pm_name);
+		} else
+			args[n++] = dt_pp_strndup(pp, s, e - s);
+
+		start = q;
+		if (*p == ')')
+			break;
+	}
+
+	if (type == DT_PP_T_EOF)
+		return NULL;
+
+	/* The variable arguments may be omitted altogether. */
+	if (pmp->pm_variadic && n == pmp->pm_nparams - 1)
+		args[n++] = dt_pp_strndup(pp, "", 0);
+
+	if (n != pmp->pm_nparams)
+		dt_pp_giveup(pp, "too few arguments for %s", pmp->pm_name);
+
+	return q;
+}
+
+static void
+dt_pp_stringify(dt_pp_t *pp, dt_ppbuf_t *out, const char *arg)
+{
+	const char	*p, *q, *end = arg + strlen(arg);
+	int		type;
+
+	dt_pp_putc(pp, out, '"');
+	for (p = arg; (type = dt_pp_token(p, end, &q)) != DT_PP_T_EOF; p = q) {
+		if (type == DT_PP_T_WS)
+			dt_pp_putc(pp, out, ' ');
+		else if (type == DT_PP_T_STRING) {
+			for (; p < q; p++) {
+				if (*p == '"' || *p == '\\')
+					dt_pp_putc(pp, out, '\\');
+				dt_pp_putc(pp, out, *p);
+			}
+		} else if (*p != DT_PP_PAINT)
+			dt_pp_put(pp, out, p, q - p);
+	}
+	dt_pp_putc(pp, out, '"');
+}
+
+static int
+dt_pp_param(const dt_ppmacro_t *pmp, const char *p, const char *q)
+{
+	int	i;
+
+	for (i = 0; i < pmp->pm_nparams; i++) {
+		if (strlen(pmp->pm_params[i]) == (size_t)(q - p) &&
+		    strncmp(pmp->pm_params[i], p, q - p) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Return the first token that is not whitespace, starting at p.
+ */
+static int
+dt_pp_nexttoken(const char *p, const char *end, const char **start,
+		const char **next)
+{
+	int	type;
+
+	while ((type = dt_pp_token(p, end, next)) == DT_PP_T_WS)
+		p = *next;
+
+	*start = p;
+	return type;
+}
+
+/*
+ * Substitute the arguments into the body of a macro.  Arguments are macro
+ * expanded (in the context of the given active macros) unless they are an
+ * operand of # or ##.
+ */
+static void
+dt_pp_subst(dt_pp_t *pp, const dt_ppmacro_t *pmp, char **args,
+	    const dt_ppactive_t *act, int nact, dt_ppbuf_t *out)
+{
+	const char	*body = pmp->pm_body, *end = body + strlen(body);
+	const char	*p, *q, *s, *t;
+	char		**xargs = NULL;
+	int		type, paste = 0;
+
+	if (pmp->pm_nparams > 0) {
+		xargs = dt_pp_alloc(pp, sizeof(char *) * pmp->pm_nparams);
+		memset(xargs, 0, sizeof(char *) * pmp->pm_nparams);
+	}
+
+	for (p = body; (type = dt_pp_token(p, end, &q)) != DT_PP_T_EOF; p = q) {
+		int	i;
+
+		if (type == DT_PP_T_WS) {
+			dt_pp_putc(pp, out, ' ');
+			continue;
+		}
+
+		if (dt_pp_ispunct(p, q, "##")) {
+			while (out->pb_len > 0 &&
+			       isspace(out->pb_buf[out->pb_len - 1]))
+				out->pb_len--;
+
+			type = dt_pp_nexttoken(q, end, &s, &t);
+			if (p == body || type == DT_PP_T_EOF)
+				dt_pp_giveup(pp, "## at edge of macro body");
+
+			/* GNU extension: , ## __VA_ARGS__ */
+			if (pmp->pm_variadic && type == DT_PP_T_IDENT &&
+			    out->pb_len > 0 &&
+			    out->pb_buf[out->pb_len - 1] == ',' &&
+			    dt_pp_param(pmp, s, t) == pmp->pm_nparams - 1 &&
+			    args[pmp->pm_nparams - 1][0] == '\0') {
+				out->pb_len--;
+				q = t;
+			} else
+				q = s;
+
+			out->pb_buf[out->pb_len] = '\0';
+			paste = 1;
+			continue;
+		}
+
+		if (pmp->pm_nparams >= 0 && *p == '#' && q == p + 1) {
+			type = dt_pp_nexttoken(q, end, &s, &t);
+			if (type != DT_PP_T_IDENT ||
+			    (i = dt_pp_param(pmp, s, t)) < 0)
+				dt_pp_giveup(pp, "# is not followed by a "
+					     "macro parameter");
+
+			dt_pp_stringify(pp, out, args[i]);
+			q = t;
+			paste = 0;
+			continue;
+		}
+
+		if (type == DT_PP_T_IDENT && (i = dt_pp_param(pmp, p, q)) >= 0) {
+			/*
+			 * Operands of ## are substituted without expansion.
+			 */
+			type = dt_pp_nexttoken(q, end, &s, &t);
+			if (paste || dt_pp_ispunct(s, t, "##")) {
+				dt_pp_puts(pp, out, args[i]);
+			} else {
+				if (xargs[i] == NULL) {
+					dt_ppbuf_t	buf = { NULL, };
+
+					dt_pp_put(pp, &buf, "", 0);
+					dt_pp_expand(pp, args[i],
+						     strlen(args[i]), &buf,
+						     act, nact, 1);
+					xargs[i] = buf.pb_buf;
+				}
+				dt_pp_puts(pp, out, xargs[i]);
+			}
+
+			paste = 0;
+			continue;
+		}
+
+		dt_pp_put(pp, out, p, q - p);
+		paste = 0;
+	}
+
+	if (xargs != NULL) {
+		int	i;
+
+		for (i = 0; i < pmp->pm_nparams; i++)
+			dt_pp_free(pp, xargs[i]);
+		dt_pp_free(pp, xargs);
+	}
+}
+
+/*
+ * Replace len bytes at offset pos in the work buffer with the given text, and
+ * adjust the ends of the active macro replacements accordingly.
+ */
+static void
+dt_pp_splice(dt_pp_t *pp, dt_ppbuf_t *work, size_t pos, size_t len,
+	     const char *s, size_t n, dt_ppactive_t *act, int nact)
+{
+	size_t	olen = work->pb_len;
+	ssize_t	delta = (ssize_t)n - (ssize_t)len;
+	int	i;
+
+	if (delta > 0)
+		dt_pp_put(pp, work, s, delta);
+
+	memmove(work->pb_buf + pos + n, work->pb_buf + pos + len,
+		olen - pos - len);
+	if (n > 0)
+		memcpy(work->pb_buf + pos, s, n);
+	if (delta < 0)
+		work->pb_len += delta;
+	work->pb_buf[work->pb_len] = '\0';
+
+	for (i = 0; i < nact; i++) {
+		if (act[i].pa_end == SIZE_MAX)
+			continue;
+		if (act[i].pa_end >= pos + len)
+			act[i].pa_end += delta;
+		else if (act[i].pa_end > pos)
+			act[i].pa_end = pos + n;
+	}
+}
+
+/*
+ * Remove all paint markers from the given buffer.
+ */
+static void
+dt_pp_unpaint(dt_ppbuf_t *pbp)
+{
+	char	*p, *q;
+
+	if (pbp->pb_buf == NULL)
+		return;
+
+	for (p = q = pbp->pb_buf; *p != '\0'; p++) {
+		if (*p != DT_PP_PAINT)
+			*q++ = *p;
+	}
+	*q = '\0';
+	pbp->pb_len = q - pbp->pb_buf;
+}
+
+/*
+ * Expand all macros in the given text and append the result to out.  The
+ * macros in act[] are being expanded already, and are therefore not subject
+ * to expansion again.
+ *
+ * Replacement text is spliced into the text being expanded, and scanning
+ * resumes at the start of the replacement (so that it is rescanned together
+ * with the rest of the text, as cpp does).  Each macro remains disabled until
+ * scanning moves past the end of its replacement text.  Occurrences of its name
+ * that are found while it is disabled are painted (preceded by DT_PP_PAINT) so
+ * that they are not expanded in a later rescan either.
+ *
+ * If the text ends in the middle of a function-like macro invocation, we
+ * return 1 without producing any output unless 'partial' is set, in which case
+ * the macro name is left as-is.
+ */
+static int
+dt_pp_expand(dt_pp_t *pp, const char *text, size_t len, dt_ppbuf_t *out,
+	     const dt_ppactive_t *outer, int nouter, int partial)
+{
+	dt_ppbuf_t	work = { NULL, };
+	dt_ppactive_t	*act;
+	int		nact = 0, maxact = nouter + 16, nexp = 0;
+	size_t		pos = 0;
+	char		paint = DT_PP_PAINT;
+
+	act = dt_pp_alloc(pp, sizeof(dt_ppactive_t) * maxact);
+	for (nact = 0; nact < nouter; nact++) {
+		act[nact].pa_macro = outer[nact].pa_macro;
+		act[nact].pa_end = SIZE_MAX;
+	}
+
+	dt_pp_put(pp, &work, text, len);
+
+	while (pos < work.pb_len) {
+		const char	*p = work.pb_buf + pos;
+		const char	*end = work.pb_buf + work.pb_len;
+		const char	*q, *s, *t, *cend;
+		dt_ppmacro_t	*pmp;
+		dt_ppbuf_t	repl = { NULL, };
+		char		**args = NULL;
+		size_t		clen;
+		int		i;
+
+		if (dt_pp_token(p, end, &q) != DT_PP_T_IDENT) {
+			pos = q - work.pb_buf;
+			continue;
+		}
+
+		/* Drop macros that are no longer active. */
+		while (nact > 0 && act[nact - 1].pa_end <= pos)
+			nact--;
+
+		pmp = NULL;
+		if (pos == 0 || work.pb_buf[pos - 1] != DT_PP_PAINT)
+			pmp = dt_pp_lookup(pp, p, q - p);
+		if (pmp == NULL) {
+			pos = q - work.pb_buf;
+			continue;
+		}
+
+		/*
+		 * An identifier that names a macro that is being expanded is
+		 * painted, so that it is never expanded again.
+		 */
+		for (i = 0; i < nact; i++) {
+			if (act[i].pa_macro == pmp && act[i].pa_end > pos)
+				break;
+		}
+		if (i < nact) {
+			clen = q - p;
+			dt_pp_splice(pp, &work, pos, 0, &paint, 1, act, nact);
+			pos += 1 + clen;
+			continue;
+		}
+
+		if (++nexp > DT_PP_MAXEXPAND)
+			dt_pp_giveup(pp, "too many macro expansions");
+
+		cend = q;
+		switch (pmp->pm_builtin) {
+		case DT_PP_B_FILE:
+			dt_pp_putc(pp, &repl, '"');
+			dt_pp_puts(pp, &repl, pp->pp_file->pf_name);
+			dt_pp_putc(pp, &repl, '"');
+			break;
+		case DT_PP_B_LINE: {
+			char	buf[16];
+
+			snprintf(buf, sizeof(buf), "%d",
+				 pp->pp_file->pf_lline);
+			dt_pp_puts(pp, &repl, buf);
+			break;
+		}
+		case DT_PP_B_UNSUP:
+			dt_pp_giveup(pp, "%s is not supported", pmp->pm_name);
+		default:
+			if (pmp->pm_nparams < 0) {
+				dt_pp_subst(pp, pmp, NULL, act, nact, &repl);
+				break;
+			}
+
+			/*
+			 * A function-like macro name that is not followed by
+			 * an argument list is not an invocation.
+			 */
+			if (dt_pp_nexttoken(q, end, &s, &t) == DT_PP_T_EOF &&
+			    !partial)
+				goto incomplete;
+			if (*s != '(' || s == end) {
+				pos = q - work.pb_buf;
+				continue;
+			}
+
+			args = dt_pp_alloc(pp, sizeof(char *) *
+					       (pmp->pm_nparams + 1));
+			if ((cend = dt_pp_args(pp, pmp, s, end, args)) == NULL) {
+				dt_pp_free(pp, args);
+				if (!partial)
+					goto incomplete;
+
+				pos = q - work.pb_buf;
+				continue;
+			}
+
+			dt_pp_subst(pp, pmp, args, act, nact, &repl);
+			for (i = 0; i < pmp->pm_nparams; i++)
+				dt_pp_free(pp, args[i]);
+			dt_pp_free(pp, args);
+		}
+
+		/*
+		 * Splice the replacement text into the work buffer, in place
+		 * of the macro invocation.
+		 */
+		dt_pp_splice(pp, &work, pos, cend - p, repl.pb_buf,
+			     repl.pb_len, act, nact);
+
+		if (pmp->pm_builtin != DT_PP_B_NONE) {
+			pos += repl.pb_len;
+		} else {
+			if (nact == maxact) {
+				maxact *= 2;
+				act = dt_pp_realloc(pp, act,
+						    sizeof(dt_ppactive_t) *
+						    maxact);
+			}
+			act[nact].pa_macro = pmp;
+			act[nact++].pa_end = pos + repl.pb_len;
+		}
+
+		dt_pp_release(pp, &repl);
+	}
+
+	if (work.pb_len > 0)
+		dt_pp_put(pp, out, work.pb_buf, work.pb_len);
+
+	dt_pp_release(pp, &work);
+	dt_pp_free(pp, act);
+
+	return 0;
+
+incomplete:
+	dt_pp_release(pp, &work);
+	dt_pp_free(pp, act);
+
+	return 1;
+}
+
+/*
+ * Evaluation of #if expressions.
+ */
+typedef struct dt_ppexpr {
+	dt_pp_t		*pe_pp;
+	const char	*pe_ptr;	/* current position */
+	const char	*pe_end;	/* end of the expression */
+	int		pe_skip;	/* operand is not evaluated */
+} dt_ppexpr_t;
+
+static const struct {
+	const char	*op;
+	int		prec;
+} dt_pp_binops[] = {
+	{ "||", 1 }, { "&&", 2 }, { "|", 3 }, { "^", 4 }, { "&", 5 },
+	{ "==", 6 }, { "!=", 6 }, { "<=", 7 }, { ">=", 7 }, { "<<", 8 },
+	{ ">>", 8 }, { "<", 7 }, { ">", 7 }, { "+", 9 }, { "-", 9 },
+	{ "*", 10 }, { "/", 10 }, { "%", 10 }, { NULL, 0 }
+};
+
+static int
+dt_pp_expr_op(dt_ppexpr_t *pep, const char *op)
+{
+	size_t	n = strlen(op);
+
+	pep->pe_ptr = dt_pp_skipws(pep->pe_ptr);
+	if (strncmp(pep->pe_ptr, op, n) != 0)
+		return 0;
+
+	pep->pe_ptr += n;
+	return 1;
+}
+
+static int64_t dt_pp_expr_cond(dt_ppexpr_t *);
+
+static int64_t
+dt_pp_expr_char(dt_ppexpr_t *pep, const char *p, const char *q)
+{
+	if (q - p == 3 && p[1] != '\\')
+		return (unsigned char)p[1];
+
+	if (q - p == 4 && p[1] == '\\') {
+		switch (p[2]) {
+		case 'n':	return '\n';
+		case 't':	return '\t';
+		case 'r':	return '\r';
+		case '0':	return '\0';
+		case '\\':	return '\\';
+		case '\'':	return '\'';
+		case '"':	return '"';
+		}
+	}
+
+	dt_pp_giveup(pep->pe_pp, "unsupported character constant");
+}
+
+static int64_t
+dt_pp_expr_primary(dt_ppexpr_t *pep)
+{
+	const char	*p, *q;
+	int64_t		val;
+
+	if (dt_pp_expr_op(pep, "(")) {
+		val = dt_pp_expr_cond(pep);
+		if (!dt_pp_expr_op(pep, ")"))
+			dt_pp_giveup(pep->pe_pp, "missing ')' in expression");
+		return val;
+	}
+
+	if (dt_pp_expr_op(pep, "-"))
+		return -dt_pp_expr_primary(pep);
+	if (dt_pp_expr_op(pep, "+"))
+		return dt_pp_expr_primary(pep);
+	if (dt_pp_expr_op(pep, "~"))
+		return ~dt_pp_expr_primary(pep);
+	if (dt_pp_expr_op(pep, "!"))
+		return !dt_pp_expr_primary(pep);
+
+	p = pep->pe_ptr;
+	switch (dt_pp_token(p, pep->pe_end, &q)) {
+	case DT_PP_T_IDENT:
+		/* Identifiers that are not macros evaluate to 0. */
+		val = 0;
+		break;
+	case DT_PP_T_NUMBER: {
+		char	*e, *s = dt_pp_strndup(pep->pe_pp, p, q - p);
+
+		errno = 0;
+		val = strtoull(s, &e, 0);
+		while (*e == 'u' || *e == 'U' || *e == 'l' || *e == 'L')
+			e++;
+		if (*e != '\0' || errno != 0)
+			dt_pp_giveup(pep->pe_pp, "invalid number '%s'", s);
+
+		dt_pp_free(pep->pe_pp, s);
+		break;
+	}
+	case DT_PP_T_STRING:
+		if (*p != '\'')
+			dt_pp_giveup(pep->pe_pp, "string in expression");
+
+		val = dt_pp_expr_char(pep, p, q);
+		break;
+	default:
+		dt_pp_giveup(pep->pe_pp, "invalid expression");
+	}
+
+	pep->pe_ptr = q;
+
+	return val;
+}
+
+static int64_t
+dt_pp_expr_binary(dt_ppexpr_t *pep, int minprec)
+{
+	int64_t	lhs = dt_pp_expr_primary(pep);
+
+	for (;;) {
+		const char	*op = NULL;
+		int64_t		rhs;
+		int		i, prec = 0, skip = pep->pe_skip;
+
+		pep->pe_ptr = dt_pp_skipws(pep->pe_ptr);
+		for (i = 0; dt_pp_binops[i].op != NULL; i++) {
+			op = dt_pp_binops[i].op;
+			prec = dt_pp_binops[i].prec;
+			if (strncmp(pep->pe_ptr, op, strlen(op)) == 0)
+				break;
+		}
+
+		if (dt_pp_binops[i].op == NULL || prec < minprec)
+			return lhs;
+
+		pep->pe_ptr += strlen(op);
+
+		if ((strcmp(op, "&&") == 0 && !lhs) ||
+		    (strcmp(op, "||") == 0 && lhs))
+			pep->pe_skip = 1;
+		rhs = dt_pp_expr_binary(pep, prec + 1);
+		pep->pe_skip = skip;
+
+		if (strcmp(op, "||") == 0)
+			lhs = lhs || rhs;
+		else if (strcmp(op, "&&") == 0)
+			lhs = lhs && rhs;
+		else if (strcmp(op, "|") == 0)
+			lhs |= rhs;
+		else if (strcmp(op, "^") == 0)
+			lhs ^= rhs;
+		else if (strcmp(op, "&") == 0)
+			lhs &= rhs;
+		else if (strcmp(op, "==") == 0)
+			lhs = lhs == rhs;
+		else if (strcmp(op, "!=") == 0)
+			lhs = lhs != rhs;
+		else if (strcmp(op, "<=") == 0)
+			lhs = lhs <= rhs;
+		else if (strcmp(op, ">=") == 0)
+			lhs = lhs >= rhs;
+		else if (strcmp(op, "<") == 0)
+			lhs = lhs < rhs;
+		else if (strcmp(op, ">") == 0)
+			lhs = lhs > rhs;
+		else if (strcmp(op, "<<") == 0)
+			lhs = rhs >= 0 && rhs < 64 ? lhs << rhs : 0;
+		else if (strcmp(op, ">>") == 0)
+			lhs = rhs >= 0 && rhs < 64 ? lhs >> rhs : 0;
+		else if (strcmp(op, "+") == 0)
+			lhs += rhs;
+		else if (strcmp(op, "-") == 0)
+			lhs -= rhs;
+		else if (strcmp(op, "*") == 0)
+			lhs *= rhs;
+		else if (rhs == 0) {
+			if (!pep->pe_skip)
+				dt_pp_giveup(pep->pe_pp, "division by zero");
+			lhs = 0;
+		} else if (strcmp(op, "/") == 0)
+			lhs /= rhs;
+		else
+			lhs %= rhs;
+	}
+}
+
+static int64_t
+dt_pp_expr_cond(dt_ppexpr_t *pep)
+{
+	int64_t	cond = dt_pp_expr_binary(pep, 1);
+	int64_t	lhs, rhs;
+	int	skip = pep->pe_skip;
+
+	if (!dt_pp_expr_op(pep, "?"))
+		return cond;
+
+	pep->pe_skip = skip || !cond;
+	lhs = dt_pp_expr_cond(pep);
+	if (!dt_pp_expr_op(pep, ":"))
+		dt_pp_giveup(pep->pe_pp, "missing ':' in expression");
+	pep->pe_skip = skip || cond;
+	rhs = dt_pp_expr_cond(pep);
+	pep->pe_skip = skip;
+
+	return cond ? lhs : rhs;
+}
+
+/*
+ * Evaluate the expression of an #if or #elif directive.
+ */
+static int
+dt_pp_eval(dt_pp_t *pp, const char *p)
+{
+	const char	*q, *s, *t, *end = p + strlen(p);
+	dt_ppbuf_t	buf = { NULL, }, xbuf = { NULL, };
+	dt_ppexpr_t	expr;
+	int		type;
+	int64_t		val;
+
+	/* Resolve 'defined' before macro expansion. */
+	for (; (type = dt_pp_token(p, end, &q)) != DT_PP_T_EOF; p = q) {
+		int	paren;
+
+		if (type != DT_PP_T_IDENT || q - p != 7 ||
+		    strncmp(p, "defined", 7) != 0) {
+			dt_pp_put(pp, &buf, p, q - p);
+			continue;
+		}
+
+		type = dt_pp_nexttoken(q, end, &s, &t);
+		paren = type == DT_PP_T_PUNCT && *s == '(';
+		if (paren)
+			type = dt_pp_nexttoken(t, end, &s, &t);
+		if (type != DT_PP_T_IDENT)
+			dt_pp_giveup(pp, "invalid use of 'defined'");
+
+		dt_pp_puts(pp, &buf, dt_pp_lookup(pp, s, t - s) ? "1" : "0");
+		q = t;
+
+		if (paren) {
+			type = dt_pp_nexttoken(q, end, &s, &t);
+			if (type != DT_PP_T_PUNCT || *s != ')')
+				dt_pp_giveup(pp, "missing ')' after 'defined'");
+			q = t;
+		}
+	}
+
+	if (buf.pb_len == 0)
+		dt_pp_giveup(pp, "#if with no expression");
+
+	dt_pp_expand(pp, buf.pb_buf, buf.pb_len, &xbuf, NULL, 0, 1);
+	dt_pp_unpaint(&xbuf);
+	if (xbuf.pb_len == 0)
+		dt_pp_giveup(pp, "#if with no expression");
+
+	/* A 'defined' that is the result of macro expansion is murky. */
+	end = xbuf.pb_buf + xbuf.pb_len;
+	for (p = xbuf.pb_buf; (type = dt_pp_token(p, end, &q)) != DT_PP_T_EOF;
+	     p = q) {
+		if (type == DT_PP_T_IDENT && q - p == 7 &&
+		    strncmp(p, "defined", 7) == 0)
+			dt_pp_giveup(pp, "'defined' generated by macro");
+	}
+
+	expr.pe_pp = pp;
+	expr.pe_ptr = xbuf.pb_buf;
+	expr.pe_end = end;
+	expr.pe_skip = 0;
+
+	val = dt_pp_expr_cond(&expr);
+	if (*dt_pp_skipws(expr.pe_ptr) != '\0')
+		dt_pp_giveup(pp, "trailing garbage in expression");
+
+	dt_pp_release(pp, &buf);
+	dt_pp_release(pp, &xbuf);
+
+	return val != 0;
+}
+
+/*
+ * Read the next logical line from the current file into lb: line splices are
+ * removed, and each comment is replaced by a single space.  Return 0 at the
+ * end of the file.
+ */
+static int
+dt_pp_getline(dt_pp_t *pp, dt_ppfile_t *pf, dt_ppbuf_t *lb)
+{
+	const char	*p = pf->pf_ptr, *end = pf->pf_end;
+
+	if (p >= end)
+		return 0;
+
+	lb->pb_len = 0;
+	dt_pp_put(pp, lb, "", 0);
+
+	while (p < end && *p != '\n') {
+		if (*p == '\\' && p + 1 < end && p[1] == '\n') {
+			p += 2;
+			pf->pf_line++;
+		} else if (*p == '/' && p + 1 < end && p[1] == '*') {
+			for (p += 2; p + 1 < end && (p[0] != '*' || p[1] != '/');
+			     p++) {
+				if (*p == '\n')
+					pf->pf_line++;
+			}
+			if (p + 1 >= end)
+				dt_pp_giveup(pp, "unterminated comment");
+
+			p += 2;
+			dt_pp_putc(pp, lb, ' ');
+		} else if (*p == '/' && p + 1 < end && p[1] == '/') {
+			for (; p < end && *p != '\n'; p++) {
+				if (*p == '\\' && p + 1 < end && p[1] == '\n') {
+					pf->pf_line++;
+					p++;
+				}
+			}
+		} else if (*p == '"' || *p == '\'') {
+			char	c = *p;
+
+			dt_pp_putc(pp, lb, *p++);
+			while (p < end && *p != c && *p != '\n') {
+				if (*p == '\\' && p + 1 < end) {
+					if (p[1] == '\n') {
+						p += 2;
+						pf->pf_line++;
+						continue;
+					}
+					dt_pp_putc(pp, lb, *p++);
+				}
+				dt_pp_putc(pp, lb, *p++);
+			}
+			if (p < end && *p == c)
+				dt_pp_putc(pp, lb, *p++);
+		} else
+			dt_pp_putc(pp, lb, *p++);
+	}
+
+	if (p < end)
+		p++;
+
+	pf->pf_line++;
+	pf->pf_ptr = p;
+
+	return 1;
+}
+
+static void
+dt_pp_marker(dt_pp_t *pp, int line, const char *name, int flag)
+{
+	char	buf[32];
+
+	snprintf(buf, sizeof(buf), "# %d \"", line);
+	dt_pp_puts(pp, &pp->pp_out, buf);
+	dt_pp_puts(pp, &pp->pp_out, name);
+	if (flag)
+		snprintf(buf, sizeof(buf), "\" %d\n", flag);
+	else
+		strcpy(buf, "\"\n");
+	dt_pp_puts(pp, &pp->pp_out, buf);
+}
+
+/*
+ * Make sure that the next output line is reported as the given line of the
+ * current file.
+ */
+static void
+dt_pp_sync(dt_pp_t *pp, dt_ppfile_t *pf, int line)
+{
+	if (line > pf->pf_oline && line - pf->pf_oline <= 8) {
+		while (pf->pf_oline < line) {
+			dt_pp_putc(pp, &pp->pp_out, '\n');
+			pf->pf_oline++;
+		}
+	} else if (line != pf->pf_oline) {
+		dt_pp_marker(pp, line, pf->pf_name, 0);
+		pf->pf_oline = line;
+	}
+}
+
+static char *
+dt_pp_readfile(dt_pp_t *pp, const char *path, size_t *lenp)
+{
+	struct stat	st;
+	char		*buf;
+	size_t		len = 0;
+	int		fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = dt_pp_alloc(pp, st.st_size + 1);
+	while (len < (size_t)st.st_size) {
+		ssize_t	n = read(fd, buf + len, st.st_size - len);
+
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+
+	*lenp = len;
+
+	return buf;
+}
+
+static void dt_pp_process(dt_pp_t *, dt_ppfile_t *);
+
+/*
+ * Process an #include directive.
+ */
+static void
+dt_pp_include(dt_pp_t *pp, dt_ppfile_t *pf, const char *p)
+{
+	dt_ppbuf_t	xbuf = { NULL, }, path = { NULL, };
+	const char	*q, *const *dirs;
+	dt_ppfile_t	inc;
+	char		*name, *text = NULL, *s;
+	size_t		len;
+	int		i;
+
+	if (*p != '"' && *p != '<') {
+		dt_pp_expand(pp, p, strlen(p), &xbuf, NULL, 0, 1);
+		dt_pp_unpaint(&xbuf);
+		p = dt_pp_skipws(xbuf.pb_buf ? xbuf.pb_buf : "");
+	}
+
+	if ((*p != '"' && *p != '<') ||
+	    (q = strchr(p + 1, *p == '"' ? '"' : '>')) == NULL || q == p + 1)
+		dt_pp_giveup(pp, "invalid #include");
+
+	name = dt_pp_strndup(pp, p + 1, q - p - 1);
+
+	if (name[0] == '/')
+		text = dt_pp_readfile(pp, name, &len);
+	if (text == NULL && name[0] != '/' && *p == '"' && pf->pf_dir != NULL) {
+		dt_pp_puts(pp, &path, pf->pf_dir);
+		dt_pp_putc(pp, &path, '/');
+		dt_pp_puts(pp, &path, name);
+		text = dt_pp_readfile(pp, path.pb_buf, &len);
+	}
+	for (i = 0; text == NULL && name[0] != '/' && i < pp->pp_nincdirs;
+	     i++) {
+		path.pb_len = 0;
+		dt_pp_puts(pp, &path, pp->pp_incdirs[i]);
+		dt_pp_putc(pp, &path, '/');
+		dt_pp_puts(pp, &path, name);
+		text = dt_pp_readfile(pp, path.pb_buf, &len);
+	}
+	for (dirs = dt_pp_sysdirs; text == NULL && name[0] != '/' && *dirs;
+	     dirs++) {
+		path.pb_len = 0;
+		dt_pp_puts(pp, &path, *dirs);
+		dt_pp_putc(pp, &path, '/');
+		dt_pp_puts(pp, &path, name);
+		text = dt_pp_readfile(pp, path.pb_buf, &len);
+	}
+
+	if (text == NULL)
+		dt_pp_giveup(pp, "cannot find include file %s", name);
+
+	if (++pp->pp_depth > DT_PP_MAXDEPTH)
+		dt_pp_giveup(pp, "#include nested too deeply");
+
+	memset(&inc, 0, sizeof(dt_ppfile_t));
+	inc.pf_name = name[0] == '/' ? name : path.pb_buf;
+	inc.pf_dir = dt_pp_strndup(pp, inc.pf_name, strlen(inc.pf_name));
+	if ((s = strrchr(inc.pf_dir, '/')) != NULL)
+		*s = '\0';
+	else
+		strcpy(inc.pf_dir, ".");
+	inc.pf_ptr = text;
+	inc.pf_end = text + len;
+	inc.pf_line = 1;
+	inc.pf_oline = 1;
+
+	dt_pp_marker(pp, 1, inc.pf_name, 1);
+	pp->pp_file = &inc;
+	dt_pp_process(pp, &inc);
+	pp->pp_file = pf;
+	pp->pp_depth--;
+
+	dt_pp_marker(pp, pf->pf_line, pf->pf_name, 2);
+	pf->pf_oline = pf->pf_line;
+
+	dt_pp_free(pp, inc.pf_dir);
+	dt_pp_free(pp, text);
+	dt_pp_free(pp, name);
+	dt_pp_release(pp, &path);
+	dt_pp_release(pp, &xbuf);
+}
+
+/*
+ * Process a preprocessing directive (p points past the #).
+ */
+static void
+dt_pp_directive(dt_pp_t *pp, dt_ppfile_t *pf, const char *p, int line)
+{
+	const char	*q, *end = p + strlen(p);
+	char		name[16];
+	int		*cond = pf->pf_ncond ? &pf->pf_cond[pf->pf_ncond - 1]
+					     : NULL;
+	int		skip = cond && (*cond & DT_PP_COND_MASK) !=
+				       DT_PP_COND_ACTIVE;
+
+	p = dt_pp_skipws(p);
+	if (*p == '\0')
+		return;		/* null directive */
+
+	if (dt_pp_token(p, end, &q) != DT_PP_T_IDENT ||
+	    (size_t)(q - p) >= sizeof(name)) {
+		if (skip)
+			return;
+
+		dt_pp_giveup(pp, "unsupported directive");
+	}
+
+	memcpy(name, p, q - p);
+	name[q - p] = '\0';
+	p = dt_pp_skipws(q);
+
+	if (strcmp(name, "if") == 0 || strcmp(name, "ifdef") == 0 ||
+	    strcmp(name, "ifndef") == 0) {
+		int	val;
+
+		if (pf->pf_ncond == DT_PP_MAXCOND)
+			dt_pp_giveup(pp, "#if nested too deeply");
+
+		if (skip)
+			val = DT_PP_COND_DONE;
+		else if (name[2] == '\0')
+			val = dt_pp_eval(pp, p) ? DT_PP_COND_ACTIVE
+						: DT_PP_COND_PENDING;
+		else {
+			if (dt_pp_token(p, end, &q) != DT_PP_T_IDENT)
+				dt_pp_giveup(pp, "#%s without macro name",
+					     name);
+
+			val = (dt_pp_lookup(pp, p, q - p) != NULL) ==
+			      (name[2] == 'd');
+			val = val ? DT_PP_COND_ACTIVE : DT_PP_COND_PENDING;
+		}
+
+		pf->pf_cond[pf->pf_ncond++] = val;
+		return;
+	}
+
+	if (strcmp(name, "elif") == 0) {
+		if (cond == NULL || (*cond & DT_PP_COND_ELSE))
+			dt_pp_giveup(pp, "#elif without #if");
+
+		if ((*cond & DT_PP_COND_MASK) == DT_PP_COND_ACTIVE)
+			*cond = DT_PP_COND_DONE;
+		else if ((*cond & DT_PP_COND_MASK) == DT_PP_COND_PENDING &&
+			 dt_pp_eval(pp, p))
+			*cond = DT_PP_COND_ACTIVE;
+		return;
+	}
+
+	if (strcmp(name, "else") == 0) {
+		if (cond == NULL || (*cond & DT_PP_COND_ELSE))
+			dt_pp_giveup(pp, "#else without #if");
+
+		if ((*cond & DT_PP_COND_MASK) == DT_PP_COND_ACTIVE)
+			*cond = DT_PP_COND_DONE;
+		else if ((*cond & DT_PP_COND_MASK) == DT_PP_COND_PENDING)
+			*cond = DT_PP_COND_ACTIVE;
+		*cond |= DT_PP_COND_ELSE;
+		return;
+	}
+
+	if (strcmp(name, "endif") == 0) {
+		if (cond == NULL)
+			dt_pp_giveup(pp, "#endif without #if");
+
+		pf->pf_ncond--;
+		return;
+	}
+
+	if (skip)
+		return;
+
+	if (strcmp(name, "define") == 0)
+		dt_pp_define(pp, p);
+	else if (strcmp(name, "undef") == 0) {
+		if (dt_pp_token(p, end, &q) != DT_PP_T_IDENT)
+			dt_pp_giveup(pp, "#undef without macro name");
+
+		dt_pp_undef(pp, p, q - p);
+	} else if (strcmp(name, "include") == 0)
+		dt_pp_include(pp, pf, p);
+	else if (strcmp(name, "pragma") == 0 || strcmp(name, "ident") == 0) {
+		/*
+		 * Pragmas are for the D compiler, except for the ones that
+		 * cpp handles itself.
+		 */
+		if (strncmp(p, "once", 4) == 0 || strncmp(p, "GCC", 3) == 0 ||
+		    strncmp(p, "push_macro", 10) == 0 ||
+		    strncmp(p, "pop_macro", 9) == 0)
+			dt_pp_giveup(pp, "unsupported #pragma");
+
+		dt_pp_sync(pp, pf, line);
+		dt_pp_putc(pp, &pp->pp_out, '#');
+		dt_pp_puts(pp, &pp->pp_out, name);
+		dt_pp_putc(pp, &pp->pp_out, ' ');
+		dt_pp_puts(pp, &pp->pp_out, p);
+		dt_pp_putc(pp, &pp->pp_out, '\n');
+		pf->pf_oline++;
+	} else
+		dt_pp_giveup(pp, "unsupported directive #%s", name);
+}
+
+/*
+ * Process all lines in a file.
+ */
+static void
+dt_pp_process(dt_pp_t *pp, dt_ppfile_t *pf)
+{
+	dt_ppbuf_t	lb = { NULL, }, nlb = { NULL, }, xb = { NULL, };
+	int		line;
+
+	for (;;) {
+		const char	*p;
+
+		line = pf->pf_lline = pf->pf_line;
+		if (!dt_pp_getline(pp, pf, &lb))
+			break;
+
+		p = dt_pp_skipws(lb.pb_buf);
+		if (*p == '#') {
+			dt_pp_directive(pp, pf, p + 1, line);
+			continue;
+		}
+
+		if (pf->pf_ncond > 0 &&
+		    (pf->pf_cond[pf->pf_ncond - 1] & DT_PP_COND_MASK) !=
+		    DT_PP_COND_ACTIVE)
+			continue;
+
+		/*
+		 * Macro invocations may span multiple lines.
+		 */
+		xb.pb_len = 0;
+		dt_pp_put(pp, &xb, "", 0);
+		while (dt_pp_expand(pp, lb.pb_buf, lb.pb_len, &xb, NULL, 0,
+				    0) != 0) {
+			if (!dt_pp_getline(pp, pf, &nlb) ||
+			    *dt_pp_skipws(nlb.pb_buf) == '#')
+				dt_pp_giveup(pp, "unterminated macro "
+					     "invocation");
+
+			dt_pp_putc(pp, &lb, ' ');
+			dt_pp_put(pp, &lb, nlb.pb_buf, nlb.pb_len);
+		}
+
+		dt_pp_unpaint(&xb);
+
+		/* Blank lines are not written out. */
+		if (*dt_pp_skipws(xb.pb_buf) == '\0')
+			continue;
+
+		dt_pp_sync(pp, pf, line);
+		dt_pp_put(pp, &pp->pp_out, xb.pb_buf, xb.pb_len);
+		dt_pp_putc(pp, &pp->pp_out, '\n');
+		pf->pf_oline++;
+	}
+
+	if (pf->pf_ncond > 0)
+		dt_pp_giveup(pp, "unterminated #if");
+
+	dt_pp_release(pp, &lb);
+	dt_pp_release(pp, &nlb);
+	dt_pp_release(pp, &xb);
+}
+
+/*
+ * Set up the predefined macros and process the cpp(1) arguments.
+ */
+static void
+dt_pp_init(dt_pp_t *pp)
+{
+	dtrace_hdl_t	*dtp = pp->pp_hdl;
+	const char	*const *s;
+	char		buf[64];
+	int		i;
+
+	if ((pp->pp_macros = dt_htab_create(dtp, &dt_pp_macro_htab_ops)) ==
+	    NULL)
+		dt_pp_nomem(pp);
+
+	for (s = dt_pp_predefs; *s != NULL; s++)
+		dt_pp_define(pp, *s);
+
+	snprintf(buf, sizeof(buf), "__SUNW_D_VERSION 0x%08x", dtp->dt_vmax);
+	dt_pp_define(pp, buf);
+
+	dt_pp_define(pp, "__FILE__");
+	dt_pp_lookup(pp, "__FILE__", 8)->pm_builtin = DT_PP_B_FILE;
+	dt_pp_define(pp, "__LINE__");
+	dt_pp_lookup(pp, "__LINE__", 8)->pm_builtin = DT_PP_B_LINE;
+	for (s = dt_pp_unsupported; *s != NULL; s++) {
+		dt_pp_define(pp, *s);
+		dt_pp_lookup(pp, *s, strlen(*s))->pm_builtin = DT_PP_B_UNSUP;
+	}
+
+	pp->pp_incdirs = dt_pp_alloc(pp, sizeof(char *) * dtp->dt_cpp_argc);
+	for (i = 1; i < dtp->dt_cpp_argc; i++) {
+		const char	*arg = dtp->dt_cpp_argv[i];
+
+		if (strncmp(arg, "-D", 2) == 0) {
+			char	*def = dt_pp_strndup(pp, arg + 2,
+						     strlen(arg + 2));
+			char	*eq = strchr(def, '=');
+
+			if (eq != NULL)
+				*eq = ' ';
+			else {
+				def = dt_pp_realloc(pp, def, strlen(def) + 3);
+				strcat(def, " 1");
+			}
+
+			dt_pp_define(pp, def);
+		} else if (strncmp(arg, "-U", 2) == 0)
+			dt_pp_undef(pp, arg + 2, strlen(arg + 2));
+		else if (strncmp(arg, "-I", 2) == 0 && arg[2] != '\0')
+			pp->pp_incdirs[pp->pp_nincdirs++] = (char *)arg + 2;
+		else
+			dt_pp_giveup(pp, "unsupported cpp option %s", arg);
+	}
+}
+
+static int
+dt_pp_run(dt_pp_t *pp, const char *text, size_t len)
+{
+	dt_ppfile_t	pf;
+
+	if (setjmp(pp->pp_jmp) != 0)
+		return -1;
+
+	if (pp->pp_hdl->dt_stdcmode != DT_STDC_XA)
+		dt_pp_giveup(pp, "unsupported -X mode");
+
+	dt_pp_init(pp);
+
+	memset(&pf, 0, sizeof(dt_ppfile_t));
+	pf.pf_name = "/dev/stdin";
+	pf.pf_ptr = text;
+	pf.pf_end = text + len;
+	pf.pf_line = 1;
+	pf.pf_oline = 1;
+
+	/*
+	 * If this is an interpreter file, skip the #! line.
+	 */
+	if (len >= 2 && text[0] == '#' && text[1] == '!') {
+		const char	*p = memchr(text, '\n', len);
+
+		pf.pf_ptr = p ? p + 1 : pf.pf_end;
+		pf.pf_line = 2;
+	}
+
+	pp->pp_file = &pf;
+	dt_pp_process(pp, &pf);
+
+	return 0;
+}
+
+static void
+dt_pp_fini(dt_pp_t *pp)
+{
+	dt_ppmem_t	*pmp;
+
+	if (pp->pp_macros != NULL)
+		dt_htab_destroy(pp->pp_hdl, pp->pp_macros);
+
+	while ((pmp = dt_list_next(&pp->pp_mem)) != NULL) {
+		dt_list_delete(&pp->pp_mem, pmp);
+		free(pmp);
+	}
+}
+
+/*
+ * Preprocess the input file with the embedded preprocessor, and return a FILE
+ * handle for the output.  If the input requires cpp(1), NULL is returned and
+ * *cfpp is set to a (seekable) copy of the input to be passed to cpp(1).  If
+ * an error occurs, NULL is returned, *cfpp is NULL, and errno is set.
+ */
+FILE *
+dt_pp_embedded(dtrace_hdl_t *dtp, FILE *ifp, FILE **cfpp)
+{
+	dt_pp_t	pp;
+	char	*text = NULL;
+	size_t	len = 0, size = 0, n;
+	FILE	*fp = NULL;
+	int	err = 0;
+
+	*cfpp = NULL;
+
+	do {
+		if (len == size) {
+			char	*ntext;
+
+			size = size ? size * 2 : 4096;
+			if ((ntext = realloc(text, size)) == NULL) {
+				free(text);
+				dt_set_errno(dtp, EDT_NOMEM);
+				return NULL;
+			}
+			text = ntext;
+		}
+
+		len += n = fread(text + len, 1, size - len, ifp);
+	} while (n > 0);
+
+	if (ferror(ifp)) {
+		free(text);
+		dt_set_errno(dtp, errno);
+		return NULL;
+	}
+
+	memset(&pp, 0, sizeof(dt_pp_t));
+	pp.pp_hdl = dtp;
+
+	if (dt_pp_run(&pp, text, len) == 0) {
+		dt_dprintf("embedded cpp: preprocessed %zu bytes\n", len);
+
+		if ((fp = tmpfile()) == NULL ||
+		    fwrite(pp.pp_out.pb_buf, 1, pp.pp_out.pb_len, fp) !=
+		    pp.pp_out.pb_len)
+			err = errno;
+	} else if (pp.pp_err != 0)
+		err = pp.pp_err;
+	else {
+		dt_dprintf("embedded cpp: %s; using %s\n", pp.pp_why,
+			   dtp->dt_cpp_path);
+
+		/*
+		 * Hand a copy of the input to cpp(1).
+		 */
+		if ((fp = tmpfile()) == NULL || fwrite(text, 1, len, fp) != len)
+			err = errno;
+	}
+
+	dt_pp_fini(&pp);
+	free(text);
+
+	if (err != 0) {
+		if (fp != NULL)
+			fclose(fp);
+		dt_set_errno(dtp, err);
+		return NULL;
+	}
+
+	fflush(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (pp.pp_why[0] != '\0') {
+		*cfpp = fp;
+		return NULL;
+	}
+
+	return fp;
+}
@@ -1254,7 +1254,7 @@ pfprint_llquantize(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 }
 
 static int
-dt_printf_format(dtrace_hdl_t *dtp, FILE *fp, const dt_pfargv_t *pfv,
+dt_printf_format_impl(dtrace_hdl_t *dtp, FILE *fp, const dt_pfargv_t *pfv,
     const dtrace_recdesc_t *recs, uint_t nrecs, const void *buf,
     size_t len, const dtrace_aggdata_t **aggsdata, int naggvars)
 {
@@ -1507,6 +1507,21 @@ dt_printf_format(dtrace_hdl_t *dtp, FILE *fp, const dt_pfargv_t *pfv,
 	return (int)(recp - recs);
 }
 
+static int
+dt_printf_format(dtrace_hdl_t *dtp, FILE *fp, const dt_pfargv_t *pfv,
+    const dtrace_recdesc_t *recs, uint_t nrecs, const void *buf,
+    size_t len, const dtrace_aggdata_t **aggsdata, int naggvars)
+{
+	hrtime_t	start = dt_phase_start();
+	int		rval;
+
+	rval = dt_printf_format_impl(dtp, fp, pfv, recs, nrecs, buf, len,
+				     aggsdata, naggvars);
+	dt_phase_end(dtp, DTRACE_PHASE_FORMAT, start);
+
+	return rval;
+}
+
 int
 dtrace_sprintf(dtrace_hdl_t *dtp, FILE *fp, void *fmtdata,
     const dtrace_recdesc_t *recp, uint_t nrecs, const void *buf, size_t len)
@@ -1896,10 +1911,17 @@ dtrace_fprinta(dtrace_hdl_t *dtp, FILE *fp, void *fmtdata,
 	pfw.pfw_err = 0;
 
 	if (naggvars == 1) {
+		int	rval;
+
 		pfw.pfw_aid = aggvars[0];
 
-		if (dtrace_aggregate_walk_sorted(dtp, dt_fprinta, &pfw) == -1 ||
-		    pfw.pfw_err != 0)
+		if (dtp->dt_options[DTRACEOPT_AGGDELTA] != DTRACEOPT_UNSET)
+			rval = dtrace_aggregate_walk_delta(dtp, pfw.pfw_aid,
+							   dt_fprinta, &pfw);
+		else
+			rval = dtrace_aggregate_walk_sorted(dtp, dt_fprinta,
+							    &pfw);
+		if (rval == -1 || pfw.pfw_err != 0)
 			return -1; /* errno is set for us */
 	} else {
 		if (dtrace_aggregate_walk_joined(dtp, aggvars, naggvars,
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -29,6 +29,8 @@ typedef struct dt_probeclause {
 	dt_ident_t	*clause;
 } dt_probeclause_t;
 
+static void dt_probe_index_remove(dtrace_hdl_t *dtp, dt_probe_t *prp);
+
 #define DEFINE_HE_FUNCS(id) \
 	static uint32_t id##_hval(const dt_probe_t *probe) \
 	{ \
@@ -254,7 +256,10 @@ dt_probe_discover(dt_provider_t *pvp, const dtrace_probedesc_t *pdp)
 		return NULL;
 	}
 
-	dt_probe_declare(pvp, prp);
+	if (dt_probe_declare(pvp, prp) == -1) {
+		dt_ident_destroy(idp);
+		return NULL;
+	}
 
 	/*
 	 * Once our new dt_probe_t is fully constructed, iterate over the
@@ -429,7 +434,7 @@ dt_probe_create(dtrace_hdl_t *dtp, dt_ident_t *idp, int protoc,
 	return prp;
 }
 
-void
+int
 dt_probe_declare(dt_provider_t *pvp, dt_probe_t *prp)
 {
 	assert(prp->pr_ident->di_kind == DT_IDENT_PROBE);
@@ -440,7 +445,10 @@ dt_probe_declare(dt_provider_t *pvp, dt_probe_t *prp)
 		pvp->pv_flags &= ~DT_PROVIDER_INTF;
 
 	prp->prov = pvp;
-	dt_idhash_xinsert(pvp->pv_probes, prp->pr_ident);
+	if (dt_idhash_xinsert(pvp->pv_probes, prp->pr_ident) == -1)
+		return dt_set_errno(pvp->pv_hdl, EDT_NOMEM);
+
+	return 0;
 }
 
 void
@@ -479,6 +487,8 @@ dt_probe_destroy(dt_probe_t *prp)
 		dt_htab_delete(dtp->dt_byfun, prp);
 		dt_htab_delete(dtp->dt_byprb, prp);
 		dt_htab_delete(dtp->dt_byfqn, prp);
+
+		dt_probe_index_remove(dtp, prp);
 	}
 
 	if (prp->prov && prp->prov->impl && prp->prov->impl->probe_destroy)
@@ -695,6 +705,7 @@ dt_probe_insert(dtrace_hdl_t *dtp, dt_provider_t *prov, const char *prv,
 	prp->desc = desc;
 	prp->prov = prov;
 	prp->prv_data = datap;
+	prp->pr_progfd = -1;
 
 	dt_htab_insert(dtp->dt_byprv, prp);
 	dt_htab_insert(dtp->dt_bymod, prp);
@@ -853,6 +864,7 @@ dt_probe_delete(dtrace_hdl_t *dtp, dt_probe_t *prp)
 	dt_htab_delete(dtp->dt_byfqn, prp);
 
 	dtp->dt_probes[prp->desc->id] = NULL;
+	dt_probe_index_remove(dtp, prp);
 
 	/* FIXME: Add cleanup code for the dt_probe_t itself. */
 }
@@ -1053,6 +1065,657 @@ dtrace_probe_info(dtrace_hdl_t *dtp, const dtrace_probedesc_t *pdp,
 						    : -1;
 }
 
+/*
+ * Report the run-time statistics of the BPF program of each enabled probe.
+ * The statistics are only collected if the "probestats" option was set when
+ * tracing was started.
+ */
+int
+dtrace_probestat_iter(dtrace_hdl_t *dtp, dtrace_probestat_f *func, void *arg)
+{
+	dt_probe_t		*prp;
+	dtrace_probestat_t	stat;
+	int			rv;
+
+	if (dtp->dt_bpfstats_fd == -1)
+		return dt_set_errno(dtp, EDT_NOSTATS);
+
+	for (prp = dt_list_next(&dtp->dt_enablings); prp != NULL;
+	     prp = dt_list_next(prp)) {
+		if (prp->pr_progfd == -1)
+			continue;
+
+		stat.dtps_desc = prp->desc;
+		if (dt_bpf_prog_stats(prp->pr_progfd, &stat.dtps_count,
+				      &stat.dtps_time) != 0)
+			return dt_set_errno(dtp, errno);
+
+		rv = func(dtp, &stat, arg);
+		if (rv != 0)
+			return rv;
+	}
+
+	return 0;
+}
+
+/*
+ * Probe description elements, numbered to match the bits used in the glob
+ * bitmap that dt_probe_iter() stores in desc->id.
+ */
+#define DT_PE_PRB	0
+#define DT_PE_FUN	1
+#define DT_PE_MOD	2
+#define DT_PE_PRV	3
+#define DT_PE_NUM	4
+
+/*
+ * Sorted index of the distinct names used for one probe description element.
+ * The names are kept in lexical order (for glob patterns with a literal
+ * prefix), and as a permutation in lexical order of the reversed names (for
+ * glob patterns with a literal suffix).  Each order comes with a cumulative
+ * count of probes, so the number of probes that use any range of names can be
+ * determined without looking at the probes themselves.
+ */
+typedef struct dt_probe_nidx {
+	uint32_t	ni_cnt;		/* number of distinct names */
+	const char	**ni_names;	/* names, in lexical order */
+	uint32_t	*ni_num;	/* probes using ni_names[i] */
+	uint32_t	*ni_sum;	/* probes using ni_names[0 .. i - 1] */
+	uint32_t	*ni_rev;	/* names, in order of reversed name */
+	uint32_t	*ni_rsum;	/* probes using ni_rev[0 .. i - 1] */
+} dt_probe_nidx_t;
+
+/*
+ * The indexes are created by the first lookup that needs them.  Probes that
+ * are added later are merged into the indexes by the next lookup that needs
+ * them, and probes that are removed are taken out of the counts right away
+ * (see dt_probe_index_remove()).
+ */
+typedef struct dt_probe_index {
+	uint32_t	pi_probe_id;	/* probes below this id are indexed */
+	uint32_t	pi_nprobes;	/* number of probes */
+	int		pi_dirty;	/* cumulative counts need updating */
+	dt_probe_nidx_t	pi_idx[DT_PE_NUM];
+} dt_probe_index_t;
+
+/*
+ * Lookup plan for a probe description: the range [lo, hi) of names (in the
+ * given order) in the index of an element, and the number of probes that use
+ * those names.
+ */
+typedef struct dt_probe_plan {
+	int		pp_elem;	/* element (DT_PE_*) */
+	int		pp_rev;		/* range is in order of reversed name */
+	uint32_t	pp_lo;		/* first name in range */
+	uint32_t	pp_hi;		/* first name past range */
+	uint32_t	pp_est;		/* number of probes in range */
+} dt_probe_plan_t;
+
+static const char *
+dt_probe_elem(const dtrace_probedesc_t *pdp, int elem)
+{
+	switch (elem) {
+	case DT_PE_PRV:
+		return pdp->prv;
+	case DT_PE_MOD:
+		return pdp->mod;
+	case DT_PE_FUN:
+		return pdp->fun;
+	default:
+		return pdp->prb;
+	}
+}
+
+static void
+dt_probe_elem_set(dtrace_probedesc_t *pdp, int elem, const char *s)
+{
+	switch (elem) {
+	case DT_PE_PRV:
+		pdp->prv = s;
+		break;
+	case DT_PE_MOD:
+		pdp->mod = s;
+		break;
+	case DT_PE_FUN:
+		pdp->fun = s;
+		break;
+	default:
+		pdp->prb = s;
+	}
+}
+
+static dt_htab_t *
+dt_probe_elem_htab(dtrace_hdl_t *dtp, int elem)
+{
+	switch (elem) {
+	case DT_PE_PRV:
+		return dtp->dt_byprv;
+	case DT_PE_MOD:
+		return dtp->dt_bymod;
+	case DT_PE_FUN:
+		return dtp->dt_byfun;
+	default:
+		return dtp->dt_byprb;
+	}
+}
+
+static dt_probe_t *
+dt_probe_elem_next(const dt_probe_t *prp, int elem)
+{
+	switch (elem) {
+	case DT_PE_PRV:
+		return prp->he_prv.next;
+	case DT_PE_MOD:
+		return prp->he_mod.next;
+	case DT_PE_FUN:
+		return prp->he_fun.next;
+	default:
+		return prp->he_prb.next;
+	}
+}
+
+static int
+dt_probe_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * Compare the last 'len' characters of 's' with those of 'sfx' (which must
+ * be at least 'len' characters long), back to front.  If 's' is shorter than
+ * 'len' characters and it matches the end of 'sfx', it sorts first.
+ */
+static int
+dt_probe_sfxcmp(const char *s, const char *sfx, size_t len)
+{
+	size_t	i = strlen(s), j = strlen(sfx);
+
+	for (; len > 0; len--) {
+		unsigned char	c, d;
+
+		if (i == 0)
+			return -1;
+
+		c = s[--i];
+		d = sfx[--j];
+		if (c != d)
+			return c < d ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Compare two names in lexical order of the reversed names.
+ */
+static int
+dt_probe_rstrcmp(const char *s, const char *t)
+{
+	size_t	len = strlen(t);
+	int	rc;
+
+	rc = dt_probe_sfxcmp(s, t, len);
+	if (rc == 0 && strlen(s) > len)
+		rc = 1;
+
+	return rc;
+}
+
+static int
+dt_probe_revcmp(const void *a, const void *b, void *arg)
+{
+	const char	**names = arg;
+
+	return dt_probe_rstrcmp(names[*(const uint32_t *)a],
+				names[*(const uint32_t *)b]);
+}
+
+static void
+dt_probe_nidx_free(dtrace_hdl_t *dtp, dt_probe_nidx_t *nip)
+{
+	dt_free(dtp, nip->ni_names);
+	dt_free(dtp, nip->ni_num);
+	dt_free(dtp, nip->ni_sum);
+	dt_free(dtp, nip->ni_rev);
+	dt_free(dtp, nip->ni_rsum);
+	memset(nip, 0, sizeof(dt_probe_nidx_t));
+}
+
+/*
+ * Recalculate the cumulative counts for the index of one element.
+ */
+static void
+dt_probe_nidx_sums(dt_probe_nidx_t *nip)
+{
+	uint32_t	i;
+
+	nip->ni_sum[0] = nip->ni_rsum[0] = 0;
+	for (i = 0; i < nip->ni_cnt; i++) {
+		nip->ni_sum[i + 1] = nip->ni_sum[i] + nip->ni_num[i];
+		nip->ni_rsum[i + 1] = nip->ni_rsum[i] +
+				      nip->ni_num[nip->ni_rev[i]];
+	}
+}
+
+/*
+ * Merge the names of 'n' probes that were added since the index of one element
+ * was last updated into the index.  The names array is sorted in place.
+ */
+static int
+dt_probe_nidx_merge(dtrace_hdl_t *dtp, dt_probe_nidx_t *nip,
+		    const char **names, uint32_t n)
+{
+	dt_probe_nidx_t	nidx;
+	uint32_t	*map, *add;
+	uint32_t	i, j, k, cnt, nadd;
+
+	qsort(names, n, sizeof(const char *), dt_probe_strcmp);
+
+	/* Count the names that are not in the index yet. */
+	for (i = j = nadd = 0; j < n; j++) {
+		if (j > 0 && strcmp(names[j], names[j - 1]) == 0)
+			continue;
+
+		while (i < nip->ni_cnt && strcmp(nip->ni_names[i], names[j]) < 0)
+			i++;
+		if (i == nip->ni_cnt || strcmp(nip->ni_names[i], names[j]) != 0)
+			nadd++;
+	}
+
+	cnt = nip->ni_cnt + nadd;
+	nidx.ni_cnt = cnt;
+	nidx.ni_names = dt_calloc(dtp, cnt, sizeof(const char *));
+	nidx.ni_num = dt_calloc(dtp, cnt, sizeof(uint32_t));
+	nidx.ni_sum = dt_calloc(dtp, cnt + 1, sizeof(uint32_t));
+	nidx.ni_rev = dt_calloc(dtp, cnt, sizeof(uint32_t));
+	nidx.ni_rsum = dt_calloc(dtp, cnt + 1, sizeof(uint32_t));
+	map = dt_calloc(dtp, nip->ni_cnt + 1, sizeof(uint32_t));
+	add = dt_calloc(dtp, nadd + 1, sizeof(uint32_t));
+	if (nidx.ni_names == NULL || nidx.ni_num == NULL ||
+	    nidx.ni_sum == NULL || nidx.ni_rev == NULL ||
+	    nidx.ni_rsum == NULL || map == NULL || add == NULL) {
+		dt_probe_nidx_free(dtp, &nidx);
+		dt_free(dtp, map);
+		dt_free(dtp, add);
+		return -1;
+	}
+
+	/*
+	 * Merge the names in lexical order, recording where the names that
+	 * were already in the index end up ('map') and where the added names
+	 * end up ('add').
+	 */
+	for (i = j = k = nadd = 0; i < nip->ni_cnt || j < n; k++) {
+		int	rc;
+
+		if (i == nip->ni_cnt)
+			rc = 1;
+		else if (j == n)
+			rc = -1;
+		else
+			rc = strcmp(nip->ni_names[i], names[j]);
+
+		if (rc <= 0) {
+			map[i] = k;
+			nidx.ni_names[k] = nip->ni_names[i];
+			nidx.ni_num[k] = nip->ni_num[i];
+			i++;
+		} else {
+			add[nadd++] = k;
+			nidx.ni_names[k] = names[j];
+			nidx.ni_num[k] = 0;
+		}
+
+		for (; j < n && strcmp(names[j], nidx.ni_names[k]) == 0; j++)
+			nidx.ni_num[k]++;
+	}
+	assert(k == cnt);
+
+	/* Merge the added names into the order of reversed names. */
+	qsort_r(add, nadd, sizeof(uint32_t), dt_probe_revcmp, nidx.ni_names);
+
+	for (i = j = k = 0; k < cnt; k++) {
+		if (j == nadd ||
+		    (i < nip->ni_cnt &&
+		     dt_probe_rstrcmp(nip->ni_names[nip->ni_rev[i]],
+				      nidx.ni_names[add[j]]) < 0))
+			nidx.ni_rev[k] = map[nip->ni_rev[i++]];
+		else
+			nidx.ni_rev[k] = add[j++];
+	}
+
+	dt_probe_nidx_sums(&nidx);
+
+	dt_free(dtp, map);
+	dt_free(dtp, add);
+	dt_probe_nidx_free(dtp, nip);
+	*nip = nidx;
+
+	return 0;
+}
+
+static void
+dt_probe_index_free(dtrace_hdl_t *dtp)
+{
+	dt_probe_index_t	*pip = dtp->dt_probe_index;
+	int			elem;
+
+	if (pip == NULL)
+		return;
+
+	for (elem = 0; elem < DT_PE_NUM; elem++)
+		dt_probe_nidx_free(dtp, &pip->pi_idx[elem]);
+
+	dt_free(dtp, pip);
+	dtp->dt_probe_index = NULL;
+}
+
+/*
+ * Return the name indexes for the current set of probes, creating them or
+ * merging the probes that were added since the last lookup into them if
+ * needed.  If that fails, NULL is returned.
+ */
+static dt_probe_index_t *
+dt_probe_index(dtrace_hdl_t *dtp)
+{
+	dt_probe_index_t	*pip = dtp->dt_probe_index;
+	const char		**names;
+	uint32_t		i, j, n;
+	int			elem;
+
+	if (dtp->dt_probes == NULL)
+		return NULL;
+
+	if (pip == NULL) {
+		pip = dt_zalloc(dtp, sizeof(dt_probe_index_t));
+		if (pip == NULL)
+			return NULL;
+
+		dtp->dt_probe_index = pip;
+	}
+
+	for (i = pip->pi_probe_id, n = 0; i < dtp->dt_probe_id; i++) {
+		if (dtp->dt_probes[i] != NULL)
+			n++;
+	}
+
+	if (n > 0) {
+		names = dt_calloc(dtp, n, sizeof(const char *));
+		if (names == NULL) {
+			dt_probe_index_free(dtp);
+			return NULL;
+		}
+
+		for (elem = 0; elem < DT_PE_NUM; elem++) {
+			for (i = pip->pi_probe_id, j = 0;
+			     i < dtp->dt_probe_id; i++) {
+				dt_probe_t	*prp = dtp->dt_probes[i];
+
+				if (prp != NULL)
+					names[j++] = dt_probe_elem(prp->desc,
+								   elem);
+			}
+			assert(j == n);
+
+			if (dt_probe_nidx_merge(dtp, &pip->pi_idx[elem], names,
+						n) == -1) {
+				dt_free(dtp, names);
+				dt_probe_index_free(dtp);
+				return NULL;
+			}
+		}
+
+		dt_free(dtp, names);
+		pip->pi_nprobes += n;
+	} else if (pip->pi_dirty) {
+		for (elem = 0; elem < DT_PE_NUM; elem++)
+			dt_probe_nidx_sums(&pip->pi_idx[elem]);
+	}
+
+	pip->pi_probe_id = dtp->dt_probe_id;
+	pip->pi_dirty = 0;
+
+	return pip->pi_nprobes > 0 ? pip : NULL;
+}
+
+/*
+ * Return the position of the first name in the index (in lexical order, or in
+ * order of reversed name if 'rev' is set) that sorts after 's' (if 'upper' is
+ * set) or that does not sort before 's' (otherwise), considering only the
+ * first (or last) 'len' characters of the name.
+ */
+static uint32_t
+dt_probe_nidx_bound(const dt_probe_nidx_t *nip, int rev, const char *s,
+		    size_t len, int upper)
+{
+	uint32_t	lo = 0, hi = nip->ni_cnt;
+
+	while (lo < hi) {
+		uint32_t	mid = lo + (hi - lo) / 2;
+		int		rc;
+
+		if (rev)
+			rc = dt_probe_sfxcmp(nip->ni_names[nip->ni_rev[mid]],
+					     s, len);
+		else
+			rc = strncmp(nip->ni_names[mid], s, len);
+
+		if (rc < 0 || (upper && rc == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Take a probe that is being removed out of the name indexes (if it is in
+ * them).  The probe must already have been removed from the hashtables.  If no
+ * other probe uses one of its names, the indexes are freed (to be recreated by
+ * the next lookup that needs them).
+ */
+static void
+dt_probe_index_remove(dtrace_hdl_t *dtp, dt_probe_t *prp)
+{
+	dt_probe_index_t	*pip = dtp->dt_probe_index;
+	int			elem;
+
+	if (pip == NULL || prp->desc->id >= pip->pi_probe_id)
+		return;
+
+	for (elem = 0; elem < DT_PE_NUM; elem++) {
+		dt_probe_nidx_t	*nip = &pip->pi_idx[elem];
+		const char	*s = dt_probe_elem(prp->desc, elem);
+		uint32_t	i;
+
+		i = dt_probe_nidx_bound(nip, 0, s, strlen(s) + 1, 0);
+		assert(i < nip->ni_cnt && strcmp(nip->ni_names[i], s) == 0);
+
+		if (--nip->ni_num[i] == 0) {
+			dt_probe_index_free(dtp);
+			return;
+		}
+
+		/*
+		 * The index refers to the name of one of the probes that use
+		 * it.  If that is the probe being removed, switch to another.
+		 */
+		if (nip->ni_names[i] == s) {
+			dtrace_probedesc_t	tdesc;
+			dt_probe_t		tmpl, *p;
+
+			memset(&tdesc, 0, sizeof(tdesc));
+			tdesc.prv = tdesc.mod = tdesc.fun = tdesc.prb = s;
+			tmpl.desc = &tdesc;
+
+			p = dt_htab_lookup(dt_probe_elem_htab(dtp, elem), &tmpl);
+			assert(p != NULL && p != prp);
+			nip->ni_names[i] = dt_probe_elem(p->desc, elem);
+		}
+	}
+
+	pip->pi_nprobes--;
+	pip->pi_dirty = 1;
+}
+
+static void
+dt_probe_plan_range(const dt_probe_nidx_t *nip, int elem, int rev,
+		    const char *s, size_t len, dt_probe_plan_t *pp)
+{
+	const uint32_t	*sum = rev ? nip->ni_rsum : nip->ni_sum;
+	uint32_t	lo, hi;
+
+	lo = dt_probe_nidx_bound(nip, rev, s, len, 0);
+	hi = dt_probe_nidx_bound(nip, rev, s, len, 1);
+
+	if (sum[hi] - sum[lo] < pp->pp_est) {
+		pp->pp_elem = elem;
+		pp->pp_rev = rev;
+		pp->pp_lo = lo;
+		pp->pp_hi = hi;
+		pp->pp_est = sum[hi] - sum[lo];
+	}
+}
+
+/*
+ * Length of the literal prefix of a glob pattern.
+ */
+static size_t
+dt_probe_pfxlen(const char *s)
+{
+	return strcspn(s, "*?[\\");
+}
+
+/*
+ * Length of the literal suffix of a glob pattern.
+ */
+static size_t
+dt_probe_sfxlen(const char *s)
+{
+	size_t	len = strlen(s), i;
+
+	for (i = len; i > 0; i--) {
+		if (strchr("*?[]\\", s[i - 1]) != NULL)
+			break;
+	}
+
+	return len - i;
+}
+
+/*
+ * Determine the most selective element of a probe description (with the glob
+ * bitmap in pdp->id), based on the number of probes that use the name (for
+ * exact elements) or the names that share the literal prefix or suffix (for
+ * glob patterns).  This is only done if at least one glob pattern has a
+ * literal prefix or suffix, since otherwise the htab for an exact element is
+ * as good as it gets (and building the indexes is not free).
+ *
+ * Return 0 if a plan was found that selects fewer than all probes, or -1
+ * otherwise.
+ */
+static int
+dt_probe_plan(dtrace_hdl_t *dtp, const dtrace_probedesc_t *pdp,
+	      dt_probe_plan_t *pp)
+{
+	dt_probe_index_t	*pip;
+	int			elem;
+
+	for (elem = 0; elem < DT_PE_NUM; elem++) {
+		const char	*s = dt_probe_elem(pdp, elem);
+
+		if ((pdp->id & (1 << elem)) &&
+		    (dt_probe_pfxlen(s) > 0 || dt_probe_sfxlen(s) > 0))
+			break;
+	}
+	if (elem == DT_PE_NUM)
+		return -1;
+
+	pip = dt_probe_index(dtp);
+	if (pip == NULL)
+		return -1;
+
+	pp->pp_elem = -1;
+	pp->pp_est = pip->pi_nprobes;
+	for (elem = 0; elem < DT_PE_NUM; elem++) {
+		const dt_probe_nidx_t	*nip = &pip->pi_idx[elem];
+		const char		*s = dt_probe_elem(pdp, elem);
+		size_t			len;
+
+		if (!(pdp->id & (1 << elem))) {
+			dt_probe_plan_range(nip, elem, 0, s, strlen(s) + 1, pp);
+			continue;
+		}
+
+		len = dt_probe_pfxlen(s);
+		if (len > 0)
+			dt_probe_plan_range(nip, elem, 0, s, len, pp);
+
+		len = dt_probe_sfxlen(s);
+		if (len > 0)
+			dt_probe_plan_range(nip, elem, 1, s, len, pp);
+	}
+
+	return pp->pp_elem == -1 ? -1 : 0;
+}
+
+static int
+dt_probe_idcmp(const void *a, const void *b)
+{
+	const dt_probe_t	*p = *(const dt_probe_t **)a;
+	const dt_probe_t	*q = *(const dt_probe_t **)b;
+
+	return p->desc->id < q->desc->id ? -1 : p->desc->id > q->desc->id;
+}
+
+/*
+ * Collect the probes that match a probe description (with the glob bitmap in
+ * pdp->id) according to a lookup plan, in order of probe id.  The array must
+ * have room for pp->pp_est probes.  Return the number of probes found.
+ */
+static uint32_t
+dt_probe_plan_exec(dtrace_hdl_t *dtp, const dt_probe_plan_t *pp,
+		   const dtrace_probedesc_t *pdp, dt_probe_t **prps)
+{
+	int			elem = pp->pp_elem;
+	const dt_probe_nidx_t	*nip = &dtp->dt_probe_index->pi_idx[elem];
+	dt_htab_t		*htab = dt_probe_elem_htab(dtp, elem);
+	const char		*pat = dt_probe_elem(pdp, elem);
+	int			glob = pdp->id & (1 << elem);
+	dtrace_probedesc_t	desc, tdesc;
+	dt_probe_t		tmpl;
+	uint32_t		i, n = 0;
+
+	desc = *pdp;
+	dt_probe_elem_set(&desc, elem, NULL);
+
+	memset(&tdesc, 0, sizeof(tdesc));
+	tmpl.desc = &tdesc;
+
+	for (i = pp->pp_lo; i < pp->pp_hi; i++) {
+		const char	*nam;
+		dt_probe_t	*prp;
+
+		nam = nip->ni_names[pp->pp_rev ? nip->ni_rev[i] : i];
+		if (glob && !dt_gmatch(nam, pat))
+			continue;
+
+		tdesc.prv = tdesc.mod = tdesc.fun = tdesc.prb = nam;
+		for (prp = dt_htab_lookup(htab, &tmpl); prp != NULL;
+		     prp = dt_probe_elem_next(prp, elem)) {
+			if (!dt_probe_gmatch(prp, &desc))
+				continue;
+
+			assert(n < pp->pp_est);
+			prps[n++] = prp;
+		}
+	}
+
+	qsort(prps, n, sizeof(dt_probe_t *), dt_probe_idcmp);
+
+	return n;
+}
+
 int
 dt_probe_iter(dtrace_hdl_t *dtp, const dtrace_probedesc_t *pdp,
 	      dt_probe_f *pfunc, dtrace_probe_f *dfunc, void *arg)
@@ -1062,6 +1725,8 @@ dt_probe_iter(dtrace_hdl_t *dtp, const dtrace_probedesc_t *pdp,
 	dt_probe_t		*prp;
 	dt_provider_t		*pvp;
 	dt_htab_next_t		*it = NULL;
+	dt_probe_plan_t		plan;
+	dt_probe_t		**prps = NULL;
 	int			i;
 	int			p_is_glob, m_is_glob, f_is_glob, n_is_glob;
 	int			rv = 0;
@@ -1175,6 +1840,47 @@ dt_probe_iter(dtrace_hdl_t *dtp, const dtrace_probedesc_t *pdp,
 	desc.id = (p_is_glob << 3) | (m_is_glob << 2) | (f_is_glob << 1) |
 		  n_is_glob;
 
+	/*
+	 * If a glob pattern element has a literal prefix or suffix, the name
+	 * indexes tell us which element selects the fewest probes, and only
+	 * the probes for the names in that range need to be matched.  They are
+	 * reported in the same order as the lookups below would: by htab
+	 * bucket (descending probe id) if an element must match exactly, and
+	 * by ascending probe id otherwise.
+	 */
+	if (dt_probe_plan(dtp, &desc, &plan) == 0) {
+		if (plan.pp_est == 0)
+			goto done;
+
+		prps = dt_calloc(dtp, plan.pp_est, sizeof(dt_probe_t *));
+	}
+
+	if (prps != NULL) {
+		uint32_t	j, n;
+		int		rev = desc.id != 0xf;
+
+		n = dt_probe_plan_exec(dtp, &plan, &desc, prps);
+		for (j = 0; j < n; j++) {
+			prp = prps[rev ? n - j - 1 : j];
+
+			if (dfunc != NULL)
+				rv = dfunc(dtp, prp->desc, arg);
+			else if (pfunc != NULL)
+				rv = pfunc(dtp, prp, arg);
+
+			if (rv != 0)
+				break;
+
+			matches++;
+		}
+
+		dt_free(dtp, prps);
+		if (rv != 0)
+			return rv;
+
+		goto done;
+	}
+
 #define HTAB_GMATCH(c, nam)						\
 	if (!c##_is_glob) {						\
 		dt_probe_t	*nxt;					\
@@ -1358,6 +2064,7 @@ dt_probe_init(dtrace_hdl_t *dtp)
 	dtp->dt_probes = NULL;
 	dtp->dt_probes_sz = 0;
 	dtp->dt_probe_id = 1;
+	dtp->dt_probe_index = NULL;
 }
 
 void
@@ -1381,6 +2088,8 @@ dt_probe_fini(dtrace_hdl_t *dtp)
 {
 	uint32_t	i;
 
+	dt_probe_index_free(dtp);
+
 	for (i = 0; i < dtp->dt_probes_sz; i++) {
 		dt_probe_t	*prp = dtp->dt_probes[i];
 
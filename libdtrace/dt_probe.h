@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -53,6 +53,7 @@ typedef struct dt_probe {
 	dtrace_typeinfo_t *argv;	/* output argument types */
 	int argc;			/* output argument count */
 	dt_probe_instance_t *pr_inst;	/* list of functions and offsets */
+	int pr_progfd;			/* BPF program fd (or -1) */
 } dt_probe_t;
 
 extern dt_probe_t *dt_probe_lookup2(dt_provider_t *, const char *);
@@ -62,7 +63,7 @@ extern dt_probe_t *dt_probe_create(dtrace_hdl_t *, dt_ident_t *, int,
 extern dt_probe_t *dt_probe_info(dtrace_hdl_t *,
     const dtrace_probedesc_t *, dtrace_probeinfo_t *);
 
-extern void dt_probe_declare(dt_provider_t *, dt_probe_t *);
+extern int dt_probe_declare(dt_provider_t *, dt_probe_t *);
 extern void dt_probe_enable(dtrace_hdl_t *dtp, dt_probe_t *prp);
 extern void dt_probe_destroy(dt_probe_t *);
 
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2019, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2019, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  *
@@ -17,6 +17,13 @@
  *   or
  *	<name> [<modname>]			fbt:<modname>:<name>:entry
  *						fbt:<modname>:<name>:return
+ *
+ * With the 'fbtfentry' option, probes on core kernel functions that are
+ * described in the kernel BTF (BTF_VMLINUX) are implemented as BPF trampoline
+ * (fentry/fexit) programs instead.  These are cheaper to fire than kprobes and
+ * provide typed arguments.  Their return probes provide the offset (always -1)
+ * in arg0, the return value in arg1, and the function arguments in arg2 and
+ * up.  Functions that cannot be traced that way use kprobes.
  */
 #include <assert.h>
 #include <errno.h>
@@ -26,13 +33,17 @@
 #include <string.h>
 #include <unistd.h>
 #include <linux/bpf.h>
+#include <linux/btf.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <bpf_asm.h>
+#include <libbpf.h>
+#include <btf.h>
 
 #include "dt_dctx.h"
 #include "dt_cg.h"
+#include "dt_bpf.h"
 #include "dt_provider.h"
 #include "dt_probe.h"
 #include "dt_pt_regs.h"
@@ -42,6 +53,7 @@ static const char		modname[] = "vmlinux";
 
 #define KPROBE_EVENTS		TRACEFS "kprobe_events"
 #define PROBE_LIST		TRACEFS "available_filter_functions"
+#define BTF_VMLINUX		"/sys/kernel/btf/vmlinux"
 
 #define FBT_GROUP_FMT		GROUP_FMT "_%s"
 #define FBT_GROUP_DATA		GROUP_DATA, prp->desc->prb
@@ -54,6 +66,62 @@ static const dtrace_pattr_t	pattr = {
 { DTRACE_STABILITY_PRIVATE, DTRACE_STABILITY_PRIVATE, DTRACE_CLASS_ISA },
 };
 
+#define FBT_KIND_UNKNOWN	0
+#define FBT_KIND_KPROBE		1
+#define FBT_KIND_FENTRY		2
+
+typedef struct fbt_probe {
+	tp_probe_t	*tp;		/* kprobe tracepoint */
+	int		kind;		/* probe implementation (FBT_KIND_*) */
+	uint32_t	btf_id;		/* BTF function id (fentry) */
+	int		link_fd;	/* BPF trampoline link (fentry) */
+} fbt_probe_t;
+
+typedef struct fbt_func {
+	const char	*name;		/* function name */
+	uint32_t	id;		/* BTF type id */
+} fbt_func_t;
+
+/*
+ * Provider data, created when it is first needed.
+ */
+typedef struct fbt_data {
+	struct btf	*btf;		/* kernel BTF (or NULL) */
+	fbt_func_t	*funcs;		/* BTF functions, sorted by name */
+	uint32_t	nfuncs;		/* number of BTF functions */
+	int		tramp;		/* BPF trampolines work (-1: unknown) */
+} fbt_data_t;
+
+static dt_probe_t *fbt_probe_insert(dtrace_hdl_t *dtp, dt_provider_t *prv,
+				    const char *mod, const char *fun,
+				    const char *prb)
+{
+	fbt_probe_t	*fpp;
+	dt_probe_t	*prp;
+
+	fpp = dt_zalloc(dtp, sizeof(fbt_probe_t));
+	if (fpp == NULL)
+		return NULL;
+
+	fpp->tp = dt_tp_alloc(dtp);
+	if (fpp->tp == NULL)
+		goto err;
+
+	fpp->kind = FBT_KIND_UNKNOWN;
+	fpp->link_fd = -1;
+
+	prp = dt_probe_insert(dtp, prv, prvname, mod, fun, prb, fpp);
+	if (prp == NULL)
+		goto err;
+
+	return prp;
+
+err:
+	dt_tp_destroy(dtp, fpp->tp);
+	dt_free(dtp, fpp);
+	return NULL;
+}
+
 /*
  * Scan the PROBE_LIST file and add entry and return probes for every function
  * that is listed.
@@ -136,9 +204,9 @@ static int populate(dtrace_hdl_t *dtp)
 		if (dt_probe_lookup(dtp, &pd) != NULL)
 			continue;
 
-		if (dt_tp_probe_insert(dtp, prv, prvname, mod, buf, "entry"))
+		if (fbt_probe_insert(dtp, prv, mod, buf, "entry"))
 			n++;
-		if (dt_tp_probe_insert(dtp, prv, prvname, mod, buf, "return"))
+		if (fbt_probe_insert(dtp, prv, mod, buf, "return"))
 			n++;
 	}
 
@@ -147,6 +215,327 @@ static int populate(dtrace_hdl_t *dtp)
 	return n;
 }
 
+static int fbt_func_cmp(const void *a, const void *b)
+{
+	return strcmp(((const fbt_func_t *)a)->name,
+		      ((const fbt_func_t *)b)->name);
+}
+
+/*
+ * Load the kernel BTF, and build a sorted index of the functions it describes.
+ * On failure, fdp->btf is left NULL and all probes will use kprobes.
+ */
+static void fbt_btf_load(dtrace_hdl_t *dtp, fbt_data_t *fdp)
+{
+	struct stat		st;
+	struct btf		*btf;
+	char			*buf;
+	ssize_t			len, n;
+	uint32_t		i, cnt;
+	int			fd;
+
+	fd = open(BTF_VMLINUX, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	if (fstat(fd, &st) == -1 || st.st_size <= 0 ||
+	    (buf = dt_alloc(dtp, st.st_size)) == NULL) {
+		close(fd);
+		return;
+	}
+
+	for (len = 0; len < st.st_size; len += n) {
+		n = read(fd, buf + len, st.st_size - len);
+		if (n <= 0)
+			break;
+	}
+	close(fd);
+
+	btf = btf__new((__u8 *)buf, len);
+	dt_free(dtp, buf);
+	if (libbpf_get_error(btf)) {
+		dt_dprintf("fbt: cannot parse %s\n", BTF_VMLINUX);
+		return;
+	}
+
+	cnt = btf__get_nr_types(btf);
+	fdp->funcs = dt_calloc(dtp, cnt, sizeof(fbt_func_t));
+	if (fdp->funcs == NULL) {
+		btf__free(btf);
+		return;
+	}
+
+	for (i = 1; i <= cnt; i++) {
+		const struct btf_type	*t = btf__type_by_id(btf, i);
+		fbt_func_t		*fp = &fdp->funcs[fdp->nfuncs];
+
+		if (BTF_INFO_KIND(t->info) != BTF_KIND_FUNC)
+			continue;
+
+		fp->name = btf__name_by_offset(btf, t->name_off);
+		fp->id = i;
+		if (fp->name != NULL)
+			fdp->nfuncs++;
+	}
+
+	qsort(fdp->funcs, fdp->nfuncs, sizeof(fbt_func_t), fbt_func_cmp);
+	fdp->btf = btf;
+}
+
+static fbt_data_t *fbt_data(dtrace_hdl_t *dtp, dt_provider_t *prv)
+{
+	fbt_data_t	*fdp = prv->pv_data;
+
+	if (fdp != NULL)
+		return fdp;
+
+	fdp = dt_zalloc(dtp, sizeof(fbt_data_t));
+	if (fdp == NULL)
+		return NULL;
+
+	fdp->tramp = -1;
+	fbt_btf_load(dtp, fdp);
+	prv->pv_data = fdp;
+
+	return fdp;
+}
+
+static void destroy(dtrace_hdl_t *dtp, void *datap)
+{
+	fbt_data_t	*fdp = datap;
+
+	btf__free(fdp->btf);
+	dt_free(dtp, fdp->funcs);
+	dt_free(dtp, fdp);
+}
+
+/*
+ * Return the BTF function prototype for a BTF function id, and the number of
+ * (non-variadic) arguments in *argcp.
+ */
+static const struct btf_type *fbt_btf_proto(const fbt_data_t *fdp,
+					    uint32_t id, int *argcp)
+{
+	const struct btf_type	*t;
+	const struct btf_param	*args;
+	int			argc;
+
+	t = btf__type_by_id(fdp->btf, id);
+	if (t == NULL)
+		return NULL;
+	t = btf__type_by_id(fdp->btf, t->type);
+	if (t == NULL || BTF_INFO_KIND(t->info) != BTF_KIND_FUNC_PROTO)
+		return NULL;
+
+	argc = BTF_INFO_VLEN(t->info);
+	args = (const struct btf_param *)(t + 1);
+	if (argc > 0 && args[argc - 1].type == 0)
+		argc--;
+
+	*argcp = argc;
+	return t;
+}
+
+/*
+ * Return whether a type is passed in a single 64-bit argument slot.
+ */
+static int fbt_btf_is_scalar(const struct btf *btf, uint32_t id)
+{
+	const struct btf_type	*t;
+	int			depth;
+
+	for (depth = 0; depth < 16; depth++) {
+		t = btf__type_by_id(btf, id);
+		if (t == NULL)
+			return 0;
+
+		switch (BTF_INFO_KIND(t->info)) {
+		case BTF_KIND_TYPEDEF:
+		case BTF_KIND_CONST:
+		case BTF_KIND_VOLATILE:
+		case BTF_KIND_RESTRICT:
+			id = t->type;
+			continue;
+		case BTF_KIND_INT:
+		case BTF_KIND_ENUM:
+			return t->size <= sizeof(uint64_t);
+		case BTF_KIND_PTR:
+			return 1;
+		default:
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Construct a D type name for a BTF type.  Qualifiers are dropped.
+ */
+static int fbt_btf_type_name(const struct btf *btf, uint32_t id, char *buf,
+			     size_t len, int depth)
+{
+	const struct btf_type	*t;
+	const char		*kw = "";
+	const char		*name;
+	size_t			n;
+
+	if (id == 0)
+		return snprintf(buf, len, "void") < len ? 0 : -1;
+
+	t = btf__type_by_id(btf, id);
+	if (t == NULL || depth > 8)
+		return -1;
+
+	switch (BTF_INFO_KIND(t->info)) {
+	case BTF_KIND_INT:
+	case BTF_KIND_TYPEDEF:
+		break;
+	case BTF_KIND_STRUCT:
+		kw = "struct ";
+		break;
+	case BTF_KIND_UNION:
+		kw = "union ";
+		break;
+	case BTF_KIND_ENUM:
+		kw = "enum ";
+		break;
+	case BTF_KIND_FWD:
+		kw = BTF_INFO_KFLAG(t->info) ? "union " : "struct ";
+		break;
+	case BTF_KIND_CONST:
+	case BTF_KIND_VOLATILE:
+	case BTF_KIND_RESTRICT:
+		return fbt_btf_type_name(btf, t->type, buf, len, depth + 1);
+	case BTF_KIND_PTR:
+		/* Pointers to types we cannot name become void pointers. */
+		if (fbt_btf_type_name(btf, t->type, buf, len, depth + 1) < 0)
+			strcpy(buf, "void");
+
+		n = strlen(buf);
+		if (snprintf(buf + n, len - n, buf[n - 1] == '*' ? "*" : " *")
+		    >= len - n)
+			return -1;
+
+		return 0;
+	default:
+		return -1;
+	}
+
+	name = btf__name_by_offset(btf, t->name_off);
+	if (name == NULL || *name == '\0')
+		return -1;
+
+	return snprintf(buf, len, "%s%s", kw, name) < len ? 0 : -1;
+}
+
+/*
+ * Load a minimal BPF trampoline program for the given BTF function, to verify
+ * that the kernel allows tracing it that way.
+ */
+static int fbt_tramp_load(uint32_t btf_id, int ret)
+{
+	union bpf_attr	attr;
+	struct bpf_insn	insns[] = {
+		BPF_MOV_IMM(BPF_REG_0, 0),
+		BPF_RETURN(),
+	};
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_TRACING;
+	attr.expected_attach_type = ret ? BPF_TRACE_FEXIT : BPF_TRACE_FENTRY;
+	attr.attach_btf_id = btf_id;
+	attr.insns = (uint64_t)(unsigned long)insns;
+	attr.insn_cnt = ARRAY_SIZE(insns);
+	attr.license = (uint64_t)(unsigned long)"GPL";
+
+	return bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int fbt_tramp_attach(int bpf_fd)
+{
+	union bpf_attr	attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.raw_tracepoint.prog_fd = bpf_fd;
+
+	return bpf(BPF_RAW_TRACEPOINT_OPEN, &attr);
+}
+
+/*
+ * Determine how a probe is implemented.  Probes use a BPF trampoline if the
+ * 'fbtfentry' option is set, the function is a core kernel function that is
+ * described in the kernel BTF with arguments that each fit a register, and
+ * the kernel accepts a trampoline program for it.  All other probes use a
+ * kprobe.
+ */
+static int fbt_kind(dtrace_hdl_t *dtp, const dt_probe_t *prp)
+{
+	fbt_probe_t		*fpp = prp->prv_data;
+	fbt_data_t		*fdp;
+	const struct btf_type	*t;
+	const struct btf_param	*args;
+	fbt_func_t		key, *fp;
+	int			i, argc, fd, lfd;
+
+	if (fpp->kind != FBT_KIND_UNKNOWN)
+		return fpp->kind;
+	if (dtp->dt_options[DTRACEOPT_FBTFENTRY] == DTRACEOPT_UNSET)
+		return FBT_KIND_KPROBE;
+
+	fpp->kind = FBT_KIND_KPROBE;
+	if (strcmp(prp->desc->mod, modname) != 0)
+		return fpp->kind;
+
+	fdp = fbt_data(dtp, prp->prov);
+	if (fdp == NULL || fdp->btf == NULL || fdp->tramp == 0)
+		return fpp->kind;
+
+	key.name = prp->desc->fun;
+	fp = bsearch(&key, fdp->funcs, fdp->nfuncs, sizeof(fbt_func_t),
+		     fbt_func_cmp);
+	if (fp == NULL)
+		return fpp->kind;
+
+	t = fbt_btf_proto(fdp, fp->id, &argc);
+	if (t == NULL || argc != BTF_INFO_VLEN(t->info))
+		return fpp->kind;
+	if (t->type != 0 && !fbt_btf_is_scalar(fdp->btf, t->type))
+		return fpp->kind;
+
+	args = (const struct btf_param *)(t + 1);
+	for (i = 0; i < argc; i++) {
+		if (!fbt_btf_is_scalar(fdp->btf, args[i].type))
+			return fpp->kind;
+	}
+
+	fd = fbt_tramp_load(fp->id, prp->desc->prb[0] == 'r');
+	if (fd < 0)
+		return fpp->kind;
+
+	/*
+	 * The first time around, also check that the program can be attached.
+	 * If it cannot, trampolines are not supported on this system.
+	 */
+	if (fdp->tramp == -1) {
+		lfd = fbt_tramp_attach(fd);
+		fdp->tramp = lfd >= 0;
+		if (lfd >= 0)
+			close(lfd);
+		else
+			dt_dprintf("fbt: BPF trampolines unavailable: %s\n",
+				   strerror(errno));
+	}
+	close(fd);
+
+	if (fdp->tramp) {
+		fpp->kind = FBT_KIND_FENTRY;
+		fpp->btf_id = fp->id;
+	}
+
+	return fpp->kind;
+}
+
 /*
  * Generate a BPF trampoline for a FBT probe.
  *
@@ -155,11 +544,25 @@ static int populate(dtrace_hdl_t *dtp)
  *
  *	int dt_fbt(dt_pt_regs *regs)
  *
+ * or, for probes that use a BPF trampoline:
+ *
+ *	int dt_fbt(uint64_t *args)
+ *
+ * where args[] holds the function arguments, followed by the return value
+ * for return probes.
+ *
  * The trampoline will populate a dt_dctx_t struct and then call the function
  * that implements the compiled D clause.  It returns 0 to the caller.
  */
 static void trampoline(dt_pcb_t *pcb)
 {
+	dt_irlist_t		*dlp = &pcb->pcb_ir;
+	const dt_probe_t	*prp = pcb->pcb_probe;
+	const fbt_probe_t	*fpp = prp->prv_data;
+	const fbt_data_t	*fdp;
+	const struct btf_type	*t;
+	int			i, argc, base = 0;
+
 	dt_cg_tramp_prologue(pcb);
 
 	/*
@@ -168,14 +571,97 @@ static void trampoline(dt_pcb_t *pcb)
 	 *				//     (%r8 = dctx->ctx)
 	 */
 
-	dt_cg_tramp_copy_regs(pcb, BPF_REG_8);
-	dt_cg_tramp_copy_args_from_regs(pcb, BPF_REG_8);
+	if (fbt_kind(pcb->pcb_hdl, prp) != FBT_KIND_FENTRY) {
+		dt_cg_tramp_copy_regs(pcb, BPF_REG_8);
+		dt_cg_tramp_copy_args_from_regs(pcb, BPF_REG_8);
+		dt_cg_tramp_epilogue(pcb);
+		return;
+	}
+
+	fdp = prp->prov->pv_data;
+	t = fbt_btf_proto(fdp, fpp->btf_id, &argc);
+	assert(t != NULL);
+
+	dt_cg_tramp_clear_regs(pcb);
+
+	/*
+	 * For return probes:
+	 *	dctx->mst->argv[0] = -1;
+	 *				// stdw [%r7 + DMST_ARG(0)], -1
+	 *	dctx->mst->argv[1] = ((uint64_t *)dctx->ctx)[argc];
+	 *				// lddw %r0, [%r8 + argc * 8]
+	 *				// stdw [%r7 + DMST_ARG(1)], %r0
+	 */
+	if (prp->desc->prb[0] == 'r') {
+		emit(dlp, BPF_STORE_IMM(BPF_DW, BPF_REG_7, DMST_ARG(0), -1));
+		if (t->type != 0) {
+			emit(dlp, BPF_LOAD(BPF_DW, BPF_REG_0, BPF_REG_8,
+					   argc * sizeof(uint64_t)));
+			emit(dlp, BPF_STORE(BPF_DW, BPF_REG_7, DMST_ARG(1),
+					    BPF_REG_0));
+		} else
+			emit(dlp, BPF_STORE_IMM(BPF_DW, BPF_REG_7, DMST_ARG(1),
+						0));
+		base = 2;
+	}
+
+	/*
+	 *	for (i = 0; i < argc; i++)
+	 *		dctx->mst->argv[base + i] =
+	 *			((uint64_t *)dctx->ctx)[i];
+	 *				// lddw %r0, [%r8 + i * 8]
+	 *				// stdw [%r7 + DMST_ARG(base + i)], %r0
+	 */
+	for (i = 0; i < argc && base + i < ARRAY_SIZE(((dt_mstate_t *)0)->argv);
+	     i++) {
+		emit(dlp, BPF_LOAD(BPF_DW, BPF_REG_0, BPF_REG_8,
+				   i * sizeof(uint64_t)));
+		emit(dlp, BPF_STORE(BPF_DW, BPF_REG_7, DMST_ARG(base + i),
+				    BPF_REG_0));
+	}
+
+	/*
+	 *	for (i = base + argc;
+	 *	     i < ARRAY_SIZE(((dt_mstate_t *)0)->argv); i++)
+	 *		dctx->mst->argv[i] = 0;
+	 *				// stdw [%r7 + DMST_ARG(i)], 0
+	 */
+	for (i += base; i < ARRAY_SIZE(((dt_mstate_t *)0)->argv); i++)
+		emit(dlp, BPF_STORE_IMM(BPF_DW, BPF_REG_7, DMST_ARG(i), 0));
+
 	dt_cg_tramp_epilogue(pcb);
 }
 
+/*
+ * Probes that use a BPF trampoline are loaded as fentry or fexit programs for
+ * their BTF function.
+ */
+static void prog_attr(dtrace_hdl_t *dtp, const dt_probe_t *prp,
+		      union bpf_attr *attr)
+{
+	const fbt_probe_t	*fpp = prp->prv_data;
+
+	if (fbt_kind(dtp, prp) != FBT_KIND_FENTRY)
+		return;
+
+	attr->prog_type = BPF_PROG_TYPE_TRACING;
+	attr->expected_attach_type = prp->desc->prb[0] == 'r'
+					? BPF_TRACE_FEXIT : BPF_TRACE_FENTRY;
+	attr->attach_btf_id = fpp->btf_id;
+}
+
 static int attach(dtrace_hdl_t *dtp, const dt_probe_t *prp, int bpf_fd)
 {
-	tp_probe_t	*tpp = prp->prv_data;
+	fbt_probe_t	*fpp = prp->prv_data;
+	tp_probe_t	*tpp = fpp->tp;
+
+	if (fbt_kind(dtp, prp) == FBT_KIND_FENTRY) {
+		fpp->link_fd = fbt_tramp_attach(bpf_fd);
+		if (fpp->link_fd < 0)
+			return dt_set_errno(dtp, errno);
+
+		return 0;
+	}
 
 	if (!dt_tp_is_created(tpp)) {
 		char	*fn;
@@ -226,12 +712,72 @@ static int attach(dtrace_hdl_t *dtp, const dt_probe_t *prp, int bpf_fd)
 	return dt_tp_attach(dtp, tpp, bpf_fd);
 }
 
+/*
+ * Probes that use a BPF trampoline have typed arguments, based on the BTF
+ * function prototype.  Types that cannot be named are reported as uint64_t.
+ */
 static int probe_info(dtrace_hdl_t *dtp, const dt_probe_t *prp,
 		      int *argcp, dt_argdesc_t **argvp)
 {
+	const fbt_probe_t	*fpp = prp->prv_data;
+	const fbt_data_t	*fdp;
+	const struct btf_type	*t;
+	const struct btf_param	*args;
+	char			types[ARRAY_SIZE(((dt_mstate_t *)0)->argv)][128];
+	dt_argdesc_t		*argv;
+	char			*strp;
+	int			i, argc, base = 0, n;
+	size_t			argsz = 0;
+
 	*argcp = 0;			/* no arguments by default */
 	*argvp = NULL;
 
+	if (fbt_kind(dtp, prp) != FBT_KIND_FENTRY)
+		return 0;
+
+	fdp = prp->prov->pv_data;
+	t = fbt_btf_proto(fdp, fpp->btf_id, &argc);
+	if (t == NULL)
+		return 0;
+
+	if (prp->desc->prb[0] == 'r') {
+		strcpy(types[0], "uint64_t");
+		if (t->type == 0 ||
+		    fbt_btf_type_name(fdp->btf, t->type, types[1],
+				      sizeof(types[1]), 0) < 0)
+			strcpy(types[1], "uint64_t");
+		base = 2;
+	}
+
+	args = (const struct btf_param *)(t + 1);
+	n = MIN(base + argc, ARRAY_SIZE(types));
+	if (n == 0)
+		return 0;
+
+	for (i = base; i < n; i++) {
+		if (fbt_btf_type_name(fdp->btf, args[i - base].type, types[i],
+				      sizeof(types[i]), 0) < 0)
+			strcpy(types[i], "uint64_t");
+	}
+
+	for (i = 0; i < n; i++)
+		argsz += strlen(types[i]) + 1;
+
+	argv = dt_zalloc(dtp, n * sizeof(dt_argdesc_t) + argsz);
+	if (argv == NULL)
+		return -ENOMEM;
+
+	strp = (char *)(argv + n);
+	for (i = 0; i < n; i++) {
+		argv[i].mapping = i;
+		argv[i].native = strp;
+		argv[i].xlate = NULL;
+		strp = stpcpy(strp, types[i]) + 1;
+	}
+
+	*argcp = n;
+	*argvp = argv;
+
 	return 0;
 }
 
@@ -239,18 +785,25 @@ static int probe_info(dtrace_hdl_t *dtp, const dt_probe_t *prp,
  * Try to clean up system resources that may have been allocated for this
  * probe.
  *
- * If there is an event FD, we close it.
+ * If there is a BPF trampoline link or an event FD, we close it.
  *
- * We also try to remove any uprobe that may have been created for the probe.
+ * We also try to remove any kprobe that may have been created for the probe.
  * This is harmless for probes that didn't get created.  If the removal fails
  * for some reason we are out of luck - fortunately it is not harmful to the
  * system as a whole.
  */
 static void detach(dtrace_hdl_t *dtp, const dt_probe_t *prp)
 {
-	tp_probe_t	*tpp = prp->prv_data;
+	fbt_probe_t	*fpp = prp->prv_data;
+	tp_probe_t	*tpp = fpp->tp;
 	int		fd;
 
+	if (fpp->link_fd != -1) {
+		close(fpp->link_fd);
+		fpp->link_fd = -1;
+		return;
+	}
+
 	if (!dt_tp_is_created(tpp))
 		return;
 
@@ -265,13 +818,23 @@ static void detach(dtrace_hdl_t *dtp, const dt_probe_t *prp)
 	close(fd);
 }
 
+static void probe_destroy(dtrace_hdl_t *dtp, void *datap)
+{
+	fbt_probe_t	*fpp = datap;
+
+	dt_tp_destroy(dtp, fpp->tp);
+	dt_free(dtp, fpp);
+}
+
 dt_provimpl_t	dt_fbt = {
 	.name		= prvname,
 	.prog_type	= BPF_PROG_TYPE_KPROBE,
 	.populate	= &populate,
 	.trampoline	= &trampoline,
+	.prog_attr	= &prog_attr,
 	.attach		= &attach,
 	.probe_info	= &probe_info,
 	.detach		= &detach,
-	.probe_destroy	= &dt_tp_probe_destroy,
+	.probe_destroy	= &probe_destroy,
+	.destroy	= &destroy,
 };
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2019, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2019, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  *
@@ -14,6 +14,20 @@
  *
  *	syscalls:sys_enter_<name>		syscall:vmlinux:<name>:entry
  *	syscalls:sys_exit_<name>		syscall:vmlinux:<name>:return
+ *
+ * When the syscallbatch option is set, probes are not attached to their own
+ * tracepoint.  Instead, a single dispatcher program is attached to each of the
+ * raw_syscalls:sys_enter and raw_syscalls:sys_exit tracepoints.  It tail-calls
+ * the program for the syscall (if any) through a BPF program array indexed by
+ * syscall number.  The raw_syscalls tracepoints have the same record layout as
+ * the per-syscall tracepoints (the syscall number followed by the arguments or
+ * the return value), so the probe programs can be used unchanged.
+ *
+ * Syscall numbers are only known for syscalls whose name matches a __NR_*
+ * definition in <asm/unistd.h>.  Other probes are attached the regular way.
+ * Note that unlike the per-syscall tracepoints, the raw_syscalls tracepoints
+ * also fire for syscalls made by 32-bit (compat) tasks, which will then be
+ * reported as the native syscall with the same number.
  */
 #include <assert.h>
 #include <ctype.h>
@@ -31,6 +45,7 @@
 
 #include "dt_dctx.h"
 #include "dt_cg.h"
+#include "dt_bpf.h"
 #include "dt_provider.h"
 #include "dt_probe.h"
 #include "dt_pt_regs.h"
@@ -67,6 +82,27 @@ struct syscall_data {
 #define ENTRY_PREFIX	"sys_enter_"
 #define EXIT_PREFIX	"sys_exit_"
 
+#define RAW_SYSCALLSFS	EVENTSFS "raw_syscalls/"
+
+/*
+ * Syscall numbers by name (sorted by name), generated from <asm/unistd.h>.
+ */
+static const struct syscall_nr {
+	const char	*name;
+	int		nr;
+} syscall_nrs[] = {
+#include "dt_syscalls.h"
+};
+
+/*
+ * State for batched attach, one for entry probes and one for return probes.
+ */
+typedef struct syscall_batch {
+	int		map_fd;		/* program array, by syscall number */
+	int		prog_fd;	/* dispatcher program */
+	tp_probe_t	*tpp;		/* raw_syscalls tracepoint */
+} syscall_batch_t;
+
 /* Scan the PROBE_LIST file and add probes for any syscalls events. */
 static int populate(dtrace_hdl_t *dtp)
 {
@@ -235,13 +271,209 @@ static int probe_info(dtrace_hdl_t *dtp, const dt_probe_t *prp,
 	return rc;
 }
 
+static int syscall_nr_cmp(const void *key, const void *elem)
+{
+	return strcmp(key, ((const struct syscall_nr *)elem)->name);
+}
+
+/*
+ * Return the syscall number for the given syscall name, or -1 if unknown.
+ */
+static int syscall_nr(const char *name)
+{
+	const struct syscall_nr	*scp;
+
+	scp = bsearch(name, syscall_nrs, ARRAY_SIZE(syscall_nrs),
+		      sizeof(struct syscall_nr), syscall_nr_cmp);
+
+	return scp != NULL ? scp->nr : -1;
+}
+
+static void batch_destroy(dtrace_hdl_t *dtp, syscall_batch_t *sbp)
+{
+	if (sbp->tpp != NULL) {
+		dt_tp_detach(dtp, sbp->tpp);
+		dt_tp_destroy(dtp, sbp->tpp);
+		sbp->tpp = NULL;
+	}
+	if (sbp->prog_fd != -1) {
+		close(sbp->prog_fd);
+		sbp->prog_fd = -1;
+	}
+	if (sbp->map_fd != -1) {
+		close(sbp->map_fd);
+		sbp->map_fd = -1;
+	}
+}
+
+/*
+ * Create the program array and the dispatcher program for entry or return
+ * probes, and attach the dispatcher to the corresponding raw_syscalls
+ * tracepoint.
+ */
+static int batch_create(dtrace_hdl_t *dtp, syscall_batch_t *sbp, int ret)
+{
+	union bpf_attr	attr;
+	FILE		*f;
+	int		i, nsyscalls = 0;
+	struct bpf_insn	insns[] = {
+		/*
+		 * bpf_tail_call(ctx, map, ((struct syscall_data *)ctx)->nr);
+		 * return 0;
+		 */
+		BPF_LOAD(BPF_DW, BPF_REG_3, BPF_REG_1,
+			 offsetof(struct syscall_data, syscall_nr)),
+		BPF_LDDW(BPF_REG_2, 0),
+		BPF_CALL_HELPER(BPF_FUNC_tail_call),
+		BPF_MOV_IMM(BPF_REG_0, 0),
+		BPF_RETURN(),
+	};
+
+	for (i = 0; i < ARRAY_SIZE(syscall_nrs); i++) {
+		if (syscall_nrs[i].nr >= nsyscalls)
+			nsyscalls = syscall_nrs[i].nr + 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_PROG_ARRAY;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = nsyscalls;
+	sbp->map_fd = bpf(BPF_MAP_CREATE, &attr);
+	if (sbp->map_fd < 0)
+		goto fail;
+
+	insns[1].src_reg = BPF_PSEUDO_MAP_FD;
+	insns[1].imm = sbp->map_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+	attr.insns = (uint64_t)(unsigned long)insns;
+	attr.insn_cnt = ARRAY_SIZE(insns);
+	attr.license = (uint64_t)(unsigned long)"GPL";
+	sbp->prog_fd = bpf(BPF_PROG_LOAD, &attr);
+	if (sbp->prog_fd < 0)
+		goto fail;
+
+	sbp->tpp = dt_tp_alloc(dtp);
+	if (sbp->tpp == NULL)
+		goto fail;
+
+	f = fopen(ret ? RAW_SYSCALLSFS "sys_exit/format"
+		      : RAW_SYSCALLSFS "sys_enter/format", "r");
+	if (f == NULL)
+		goto fail;
+
+	i = dt_tp_event_info(dtp, f, 0, sbp->tpp, NULL, NULL);
+	fclose(f);
+	if (i < 0) {
+		errno = -i;
+		goto fail;
+	}
+
+	if (dt_tp_attach(dtp, sbp->tpp, sbp->prog_fd) < 0) {
+		batch_destroy(dtp, sbp);
+		return -1;
+	}
+
+	dt_dprintf("syscall: dispatcher attached to raw_syscalls:%s\n",
+		   ret ? "sys_exit" : "sys_enter");
+
+	return 0;
+
+fail:
+	dt_set_errno(dtp, errno);
+	batch_destroy(dtp, sbp);
+
+	return -1;
+}
+
+static int attach(dtrace_hdl_t *dtp, const dt_probe_t *prp, int bpf_fd)
+{
+	syscall_batch_t	*sbp = prp->prov->pv_data;
+	int		i, ret, nr;
+
+	if (dtp->dt_options[DTRACEOPT_SYSCALLBATCH] == DTRACEOPT_UNSET)
+		return dt_tp_probe_attach(dtp, prp, bpf_fd);
+
+	nr = syscall_nr(prp->desc->fun);
+	if (nr < 0)
+		return dt_tp_probe_attach(dtp, prp, bpf_fd);
+
+	if (sbp == NULL) {
+		sbp = dt_alloc(dtp, 2 * sizeof(syscall_batch_t));
+		if (sbp == NULL)
+			return -1;
+
+		for (i = 0; i < 2; i++) {
+			sbp[i].map_fd = -1;
+			sbp[i].prog_fd = -1;
+			sbp[i].tpp = NULL;
+		}
+
+		prp->prov->pv_data = sbp;
+	}
+
+	/*
+	 * We know that the probe name is either "entry" or "return", so we can
+	 * just check the first character.
+	 */
+	ret = prp->desc->prb[0] == 'r';
+	sbp += ret;
+	if (sbp->map_fd == -1 && batch_create(dtp, sbp, ret) < 0)
+		return -1;
+
+	if (dt_bpf_map_update(sbp->map_fd, &nr, &bpf_fd) < 0)
+		return dt_set_errno(dtp, errno);
+
+	dt_dprintf("syscall: batched %s:%s (syscall %d)\n",
+		   prp->desc->fun, prp->desc->prb, nr);
+
+	return 0;
+}
+
+/*
+ * A batched probe is detached by removing its program from the program array,
+ * so the dispatcher no longer calls it.  The dispatchers and the program arrays
+ * are shared by all probes, and are only released when the provider is
+ * destroyed.
+ */
+static void detach(dtrace_hdl_t *dtp, const dt_probe_t *prp)
+{
+	syscall_batch_t	*sbp = prp->prov->pv_data;
+	int		nr;
+
+	dt_tp_probe_detach(dtp, prp);
+
+	if (sbp == NULL)
+		return;
+
+	nr = syscall_nr(prp->desc->fun);
+	if (nr < 0)
+		return;
+
+	sbp += prp->desc->prb[0] == 'r';
+	if (sbp->map_fd != -1)
+		dt_bpf_map_delete(sbp->map_fd, &nr);
+}
+
+static void destroy(dtrace_hdl_t *dtp, void *datap)
+{
+	syscall_batch_t	*sbp = datap;
+
+	batch_destroy(dtp, &sbp[0]);
+	batch_destroy(dtp, &sbp[1]);
+	dt_free(dtp, sbp);
+}
+
 dt_provimpl_t	dt_syscall = {
 	.name		= prvname,
 	.prog_type	= BPF_PROG_TYPE_TRACEPOINT,
 	.populate	= &populate,
 	.trampoline	= &trampoline,
-	.attach		= &dt_tp_probe_attach,
+	.attach		= &attach,
 	.probe_info	= &probe_info,
-	.detach		= &dt_tp_probe_detach,
+	.detach		= &detach,
 	.probe_destroy	= &dt_tp_probe_destroy,
+	.destroy	= &destroy,
 };
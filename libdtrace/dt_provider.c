@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -45,6 +45,10 @@ dt_provider_del_prov(dt_provider_t *head, dt_provider_t *pvp)
 	if (pvp->pv_probes != NULL)
 		dt_idhash_destroy(pvp->pv_probes);
 
+	if (pvp->pv_data != NULL && pvp->impl != NULL &&
+	    pvp->impl->destroy != NULL)
+		pvp->impl->destroy(pvp->pv_hdl, pvp->pv_data);
+
 	dt_node_link_free(&pvp->pv_nodes);
 	free(pvp->pv_xrefs);
 	free(pvp);
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -31,6 +31,7 @@ extern "C" {
 #define GROUP_DATA	getpid(), prvname
 
 struct dt_probe;
+union bpf_attr;
 
 /*
  * Because it would waste both space and time, argument types are not recorded
@@ -67,6 +68,9 @@ typedef struct dt_provimpl {
 	void (*enable)(dtrace_hdl_t *dtp,	/* enable the given probe */
 		       struct dt_probe *prp);
 	void (*trampoline)(dt_pcb_t *pcb);	/* generate BPF trampoline */
+	void (*prog_attr)(dtrace_hdl_t *dtp,	/* per-probe BPF load attrs */
+			  const struct dt_probe *prp,
+			  union bpf_attr *attr);
 	int (*attach)(dtrace_hdl_t *dtp,	/* attach BPF prog to probe */
 		      const struct dt_probe *prp, int bpf_fd);
 	int (*probe_info)(dtrace_hdl_t *dtp,	/* get probe info */
@@ -74,8 +78,10 @@ typedef struct dt_provimpl {
 			  int *argcp, dt_argdesc_t **argvp);
 	void (*detach)(dtrace_hdl_t *dtp,	/* probe cleanup */
 		       const struct dt_probe *prb);
-	void (*probe_destroy)(dtrace_hdl_t *dtp, /* free provider data */
+	void (*probe_destroy)(dtrace_hdl_t *dtp, /* free probe data */
 			      void *datap);
+	void (*destroy)(dtrace_hdl_t *dtp,	/* free provider data */
+			void *datap);
 } dt_provimpl_t;
 
 extern dt_provimpl_t dt_dtrace;
@@ -97,6 +103,7 @@ typedef struct dt_provider {
 	ulong_t pv_gen;			/* generation # that created me */
 	dtrace_hdl_t *pv_hdl;		/* pointer to containing dtrace_hdl */
 	uint_t pv_flags;		/* flags (see below) */
+	void *pv_data;			/* provider-specific data */
 } dt_provider_t;
 
 typedef struct tp_probe tp_probe_t;
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2003, 2020, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2003, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -116,7 +116,10 @@ dt_regset_free(dt_regset_t *drp, int reg)
 }
 
 /*
- * Allocate %r1 through %r5 for use as function call arguments in BPF.
+ * Allocate %r1 through %r5 for use as function call arguments in BPF.  Any of
+ * these registers that are in use are spilled to the stack.  The optimizer
+ * (dt_irlist_optimize()) keeps such spilled values in a free callee-saved
+ * register instead, or drops the spill if it turns out not to be needed.
  */
 int
 dt_regset_xalloc_args(dt_regset_t *drp)
@@ -0,0 +1,628 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Kernel type index.
+ *
+ * Looking up a type name in every module means loading the CTF for every
+ * kernel module, even though almost all kernel types live in the shared CTF
+ * and most names that are looked up (by the lexer, to tell identifiers from
+ * type names) are not types at all.  The type index maps each type name in the
+ * CTF archive to the module that defines it, so that only that module's CTF
+ * needs to be loaded.
+ *
+ * The index is built from the archive the first time it is needed.  If the
+ * typecache option is set, it is saved in the given directory and reused by
+ * later runs for as long as the archive does not change.
+ */
+
+#include <alloca.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <dt_impl.h>
+#include <dt_string.h>
+#include <dt_typeidx.h>
+
+#define DT_TYPEIDX_MAGIC	0x44545449	/* "DTTI" */
+#define DT_TYPEIDX_VERSION	1
+
+typedef struct dt_typeidx_ent {
+	dt_hentry_t	dte_he;		/* htab links */
+	const char	*dte_module;	/* module that defines the type */
+	ctf_id_t	dte_type;	/* type id in that module */
+	int		dte_fwd;	/* type is a forward declaration */
+	char		dte_name[1];	/* type name */
+} dt_typeidx_ent_t;
+
+struct dt_typeidx {
+	dt_htab_t	*dti_types;	/* dt_typeidx_ent_t, by name */
+	char		**dti_mods;	/* modules in the archive (sorted) */
+	uint32_t	dti_nmods;	/* number of modules */
+	uint32_t	dti_modsz;	/* size of dti_mods */
+};
+
+/*
+ * On-disk format: a header, an array of module name offsets, an array of
+ * entries, and a string table.  The header identifies the archive that the
+ * index was built from.
+ */
+typedef struct dt_typeidx_hdr {
+	uint32_t	dth_magic;	/* DT_TYPEIDX_MAGIC */
+	uint32_t	dth_version;	/* DT_TYPEIDX_VERSION */
+	uint64_t	dth_dev;	/* archive st_dev */
+	uint64_t	dth_ino;	/* archive st_ino */
+	uint64_t	dth_size;	/* archive st_size */
+	uint64_t	dth_mtime;	/* archive st_mtime (in ns) */
+	uint32_t	dth_nmods;	/* number of modules */
+	uint32_t	dth_nents;	/* number of entries */
+	uint32_t	dth_strsz;	/* size of string table */
+	uint32_t	dth_pad;
+} dt_typeidx_hdr_t;
+
+typedef struct dt_typeidx_rec {
+	uint32_t	dtr_name;	/* name offset in string table */
+	uint32_t	dtr_module;	/* module index */
+	uint32_t	dtr_type;	/* type id */
+	uint32_t	dtr_fwd;	/* forward declaration */
+} dt_typeidx_rec_t;
+
+static uint32_t
+dt_typeidx_hval(const dt_typeidx_ent_t *ent)
+{
+	return str2hval(ent->dte_name, 0);
+}
+
+static int
+dt_typeidx_cmp(const dt_typeidx_ent_t *p, const dt_typeidx_ent_t *q)
+{
+	return strcmp(p->dte_name, q->dte_name);
+}
+
+DEFINE_HE_STD_LINK_FUNCS(dt_typeidx, dt_typeidx_ent_t, dte_he)
+
+static void *
+dt_typeidx_del_ent(dt_typeidx_ent_t *head, dt_typeidx_ent_t *ent)
+{
+	head = dt_typeidx_del(head, ent);
+	free(ent);
+
+	return head;
+}
+
+static dt_htab_ops_t dt_typeidx_htab_ops = {
+	.hval = (htab_hval_fn)dt_typeidx_hval,
+	.cmp = (htab_cmp_fn)dt_typeidx_cmp,
+	.add = (htab_add_fn)dt_typeidx_add,
+	.del = (htab_del_fn)dt_typeidx_del_ent,
+	.next = (htab_next_fn)dt_typeidx_next
+};
+
+static void
+dt_typeidx_free(dtrace_hdl_t *dtp, dt_typeidx_t *dti)
+{
+	uint32_t	i;
+
+	dt_htab_destroy(dtp, dti->dti_types);
+	dti->dti_types = NULL;
+
+	for (i = 0; i < dti->dti_nmods; i++)
+		free(dti->dti_mods[i]);
+	free(dti->dti_mods);
+	dti->dti_mods = NULL;
+	dti->dti_nmods = dti->dti_modsz = 0;
+}
+
+void
+dt_typeidx_destroy(dtrace_hdl_t *dtp)
+{
+	if (dtp->dt_typeidx == NULL)
+		return;
+
+	dt_typeidx_free(dtp, dtp->dt_typeidx);
+	free(dtp->dt_typeidx);
+	dtp->dt_typeidx = NULL;
+}
+
+/*
+ * Return the module name as stored in the index, adding it if needed.
+ */
+static const char *
+dt_typeidx_module(dt_typeidx_t *dti, const char *name)
+{
+	uint32_t	i;
+
+	for (i = 0; i < dti->dti_nmods; i++) {
+		if (strcmp(dti->dti_mods[i], name) == 0)
+			return dti->dti_mods[i];
+	}
+
+	if (dti->dti_nmods == dti->dti_modsz) {
+		uint32_t	nsz = dti->dti_modsz ? dti->dti_modsz * 2 : 64;
+		char		**nmods;
+
+		nmods = realloc(dti->dti_mods, nsz * sizeof(char *));
+		if (nmods == NULL)
+			return NULL;
+
+		dti->dti_mods = nmods;
+		dti->dti_modsz = nsz;
+	}
+
+	if ((dti->dti_mods[dti->dti_nmods] = strdup(name)) == NULL)
+		return NULL;
+
+	return dti->dti_mods[dti->dti_nmods++];
+}
+
+/*
+ * Add a type to the index.  A definition of a type takes precedence over a
+ * forward declaration.  Otherwise, the first module that defines a type wins.
+ */
+static int
+dt_typeidx_insert(dt_typeidx_t *dti, const char *name, const char *mod,
+		  ctf_id_t type, int fwd)
+{
+	dt_typeidx_ent_t	*ent, *tmpl;
+	size_t			len = strlen(name);
+
+	tmpl = alloca(sizeof(dt_typeidx_ent_t) + len);
+	strcpy(tmpl->dte_name, name);
+
+	ent = dt_htab_lookup(dti->dti_types, tmpl);
+	if (ent != NULL) {
+		if (ent->dte_fwd && !fwd) {
+			ent->dte_module = mod;
+			ent->dte_type = type;
+			ent->dte_fwd = 0;
+		}
+
+		return 0;
+	}
+
+	ent = malloc(sizeof(dt_typeidx_ent_t) + len);
+	if (ent == NULL)
+		return -1;
+
+	memset(ent, 0, sizeof(dt_typeidx_ent_t));
+	strcpy(ent->dte_name, name);
+	ent->dte_module = mod;
+	ent->dte_type = type;
+	ent->dte_fwd = fwd;
+
+	if (dt_htab_insert(dti->dti_types, ent) < 0) {
+		free(ent);
+		return -1;
+	}
+
+	return 0;
+}
+
+typedef struct dt_typeidx_build {
+	dt_typeidx_t	*dtb_idx;	/* index being built */
+	ctf_file_t	*dtb_ctfp;	/* CTF container being indexed */
+	const char	*dtb_module;	/* module the container belongs to */
+} dt_typeidx_build_t;
+
+static int
+dt_typeidx_add_type(ctf_id_t type, void *arg)
+{
+	dt_typeidx_build_t	*dtb = arg;
+	char			name[DT_TYPE_NAMELEN];
+	int			kind;
+
+	/*
+	 * Only named types can be looked up by a plain name.  Others (e.g.
+	 * pointers) are found through the type they refer to.
+	 */
+	kind = ctf_type_kind(dtb->dtb_ctfp, type);
+	switch (kind) {
+	case CTF_K_INTEGER:
+	case CTF_K_FLOAT:
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+	case CTF_K_ENUM:
+	case CTF_K_TYPEDEF:
+	case CTF_K_FORWARD:
+		break;
+	default:
+		return 0;
+	}
+
+	if (ctf_type_name(dtb->dtb_ctfp, type, name, sizeof(name)) == NULL ||
+	    name[0] == '\0' || name[strlen(name) - 1] == ' ' ||
+	    strchr(name, '(') != NULL)
+		return 0;
+
+	return dt_typeidx_insert(dtb->dtb_idx, name, dtb->dtb_module, type,
+				 kind == CTF_K_FORWARD);
+}
+
+static int
+dt_typeidx_add_member(ctf_file_t *fp, const char *name, void *arg)
+{
+	dt_typeidx_build_t	*dtb = arg;
+
+	/* The shared CTF has been indexed already. */
+	if (strcmp(name, "shared_ctf") == 0)
+		return 0;
+
+	dtb->dtb_ctfp = fp;
+	dtb->dtb_module = dt_typeidx_module(dtb->dtb_idx, name);
+	if (dtb->dtb_module == NULL)
+		return -1;
+
+	return ctf_type_iter(fp, dt_typeidx_add_type, dtb);
+}
+
+/*
+ * Build the index from the CTF archive.  Types in the shared CTF are visible
+ * through every module; they are attributed to vmlinux, which is always
+ * searched first.
+ */
+static int
+dt_typeidx_build(dtrace_hdl_t *dtp, dt_typeidx_t *dti)
+{
+	dt_typeidx_build_t	dtb;
+
+	dtb.dtb_idx = dti;
+	dtb.dtb_ctfp = dtp->dt_shared_ctf;
+	dtb.dtb_module = dt_typeidx_module(dti, "vmlinux");
+	if (dtb.dtb_module == NULL)
+		return -1;
+
+	if (ctf_type_iter(dtp->dt_shared_ctf, dt_typeidx_add_type, &dtb) != 0 ||
+	    ctf_archive_iter(dtp->dt_ctfa, dt_typeidx_add_member, &dtb) != 0)
+		return -1;
+
+	return 0;
+}
+
+static int
+dt_typeidx_modcmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * Identify the CTF archive, and the cache file for its index.
+ */
+static int
+dt_typeidx_key(dtrace_hdl_t *dtp, dt_typeidx_hdr_t *hdr, char *path,
+	       size_t len)
+{
+	struct stat	st;
+	char		*ctfa_name;
+	int		rc;
+
+	if (dtp->dt_ctfa_path == NULL) {
+		ctfa_name = alloca(strlen(dtp->dt_module_path) +
+				   strlen("/kernel/vmlinux.ctfa") + 1);
+		strcpy(stpcpy(ctfa_name, dtp->dt_module_path),
+		       "/kernel/vmlinux.ctfa");
+	} else
+		ctfa_name = dtp->dt_ctfa_path;
+
+	rc = stat(ctfa_name, &st);
+	if (rc == -1)
+		return -1;
+
+	memset(hdr, 0, sizeof(dt_typeidx_hdr_t));
+	hdr->dth_magic = DT_TYPEIDX_MAGIC;
+	hdr->dth_version = DT_TYPEIDX_VERSION;
+	hdr->dth_dev = st.st_dev;
+	hdr->dth_ino = st.st_ino;
+	hdr->dth_size = st.st_size;
+	hdr->dth_mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL +
+			 st.st_mtim.tv_nsec;
+
+	snprintf(path, len, "%s/typeidx-%08x.idx", dtp->dt_typecache,
+		 str2hval(ctfa_name, 0));
+
+	return 0;
+}
+
+/*
+ * Load the index from the cache.  Anything that does not look right means
+ * that the cached index is ignored (and replaced).
+ */
+static int
+dt_typeidx_read(dtrace_hdl_t *dtp, dt_typeidx_t *dti,
+		const dt_typeidx_hdr_t *key, const char *path)
+{
+	dt_typeidx_hdr_t	*hdr;
+	const uint32_t		*mods;
+	const dt_typeidx_rec_t	*recs;
+	const char		*strs;
+	struct stat		st;
+	char			*buf = NULL;
+	size_t			size;
+	uint32_t		i;
+	int			fd, rc = -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(dt_typeidx_hdr_t) ||
+	    (buf = malloc(st.st_size)) == NULL ||
+	    read(fd, buf, st.st_size) != st.st_size)
+		goto out;
+
+	size = st.st_size;
+	hdr = (dt_typeidx_hdr_t *)buf;
+	if (memcmp(hdr, key, offsetof(dt_typeidx_hdr_t, dth_nmods)) != 0 ||
+	    size != sizeof(dt_typeidx_hdr_t) +
+		    (uint64_t)hdr->dth_nmods * sizeof(uint32_t) +
+		    (uint64_t)hdr->dth_nents * sizeof(dt_typeidx_rec_t) +
+		    hdr->dth_strsz ||
+	    hdr->dth_strsz == 0)
+		goto out;
+
+	mods = (const uint32_t *)(hdr + 1);
+	recs = (const dt_typeidx_rec_t *)(mods + hdr->dth_nmods);
+	strs = (const char *)(recs + hdr->dth_nents);
+	if (strs[hdr->dth_strsz - 1] != '\0')
+		goto out;
+
+	for (i = 0; i < hdr->dth_nmods; i++) {
+		if (mods[i] >= hdr->dth_strsz ||
+		    dt_typeidx_module(dti, strs + mods[i]) == NULL)
+			goto out;
+	}
+
+	for (i = 0; i < hdr->dth_nents; i++) {
+		const dt_typeidx_rec_t	*rec = &recs[i];
+
+		if (rec->dtr_name >= hdr->dth_strsz ||
+		    rec->dtr_module >= dti->dti_nmods ||
+		    dt_typeidx_insert(dti, strs + rec->dtr_name,
+				      dti->dti_mods[rec->dtr_module],
+				      rec->dtr_type, rec->dtr_fwd) != 0)
+			goto out;
+	}
+
+	dt_dprintf("using cached type index %s\n", path);
+	rc = 0;
+
+out:
+	if (rc != 0)
+		dt_dprintf("ignoring cached type index %s\n", path);
+	free(buf);
+	close(fd);
+
+	return rc;
+}
+
+/*
+ * Save the index in the cache.  Failures are not fatal: the cache is merely
+ * an optimization.
+ */
+static void
+dt_typeidx_write(dtrace_hdl_t *dtp, const dt_typeidx_t *dti,
+		 const dt_typeidx_hdr_t *key, const char *path)
+{
+	char			tmp[PATH_MAX + 16];
+	dt_typeidx_hdr_t	hdr = *key;
+	dt_typeidx_rec_t	*recs = NULL;
+	uint32_t		*mods = NULL;
+	dt_strtab_t		*strs = NULL;
+	char			*strbuf = NULL;
+	dt_htab_next_t		*it = NULL;
+	dt_typeidx_ent_t	*ent;
+	size_t			modsz, recsz;
+	uint32_t		i;
+	int			fd = -1;
+
+	hdr.dth_nmods = dti->dti_nmods;
+	hdr.dth_nents = dt_htab_entries(dti->dti_types);
+	modsz = hdr.dth_nmods * sizeof(uint32_t);
+	recsz = hdr.dth_nents * sizeof(dt_typeidx_rec_t);
+
+	mods = malloc(modsz);
+	recs = malloc(recsz);
+	strs = dt_strtab_create(BUFSIZ);
+	if (mods == NULL || recs == NULL || strs == NULL)
+		goto fail;
+
+	for (i = 0; i < dti->dti_nmods; i++)
+		mods[i] = dt_strtab_insert(strs, dti->dti_mods[i]);
+
+	for (i = 0; (ent = dt_htab_next(dti->dti_types, &it)) != NULL; i++) {
+		const char	**mp;
+
+		mp = bsearch(&ent->dte_module, dti->dti_mods, dti->dti_nmods,
+			     sizeof(char *), dt_typeidx_modcmp);
+
+		recs[i].dtr_name = dt_strtab_insert(strs, ent->dte_name);
+		recs[i].dtr_module = mp - (const char **)dti->dti_mods;
+		recs[i].dtr_type = ent->dte_type;
+		recs[i].dtr_fwd = ent->dte_fwd;
+	}
+
+	hdr.dth_strsz = dt_strtab_size(strs);
+	strbuf = malloc(hdr.dth_strsz);
+	if (strbuf == NULL)
+		goto fail;
+
+	dt_strtab_write(strs, (dt_strtab_write_f *)dt_strtab_copystr, strbuf);
+
+	/*
+	 * Write to a temporary file, and rename it into place so that
+	 * concurrent consumers never see a partial index.
+	 */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		goto fail;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, mods, modsz) != modsz ||
+	    write(fd, recs, recsz) != recsz ||
+	    write(fd, strbuf, hdr.dth_strsz) != hdr.dth_strsz)
+		goto fail;
+
+	if (close(fd) == 0 && rename(tmp, path) == 0)
+		goto out;
+
+	fd = -1;
+
+fail:
+	dt_dprintf("failed to write cached type index %s\n", path);
+	if (fd != -1)
+		close(fd);
+	unlink(tmp);
+
+out:
+	free(mods);
+	free(recs);
+	free(strbuf);
+	if (strs != NULL)
+		dt_strtab_destroy(strs);
+}
+
+/*
+ * Make the index available, if it can be.  The index is only built once: if
+ * that fails, kernel type lookups fall back to searching every module.
+ */
+static dt_typeidx_t *
+dt_typeidx_get(dtrace_hdl_t *dtp)
+{
+	dt_typeidx_t		*dti = dtp->dt_typeidx;
+	dt_typeidx_hdr_t	key;
+	char			path[PATH_MAX];
+	int			cached = 0, build = 0;
+
+	if (dti != NULL)
+		return dti->dti_types != NULL ? dti : NULL;
+
+	/*
+	 * The archive is opened when the first kernel module is loaded.
+	 */
+	if (dtp->dt_ctfa == NULL)
+		return NULL;
+
+	dti = dt_zalloc(dtp, sizeof(dt_typeidx_t));
+	if (dti == NULL)
+		return NULL;
+
+	dtp->dt_typeidx = dti;
+	dti->dti_types = dt_htab_create(dtp, &dt_typeidx_htab_ops);
+	if (dti->dti_types == NULL)
+		return NULL;
+
+	if (dtp->dt_typecache != NULL &&
+	    dt_typeidx_key(dtp, &key, path, sizeof(path)) == 0)
+		cached = 1;
+
+	if (!cached || dt_typeidx_read(dtp, dti, &key, path) != 0) {
+		/* Discard whatever part of the cached index was read. */
+		dt_typeidx_free(dtp, dti);
+		dti->dti_types = dt_htab_create(dtp, &dt_typeidx_htab_ops);
+		if (dti->dti_types == NULL)
+			return NULL;
+
+		if (dt_typeidx_build(dtp, dti) != 0) {
+			dt_dprintf("cannot build kernel type index\n");
+			dt_typeidx_free(dtp, dti);
+			return NULL;
+		}
+
+		build = 1;
+	}
+
+	qsort(dti->dti_mods, dti->dti_nmods, sizeof(char *),
+	      dt_typeidx_modcmp);
+
+	if (cached && build)
+		dt_typeidx_write(dtp, dti, &key, path);
+
+	return dti;
+}
+
+/*
+ * The index only knows about plain type names: an identifier, possibly
+ * preceded by "struct", "union", or "enum", or a sequence of integer type
+ * keywords.  Pointers, arrays, qualifiers, and scoped names are looked up the
+ * slow way.
+ */
+static int
+dt_typeidx_plain(const char *name)
+{
+	const char	*p;
+
+	if (!isalpha(name[0]) && name[0] != '_')
+		return 0;
+
+	if (strncmp(name, "const ", 6) == 0 ||
+	    strncmp(name, "volatile ", 9) == 0 ||
+	    strncmp(name, "restrict ", 9) == 0)
+		return 0;
+
+	for (p = name; *p != '\0'; p++) {
+		if (*p == ' ') {
+			if (p[1] == ' ' || p[1] == '\0')
+				return 0;
+		} else if (!isalnum(*p) && *p != '_')
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Look up a type name in the kernel type index.  Returns -1 if the index
+ * cannot be used for this name.  Otherwise, returns 0 and sets *modp to the
+ * name of the module that defines the type (and *typep to its type id), or to
+ * NULL if no module in the CTF archive has a type by that name.
+ */
+int
+dt_typeidx_lookup(dtrace_hdl_t *dtp, const char *name, const char **modp,
+		  ctf_id_t *typep)
+{
+	dt_typeidx_t		*dti;
+	dt_typeidx_ent_t	*ent, *tmpl;
+
+	if (!dt_typeidx_plain(name) || (dti = dt_typeidx_get(dtp)) == NULL)
+		return -1;
+
+	tmpl = alloca(sizeof(dt_typeidx_ent_t) + strlen(name));
+	strcpy(tmpl->dte_name, name);
+
+	ent = dt_htab_lookup(dti->dti_types, tmpl);
+	if (ent == NULL) {
+		*modp = NULL;
+		return 0;
+	}
+
+	*modp = ent->dte_module;
+	*typep = ent->dte_type;
+
+	return 0;
+}
+
+/*
+ * Return whether the given module is covered by the index.
+ */
+int
+dt_typeidx_has_module(dtrace_hdl_t *dtp, const char *name)
+{
+	dt_typeidx_t	*dti = dtp->dt_typeidx;
+
+	if (dti == NULL || dti->dti_types == NULL)
+		return 0;
+
+	return bsearch(&name, dti->dti_mods, dti->dti_nmods, sizeof(char *),
+		       dt_typeidx_modcmp) != NULL;
+}
@@ -0,0 +1,28 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef	_DT_TYPEIDX_H
+#define	_DT_TYPEIDX_H
+
+#include <dt_impl.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct dt_typeidx dt_typeidx_t;
+
+extern int dt_typeidx_lookup(dtrace_hdl_t *, const char *, const char **,
+    ctf_id_t *);
+extern int dt_typeidx_has_module(dtrace_hdl_t *, const char *);
+extern void dt_typeidx_destroy(dtrace_hdl_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_TYPEIDX_H */
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2006, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2006, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -20,6 +20,14 @@
 #include <sys/epoll.h>
 #include <valgrind/valgrind.h>
 
+static const char *const _dt_phase_names[DTRACE_PHASE_MAX] = {
+	"wait",
+	"consume",
+	"format",
+	"symbol",
+	"aggsnap",
+};
+
 void
 BEGIN_probe(void)
 {
@@ -168,6 +176,81 @@ dtrace_stop(dtrace_hdl_t *dtp)
 	return 0;
 }
 
+/*
+ * Consumer phase timing.  CLOCK_MONOTONIC is read through the vDSO (using the
+ * TSC on x86), so taking a timestamp does not involve a system call.
+ */
+hrtime_t
+dt_phase_start(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (hrtime_t)ts.tv_sec * NANOSEC + ts.tv_nsec;
+}
+
+void
+dt_phase_end(dtrace_hdl_t *dtp, int phase, hrtime_t start)
+{
+	dtrace_phasestat_t	*php = &dtp->dt_stats.dtst_phases[phase];
+
+	php->dtph_count++;
+	php->dtph_time += dt_phase_start() - start;
+}
+
+int
+dtrace_stats(dtrace_hdl_t *dtp, dtrace_stats_t *stp)
+{
+	memcpy(stp, &dtp->dt_stats, sizeof(dtrace_stats_t));
+
+	return 0;
+}
+
+const char *
+dtrace_phase_name(int phase)
+{
+	if (phase < 0 || phase >= DTRACE_PHASE_MAX)
+		return "unknown";
+
+	return _dt_phase_names[phase];
+}
+
+/*
+ * Write the consumer statistics to stderr if the statsrate option is set and
+ * at least that much time has passed since the previous dump.
+ */
+static void
+dt_stats_dump(dtrace_hdl_t *dtp)
+{
+	dtrace_optval_t		interval = dtp->dt_options[DTRACEOPT_STATSRATE];
+	const dtrace_stats_t	*stp = &dtp->dt_stats;
+	hrtime_t		now;
+	int			i;
+
+	if (interval == DTRACEOPT_UNSET)
+		return;
+
+	now = gethrtime();
+	if (now - dtp->dt_laststats < interval)
+		return;
+
+	dtp->dt_laststats = now;
+
+	fprintf(stderr, "dtrace: %llu records, %llu bytes consumed\n",
+		(unsigned long long)stp->dtst_records,
+		(unsigned long long)stp->dtst_bytes);
+
+	for (i = 0; i < DTRACE_PHASE_MAX; i++) {
+		const dtrace_phasestat_t	*php = &stp->dtst_phases[i];
+
+		fprintf(stderr, "dtrace:   %-8s %10llu calls %14llu ns\n",
+			_dt_phase_names[i],
+			(unsigned long long)php->dtph_count,
+			(unsigned long long)php->dtph_time);
+	}
+}
+
 #if 0
 dtrace_workstatus_t
 dtrace_work(dtrace_hdl_t *dtp, FILE *fp,
@@ -246,6 +329,8 @@ dtrace_work(dtrace_hdl_t *dtp, FILE *fp, dtrace_consume_probe_f *pfunc,
 	    DTRACE_WORKSTATUS_ERROR)
 		return DTRACE_WORKSTATUS_ERROR;
 
+	dt_stats_dump(dtp);
+
 	return rval;
 }
 #endif
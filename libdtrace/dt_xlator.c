@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2005, 2020, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2005, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -126,7 +126,11 @@ dt_xlator_create(dtrace_hdl_t *dtp,
 		if (dxp->dx_locals == NULL)
 			goto err; /* no memory for identifier hash */
 
-		dt_idhash_xinsert(dxp->dx_locals, dxp->dx_ident);
+		if (dt_idhash_xinsert(dxp->dx_locals, dxp->dx_ident) == -1) {
+			dt_idhash_destroy(dxp->dx_locals);
+			dxp->dx_locals = NULL;
+			goto err; /* no memory for identifier hash */
+		}
 	}
 
 	dxp->dx_souid.di_name = "translator";
@@ -1,6 +1,6 @@
 /*
  * Oracle Linux DTrace.
- * Copyright (c) 2007, 2021, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2007, 2022, Oracle and/or its affiliates. All rights reserved.
  * Licensed under the Universal Permissive License v 1.0 as shown at
  * http://oss.oracle.com/licenses/upl.
  */
@@ -421,6 +421,9 @@ extern int dtrace_aggregate_walk_keyvarrevsorted(dtrace_hdl_t *dtp,
 extern int dtrace_aggregate_walk_valvarrevsorted(dtrace_hdl_t *dtp,
     dtrace_aggregate_f *func, void *arg);
 
+extern int dtrace_aggregate_walk_delta(dtrace_hdl_t *dtp, dtrace_aggid_t varid,
+    dtrace_aggregate_f *func, void *arg);
+
 #define	DTRACE_AGD_PRINTED	0x1	/* aggregation printed in program */
 
 /*
@@ -562,6 +565,50 @@ extern int dtrace_probe_iter(dtrace_hdl_t *dtp,
 extern int dtrace_probe_info(dtrace_hdl_t *dtp,
     const dtrace_probedesc_t *pdp, dtrace_probeinfo_t *pip);
 
+/*
+ * Run-time statistics for the BPF program of an enabled probe, collected when
+ * the "probestats" option is set.
+ */
+typedef struct dtrace_probestat {
+	const dtrace_probedesc_t *dtps_desc;	/* probe description */
+	uint64_t dtps_count;			/* number of firings */
+	uint64_t dtps_time;			/* total run time (ns) */
+} dtrace_probestat_t;
+
+typedef int dtrace_probestat_f(dtrace_hdl_t *dtp,
+    const dtrace_probestat_t *psp, void *arg);
+
+extern int dtrace_probestat_iter(dtrace_hdl_t *dtp, dtrace_probestat_f *func,
+    void *arg);
+
+/*
+ * DTrace Consumer Statistics Interface
+ *
+ * The library keeps counts and cumulative times for the main phases of trace
+ * data consumption.  Times are in nanoseconds and are inclusive, i.e. the
+ * time spent formatting output is also accounted for in the consume phase.
+ */
+#define	DTRACE_PHASE_WAIT	0	/* waiting for buffer data */
+#define	DTRACE_PHASE_CONSUME	1	/* decoding records from buffers */
+#define	DTRACE_PHASE_FORMAT	2	/* formatting output */
+#define	DTRACE_PHASE_SYMBOL	3	/* resolving stack symbols */
+#define	DTRACE_PHASE_AGGSNAP	4	/* snapshotting aggregation data */
+#define	DTRACE_PHASE_MAX	5	/* number of phases */
+
+typedef struct dtrace_phasestat {
+	uint64_t dtph_count;			/* number of times entered */
+	uint64_t dtph_time;			/* total time spent (ns) */
+} dtrace_phasestat_t;
+
+typedef struct dtrace_stats {
+	uint64_t dtst_records;			/* records consumed */
+	uint64_t dtst_bytes;			/* bytes consumed */
+	dtrace_phasestat_t dtst_phases[DTRACE_PHASE_MAX]; /* per-phase stats */
+} dtrace_stats_t;
+
+extern int dtrace_stats(dtrace_hdl_t *dtp, dtrace_stats_t *stp);
+extern const char *dtrace_phase_name(int phase);
+
 /*
  * DTrace Vector Interface
  *
@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+echo '/*'
+echo ' * Oracle Linux DTrace.'
+echo ' * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.'
+echo ' * Use is subject to license terms.'
+echo ' *'
+echo ' */'
+
+# The input is the list of macros that the C compiler predefines in C99 mode
+# (as produced by -E -dM), which is what cpp(1) predefines when it is run for
+# D programs.  The output is a list of "name body" string initializers for the
+# embedded preprocessor, sorted by name.
+
+sed -n 's/^#define //p' | \
+    sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e 's/^.*$/\t"&",/' | \
+    LC_ALL=C sort
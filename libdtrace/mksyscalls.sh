@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+echo '/*'
+echo ' * Oracle Linux DTrace.'
+echo ' * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.'
+echo ' * Use is subject to license terms.'
+echo ' *'
+echo ' */'
+
+# The input is from /usr/include/asm/unistd.h and files it includes.
+# Syscall numbers are sometimes defined in terms of other macros (e.g.
+# __NR3264_* in asm-generic), so we read them all in and then print the
+# __NR_* ones, looking up numerical values where necessary.  The output
+# is a list of { name, number } initializers, sorted by name.
+
+awk '
+    /^#define[[:blank:]]*__NR/ { nr[$2] = $3 }
+    END {
+        for (name in nr) {
+            if (substr(name, 1, 5) != "__NR_" || name == "__NR_syscalls")
+                continue;
+            num = nr[name];
+            for (i = 0; (num in nr) && i < 8; i++)
+                num = nr[num];
+            if (num !~ /^[0-9]+$/)
+                continue;
+            printf("\t{ \"%s\", %d },\n", substr(name, 6), num);
+        }
+    }' | LC_ALL=C sort
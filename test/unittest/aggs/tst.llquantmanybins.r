@@ -0,0 +1,14 @@
+
+
+           value  ------------- Distribution ------------- count    
+            1100 |                                         0        
+            1200 |@@@@@@@@@@@@@@@@@@@@@@@@@@@              2        
+            1300 |@@@@@@@@@@@@@                            1        
+            1400 |                                         0        
+
+
+           value  ------------- Distribution ------------- count    
+          980000 |                                         0        
+          990000 |@@@@@@@@@@@@@@@@@@@@                     1        
+      >= 1000000 |@@@@@@@@@@@@@@@@@@@@                     1        
+
@@ -0,0 +1,3 @@
+clause 1: gvars
+clause 2: lvars
+clause 3: aggs
@@ -0,0 +1,20 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+# ASSERTION:  That dtrace -S lists the DIFO flags of each clause.
+
+dtrace=$1
+
+# Print the DIFO flags of each clause.
+$dtrace $dt_flags -Sqn '
+BEGIN { x = 1; }
+BEGIN { this->y = 2; }
+BEGIN { @ = count(); exit(0); }
+' 2>&1 > /dev/null | awk '
+/^Disassembly of clause / { sect = "clause " ++n; next; }
+/^Disassembly of / { sect = ""; next; }
+sect != "" && $1 == "FLAGS" { $1 = ""; print sect ":" $0; }'
@@ -0,0 +1 @@
+&gvars
@@ -0,0 +1,20 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+# ASSERTION:  That the trampoline loads the address of the gvars map value
+#	      directly (BPF_PSEUDO_MAP_VALUE) rather than looking it up.
+
+dtrace=$1
+
+# Print the references to the gvars map in the program for the BEGIN probe.
+# A map value load is listed as &gvars, a map fd load as gvars.
+$dtrace $dt_flags -xdisasm=2 -Sqn '
+BEGIN { x = 1; exit(0); }
+' 2>&1 > /dev/null | awk '
+/^Disassembly of program dtrace:::BEGIN:/ { sect = 1; next; }
+/^Disassembly of / { sect = 0; next; }
+sect && / ! &?gvars$/ { print $NF; }'
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+# ASSERTION:  That the peephole optimizer folds the branch on a constant
+#	      predicate, and that -xnopeephole leaves it in place.
+
+dtrace=$1
+
+# Count the predicate tests of the form
+#	mov  %rX, 1
+#	jeq  %rX, 0, N
+# in the clause disassembly.
+count()
+{
+	$dtrace $dt_flags "$@" -Sen 'BEGIN /1/ { exit(0); }' |& awk '
+	$8 == "jeq" && $9 == reg && $10 == "0," { n++; }
+	{ reg = ($8 == "mov" && $10 == "1") ? $9 : ""; }
+	END { print n + 0; }'
+}
+
+n=`count -xnopeephole`
+if [ "$n" -ne 1 ]; then
+	echo "unoptimized code: expected 1 constant predicate test, found $n"
+	exit 1
+fi
+
+n=`count`
+if [ "$n" -ne 0 ]; then
+	echo "optimized code: expected no constant predicate test, found $n"
+	exit 1
+fi
+
+exit 0
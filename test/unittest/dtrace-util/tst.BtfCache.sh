@@ -0,0 +1,101 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# ASSERTION: Without a CTF archive, kernel types are converted from BTF, and
+# the -xbtfcache option saves the converted types so that later invocations
+# do not need to convert them again.
+#
+# SECTION: dtrace Utility/-x Option
+#
+
+dtrace=$1
+
+[ -r /sys/kernel/btf/vmlinux ] || exit 67
+
+DIRNAME="$tmpdir/btfcache.$$.$RANDOM"
+mkdir -p $DIRNAME
+
+run()
+{
+	$dtrace $dt_flags -xctfpath=/dev/null -xbtfcache=$DIRNAME -xdebug -qn '
+	BEGIN
+	{
+		printf("%d %d\n", sizeof(struct task_struct) > 0,
+		    offsetof(struct task_struct, pid) > 0);
+		exit(0);
+	}' 2> $DIRNAME/err.txt
+}
+
+count()
+{
+	grep -c "$1" $DIRNAME/err.txt
+}
+
+# The first run converts the vmlinux BTF and saves the result.
+out1=$(run) || { echo "DTrace failed (no cache)"; exit 1; }
+
+if [ "$out1" != "1 1" ]; then
+	echo "unexpected output: '$out1'"
+	exit 1
+fi
+if [ `count 'loaded CTF container for vmlinux from BTF'` -ne 1 ]; then
+	echo "vmlinux types not taken from BTF"
+	exit 1
+fi
+if [ `count 'converting BTF for vmlinux'` -ne 1 ] ||
+   [ `count 'using cached CTF'` -ne 0 ]; then
+	echo "vmlinux BTF not converted"
+	exit 1
+fi
+if ! ls $DIRNAME/btf-vmlinux-*.ctf > /dev/null 2>&1; then
+	echo "no cached CTF created"
+	exit 1
+fi
+
+# The second run uses the cached CTF instead of converting the BTF.
+out2=$(run) || { echo "DTrace failed (with cache)"; exit 1; }
+
+if [ "$out1" != "$out2" ]; then
+	echo "output mismatch: '$out1' vs '$out2'"
+	exit 1
+fi
+if [ `count 'using cached CTF .*/btf-vmlinux-'` -ne 1 ] ||
+   [ `count 'converting BTF for vmlinux'` -ne 0 ]; then
+	echo "cached CTF for vmlinux not used"
+	exit 1
+fi
+
+# A corrupt cache file must be ignored (and replaced).
+for f in $DIRNAME/btf-*.ctf; do
+	echo garbage > $f
+done
+
+out3=$(run) || { echo "DTrace failed (corrupt cache)"; exit 1; }
+
+if [ "$out1" != "$out3" ]; then
+	echo "output mismatch: '$out1' vs '$out3'"
+	exit 1
+fi
+if [ `count 'ignoring cached CTF .*/btf-vmlinux-'` -ne 1 ] ||
+   [ `count 'converting BTF for vmlinux'` -ne 1 ]; then
+	echo "corrupt cached CTF not ignored"
+	exit 1
+fi
+
+out4=$(run) || { echo "DTrace failed (replaced cache)"; exit 1; }
+
+if [ "$out1" != "$out4" ] ||
+   [ `count 'using cached CTF .*/btf-vmlinux-'` -ne 1 ]; then
+	echo "corrupt cached CTF not replaced"
+	exit 1
+fi
+
+rm -rf $DIRNAME
+
+exit 0
@@ -0,0 +1,116 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# ASSERTION: The -xlibcache option saves a snapshot of the D library
+# dependencies and the BPF library functions.  Later invocations use the
+# snapshot instead of scanning the libraries, except for libraries that
+# changed.
+#
+# SECTION: dtrace Utility/-x Option
+#
+
+dtrace=$1
+
+DIRNAME="$tmpdir/libcache.$$.$RANDOM"
+mkdir -p $DIRNAME/cache $DIRNAME/lib
+
+echo 'inline int TSTVAL = 42;' > $DIRNAME/lib/tst.d
+
+# The library directory is given with a trailing slash on purpose.
+run()
+{
+	$dtrace $dt_flags -xlibcache=$DIRNAME/cache -xlibdir=$DIRNAME/lib/ \
+	    -xdebug -qn '
+	BEGIN
+	{
+		printf("%d %d %d\n", EINVAL, SIGKILL, TSTVAL);
+		exit(0);
+	}' 2> $DIRNAME/err.txt
+}
+
+cached()
+{
+	grep -c "using cached $1" $DIRNAME/err.txt
+}
+
+# No snapshot yet: everything is scanned.
+out1=$(run) || { echo "DTrace failed (no snapshot)"; exit 1; }
+
+if [ "$out1" != "22 9 42" ]; then
+	echo "unexpected output: '$out1'"
+	exit 1
+fi
+if [ `cached dependencies` -ne 0 ] || [ `cached "BPF functions"` -ne 0 ]; then
+	echo "snapshot used before it was created"
+	exit 1
+fi
+if [ `ls $DIRNAME/cache/dlibs-*.snap | wc -l` -lt 2 ]; then
+	echo "no library snapshots created"
+	exit 1
+fi
+
+# The snapshot is used for the system and the user library directory.
+out2=$(run) || { echo "DTrace failed (with snapshot)"; exit 1; }
+
+if [ "$out1" != "$out2" ]; then
+	echo "output mismatch: '$out1' vs '$out2'"
+	exit 1
+fi
+if [ `cached "dependencies for .*/errno.d"` -ne 1 ] ||
+   [ `cached "dependencies for $DIRNAME/lib/.*tst.d"` -ne 1 ]; then
+	echo "cached library dependencies not used"
+	exit 1
+fi
+if [ `cached "BPF functions for .*\.o"` -lt 1 ]; then
+	echo "cached BPF functions not used"
+	exit 1
+fi
+
+# A library that changed is scanned again.
+sleep 1
+sed -i 's/42/43/' $DIRNAME/lib/tst.d
+
+out3=$(run) || { echo "DTrace failed (changed library)"; exit 1; }
+
+if [ "$out3" != "22 9 43" ]; then
+	echo "unexpected output for changed library: '$out3'"
+	exit 1
+fi
+if [ `cached "dependencies for $DIRNAME/lib/.*tst.d"` -ne 0 ] ||
+   [ `cached "dependencies for .*/errno.d"` -ne 1 ]; then
+	echo "snapshot used for a changed library"
+	exit 1
+fi
+
+# A corrupt snapshot must be ignored (and replaced).
+for f in $DIRNAME/cache/dlibs-*.snap; do
+	echo garbage > $f
+done
+
+out4=$(run) || { echo "DTrace failed (corrupt snapshot)"; exit 1; }
+
+if [ "$out3" != "$out4" ]; then
+	echo "output mismatch: '$out3' vs '$out4'"
+	exit 1
+fi
+if [ `cached dependencies` -ne 0 ] || [ `cached "BPF functions"` -ne 0 ]; then
+	echo "corrupt snapshot used"
+	exit 1
+fi
+
+out5=$(run) || { echo "DTrace failed (replaced snapshot)"; exit 1; }
+
+if [ "$out3" != "$out5" ] || [ `cached "BPF functions"` -lt 1 ]; then
+	echo "corrupt snapshot not replaced"
+	exit 1
+fi
+
+rm -rf $DIRNAME
+
+exit 0
@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+# @@timeout: 80
+
+##
+#
+# ASSERTION:
+# Listing probes with glob patterns that have a literal prefix or suffix
+# yields the same probes as filtering the full list of probes.
+#
+# SECTION: dtrace Utility/-ln Option
+#
+##
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+
+$dtrace $dt_flags -l | awk 'NR > 1 { print }' | sort -n > all.out
+if [ ! -s all.out ]; then
+	echo "failed to list all probes"
+	exit 1
+fi
+
+#
+# check <probe description> <awk condition>
+#
+check() {
+	$dtrace $dt_flags -ln "$1" 2> /dev/null | awk 'NR > 1 { print }' | \
+		sort -n > glob.out
+	awk "$2" all.out > filter.out
+	if [ ! -s filter.out ]; then
+		echo "no probes match '$1'"
+		exit 1
+	fi
+	if ! cmp -s glob.out filter.out; then
+		echo "probes listed for '$1' differ from the filtered list:"
+		diff glob.out filter.out
+		exit 1
+	fi
+}
+
+check 'syscall::read*:entry'	'$2 == "syscall" && $4 ~ /^read/ && $5 == "entry"'
+check 'syscall::*read:'		'$2 == "syscall" && $4 ~ /read$/'
+check 'syscall::*read*:return'	'$2 == "syscall" && $4 ~ /read/ && $5 == "return"'
+check 'sys*:::entry'		'$2 ~ /^sys/ && $5 == "entry"'
+check 'fbt::vfs_*:ret*'		'$2 == "fbt" && $4 ~ /^vfs_/ && $5 ~ /^ret/'
+check 'fbt::*_write:'		'$2 == "fbt" && $4 ~ /_write$/'
+check 'fbt:vmlinux:*lock:entry'	'$2 == "fbt" && $3 == "vmlinux" && $4 ~ /lock$/ && $5 == "entry"'
+
+rm -f all.out glob.out filter.out
+
+exit 0
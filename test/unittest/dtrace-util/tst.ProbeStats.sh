@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# ASSERTION: The -xprobestats option reports the number of firings of each
+# enabled probe at exit, and -xprobebudget warns about probes that exceed the
+# given cost per firing.
+#
+# SECTION: dtrace Utility/-x Option
+#
+
+dtrace=$1
+
+out=$($dtrace $dt_flags -xprobestats -xprobebudget=0 -qn '
+tick-10ms
+/++i == 5/
+{
+	exit(0);
+}' 2>&1)
+
+if [ $? -ne 0 ]; then
+	echo "DTrace failed"
+	echo "$out"
+	exit 1
+fi
+
+echo "$out" | awk '
+$1 == "ID" && $2 == "FIRINGS" { hdr = 1; next; }
+hdr && $NF == "profile:::tick-10ms" && $2 >= 5 { ok = 1; }
+/warning: profile:::tick-10ms costs [0-9]+ ns per firing/ { warned = 1; }
+END {
+	if (!ok || !warned) {
+		print "unexpected output";
+		exit 1;
+	}
+}' || { echo "$out"; exit 1; }
+
+exit 0
@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# ASSERTION: The -xstatsrate option periodically reports consumer statistics
+# for each phase of trace data consumption.
+#
+# SECTION: dtrace Utility/-x Option
+#
+
+dtrace=$1
+
+out=$($dtrace $dt_flags -xstatsrate=1ms -qn '
+tick-10ms
+{
+	printf("%d\n", i);
+}
+
+tick-10ms
+/++i == 10/
+{
+	exit(0);
+}' 2>&1 >/dev/null)
+
+if [ $? -ne 0 ]; then
+	echo "DTrace failed"
+	echo "$out"
+	exit 1
+fi
+
+# The statistics are cumulative, so the last report must show that trace data
+# was consumed and formatted, and that the consumer waited for it.
+echo "$out" | awk '
+/^dtrace: [0-9]+ records, [0-9]+ bytes consumed$/ { recs = $2; }
+$1 == "dtrace:" && $3 ~ /^[0-9]+$/ && $4 == "calls" {
+	phase[$2] = 1;
+	count[$2] = $3;
+}
+END {
+	if (!recs || !phase["wait"] || !phase["consume"] ||
+	    !phase["format"] || !phase["symbol"] || !phase["aggsnap"]) {
+		print "unexpected output";
+		exit 1;
+	}
+	if (!count["wait"] || !count["consume"] || !count["format"]) {
+		print "no wait, consume, or format calls counted";
+		exit 1;
+	}
+}' || { echo "$out"; exit 1; }
+
+exit 0
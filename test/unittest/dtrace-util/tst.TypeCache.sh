@@ -0,0 +1,121 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# ASSERTION: Kernel type lookups only load the CTF of the module that defines
+# the type (according to the kernel type index), and the -xtypecache option
+# saves the index for use by later invocations.
+#
+# SECTION: dtrace Utility/-x Option
+#
+
+dtrace=$1
+
+[ -r /lib/modules/$(uname -r)/kernel/vmlinux.ctfa ] || exit 67
+
+DIRNAME="$tmpdir/typecache.$$.$RANDOM"
+mkdir -p $DIRNAME
+
+run()
+{
+	$dtrace $dt_flags -xtypecache=$DIRNAME -xdebug -qn "$1" \
+	    2> $DIRNAME/err.txt
+}
+
+count()
+{
+	grep -c "$1" $DIRNAME/err.txt
+}
+
+modules()
+{
+	sed -n 's/.*Loading CTF for module \(.*\) from archive.*/\1/p' \
+	    $DIRNAME/err.txt | sort -u
+}
+
+# The program looks up a type that is defined in vmlinux, and an identifier
+# that is not a type at all (which used to mean loading every module's CTF).
+prog='
+BEGIN
+{
+	x = 1;
+	printf("%d %d %d\n", sizeof(struct task_struct) > 0,
+	    sizeof(pid_t), x);
+	exit(0);
+}'
+
+# Modules that are loaded without any type lookups in the program.
+run 'BEGIN { exit(0); }' || { echo "DTrace failed (baseline)"; exit 1; }
+modules > $DIRNAME/base.txt
+rm -f $DIRNAME/typeidx-*.idx
+
+out1=$(run "$prog") || { echo "DTrace failed (no index)"; exit 1; }
+
+if [ "$out1" != "1 4 1" ]; then
+	echo "unexpected output: '$out1'"
+	exit 1
+fi
+if [ `count 'using cached type index'` -ne 0 ]; then
+	echo "type index used before it was saved"
+	exit 1
+fi
+if ! ls $DIRNAME/typeidx-*.idx > /dev/null 2>&1; then
+	echo "no type index created"
+	exit 1
+fi
+
+# The type lookups load the CTF for one module (vmlinux) at most.
+modules > $DIRNAME/prog.txt
+extra=`comm -13 $DIRNAME/base.txt $DIRNAME/prog.txt`
+if [ -n "$extra" ] && [ "$extra" != "vmlinux" ]; then
+	echo "type lookups loaded CTF for other modules:" $extra
+	exit 1
+fi
+
+# The second run uses the saved index.
+out2=$(run "$prog") || { echo "DTrace failed (with index)"; exit 1; }
+
+if [ "$out1" != "$out2" ]; then
+	echo "output mismatch: '$out1' vs '$out2'"
+	exit 1
+fi
+if [ `count 'using cached type index'` -ne 1 ]; then
+	echo "saved type index not used"
+	exit 1
+fi
+if [ "`modules`" != "`cat $DIRNAME/prog.txt`" ]; then
+	echo "saved type index loads different modules:" `modules`
+	exit 1
+fi
+
+# A corrupt index must be ignored (and replaced).
+for f in $DIRNAME/typeidx-*.idx; do
+	echo garbage > $f
+done
+
+out3=$(run "$prog") || { echo "DTrace failed (corrupt index)"; exit 1; }
+
+if [ "$out1" != "$out3" ]; then
+	echo "output mismatch: '$out1' vs '$out3'"
+	exit 1
+fi
+if [ `count 'ignoring cached type index'` -ne 1 ]; then
+	echo "corrupt type index not ignored"
+	exit 1
+fi
+
+out4=$(run "$prog") || { echo "DTrace failed (replaced index)"; exit 1; }
+
+if [ "$out1" != "$out4" ] || [ `count 'using cached type index'` -ne 1 ]; then
+	echo "corrupt type index not replaced"
+	exit 1
+fi
+
+rm -rf $DIRNAME
+
+exit 0
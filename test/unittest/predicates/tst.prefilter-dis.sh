@@ -0,0 +1,33 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+# ASSERTION:  That the trampoline tests the pid and execname prefilters of
+#	      the clauses for a probe, but only if every clause for the probe
+#	      has a prefilter.
+
+dtrace=$1
+
+# Count the pid and execname prefilter tests in the trampoline for the
+# syscall::mmap:entry probe, i.e. in its program up to the first clause call.
+count()
+{
+	$dtrace $dt_flags -xdisasm=2 -Sqn "
+	syscall::mmap:entry /pid == 123456/ { n++; }
+	syscall::mmap:entry /execname == \"dtrace\"/ { n++; }
+	$1
+	BEGIN { exit(0); }
+	" 2>&1 > /dev/null | awk '
+	/^Disassembly of program syscall:vmlinux:mmap:entry:/ { sect = 1; next; }
+	/^Disassembly of / { sect = 0; next; }
+	sect && $8 == "call" && $9 ~ /^dt_clause_/ { sect = 0; }
+	sect && $8 == "jeq" && $9 == "%r0," && $10 == "123456," { pid++; }
+	sect && $8 == "call" && $9 == "bpf_get_current_comm" { comm++; }
+	END { print pid + 0, comm + 0; }'
+}
+
+echo `count`
+echo `count 'syscall::mmap:entry /n < 10/ { n++; }'`
@@ -0,0 +1 @@
+10 10 0
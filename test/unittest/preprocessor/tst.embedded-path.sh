@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# ASSERTION: The embedded preprocessor handles programs that use the macros
+#	     that cpp(1) predefines, and hands programs it does not support
+#	     to cpp(1).
+#
+# SECTION: Program Structure/Use of the C Preprocessor
+
+dtrace=$1
+
+DIRNAME="$tmpdir/embedded-path.$$.$RANDOM"
+mkdir -p $DIRNAME
+cd $DIRNAME
+
+run() {
+	$dtrace $dt_flags -C -xcppmode=embedded -xdebug -qs /dev/stdin \
+	    > out.txt 2> err.txt
+}
+
+# Predefined macros beyond the few that every compiler has.
+run <<EOF
+#if defined(__SIZEOF_POINTER__) && defined(__INT64_C)
+#define RES	(__SIZEOF_POINTER__ * __CHAR_BIT__ + __INT64_C(0))
+#else
+#define RES	-1
+#endif
+BEGIN { printf("%d\n", RES); exit(0); }
+EOF
+if [ $? -ne 0 ]; then
+	echo "embedded: dtrace failed"
+	cat err.txt
+	exit 1
+fi
+if ! grep -q 'embedded cpp: preprocessed' err.txt ||
+   grep -q 'embedded cpp: .*; using' err.txt; then
+	echo "embedded: program was not handled by the embedded preprocessor"
+	grep 'embedded cpp' err.txt
+	exit 1
+fi
+if [ "`cat out.txt`" != "`getconf LONG_BIT`" ]; then
+	echo "embedded: unexpected output"
+	cat out.txt
+	exit 1
+fi
+
+# cpp-specific builtins are left to cpp(1).
+run <<EOF
+BEGIN { printf("%d %d\n", __COUNTER__, __COUNTER__); exit(0); }
+EOF
+if [ $? -ne 0 ]; then
+	echo "fallback: dtrace failed"
+	cat err.txt
+	exit 1
+fi
+if ! grep -q 'embedded cpp: .*; using' err.txt ||
+   grep -q 'embedded cpp: preprocessed' err.txt; then
+	echo "fallback: program was not handed to cpp"
+	grep 'embedded cpp' err.txt
+	exit 1
+fi
+if [ "`cat out.txt`" != "0 1" ]; then
+	echo "fallback: unexpected output"
+	cat out.txt
+	exit 1
+fi
+
+cd /
+rm -rf $DIRNAME
+exit 0
@@ -0,0 +1,5 @@
+25 a "b" 5
+3 yes
+5
+done
+
@@ -0,0 +1,7 @@
+sum 5
+min 10
+max 3
+--
+sum 3
+min 8
+
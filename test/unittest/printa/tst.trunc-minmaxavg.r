@@ -0,0 +1,9 @@
+min 2 7
+min 4 9
+max 3 8
+max 1 10
+avg 3 7
+avg 2 15
+low 4 1
+low 1 3
+
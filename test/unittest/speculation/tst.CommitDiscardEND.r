@@ -0,0 +1,4 @@
+begin
+committed
+end
+
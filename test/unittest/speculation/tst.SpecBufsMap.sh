@@ -0,0 +1,31 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# ASSERTION: The speculation buffer map is only created when a clause
+#	     speculates data.
+
+dtrace=$1
+
+nmaps() {
+	$dtrace $dt_flags -xdebug -qn "$1" 2>&1 | \
+	    grep -c "Creating BPF map 'specbufs'"
+}
+
+n=`nmaps 'BEGIN { exit(0); }'`
+if [ "$n" -ne 0 ]; then
+	echo "specbufs map created without speculation"
+	exit 1
+fi
+
+n=`nmaps 'BEGIN { s = speculation(); speculate(s); trace(1); }
+	  BEGIN { commit(s); exit(0); }'`
+if [ "$n" -ne 1 ]; then
+	echo "specbufs map not created for speculation"
+	exit 1
+fi
+
+exit 0
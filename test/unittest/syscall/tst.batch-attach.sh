@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# ASSERTION: With the syscallbatch option, syscall probes are attached through
+# the raw_syscalls dispatchers rather than to their own tracepoints.
+#
+# SECTION: dtrace Utility/-x Option
+#
+
+dtrace=$1
+
+DIRNAME="$tmpdir/syscall-batch.$$.$RANDOM"
+mkdir -p $DIRNAME
+
+run()
+{
+	$dtrace $dt_flags -xdebug "$@" -qn '
+	syscall::mmap:entry,
+	syscall::mmap:return
+	{
+		n++;
+	}
+
+	BEGIN
+	{
+		exit(0);
+	}' 2> $DIRNAME/err.txt
+}
+
+count()
+{
+	grep -c "$1" $DIRNAME/err.txt
+}
+
+run -xsyscallbatch || { echo "DTrace failed (batched)"; exit 1; }
+
+if [ `count 'syscall: dispatcher attached to raw_syscalls:sys_enter'` -ne 1 ] ||
+   [ `count 'syscall: dispatcher attached to raw_syscalls:sys_exit'` -ne 1 ]; then
+	echo "raw_syscalls dispatchers not attached"
+	exit 1
+fi
+if [ `count 'syscall: batched mmap:entry'` -ne 1 ] ||
+   [ `count 'syscall: batched mmap:return'` -ne 1 ]; then
+	echo "mmap probes not batched"
+	exit 1
+fi
+
+run || { echo "DTrace failed (not batched)"; exit 1; }
+
+if [ `count 'syscall: '` -ne 0 ]; then
+	echo "probes batched without the syscallbatch option"
+	exit 1
+fi
+
+rm -rf $DIRNAME
+
+exit 0
@@ -0,0 +1,771 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Micro-benchmark for the string functions in the BPF function library
+ * (bpf_dlib.o).
+ *
+ * For every function under test, a small BPF driver program is constructed
+ * that calls the function a fixed number of times (unrolled) between two
+ * bpf_ktime_get_ns() calls.  The function (and any functions it calls) is
+ * linked into the driver program straight from the BPF library ELF object.
+ * The program is loaded as a raw tracepoint program and executed using
+ * BPF_PROG_TEST_RUN.  The cost of an empty driver program is measured as
+ * well, and subtracted from the results.
+ *
+ * Since the programs must pass the BPF verifier, this also serves as a check
+ * that the library functions are accepted by the verifier of the running
+ * kernel.  The results of the function calls are validated against their C
+ * library equivalents.  For dt_strcmp(), strings that compare less, greater,
+ * or where one is a prefix of the other are validated as well.
+ *
+ * Usage: bpf-strbench [-s strsize] [-n calls] [-r runs] bpf_dlib.o
+ *
+ * Output is one line per function and string length:
+ *	<function> <length> <ns/call>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <bpf_asm.h>
+#include <dt_dctx.h>
+
+#define MAX_INSNS	BPF_MAXINSNS
+#define MAX_FUNCS	64
+#define LOG_SIZE	(16 * 1024 * 1024)
+
+/*
+ * Layout of the benchmark map value.
+ */
+#define OFF_T0		0
+#define OFF_T1		8
+#define OFF_RET		16
+#define OFF_S		(32 + 0 * slotsz)
+#define OFF_T		(32 + 1 * slotsz)
+#define OFF_TMP1	(32 + 2 * slotsz)
+#define OFF_TMP2	(32 + 3 * slotsz)
+#define OFF_DST		(32 + 4 * slotsz)
+#define VALSZ		(32 + 6 * slotsz)
+
+/*
+ * Stack layout of the driver program.
+ */
+#define STK_KEY		(-8)
+#define STK_DCTX	(STK_KEY - DCTX_SIZE)
+
+typedef struct func {
+	char		*name;
+	uint64_t	off;		/* offset in .text */
+	uint64_t	size;		/* size in bytes */
+	int		pc;		/* instruction index in program */
+} func_t;
+
+typedef enum bench_kind {
+	BK_NONE = 0,
+	BK_STRLEN,
+	BK_STRCMP,
+	BK_STRCHR,
+	BK_STRRCHR,
+	BK_INDEX,
+	BK_STRJOIN,
+} bench_kind_t;
+
+static const struct bench {
+	const char	*name;
+	bench_kind_t	kind;
+} benches[] = {
+	{ "dt_strlen", BK_STRLEN },
+	{ "dt_strcmp", BK_STRCMP },
+	{ "dt_strchr", BK_STRCHR },
+	{ "dt_strrchr", BK_STRRCHR },
+	{ "dt_index", BK_INDEX },
+	{ "dt_strjoin", BK_STRJOIN },
+	{ NULL, },
+};
+
+static const char	*progname;
+static int		strsize = 256;
+static int		ncalls = 16;
+static int		nruns = 1000;
+static size_t		slotsz;
+
+static Elf		*elf;
+static Elf_Data		*text, *symtab, *rels;
+static int		strs_idx;
+static func_t		funcs[MAX_FUNCS];
+static int		nfuncs;
+
+static struct bpf_insn	prog[MAX_INSNS];
+static int		plen;
+
+static int
+sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+static void
+fail(const char *fmt, ...)
+{
+	va_list	ap;
+
+	fprintf(stderr, "%s: ", progname);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static void
+emit_insn(struct bpf_insn insn)
+{
+	if (plen >= MAX_INSNS)
+		fail("program too large\n");
+
+	prog[plen++] = insn;
+}
+
+static void
+emit_lddw(int reg, int src, uint64_t val)
+{
+	struct bpf_insn	insn[] = { BPF_LDDW(reg, val) };
+
+	insn[0].src_reg = src;
+	emit_insn(insn[0]);
+	emit_insn(insn[1]);
+}
+
+/*
+ * Open the BPF library and locate the sections we need.
+ */
+static void
+read_dlib(const char *fn)
+{
+	int		fd, idx = 0, text_idx = -1;
+	Elf_Scn		*scn = NULL;
+	GElf_Ehdr	ehdr;
+	GElf_Shdr	shdr;
+
+	elf_version(EV_CURRENT);
+	if ((fd = open(fn, O_RDONLY)) == -1)
+		fail("%s: %s\n", fn, strerror(errno));
+	if ((elf = elf_begin(fd, ELF_C_READ, NULL)) == NULL ||
+	    gelf_getehdr(elf, &ehdr) == NULL)
+		fail("%s: %s\n", fn, elf_errmsg(elf_errno()));
+	if (ehdr.e_machine != EM_BPF)
+		fail("%s: not a BPF object\n", fn);
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		const char	*name;
+
+		idx++;
+		if (gelf_getshdr(scn, &shdr) == NULL)
+			fail("%s: %s\n", fn, elf_errmsg(elf_errno()));
+
+		switch (shdr.sh_type) {
+		case SHT_SYMTAB:
+			symtab = elf_getdata(scn, NULL);
+			strs_idx = shdr.sh_link;
+			break;
+		case SHT_PROGBITS:
+			name = elf_strptr(elf, ehdr.e_shstrndx, shdr.sh_name);
+			if (name != NULL && strcmp(name, ".text") == 0) {
+				text = elf_getdata(scn, NULL);
+				text_idx = idx;
+			}
+			break;
+		case SHT_REL:
+			if (shdr.sh_info == text_idx)
+				rels = elf_getdata(scn, NULL);
+			break;
+		}
+	}
+
+	if (text == NULL || symtab == NULL)
+		fail("%s: no .text or .symtab section\n", fn);
+}
+
+/*
+ * Find the function with the given name, and determine its size.  Like the
+ * dlib loader in libdtrace, we work around symbols that have a zero size and
+ * strip trailing 0-padding.
+ */
+static func_t *
+find_func(const char *name)
+{
+	int		i, symc = symtab->d_size / sizeof(GElf_Sym);
+	GElf_Sym	sym;
+	func_t		*fp = NULL;
+	uint64_t	end = text->d_size;
+
+	for (i = 0; i < nfuncs; i++) {
+		if (strcmp(funcs[i].name, name) == 0)
+			return &funcs[i];
+	}
+
+	for (i = 0; i < symc; i++) {
+		const char	*s;
+
+		if (!gelf_getsym(symtab, i, &sym) ||
+		    GELF_ST_BIND(sym.st_info) != STB_GLOBAL ||
+		    sym.st_shndx == SHN_UNDEF)
+			continue;
+		s = elf_strptr(elf, strs_idx, sym.st_name);
+		if (s == NULL || strcmp(s, name) != 0)
+			continue;
+
+		if (nfuncs == MAX_FUNCS)
+			fail("too many functions\n");
+		fp = &funcs[nfuncs++];
+		fp->name = strdup(name);
+		fp->off = sym.st_value;
+		fp->size = sym.st_size;
+		fp->pc = -1;
+		break;
+	}
+
+	if (fp == NULL)
+		return NULL;
+
+	if (fp->size == 0) {
+		for (i = 0; i < symc; i++) {
+			if (!gelf_getsym(symtab, i, &sym) ||
+			    GELF_ST_BIND(sym.st_info) != STB_GLOBAL ||
+			    sym.st_shndx == SHN_UNDEF)
+				continue;
+			if (sym.st_value > fp->off && sym.st_value < end)
+				end = sym.st_value;
+		}
+		fp->size = end - fp->off;
+	}
+
+	if (*(uint64_t *)((char *)text->d_buf + fp->off + fp->size -
+			  sizeof(struct bpf_insn)) == 0)
+		fp->size -= sizeof(struct bpf_insn);
+
+	return fp;
+}
+
+/*
+ * Append the given function to the program, and recursively link in any
+ * functions it calls.  Relocations against the STRSZ and STBSZ constants are
+ * resolved as well.  Any other relocation is not supported.
+ */
+static void
+link_func(func_t *fp)
+{
+	int	i, relc;
+
+	if (fp->pc != -1)
+		return;
+
+	fp->pc = plen;
+	if (plen + fp->size / sizeof(struct bpf_insn) > MAX_INSNS)
+		fail("program too large\n");
+	memcpy(&prog[plen], (char *)text->d_buf + fp->off, fp->size);
+	plen += fp->size / sizeof(struct bpf_insn);
+
+	relc = rels ? rels->d_size / sizeof(GElf_Rel) : 0;
+	for (i = 0; i < relc; i++) {
+		GElf_Rel	rel;
+		GElf_Sym	sym;
+		const char	*name;
+		uint64_t	val;
+		int		ioff;
+		func_t		*cfp;
+
+		if (!gelf_getrel(rels, i, &rel) ||
+		    rel.r_offset < fp->off ||
+		    rel.r_offset >= fp->off + fp->size)
+			continue;
+		if (!gelf_getsym(symtab, GELF_R_SYM(rel.r_info), &sym))
+			continue;
+
+		name = elf_strptr(elf, strs_idx, sym.st_name);
+		ioff = fp->pc + (rel.r_offset - fp->off) /
+				sizeof(struct bpf_insn);
+
+		if (strcmp(name, "STRSZ") == 0)
+			val = strsize;
+		else if (strcmp(name, "STBSZ") == 0)
+			val = 0;
+		else if ((cfp = find_func(name)) != NULL) {
+			link_func(cfp);
+			val = cfp->pc - ioff - 1;
+		} else
+			fail("%s: unsupported relocation against %s\n",
+			     fp->name, name);
+
+		if (GELF_R_TYPE(rel.r_info) == R_BPF_64_64) {
+			prog[ioff].imm = val & 0xffffffff;
+			prog[ioff + 1].imm = val >> 32;
+		} else
+			prog[ioff].imm = (int32_t)val;
+	}
+}
+
+/*
+ * Emit code to set up the arguments for (and call) the function under test.
+ * The call instruction is returned so its offset can be filled in once the
+ * function has been linked in.
+ */
+static int
+emit_call(bench_kind_t kind)
+{
+	switch (kind) {
+	case BK_STRLEN:
+		emit_insn(BPF_MOV_REG(BPF_REG_1, BPF_REG_FP));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, STK_DCTX));
+		emit_insn(BPF_MOV_REG(BPF_REG_2, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, OFF_S));
+		break;
+	case BK_STRCMP:
+	case BK_INDEX:
+		emit_insn(BPF_MOV_REG(BPF_REG_1, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, OFF_S));
+		emit_insn(BPF_MOV_REG(BPF_REG_2, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, OFF_T));
+		if (kind == BK_STRCMP) {
+			emit_insn(BPF_MOV_REG(BPF_REG_3, BPF_REG_6));
+			emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, OFF_TMP1));
+			emit_insn(BPF_MOV_REG(BPF_REG_4, BPF_REG_6));
+			emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, OFF_TMP2));
+		} else {
+			emit_insn(BPF_MOV_IMM(BPF_REG_3, 0));
+			emit_insn(BPF_MOV_REG(BPF_REG_4, BPF_REG_6));
+			emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, OFF_TMP1));
+			emit_insn(BPF_MOV_REG(BPF_REG_5, BPF_REG_6));
+			emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_5, OFF_TMP2));
+		}
+		break;
+	case BK_STRCHR:
+	case BK_STRRCHR:
+		/* The char to look for is passed in t[0]. */
+		emit_insn(BPF_MOV_REG(BPF_REG_1, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, OFF_S));
+		emit_insn(BPF_LOAD(BPF_B, BPF_REG_2, BPF_REG_6, OFF_T));
+		emit_insn(BPF_MOV_REG(BPF_REG_3, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, OFF_DST));
+		emit_insn(BPF_MOV_REG(BPF_REG_4, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, OFF_TMP1));
+		break;
+	case BK_STRJOIN:
+		emit_insn(BPF_MOV_REG(BPF_REG_1, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, OFF_DST));
+		emit_insn(BPF_MOV_REG(BPF_REG_2, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, OFF_S));
+		emit_insn(BPF_MOV_REG(BPF_REG_3, BPF_REG_6));
+		emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, OFF_T));
+		break;
+	default:
+		return -1;
+	}
+
+	emit_insn(BPF_CALL_FUNC(0));
+	emit_insn(BPF_STORE(BPF_DW, BPF_REG_6, OFF_RET, BPF_REG_0));
+
+	return plen - 2;
+}
+
+/*
+ * Construct and load the driver program for the given function.  If name is
+ * NULL, the driver program does not call any function (baseline).
+ */
+static int
+load_prog(int mapfd, const char *name, bench_kind_t kind)
+{
+	union bpf_attr	attr;
+	int		i, fd, lbl_exit, calls[ncalls];
+	func_t		*fp = NULL;
+	static char	*log;
+
+	plen = 0;
+	for (i = 0; i < nfuncs; i++)
+		funcs[i].pc = -1;
+
+	/*
+	 *	key = 0;
+	 *	r6 = bpf_map_lookup_elem(&bench, &key);
+	 *	if (r6 == 0)
+	 *		goto exit;
+	 *	dctx.strtab = r6 + OFF_TMP1;
+	 */
+	emit_insn(BPF_STORE_IMM(BPF_W, BPF_REG_FP, STK_KEY, 0));
+	emit_lddw(BPF_REG_1, BPF_PSEUDO_MAP_FD, mapfd);
+	emit_insn(BPF_MOV_REG(BPF_REG_2, BPF_REG_FP));
+	emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, STK_KEY));
+	emit_insn(BPF_CALL_HELPER(BPF_FUNC_map_lookup_elem));
+	lbl_exit = plen;
+	emit_insn(BPF_BRANCH_IMM(BPF_JEQ, BPF_REG_0, 0, 0));
+	emit_insn(BPF_MOV_REG(BPF_REG_6, BPF_REG_0));
+	emit_insn(BPF_ALU64_IMM(BPF_ADD, BPF_REG_0, OFF_TMP1));
+	emit_insn(BPF_STORE(BPF_DW, BPF_REG_FP, STK_DCTX + DCTX_STRTAB,
+			    BPF_REG_0));
+
+	/*
+	 *	*(r6 + OFF_T0) = bpf_ktime_get_ns();
+	 *	(ncalls times: call function, store result)
+	 *	*(r6 + OFF_T1) = bpf_ktime_get_ns();
+	 */
+	emit_insn(BPF_CALL_HELPER(BPF_FUNC_ktime_get_ns));
+	emit_insn(BPF_STORE(BPF_DW, BPF_REG_6, OFF_T0, BPF_REG_0));
+	for (i = 0; name != NULL && i < ncalls; i++)
+		calls[i] = emit_call(kind);
+	emit_insn(BPF_CALL_HELPER(BPF_FUNC_ktime_get_ns));
+	emit_insn(BPF_STORE(BPF_DW, BPF_REG_6, OFF_T1, BPF_REG_0));
+
+	prog[lbl_exit].off = plen - lbl_exit - 1;
+	emit_insn(BPF_MOV_IMM(BPF_REG_0, 0));
+	emit_insn(BPF_RETURN());
+
+	if (name != NULL) {
+		fp = find_func(name);
+		if (fp == NULL)
+			fail("%s: function not found\n", name);
+
+		link_func(fp);
+		for (i = 0; i < ncalls; i++)
+			prog[calls[i]].imm = fp->pc - calls[i] - 1;
+	}
+
+	if (log == NULL && (log = malloc(LOG_SIZE)) == NULL)
+		fail("%s\n", strerror(ENOMEM));
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_RAW_TRACEPOINT;
+	attr.insns = (uint64_t)(uintptr_t)prog;
+	attr.insn_cnt = plen;
+	attr.license = (uint64_t)(uintptr_t)"GPL";
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd >= 0)
+		return fd;
+
+	/* Load again, with the verifier log enabled. */
+	attr.log_level = 1;
+	attr.log_buf = (uint64_t)(uintptr_t)log;
+	attr.log_size = LOG_SIZE;
+	log[0] = '\0';
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0) {
+		fprintf(stderr, "%s\n", log);
+		fail("%s: BPF program load failed: %s\n",
+		     name ? name : "baseline", strerror(errno));
+	}
+
+	return fd;
+}
+
+/*
+ * Run the given program nruns times, and return the lowest time (in ns) that
+ * was measured.
+ */
+static uint64_t
+run_prog(int progfd, int mapfd, char *val)
+{
+	union bpf_attr	attr;
+	uint32_t	key = 0;
+	uint64_t	best = UINT64_MAX;
+	int		i;
+
+	for (i = 0; i < nruns; i++) {
+		uint64_t	t;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.test.prog_fd = progfd;
+		if (sys_bpf(BPF_PROG_TEST_RUN, &attr) < 0)
+			fail("BPF_PROG_TEST_RUN failed: %s\n", strerror(errno));
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = mapfd;
+		attr.key = (uint64_t)(uintptr_t)&key;
+		attr.value = (uint64_t)(uintptr_t)val;
+		if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0)
+			fail("map lookup failed: %s\n", strerror(errno));
+
+		t = *(uint64_t *)&val[OFF_T1] - *(uint64_t *)&val[OFF_T0];
+		if (t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+/*
+ * Fill in the input strings for a benchmark with a string length of len, and
+ * return the expected result (or -2 if the result is not a return value).
+ */
+static int64_t
+setup(bench_kind_t kind, char *val, int len)
+{
+	char	*s = &val[OFF_S];
+	char	*t = &val[OFF_T];
+	char	*p;
+	int	i;
+
+	memset(val, 0, VALSZ);
+	for (i = 0; i < len; i++)
+		s[i] = 'a' + (i * 7) % 26;
+
+	switch (kind) {
+	case BK_STRLEN:
+		return len;
+	case BK_STRCMP:
+		strcpy(t, s);
+		return 0;
+	case BK_STRCHR:
+		t[0] = len ? s[len - 1] : 'x';
+		return len ? 0 : -1;
+	case BK_STRRCHR:
+		t[0] = len ? s[0] : 'x';
+		return len ? 0 : -1;
+	case BK_INDEX:
+		strcpy(t, s + (len > 4 ? len - 4 : 0));
+		p = strstr(s, t);
+		return p ? p - s : -1;
+	case BK_STRJOIN:
+		strcpy(t, s);
+		return -2;
+	default:
+		return -2;
+	}
+}
+
+/*
+ * Validate the result of a benchmark run against the expected result.
+ */
+static int
+check(bench_kind_t kind, const char *val, int len, int64_t exp)
+{
+	int64_t		ret = *(int64_t *)&val[OFF_RET];
+	const char	*s = &val[OFF_S];
+	const char	*dst = &val[OFF_DST];
+	char		buf[2 * strsize + 1];
+
+	switch (kind) {
+	case BK_STRCHR:
+		if (ret == 0)
+			return strcmp(dst, strchr(s, s[len - 1])) == 0;
+		break;
+	case BK_STRRCHR:
+		if (ret == 0)
+			return strcmp(dst, strrchr(s, s[0])) == 0;
+		break;
+	case BK_STRJOIN:
+		snprintf(buf, sizeof(buf), "%s%s", s, &val[OFF_T]);
+		buf[strsize] = '\0';
+		return strcmp(dst, buf) == 0;
+	default:
+		break;
+	}
+
+	return ret == exp;
+}
+
+/*
+ * Additional cases for validating dt_strcmp(), beyond equal strings.
+ */
+typedef enum strcmp_case {
+	SC_LT = 0,		/* last character of t is greater */
+	SC_GT,			/* last character of t is smaller */
+	SC_LT_HIGH,		/* first character of t has the high bit set */
+	SC_PREFIX_S,		/* s is a proper prefix of t */
+	SC_PREFIX_T,		/* t is a proper prefix of s */
+	SC_NUM
+} strcmp_case_t;
+
+static const char	*strcmp_case_names[SC_NUM] = {
+	"lt", "gt", "lt-high", "prefix-s", "prefix-t"
+};
+
+/*
+ * Fill in the input strings for a dt_strcmp() validation case with a string
+ * length of len, and return the expected result (as returned by strcmp(3)).
+ * Return -2 if the case does not apply to strings of that length.
+ */
+static int
+setup_strcmp(strcmp_case_t c, char *val, int len)
+{
+	char	*s = &val[OFF_S];
+	char	*t = &val[OFF_T];
+
+	if (c == SC_PREFIX_S ? len + 2 > strsize : len == 0)
+		return -2;
+
+	setup(BK_STRCMP, val, len);
+
+	switch (c) {
+	case SC_LT:
+		t[len - 1]++;
+		break;
+	case SC_GT:
+		t[len - 1]--;
+		break;
+	case SC_LT_HIGH:
+		t[0] = (char)0xe0;
+		break;
+	case SC_PREFIX_S:
+		t[len] = 'z';
+		break;
+	case SC_PREFIX_T:
+		t[len - 1] = '\0';
+		break;
+	default:
+		return -2;
+	}
+
+	return strcmp(s, t);
+}
+
+/*
+ * Store the benchmark map value.
+ */
+static void
+store_val(int mapfd, char *val)
+{
+	union bpf_attr	attr;
+	uint32_t	key = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = mapfd;
+	attr.key = (uint64_t)(uintptr_t)&key;
+	attr.value = (uint64_t)(uintptr_t)val;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+		fail("map update failed: %s\n", strerror(errno));
+}
+
+/*
+ * Validate dt_strcmp() for strings that are not equal, with a string length
+ * of len.  Only the sign of the result matters.  Return the name of the first
+ * case that fails, or NULL if all cases pass.
+ */
+static const char *
+check_strcmp(int progfd, int mapfd, char *val, int len)
+{
+	strcmp_case_t	c;
+
+	for (c = 0; c < SC_NUM; c++) {
+		int	exp = setup_strcmp(c, val, len);
+		int64_t	ret;
+
+		if (exp == -2)
+			continue;
+
+		store_val(mapfd, val);
+		run_prog(progfd, mapfd, val);
+
+		ret = *(int64_t *)&val[OFF_RET];
+		if ((ret > 0) - (ret < 0) != (exp > 0) - (exp < 0))
+			return strcmp_case_names[c];
+	}
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	union bpf_attr		attr;
+	const struct bench	*bp;
+	static const int	lens[] = { 0, 1, 7, 8, 15, 31, 64, 127, 255,
+					   -1 };
+	int			opt, mapfd, progfd, i, rc = 0;
+	uint64_t		base;
+	char			*val;
+
+	progname = argv[0];
+	while ((opt = getopt(argc, argv, "n:r:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			ncalls = atoi(optarg);
+			break;
+		case 'r':
+			nruns = atoi(optarg);
+			break;
+		case 's':
+			strsize = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || ncalls <= 0 || nruns <= 0 || strsize <= 0)
+		goto usage;
+
+	read_dlib(argv[optind]);
+
+	slotsz = (strsize + 1 + 7) & ~7;
+	val = calloc(1, VALSZ);
+	if (val == NULL)
+		fail("%s\n", strerror(ENOMEM));
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_ARRAY;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = VALSZ;
+	attr.max_entries = 1;
+	mapfd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (mapfd < 0)
+		fail("cannot create map: %s\n", strerror(errno));
+
+	progfd = load_prog(mapfd, NULL, BK_NONE);
+	base = run_prog(progfd, mapfd, val);
+	close(progfd);
+
+	printf("%-12s %6s %10s\n", "FUNCTION", "LENGTH", "NS/CALL");
+	for (bp = benches; bp->name != NULL; bp++) {
+		progfd = load_prog(mapfd, bp->name, bp->kind);
+
+		for (i = 0; lens[i] != -1 && lens[i] < strsize; i++) {
+			const char	*fc;
+			uint64_t	t;
+			int64_t		exp;
+
+			exp = setup(bp->kind, val, lens[i]);
+			store_val(mapfd, val);
+
+			t = run_prog(progfd, mapfd, val);
+			t = t > base ? t - base : 0;
+
+			if (!check(bp->kind, val, lens[i], exp)) {
+				printf("%-12s %6d %10s\n", bp->name, lens[i],
+				       "FAIL");
+				rc = 1;
+				continue;
+			}
+
+			if (bp->kind == BK_STRCMP &&
+			    (fc = check_strcmp(progfd, mapfd, val,
+					       lens[i])) != NULL) {
+				printf("%-12s %6d %10s (%s)\n", bp->name,
+				       lens[i], "FAIL", fc);
+				rc = 1;
+				continue;
+			}
+
+			printf("%-12s %6d %10.1f\n", bp->name, lens[i],
+			       (double)t / ncalls);
+		}
+
+		close(progfd);
+	}
+
+	return rc;
+
+usage:
+	fprintf(stderr, "Usage: %s [-s strsize] [-n calls] [-r runs] "
+			"bpf_dlib.o\n", progname);
+	return 2;
+}
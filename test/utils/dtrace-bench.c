@@ -0,0 +1,464 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2022, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Performance benchmarks for libdtrace.
+ *
+ * All benchmarks that need probe firings use a single trigger program that
+ * calls syscall(SYS_mmap, ...) in a tight loop (test/triggers/syscall-tst-args).
+ * The trigger is started (stopped) under libdtrace control so that its pid can
+ * be used in the D programs, and it is released (killed) when the handle is
+ * closed.  The following is measured:
+ *
+ *   startup	time spent in dtrace_open(), dtrace_update(), compiling the D
+ *		program, dtrace_program_exec(), dtrace_go() (loading and
+ *		attaching the BPF programs), and dtrace_close()
+ *   firing	average BPF run time per firing of an empty clause for each
+ *		provider, as reported by the probestats option
+ *   consume	consumer throughput (records/s) and average consumer cost per
+ *		record for trace(), printf(), and stack() records
+ *   aggsnap	time spent in dtrace_aggregate_snap() for a varying number of
+ *		aggregations
+ *   compile	time spent compiling a D program with a varying number of
+ *		clauses, each using its own global and clause-local variable
+ *
+ * Usage: dtrace-bench [-d seconds] [-r runs] trigger [benchmark ...]
+ *
+ * Output is one line per measurement:
+ *	<benchmark> <name> <value> <unit>
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+#define NANOSEC		1000000000ULL
+
+static const char	*trigger;
+static int		duration = 2;
+static int		runs = 5;
+static FILE		*devnull;
+
+static const char	startup_prog[] =
+	"syscall::getpid:entry { trace(pid); }";
+
+static const char	*const startup_phases[] = {
+	"open", "update", "compile", "exec", "go", "close"
+};
+#define STARTUP_NPHASES	(sizeof(startup_phases) / sizeof(startup_phases[0]))
+
+static const struct {
+	const char	*name;
+	const char	*prog;
+} firing_progs[] = {
+	{ "syscall",	"syscall::mmap:entry /pid == %d/ {}" },
+	{ "fbt",	"fbt::vm_mmap_pgoff:entry /pid == %d/ {}" },
+	{ "sdt",	"sdt:raw_syscalls::sys_enter /pid == %d/ {}" },
+	{ "profile",	"profile-4999 /pid == %d/ {}" },
+	{ "pid",	"pid%d::syscall:entry {}" },
+}, consume_progs[] = {
+	{ "trace",	"syscall::mmap:entry /pid == %d/ { trace(arg0); }" },
+	{ "printf",	"syscall::mmap:entry /pid == %d/ "
+			"{ printf(\"%%d %%x\\n\", arg0, arg1); }" },
+	{ "stack",	"syscall::mmap:entry /pid == %d/ { stack(); }" },
+};
+
+static const int	aggsnap_counts[] = { 1, 16, 64, 256 };
+static const int	compile_counts[] = { 16, 256, 1024, 4096 };
+
+static void
+fail(const char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "dtrace-bench: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+
+	exit(1);
+}
+
+static void
+warn(dtrace_hdl_t *dtp, const char *what)
+{
+	fprintf(stderr, "dtrace-bench: %s: %s\n", what,
+		dtrace_errmsg(dtp, dtrace_errno(dtp)));
+}
+
+static uint64_t
+now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * NANOSEC + ts.tv_nsec;
+}
+
+static dtrace_hdl_t *
+open_handle(void)
+{
+	dtrace_hdl_t	*dtp;
+	int		err;
+
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	if (dtp == NULL)
+		fail("cannot open dtrace library: %s",
+		     dtrace_errmsg(NULL, err));
+
+	dtrace_setoptenv(dtp, "DTRACE_OPT_");
+	if (dtrace_setopt(dtp, "quiet", NULL) == -1)
+		fail("cannot set quiet option");
+
+	return dtp;
+}
+
+/*
+ * Compile and run a D program against a fresh instance of the trigger for the
+ * benchmark duration, writing all output to /dev/null.  The program text is
+ * given as a format string with a single %d for the pid of the trigger.
+ *
+ * Returns the handle (so that the caller can collect statistics before closing
+ * it), or NULL if the program could not be run.  The time spent tracing is
+ * stored in *elapsed.
+ */
+static dtrace_hdl_t *
+run_prog(const char *fmt, const char *opt, uint64_t *elapsed)
+{
+	dtrace_hdl_t		*dtp = open_handle();
+	struct dtrace_proc	*proc;
+	dtrace_prog_t		*pgp;
+	dtrace_proginfo_t	info;
+	char			*argv[] = { (char *)trigger, NULL };
+	char			*prog;
+	uint64_t		start;
+
+	if (opt != NULL && dtrace_setopt(dtp, opt, NULL) == -1) {
+		warn(dtp, opt);
+		goto fail;
+	}
+
+	proc = dtrace_proc_create(dtp, trigger, argv, 0);
+	if (proc == NULL) {
+		warn(dtp, trigger);
+		goto fail;
+	}
+
+	if (asprintf(&prog, fmt, dtrace_proc_getpid(dtp, proc)) == -1)
+		fail("out of memory");
+
+	pgp = dtrace_program_strcompile(dtp, prog, DTRACE_PROBESPEC_NAME, 0, 0,
+					NULL);
+	if (pgp == NULL) {
+		warn(dtp, prog);
+		free(prog);
+		goto fail;
+	}
+	free(prog);
+
+	if (dtrace_program_exec(dtp, pgp, &info) == -1) {
+		warn(dtp, "cannot enable probes");
+		goto fail;
+	}
+
+	if (dtrace_go(dtp, 0) == -1) {
+		warn(dtp, "cannot start tracing");
+		goto fail;
+	}
+
+	dtrace_proc_continue(dtp, proc);
+
+	start = now();
+	do {
+		dtrace_workstatus_t	rval;
+
+		rval = dtrace_work(dtp, devnull, NULL, NULL, NULL);
+		if (rval == DTRACE_WORKSTATUS_ERROR) {
+			warn(dtp, "processing aborted");
+			goto fail;
+		}
+		if (rval == DTRACE_WORKSTATUS_DONE)
+			break;
+	} while (now() - start < duration * NANOSEC);
+
+	*elapsed = now() - start;
+	dtrace_stop(dtp);
+
+	return dtp;
+
+fail:
+	dtrace_close(dtp);
+	return NULL;
+}
+
+static void
+bench_startup(void)
+{
+	uint64_t	t[STARTUP_NPHASES + 1];
+	uint64_t	sum[STARTUP_NPHASES] = { 0 };
+	int		i, j;
+
+	for (i = 0; i < runs; i++) {
+		dtrace_hdl_t		*dtp;
+		dtrace_prog_t		*pgp;
+		dtrace_proginfo_t	info;
+
+		t[0] = now();
+		dtp = open_handle();
+		t[1] = now();
+		if (dtrace_update(dtp) == -1)
+			fail("update failed");
+		t[2] = now();
+		pgp = dtrace_program_strcompile(dtp, startup_prog,
+						DTRACE_PROBESPEC_NAME, 0, 0,
+						NULL);
+		if (pgp == NULL)
+			fail("compile failed: %s",
+			     dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		t[3] = now();
+		if (dtrace_program_exec(dtp, pgp, &info) == -1)
+			fail("exec failed: %s",
+			     dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		t[4] = now();
+		if (dtrace_go(dtp, 0) == -1)
+			fail("go failed: %s",
+			     dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		t[5] = now();
+		dtrace_stop(dtp);
+		dtrace_close(dtp);
+		t[6] = now();
+
+		for (j = 0; j < STARTUP_NPHASES; j++)
+			sum[j] += t[j + 1] - t[j];
+	}
+
+	for (j = 0; j < STARTUP_NPHASES; j++)
+		printf("startup %s %lu ns\n", startup_phases[j],
+		       sum[j] / runs);
+}
+
+static int
+firing_stat(dtrace_hdl_t *dtp, const dtrace_probestat_t *psp, void *arg)
+{
+	uint64_t	*tot = arg;
+
+	tot[0] += psp->dtps_count;
+	tot[1] += psp->dtps_time;
+
+	return 0;
+}
+
+static void
+bench_firing(void)
+{
+	int	i;
+
+	for (i = 0; i < sizeof(firing_progs) / sizeof(firing_progs[0]); i++) {
+		dtrace_hdl_t	*dtp;
+		uint64_t	elapsed;
+		uint64_t	tot[2] = { 0, 0 };
+
+		dtp = run_prog(firing_progs[i].prog, "probestats", &elapsed);
+		if (dtp == NULL)
+			continue;
+
+		if (dtrace_probestat_iter(dtp, firing_stat, tot) != 0)
+			warn(dtp, "cannot retrieve probe statistics");
+		else if (tot[0] == 0)
+			fprintf(stderr, "dtrace-bench: %s: no firings\n",
+				firing_progs[i].name);
+		else
+			printf("firing %s %lu ns\n", firing_progs[i].name,
+			       tot[1] / tot[0]);
+
+		dtrace_close(dtp);
+	}
+}
+
+static void
+bench_consume(void)
+{
+	int	i;
+
+	for (i = 0; i < sizeof(consume_progs) / sizeof(consume_progs[0]); i++) {
+		dtrace_hdl_t	*dtp;
+		dtrace_stats_t	st;
+		uint64_t	elapsed;
+		uint64_t	nrecs;
+
+		dtp = run_prog(consume_progs[i].prog, NULL, &elapsed);
+		if (dtp == NULL)
+			continue;
+
+		dtrace_stats(dtp, &st);
+		nrecs = st.dtst_records;
+		printf("consume %s %lu rec/s\n", consume_progs[i].name,
+		       elapsed ? nrecs * NANOSEC / elapsed : 0);
+		printf("consume %s %lu ns/rec\n", consume_progs[i].name,
+		       nrecs ? st.dtst_phases[DTRACE_PHASE_CONSUME].dtph_time /
+			       nrecs : 0);
+
+		dtrace_close(dtp);
+	}
+}
+
+static void
+bench_aggsnap(void)
+{
+	int	i, j;
+
+	for (i = 0; i < sizeof(aggsnap_counts) / sizeof(aggsnap_counts[0]);
+	     i++) {
+		dtrace_hdl_t	*dtp;
+		char		*prog, *p;
+		uint64_t	elapsed, start;
+		int		n = aggsnap_counts[i];
+
+		/*
+		 * This version of DTrace does not support aggregation keys, so
+		 * we vary the number of aggregations instead.
+		 */
+		prog = malloc(64 + n * 32);
+		if (prog == NULL)
+			fail("out of memory");
+
+		p = prog + sprintf(prog, "syscall::mmap:entry /pid == %%d/ {");
+		for (j = 0; j < n; j++)
+			p += sprintf(p, " @a%d = count();", j);
+		strcpy(p, " }");
+
+		dtp = run_prog(prog, NULL, &elapsed);
+		free(prog);
+		if (dtp == NULL)
+			continue;
+
+		start = now();
+		for (j = 0; j < runs; j++) {
+			if (dtrace_aggregate_snap(dtp) == -1) {
+				warn(dtp, "cannot snapshot aggregations");
+				break;
+			}
+		}
+		if (j == runs)
+			printf("aggsnap %d %lu ns\n", n, (now() - start) / runs);
+
+		dtrace_close(dtp);
+	}
+}
+
+static void
+bench_compile(void)
+{
+	int	i, j;
+
+	for (i = 0; i < sizeof(compile_counts) / sizeof(compile_counts[0]);
+	     i++) {
+		dtrace_hdl_t	*dtp = open_handle();
+		char		*prog, *p;
+		uint64_t	start, tot = 0;
+		int		n = compile_counts[i];
+
+		prog = malloc(n * 80 + 1);
+		if (prog == NULL)
+			fail("out of memory");
+
+		for (j = 0, p = prog; j < n; j++)
+			p += sprintf(p, "syscall::mmap:entry "
+					"{ this->v%d = arg0; g%d = this->v%d; }\n",
+				     j, j, j);
+
+		for (j = 0; j < runs; j++) {
+			dtrace_prog_t	*pgp;
+
+			start = now();
+			pgp = dtrace_program_strcompile(dtp, prog,
+							DTRACE_PROBESPEC_NAME,
+							0, 0, NULL);
+			tot += now() - start;
+			if (pgp == NULL) {
+				warn(dtp, "compile failed");
+				break;
+			}
+		}
+		if (j == runs)
+			printf("compile %d %lu ns\n", n, tot / runs);
+
+		free(prog);
+		dtrace_close(dtp);
+	}
+}
+
+static const struct {
+	const char	*name;
+	void		(*func)(void);
+} benchmarks[] = {
+	{ "startup",	bench_startup },
+	{ "firing",	bench_firing },
+	{ "consume",	bench_consume },
+	{ "aggsnap",	bench_aggsnap },
+	{ "compile",	bench_compile },
+};
+
+static void
+usage(void)
+{
+	fail("Usage: dtrace-bench [-d seconds] [-r runs] trigger "
+	     "[benchmark ...]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int	opt, i, j;
+
+	while ((opt = getopt(argc, argv, "d:r:")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind >= argc || duration <= 0 || runs <= 0)
+		usage();
+
+	trigger = argv[optind++];
+
+	devnull = fopen("/dev/null", "w");
+	if (devnull == NULL)
+		fail("cannot open /dev/null: %s", strerror(errno));
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++) {
+				if (strcmp(argv[j], benchmarks[i].name) == 0)
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+
+		benchmarks[i].func();
+	}
+
+	return 0;
+}